@@ -0,0 +1,718 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "analysis.h"
+#include "parser.h"
+
+inline static bool AtomNode_is(Node* node, size_t length, char* name) {
+  return node->type == NODE_IDENTIFIER &&
+    ((AtomNode*)node)->length == length &&
+    !memcmp(((AtomNode*)node)->text, name, length);
+}
+
+/*
+ * Searches the names recorded for a deferred body, from names[start] up to
+ * names[end - 1].
+ */
+static bool DeferredBodyNode_has(
+    DeferredBodyNode* node,
+    size_t start,
+    size_t end,
+    size_t length,
+    char* name) {
+  for(size_t i = start; i < end; i++) {
+    if(node->names[i].length == length && !memcmp(node->names[i].text, name, length)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool Node_usesAsValue(Node* node, size_t length, char* name) {
+  if(node == NULL) return false;
+
+  switch(node->type) {
+    case NODE_NIL:
+    case NODE_TRUE:
+    case NODE_FALSE:
+    case NODE_NUMBER:
+    case NODE_STRING:
+      return false;
+
+    case NODE_IDENTIFIER:
+      return AtomNode_is(node, length, name);
+
+    case NODE_NEGATE:
+    case NODE_NOT:
+    case NODE_IMPORT:
+      return Node_usesAsValue(((UnaryNode*)node)->arg, length, name);
+
+    case NODE_CALL:
+      {
+        BinaryNode* bNode = (BinaryNode*)node;
+
+        /*
+         * Calling a function by name is the one use which doesn't let the
+         * function escape.
+         */
+        if(bNode->arg0->type != NODE_IDENTIFIER &&
+            Node_usesAsValue(bNode->arg0, length, name)) {
+          return true;
+        }
+
+        return Node_usesAsValue(bNode->arg1, length, name);
+      }
+
+    case NODE_ASSIGN:
+      /*
+       * The target of an assignment is not a use.
+       */
+      return Node_usesAsValue(((BinaryNode*)node)->arg1, length, name);
+
+    case NODE_PROPERTY:
+      /*
+       * The right side of a property access is a property name, not a
+       * variable.
+       */
+      return Node_usesAsValue(((BinaryNode*)node)->arg0, length, name);
+
+    case NODE_ADD:
+    case NODE_SUBTRACT:
+    case NODE_MULTIPLY:
+    case NODE_DIVIDE:
+    case NODE_EQUALS:
+    case NODE_NOT_EQUALS:
+    case NODE_GREATER_THAN_EQUALS:
+    case NODE_LESS_THAN_EQUALS:
+    case NODE_GREATER_THAN:
+    case NODE_LESS_THAN:
+    case NODE_AND:
+    case NODE_OR:
+    case NODE_WHILE:
+      return Node_usesAsValue(((BinaryNode*)node)->arg0, length, name) ||
+        Node_usesAsValue(((BinaryNode*)node)->arg1, length, name);
+
+    case NODE_FN_DEF:
+      /*
+       * The name and parameters of a function definition are declarations,
+       * so we only look at the body.
+       */
+      return Node_usesAsValue(((TernaryNode*)node)->arg2, length, name);
+
+    case NODE_IF:
+      return Node_usesAsValue(((TernaryNode*)node)->arg0, length, name) ||
+        Node_usesAsValue(((TernaryNode*)node)->arg1, length, name) ||
+        Node_usesAsValue(((TernaryNode*)node)->arg2, length, name);
+
+    case NODE_COMMA_SEPARATED_LIST:
+    case NODE_EXPRESSION_LIST:
+      {
+        ExpressionListNode* elNode = (ExpressionListNode*)node;
+
+        for(size_t i = 0; i < elNode->length; i++) {
+          if(Node_usesAsValue(elNode->items[i], length, name)) return true;
+        }
+
+        return false;
+      }
+
+    case NODE_DEFERRED_BODY:
+      {
+        DeferredBodyNode* dNode = (DeferredBodyNode*)node;
+        return DeferredBodyNode_has(dNode, dNode->assignedCount, dNode->nameCount, length, name);
+      }
+
+    default:
+      assert(false);
+      return true;
+  }
+}
+
+/*
+ * If `nestedOnly` is true, only assignments inside nested functions count.
+ */
+static bool assignsTo(Node* node, size_t length, char* name, bool nestedOnly) {
+  if(node == NULL) return false;
+
+  switch(node->type) {
+    case NODE_NIL:
+    case NODE_TRUE:
+    case NODE_FALSE:
+    case NODE_IDENTIFIER:
+    case NODE_NUMBER:
+    case NODE_STRING:
+      return false;
+
+    case NODE_NEGATE:
+    case NODE_NOT:
+    case NODE_IMPORT:
+      return assignsTo(((UnaryNode*)node)->arg, length, name, nestedOnly);
+
+    case NODE_ASSIGN:
+      if(!nestedOnly && AtomNode_is(((BinaryNode*)node)->arg0, length, name)) {
+        return true;
+      }
+
+      return assignsTo(((BinaryNode*)node)->arg1, length, name, nestedOnly);
+
+    case NODE_PROPERTY:
+    case NODE_ADD:
+    case NODE_SUBTRACT:
+    case NODE_MULTIPLY:
+    case NODE_DIVIDE:
+    case NODE_EQUALS:
+    case NODE_NOT_EQUALS:
+    case NODE_GREATER_THAN_EQUALS:
+    case NODE_LESS_THAN_EQUALS:
+    case NODE_GREATER_THAN:
+    case NODE_LESS_THAN:
+    case NODE_AND:
+    case NODE_OR:
+    case NODE_WHILE:
+    case NODE_CALL:
+      return assignsTo(((BinaryNode*)node)->arg0, length, name, nestedOnly) ||
+        assignsTo(((BinaryNode*)node)->arg1, length, name, nestedOnly);
+
+    case NODE_FN_DEF:
+      /*
+       * Nested functions can assign to the variables of the functions
+       * enclosing them, so we have to look inside.
+       */
+      return assignsTo(((TernaryNode*)node)->arg2, length, name, false);
+
+    case NODE_IF:
+      return assignsTo(((TernaryNode*)node)->arg0, length, name, nestedOnly) ||
+        assignsTo(((TernaryNode*)node)->arg1, length, name, nestedOnly) ||
+        assignsTo(((TernaryNode*)node)->arg2, length, name, nestedOnly);
+
+    case NODE_COMMA_SEPARATED_LIST:
+    case NODE_EXPRESSION_LIST:
+      {
+        ExpressionListNode* elNode = (ExpressionListNode*)node;
+
+        for(size_t i = 0; i < elNode->length; i++) {
+          if(assignsTo(elNode->items[i], length, name, nestedOnly)) return true;
+        }
+
+        return false;
+      }
+
+    case NODE_DEFERRED_BODY:
+      {
+        /*
+         * The recorded assignments don't say whether they're in nested
+         * functions, so they count either way.
+         */
+        DeferredBodyNode* dNode = (DeferredBodyNode*)node;
+        return DeferredBodyNode_has(dNode, 0, dNode->assignedCount, length, name);
+      }
+
+    default:
+      assert(false);
+      return true;
+  }
+}
+
+bool Node_assignsTo(Node* node, size_t length, char* name) {
+  return assignsTo(node, length, name, false);
+}
+
+bool Node_assignsInNestedFunctions(Node* node, size_t length, char* name) {
+  return assignsTo(node, length, name, true);
+}
+
+bool Node_collectAssignments(
+    Node* node,
+    AtomNode** targets,
+    size_t* count,
+    size_t capacity) {
+  if(node == NULL) return true;
+
+  switch(node->type) {
+    case NODE_NIL:
+    case NODE_TRUE:
+    case NODE_FALSE:
+    case NODE_IDENTIFIER:
+    case NODE_NUMBER:
+    case NODE_STRING:
+      return true;
+
+    case NODE_NEGATE:
+    case NODE_NOT:
+    case NODE_IMPORT:
+      return Node_collectAssignments(((UnaryNode*)node)->arg, targets, count, capacity);
+
+    case NODE_ASSIGN:
+      {
+        BinaryNode* bNode = (BinaryNode*)node;
+
+        if(bNode->arg0->type != NODE_IDENTIFIER) return false;
+        if(*count == capacity) return false;
+
+        targets[*count] = (AtomNode*)(bNode->arg0);
+        (*count)++;
+
+        return Node_collectAssignments(bNode->arg1, targets, count, capacity);
+      }
+
+    case NODE_PROPERTY:
+    case NODE_ADD:
+    case NODE_SUBTRACT:
+    case NODE_MULTIPLY:
+    case NODE_DIVIDE:
+    case NODE_EQUALS:
+    case NODE_NOT_EQUALS:
+    case NODE_GREATER_THAN_EQUALS:
+    case NODE_LESS_THAN_EQUALS:
+    case NODE_GREATER_THAN:
+    case NODE_LESS_THAN:
+    case NODE_AND:
+    case NODE_OR:
+    case NODE_WHILE:
+    case NODE_CALL:
+      return Node_collectAssignments(((BinaryNode*)node)->arg0, targets, count, capacity) &&
+        Node_collectAssignments(((BinaryNode*)node)->arg1, targets, count, capacity);
+
+    case NODE_FN_DEF:
+      return false;
+
+    case NODE_IF:
+      return Node_collectAssignments(((TernaryNode*)node)->arg0, targets, count, capacity) &&
+        Node_collectAssignments(((TernaryNode*)node)->arg1, targets, count, capacity) &&
+        Node_collectAssignments(((TernaryNode*)node)->arg2, targets, count, capacity);
+
+    case NODE_COMMA_SEPARATED_LIST:
+    case NODE_EXPRESSION_LIST:
+      {
+        ExpressionListNode* elNode = (ExpressionListNode*)node;
+
+        for(size_t i = 0; i < elNode->length; i++) {
+          if(!Node_collectAssignments(elNode->items[i], targets, count, capacity)) {
+            return false;
+          }
+        }
+
+        return true;
+      }
+
+    case NODE_DEFERRED_BODY:
+      return false;
+
+    default:
+      assert(false);
+      return false;
+  }
+}
+
+bool Node_isParameter(Node* parameters, AtomNode* identifier) {
+  if(parameters == NULL) return false;
+
+  if(parameters->type == NODE_IDENTIFIER) {
+    return AtomNode_is(parameters, identifier->length, identifier->text);
+  }
+
+  assert(parameters->type == NODE_COMMA_SEPARATED_LIST);
+  ExpressionListNode* elNode = (ExpressionListNode*)parameters;
+
+  for(size_t i = 0; i < elNode->length; i++) {
+    if(AtomNode_is(elNode->items[i], identifier->length, identifier->text)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/*
+ * Adds the cost of `node` to `*cost`, returning false as soon as the budget
+ * is exhausted or a node which can't be inlined is found.
+ */
+static bool Node_addInlineCost(Node* node, Node* parameters, size_t* cost, size_t budget) {
+  if(node == NULL) return true;
+
+  (*cost)++;
+  if(*cost > budget) return false;
+
+  switch(node->type) {
+    case NODE_NIL:
+    case NODE_TRUE:
+    case NODE_FALSE:
+    case NODE_IDENTIFIER:
+    case NODE_NUMBER:
+    case NODE_STRING:
+      return true;
+
+    case NODE_NEGATE:
+    case NODE_NOT:
+    case NODE_IMPORT:
+      return Node_addInlineCost(((UnaryNode*)node)->arg, parameters, cost, budget);
+
+    case NODE_ASSIGN:
+      {
+        /*
+         * Assigning a parameter only touches the caller's copy of the
+         * argument. Anything else would declare a variable in the caller.
+         */
+        BinaryNode* bNode = (BinaryNode*)node;
+        if(bNode->arg0->type != NODE_IDENTIFIER) return false;
+        if(!Node_isParameter(parameters, (AtomNode*)(bNode->arg0))) return false;
+        return Node_addInlineCost(bNode->arg1, parameters, cost, budget);
+      }
+
+    case NODE_PROPERTY:
+    case NODE_ADD:
+    case NODE_SUBTRACT:
+    case NODE_MULTIPLY:
+    case NODE_DIVIDE:
+    case NODE_EQUALS:
+    case NODE_NOT_EQUALS:
+    case NODE_GREATER_THAN_EQUALS:
+    case NODE_LESS_THAN_EQUALS:
+    case NODE_GREATER_THAN:
+    case NODE_LESS_THAN:
+    case NODE_AND:
+    case NODE_OR:
+    case NODE_WHILE:
+    case NODE_CALL:
+      return Node_addInlineCost(((BinaryNode*)node)->arg0, parameters, cost, budget) &&
+        Node_addInlineCost(((BinaryNode*)node)->arg1, parameters, cost, budget);
+
+    case NODE_FN_DEF:
+      /*
+       * A nested function would be compiled at the wrong depth.
+       */
+      return false;
+
+    case NODE_IF:
+      return Node_addInlineCost(((TernaryNode*)node)->arg0, parameters, cost, budget) &&
+        Node_addInlineCost(((TernaryNode*)node)->arg1, parameters, cost, budget) &&
+        Node_addInlineCost(((TernaryNode*)node)->arg2, parameters, cost, budget);
+
+    case NODE_COMMA_SEPARATED_LIST:
+    case NODE_EXPRESSION_LIST:
+      {
+        ExpressionListNode* elNode = (ExpressionListNode*)node;
+
+        for(size_t i = 0; i < elNode->length; i++) {
+          if(!Node_addInlineCost(elNode->items[i], parameters, cost, budget)) {
+            return false;
+          }
+        }
+
+        return true;
+      }
+
+    case NODE_DEFERRED_BODY:
+      return false;
+
+    default:
+      assert(false);
+      return false;
+  }
+}
+
+bool Node_isInlineable(Node* body, Node* parameters, size_t budget) {
+  size_t cost = 0;
+  return Node_addInlineCost(body, parameters, &cost, budget);
+}
+
+bool Node_everyIdentifier(
+    Node* node,
+    bool (*predicate)(void*, AtomNode*),
+    void* context) {
+  if(node == NULL) return true;
+
+  switch(node->type) {
+    case NODE_NIL:
+    case NODE_TRUE:
+    case NODE_FALSE:
+    case NODE_NUMBER:
+    case NODE_STRING:
+      return true;
+
+    case NODE_IDENTIFIER:
+      return predicate(context, (AtomNode*)node);
+
+    case NODE_NEGATE:
+    case NODE_NOT:
+    case NODE_IMPORT:
+      return Node_everyIdentifier(((UnaryNode*)node)->arg, predicate, context);
+
+    case NODE_PROPERTY:
+      return Node_everyIdentifier(((BinaryNode*)node)->arg0, predicate, context);
+
+    case NODE_ADD:
+    case NODE_SUBTRACT:
+    case NODE_MULTIPLY:
+    case NODE_DIVIDE:
+    case NODE_EQUALS:
+    case NODE_NOT_EQUALS:
+    case NODE_GREATER_THAN_EQUALS:
+    case NODE_LESS_THAN_EQUALS:
+    case NODE_GREATER_THAN:
+    case NODE_LESS_THAN:
+    case NODE_AND:
+    case NODE_OR:
+    case NODE_ASSIGN:
+    case NODE_WHILE:
+    case NODE_CALL:
+      return Node_everyIdentifier(((BinaryNode*)node)->arg0, predicate, context) &&
+        Node_everyIdentifier(((BinaryNode*)node)->arg1, predicate, context);
+
+    case NODE_FN_DEF:
+      return Node_everyIdentifier(((TernaryNode*)node)->arg2, predicate, context);
+
+    case NODE_IF:
+      return Node_everyIdentifier(((TernaryNode*)node)->arg0, predicate, context) &&
+        Node_everyIdentifier(((TernaryNode*)node)->arg1, predicate, context) &&
+        Node_everyIdentifier(((TernaryNode*)node)->arg2, predicate, context);
+
+    case NODE_COMMA_SEPARATED_LIST:
+    case NODE_EXPRESSION_LIST:
+      {
+        ExpressionListNode* elNode = (ExpressionListNode*)node;
+
+        for(size_t i = 0; i < elNode->length; i++) {
+          if(!Node_everyIdentifier(elNode->items[i], predicate, context)) {
+            return false;
+          }
+        }
+
+        return true;
+      }
+
+    case NODE_DEFERRED_BODY:
+      /*
+       * Only the distinct names are recorded, so this can't be answered.
+       */
+      return false;
+
+    default:
+      assert(false);
+      return false;
+  }
+}
+
+inline static bool FlatTree_is(FlatTree* self, uint32_t index, size_t length, char* name) {
+  return self->kinds[index] == NODE_IDENTIFIER &&
+    self->lengths[index] == length &&
+    !memcmp(self->source + self->offsets[index], name, length);
+}
+
+/*
+ * Appends every NODE_FN_DEF in `node`, at any depth, to `*definitions`.
+ */
+static void Node_collectDefinitions(
+    Node* node,
+    TernaryNode*** definitions,
+    size_t* count,
+    size_t* capacity) {
+  if(node == NULL) return;
+
+  switch(node->type) {
+    case NODE_NIL:
+    case NODE_TRUE:
+    case NODE_FALSE:
+    case NODE_IDENTIFIER:
+    case NODE_NUMBER:
+    case NODE_STRING:
+    case NODE_DEFERRED_BODY:
+      return;
+
+    case NODE_NEGATE:
+    case NODE_NOT:
+    case NODE_IMPORT:
+      Node_collectDefinitions(((UnaryNode*)node)->arg, definitions, count, capacity);
+      return;
+
+    case NODE_PROPERTY:
+    case NODE_ADD:
+    case NODE_SUBTRACT:
+    case NODE_MULTIPLY:
+    case NODE_DIVIDE:
+    case NODE_EQUALS:
+    case NODE_NOT_EQUALS:
+    case NODE_GREATER_THAN_EQUALS:
+    case NODE_LESS_THAN_EQUALS:
+    case NODE_GREATER_THAN:
+    case NODE_LESS_THAN:
+    case NODE_AND:
+    case NODE_OR:
+    case NODE_ASSIGN:
+    case NODE_WHILE:
+    case NODE_CALL:
+      Node_collectDefinitions(((BinaryNode*)node)->arg0, definitions, count, capacity);
+      Node_collectDefinitions(((BinaryNode*)node)->arg1, definitions, count, capacity);
+      return;
+
+    case NODE_FN_DEF:
+      if(*count == *capacity) {
+        *capacity = *capacity == 0 ? 8 : *capacity * 2;
+        *definitions = realloc(*definitions, sizeof(TernaryNode*) * *capacity);
+        assert(*definitions != NULL); /* TODO Handle this */
+      }
+
+      (*definitions)[(*count)++] = (TernaryNode*)node;
+      Node_collectDefinitions(((TernaryNode*)node)->arg2, definitions, count, capacity);
+      return;
+
+    case NODE_IF:
+      Node_collectDefinitions(((TernaryNode*)node)->arg0, definitions, count, capacity);
+      Node_collectDefinitions(((TernaryNode*)node)->arg1, definitions, count, capacity);
+      Node_collectDefinitions(((TernaryNode*)node)->arg2, definitions, count, capacity);
+      return;
+
+    case NODE_COMMA_SEPARATED_LIST:
+    case NODE_EXPRESSION_LIST:
+      {
+        ExpressionListNode* elNode = (ExpressionListNode*)node;
+
+        for(size_t i = 0; i < elNode->length; i++) {
+          Node_collectDefinitions(elNode->items[i], definitions, count, capacity);
+        }
+      } return;
+
+    default:
+      assert(false);
+  }
+}
+
+static bool AtomNode_isNot(void* target, AtomNode* identifier) {
+  AtomNode* name = target;
+  return !AtomNode_is((Node*)identifier, name->length, name->text);
+}
+
+bool Node_functionEscapes(Node* body, size_t length, char* name) {
+  if(Node_usesAsValue(body, length, name)) return true;
+
+  TernaryNode** definitions = NULL;
+  size_t count = 0;
+  size_t capacity = 0;
+  Node_collectDefinitions(body, &definitions, &count, &capacity);
+
+  bool* escapes = calloc(count == 0 ? 1 : count, sizeof(bool));
+  assert(escapes != NULL); /* TODO Handle this */
+
+  for(size_t i = 0; i < count; i++) {
+    AtomNode* definitionName = (AtomNode*)(definitions[i]->arg0);
+    escapes[i] = Node_usesAsValue(body, definitionName->length, definitionName->text);
+  }
+
+  // A function which an escaping function refers to escapes with it
+  bool changed = true;
+
+  while(changed) {
+    changed = false;
+
+    for(size_t i = 0; i < count; i++) {
+      if(!escapes[i]) continue;
+
+      for(size_t j = 0; j < count; j++) {
+        if(escapes[j]) continue;
+
+        if(!Node_everyIdentifier(definitions[i]->arg2, AtomNode_isNot, definitions[j]->arg0)) {
+          escapes[j] = true;
+          changed = true;
+        }
+      }
+    }
+  }
+
+  bool result = false;
+
+  for(size_t i = 0; i < count; i++) {
+    if(escapes[i] && AtomNode_is(definitions[i]->arg0, length, name)) result = true;
+  }
+
+  free(escapes);
+  free(definitions);
+  return result;
+}
+
+bool FlatTree_usesAsValue(FlatTree* self, uint32_t index, size_t length, char* name) {
+  uint32_t end = self->ends[index];
+
+  switch(self->kinds[index]) {
+    case NODE_IDENTIFIER:
+      return FlatTree_is(self, index, length, name);
+
+    case NODE_CALL:
+      {
+        // As in Node_usesAsValue, calling by name is not a use
+        uint32_t callee = index + 1;
+
+        if(self->kinds[callee] != NODE_IDENTIFIER &&
+            FlatTree_usesAsValue(self, callee, length, name)) {
+          return true;
+        }
+
+        return FlatTree_usesAsValue(self, self->ends[callee], length, name);
+      }
+
+    case NODE_ASSIGN:
+    case NODE_PROPERTY:
+      {
+        // Only one side of each of these can use a variable
+        uint32_t left = index + 1;
+        uint32_t used = self->kinds[index] == NODE_ASSIGN ? self->ends[left] : left;
+        return FlatTree_usesAsValue(self, used, length, name);
+      }
+
+    case NODE_FN_DEF:
+      {
+        uint32_t parameters = self->ends[index + 1];
+        return FlatTree_usesAsValue(self, self->ends[parameters], length, name);
+      }
+
+    default:
+      for(uint32_t child = index + 1; child < end; child = self->ends[child]) {
+        if(FlatTree_usesAsValue(self, child, length, name)) return true;
+      }
+
+      return false;
+  }
+}
+
+/*
+ * Unlike the other questions, this one doesn't depend on where a node is,
+ * only on whether it's inside a function, so it's a scan of the nodes.
+ */
+static bool FlatTree_assigns(
+    FlatTree* self,
+    uint32_t index,
+    size_t length,
+    char* name,
+    bool nestedOnly) {
+  uint32_t end = self->ends[index];
+  uint32_t nestedEnd = index;
+
+  for(uint32_t i = index; i < end; i++) {
+    switch(self->kinds[i]) {
+      case NODE_FN_DEF:
+      case NODE_DEFERRED_BODY:
+        if(self->ends[i] > nestedEnd) nestedEnd = self->ends[i];
+        break;
+
+      case NODE_ASSIGN:
+        if((!nestedOnly || i < nestedEnd) && FlatTree_is(self, i + 1, length, name)) {
+          return true;
+        }
+        break;
+
+      default:
+        break;
+    }
+  }
+
+  return false;
+}
+
+bool FlatTree_assignsTo(FlatTree* self, uint32_t index, size_t length, char* name) {
+  return FlatTree_assigns(self, index, length, name, false);
+}
+
+bool FlatTree_assignsInNestedFunctions(FlatTree* self, uint32_t index, size_t length, char* name) {
+  return FlatTree_assigns(self, index, length, name, true);
+}
@@ -0,0 +1,88 @@
+#ifndef FUR_ANALYSIS_H
+#define FUR_ANALYSIS_H
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "flat_tree.h"
+#include "parser.h"
+
+/*
+ * Static questions the compiler asks about the abstract syntax tree before
+ * it emits code for it. These are conservative: when the answer can't be
+ * determined cheaply, they answer in the way that disables the optimization
+ * which is asking.
+ */
+
+/*
+ * Returns true if the identifier `name` is used anywhere in `node` in a way
+ * other than being called, i.e. read as a value that could be stored, passed
+ * or returned. Assignment targets, function names and parameters are
+ * declarations, not uses. Shadowing is ignored, so a shadowed use still counts.
+ */
+bool Node_usesAsValue(Node* node, size_t length, char* name);
+
+/*
+ * Returns true if the function `name`, defined in `body`, may be called
+ * after `body`'s frame has returned: if `body` uses it as a value, or if
+ * any function defined in `body` which may itself be called then refers to
+ * it at all.
+ */
+bool Node_functionEscapes(Node* body, size_t length, char* name);
+
+/*
+ * Returns true if `name` is the target of an assignment anywhere in `node`,
+ * including inside nested functions.
+ */
+bool Node_assignsTo(Node* node, size_t length, char* name);
+
+/*
+ * Returns true if `name` is the target of an assignment inside a function
+ * defined somewhere in `node`, meaning a call could change it.
+ */
+bool Node_assignsInNestedFunctions(Node* node, size_t length, char* name);
+
+/*
+ * Appends the target of every assignment in `node` to `targets`. Returns
+ * false if there are more than `capacity` of them, or if `node` defines a
+ * function.
+ */
+bool Node_collectAssignments(
+    Node* node,
+    AtomNode** targets,
+    size_t* count,
+    size_t capacity);
+
+/*
+ * Returns true if `identifier` is one of `parameters`, which is NULL, a
+ * single identifier, or a comma separated list of identifiers, as in a
+ * NODE_FN_DEF.
+ */
+bool Node_isParameter(Node* parameters, AtomNode* identifier);
+
+/*
+ * Returns true if a function body has at most `budget` nodes, defines no
+ * functions, and assigns to nothing but its own parameters, so that it can
+ * be compiled in place of a call without declaring anything in the caller.
+ */
+bool Node_isInlineable(Node* body, Node* parameters, size_t budget);
+
+/*
+ * Calls `predicate` on every identifier in `node` until one returns false,
+ * and returns false if any did. Property names are not identifiers.
+ */
+bool Node_everyIdentifier(
+    Node* node,
+    bool (*predicate)(void*, AtomNode*),
+    void* context);
+
+/*
+ * The same questions as Node_usesAsValue, Node_assignsTo and
+ * Node_assignsInNestedFunctions, about the node at `index` in a flat tree,
+ * with the same answers.
+ */
+bool FlatTree_usesAsValue(FlatTree*, uint32_t index, size_t length, char* name);
+bool FlatTree_assignsTo(FlatTree*, uint32_t index, size_t length, char* name);
+bool FlatTree_assignsInNestedFunctions(FlatTree*, uint32_t index, size_t length, char* name);
+
+#endif
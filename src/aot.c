@@ -0,0 +1,106 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "aot.h"
+#include "code.h"
+#include "furc.h"
+#include "object.h"
+#include "runtime.h"
+#include "thread.h"
+
+static size_t numberCodes(Code* code, Code** codes, size_t count, size_t capacity) {
+  for(size_t i = 0; i < code->interns.length; i++) {
+    Obj* intern = code->interns.items[i];
+    if(intern->type != OBJ_CLOSURE) continue;
+
+    Code* closureCode = ((ObjClosure*)intern)->code;
+    if(count < capacity) codes[count] = closureCode;
+    count = numberCodes(closureCode, codes, count + 1, capacity);
+  }
+
+  return count;
+}
+
+size_t Aot_numberCodes(Code* module, Code** codes, size_t capacity) {
+  if(capacity > 0) codes[0] = module;
+  return numberCodes(module, codes, 1, capacity);
+}
+
+int Aot_main(AotProgram* program, const uint8_t* image, size_t length) {
+  Runtime runtime;
+  Runtime_init(&runtime);
+  Code code;
+  Code_init(&code);
+
+  FurcImage furcImage = { .data=image, .length=length };
+  size_t startIndex;
+
+  if(!FurcImage_load(&furcImage, &runtime, &code, &startIndex, NULL)
+      || Aot_numberCodes(&code, program->codes, program->count) != program->count) {
+    fprintf(stderr, "Invalid embedded image.\n");
+    return 1;
+  }
+
+  Thread thread;
+  Thread_init(&thread);
+
+  program->functions[0](&thread, NULL, thread.stack.items);
+
+  Thread_free(&thread);
+  Code_free(&code);
+  Runtime_free(&runtime);
+
+  return 0;
+}
+
+void Aot_call(
+    Thread* self,
+    AotProgram* program,
+    uint8_t argc,
+    Code** cachedCode,
+    AotFunction* cachedFunction) {
+  assert(self->stack.top > self->stack.items);
+  self->stack.top--;
+  Value callee = *(self->stack.top);
+  assert(callee.is_a == TYPE_OBJ);
+
+  switch(callee.as.obj->type) {
+    case OBJ_CLOSURE:
+      {
+        ObjClosure* closure = (ObjClosure*)(callee.as.obj);
+        assert(argc == closure->arity); /* TODO Handle this */
+
+        if(closure->code != *cachedCode) {
+          size_t i = 0;
+          while(i < program->count && program->codes[i] != closure->code) i++;
+          assert(i < program->count);
+
+          *cachedCode = closure->code;
+          *cachedFunction = program->functions[i];
+        }
+
+        AOT_ENTER(closure, argc, (*cachedFunction));
+      } break;
+
+    case OBJ_NATIVE:
+      {
+        NativeFunction call = ((ObjNative*)(callee.as.obj))->call;
+
+        // As in the interpreter, the arguments stay on the stack during the call
+        Value* argv = self->stack.top - argc;
+        Value result = call(self, argc, argv);
+
+        // Natives only block on a scheduler, which generated C doesn't run on
+        assert(!self->blocked);
+
+        *argv = result;
+        self->stack.top = argv + 1;
+      } break;
+
+    default:
+      assert(false);
+  }
+}
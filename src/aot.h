@@ -0,0 +1,245 @@
+#ifndef FUR_AOT_H
+#define FUR_AOT_H
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "code.h"
+#include "object.h"
+#include "operations.h"
+#include "thread.h"
+#include "value.h"
+
+/*
+ * Support for the C which fur_aot generates from a program.
+ *
+ * Each Code in the program becomes a C function which does what the
+ * interpreter would do for each of its instructions, on the thread's stack
+ * and with the same frame layout, so objects, upvalues and natives behave
+ * exactly as they do in the interpreter. Jumps become gotos, and calls
+ * become C calls rather than frames on the thread's FrameStack.
+ *
+ * The interns and closures are loaded at startup from a .furc image
+ * embedded in the generated code.
+ */
+
+typedef void (*AotFunction)(Thread*, ObjClosure* current, Value* fp);
+
+/*
+ * The Codes of a program, in the order Aot_numberCodes visits them, and the
+ * functions generated from them.
+ */
+typedef struct {
+  size_t count;
+  Code** codes;
+  const AotFunction* functions;
+} AotProgram;
+
+/*
+ * Stores the module's code and then the code of every closure, depth first
+ * in the order of their interns, which is the order they appear in a .furc
+ * file. Returns how many there are, storing at most `capacity`.
+ */
+size_t Aot_numberCodes(Code* module, Code** codes, size_t capacity);
+
+/*
+ * Loads the image, runs the module, and frees everything.
+ */
+int Aot_main(AotProgram*, const uint8_t* image, size_t length);
+
+/*
+ * Calls the closure or native below the top `argc` values, for OP_CALL. The
+ * cache is the last Code the call site called and its function, so a call
+ * site which always calls the same function doesn't search for it.
+ */
+void Aot_call(
+    Thread*,
+    AotProgram*,
+    uint8_t argc,
+    Code** cachedCode,
+    AotFunction* cachedFunction);
+
+/*
+ * The generated functions are written in terms of these macros, which
+ * expect `self`, `current`, `fp` and `code` to be in scope.
+ */
+
+#define AOT_PUSH(value) \
+  do { \
+    assert(self->stack.top - self->stack.items < MAX_STACK_DEPTH); \
+    *(self->stack.top) = (value); \
+    self->stack.top++; \
+  } while(false)
+
+#define AOT_TOP (self->stack.top - 1)
+
+#ifdef DEBUG
+#define AOT_CHECK_INT(v) assert((v).is_a == TYPE_INTEGER)
+#else
+#define AOT_CHECK_INT(v)
+#endif
+
+inline static bool Aot_popBoolean(Thread* self) {
+  assert(self->stack.top > self->stack.items);
+  self->stack.top--;
+  assert(self->stack.top->is_a == TYPE_BOOLEAN);
+  return self->stack.top->as.boolean;
+}
+
+inline static void Aot_add(Thread* self) {
+  switch(AOT_TOP->is_a) {
+    case TYPE_INTEGER:
+      Stack_binary(&(self->stack), add);
+      break;
+
+    case TYPE_OBJ:
+      Stack_binary(&(self->stack), concat);
+
+      // Add the concatenated string to the heap
+      assert(AOT_TOP->as.obj->type == OBJ_STRING);
+      Thread_addToHeap(self, AOT_TOP->as.obj);
+      break;
+
+    default:
+      assert(false);
+  }
+}
+
+inline static void Aot_native(Thread* self, uint16_t index) {
+  assert(index < NATIVE_COUNT);
+
+  ObjNative* n = ObjNative_allocateOne();
+  ObjNative_init(n, NATIVE[index].call);
+
+  AOT_PUSH(Value_fromObj((Obj*)n));
+  /* Add to heap AFTER adding to stack, to be sure it doesn't get GC'ed */
+  Thread_addToHeap(self, (Obj*)n);
+}
+
+#define AOT_NIL() \
+  do { \
+    Value nil; \
+    nil.is_a = TYPE_NIL; \
+    AOT_PUSH(nil); \
+  } while(false)
+
+#define AOT_TRUE()        AOT_PUSH(Value_fromBool(true))
+#define AOT_FALSE()       AOT_PUSH(Value_fromBool(false))
+#define AOT_INTEGER(i)    AOT_PUSH(Value_fromInt32(i))
+#define AOT_INTERN(i)     AOT_PUSH(Value_fromObj(Code_getInterned(code, (i))))
+#define AOT_NATIVE(i)     Aot_native(self, (i))
+#define AOT_DROP()        (self->stack.top--)
+
+#define AOT_GET(i)        AOT_PUSH(fp[i])
+#define AOT_SET(i)        (fp[i] = *(--self->stack.top))
+#define AOT_GET_OUTER(d, i) AOT_PUSH(self->display[d][i])
+#define AOT_SET_OUTER(d, i) (self->display[d][i] = *(--self->stack.top))
+#define AOT_DECLARE_GLOBAL() Thread_declareGlobal(self)
+#define AOT_GET_LATE(i, n) \
+  Thread_getLate(self, (i), (ObjString*)Code_getInterned(code, (n)))
+#define AOT_GET_UPVALUE(i) AOT_PUSH(*(current->upvalues[i]->location))
+#define AOT_SET_UPVALUE(i) \
+  (*(current->upvalues[i]->location) = *(--self->stack.top))
+#define AOT_CLOSURE(i) \
+  Thread_pushClosure(self, current, fp, (ObjClosure*)Code_getInterned(code, (i)))
+
+#define AOT_UNARY(function) (*AOT_TOP = function(*AOT_TOP))
+#define AOT_BINARY(function) \
+  do { \
+    self->stack.top--; \
+    *AOT_TOP = function(*AOT_TOP, *(self->stack.top)); \
+  } while(false)
+#define AOT_ADD()         Aot_add(self)
+
+#define AOT_INT_ARITHMETIC(operator) \
+  do { \
+    self->stack.top--; \
+    AOT_CHECK_INT(*AOT_TOP); \
+    AOT_CHECK_INT(*(self->stack.top)); \
+    AOT_TOP->as.integer = AOT_TOP->as.integer operator self->stack.top->as.integer; \
+  } while(false)
+
+#define AOT_INT_COMPARISON(operator) \
+  do { \
+    self->stack.top--; \
+    AOT_CHECK_INT(*AOT_TOP); \
+    AOT_CHECK_INT(*(self->stack.top)); \
+    AOT_TOP->as.boolean = AOT_TOP->as.integer operator self->stack.top->as.integer; \
+    AOT_TOP->is_a = TYPE_BOOLEAN; \
+  } while(false)
+
+#define AOT_NEGATE_INT() \
+  do { \
+    AOT_CHECK_INT(*AOT_TOP); \
+    AOT_TOP->as.integer = -(AOT_TOP->as.integer); \
+  } while(false)
+
+#define AOT_JUMP(label)           goto label
+#define AOT_JUMP_IF_TRUE(label)   if(Aot_popBoolean(self)) goto label
+#define AOT_JUMP_IF_FALSE(label)  if(!Aot_popBoolean(self)) goto label
+
+/*
+ * See the comment above OP_AND in thread.c.
+ */
+#define AOT_AND(label) \
+  do { \
+    assert(AOT_TOP->is_a == TYPE_BOOLEAN); \
+    if(!(AOT_TOP->as.boolean)) goto label; \
+    self->stack.top--; \
+  } while(false)
+
+#define AOT_OR(label) \
+  do { \
+    assert(AOT_TOP->is_a == TYPE_BOOLEAN); \
+    if(AOT_TOP->as.boolean) goto label; \
+    self->stack.top--; \
+  } while(false)
+
+/*
+ * Runs `function` for `callee` with the top `argc` values as its arguments,
+ * maintaining the display as the interpreter does.
+ */
+#define AOT_ENTER(callee, argc, function) \
+  do { \
+    ObjClosure* enterCallee = (callee); \
+    Value* calleeFp = self->stack.top - (argc); \
+    Value* displaced = self->display[enterCallee->depth]; \
+    \
+    self->display[enterCallee->depth] = calleeFp; \
+    function(self, enterCallee, calleeFp); \
+    self->display[enterCallee->depth] = displaced; \
+  } while(false)
+
+#define AOT_CALL_DIRECT(i, function) \
+  do { \
+    ObjClosure* directCallee = (ObjClosure*)Code_getCallee(code, (i)); \
+    AOT_ENTER(directCallee, directCallee->arity, function); \
+  } while(false)
+
+#define AOT_CALL_SELF(argc, function) AOT_ENTER(current, (argc), function)
+
+#define AOT_CALL(program, argc) \
+  do { \
+    static Code* cachedCode = NULL; \
+    static AotFunction cachedFunction = NULL; \
+    Aot_call(self, &(program), (argc), &cachedCode, &cachedFunction); \
+  } while(false)
+
+#define AOT_RETURN() \
+  do { \
+    assert(fp < self->stack.top); \
+    Thread_closeUpvalues(self, fp); \
+    *fp = *AOT_TOP; \
+    self->stack.top = fp + 1; \
+    return; \
+  } while(false)
+
+#define AOT_RETURN_MODULE() \
+  do { \
+    self->stack.top--; \
+    return; \
+  } while(false)
+
+#endif
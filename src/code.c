@@ -11,33 +11,54 @@ void Instruction_print(Instruction i) {
   switch(i) {
     #define MAP(i) case i: printf(#i); break;
     MAP(OP_ADD);
+    MAP(OP_ADD_INT);
     MAP(OP_AND);
     MAP(OP_CALL);
+    MAP(OP_CALL_DIRECT);
+    MAP(OP_CALL_SELF);
+    MAP(OP_CLOSURE);
+    MAP(OP_DECLARE_GLOBAL);
     MAP(OP_DIVIDE);
+    MAP(OP_DIVIDE_INT);
     MAP(OP_DROP);
     MAP(OP_EQ);
+    MAP(OP_EQ_INT);
     MAP(OP_FALSE);
     MAP(OP_GEQ);
+    MAP(OP_GEQ_INT);
     MAP(OP_GET);
+    MAP(OP_GET_LATE);
+    MAP(OP_GET_OUTER);
+    MAP(OP_GET_UPVALUE);
     MAP(OP_GT);
+    MAP(OP_GT_INT);
+    MAP(OP_IMPORT);
     MAP(OP_INTEGER);
     MAP(OP_JUMP);
     MAP(OP_JUMP_IF_TRUE);
     MAP(OP_JUMP_IF_FALSE);
     MAP(OP_LEQ);
+    MAP(OP_LEQ_INT);
     MAP(OP_LT);
+    MAP(OP_LT_INT);
     MAP(OP_MULTIPLY);
+    MAP(OP_MULTIPLY_INT);
     MAP(OP_NATIVE);
     MAP(OP_NEGATE);
+    MAP(OP_NEGATE_INT);
     MAP(OP_NEQ);
+    MAP(OP_NEQ_INT);
     MAP(OP_NIL);
     MAP(OP_NOT);
     MAP(OP_OR);
     MAP(OP_PROP);
     MAP(OP_RETURN);
     MAP(OP_SET);
+    MAP(OP_SET_OUTER);
+    MAP(OP_SET_UPVALUE);
     MAP(OP_INTERN);
     MAP(OP_SUBTRACT);
+    MAP(OP_SUBTRACT_INT);
     MAP(OP_TRUE);
     #undef MAP
 
@@ -46,26 +67,166 @@ void Instruction_print(Instruction i) {
   }
 }
 
+int Instruction_operandSize(uint8_t instruction) {
+  switch(instruction) {
+    case OP_NIL:
+    case OP_TRUE:
+    case OP_FALSE:
+    case OP_ADD:
+    case OP_DROP:
+    case OP_SUBTRACT:
+    case OP_DIVIDE:
+    case OP_MULTIPLY:
+    case OP_NEGATE:
+    case OP_NOT:
+    case OP_EQ:
+    case OP_LT:
+    case OP_GT:
+    case OP_NEQ:
+    case OP_GEQ:
+    case OP_LEQ:
+    case OP_RETURN:
+    case OP_ADD_INT:
+    case OP_SUBTRACT_INT:
+    case OP_MULTIPLY_INT:
+    case OP_DIVIDE_INT:
+    case OP_NEGATE_INT:
+    case OP_EQ_INT:
+    case OP_NEQ_INT:
+    case OP_LT_INT:
+    case OP_GT_INT:
+    case OP_LEQ_INT:
+    case OP_GEQ_INT:
+    case OP_DECLARE_GLOBAL:
+      return 0;
+
+    case OP_INTERN:
+    case OP_GET:
+    case OP_SET:
+    case OP_GET_UPVALUE:
+    case OP_SET_UPVALUE:
+    case OP_CLOSURE:
+    case OP_CALL:
+    case OP_CALL_DIRECT:
+    case OP_CALL_SELF:
+    case OP_PROP:
+      return 1;
+
+    case OP_NATIVE:
+    case OP_GET_OUTER:
+    case OP_SET_OUTER:
+    case OP_GET_LATE:
+    case OP_IMPORT:
+    case OP_JUMP:
+    case OP_JUMP_IF_TRUE:
+    case OP_JUMP_IF_FALSE:
+    case OP_AND:
+    case OP_OR:
+      return 2;
+
+    case OP_INTEGER:
+      return sizeof(int32_t);
+
+    default:
+      return -1;
+  }
+}
+
 LIST_IMPL_INIT_NO_PREALLOC(ObjList);
 LIST_IMPL_FREE_WITH_ITEMS(ObjList, Obj_free);
 LIST_IMPL_APPEND_NO_PREALLOC(ObjList, Obj*, 8);
 
-LIST_IMPL_INIT_PREALLOC(LineRunList, LineRun, 8);
-LIST_IMPL_FREE_WITHOUT_ITEMS(LineRunList);
-LIST_IMPL_APPEND_PREALLOC(LineRunList, LineRun);
+LIST_IMPL_INIT_NO_PREALLOC(CalleeList);
+LIST_IMPL_FREE_WITHOUT_ITEMS(CalleeList);
+LIST_IMPL_APPEND_NO_PREALLOC(CalleeList, Obj*, 4);
+
+LIST_IMPL_INIT_NO_PREALLOC(LineDeltaList);
+LIST_IMPL_FREE_WITHOUT_ITEMS(LineDeltaList);
+LIST_IMPL_APPEND_NO_PREALLOC(LineDeltaList, uint8_t, 16);
+
+LIST_IMPL_INIT_NO_PREALLOC(LineCheckpointList);
+LIST_IMPL_FREE_WITHOUT_ITEMS(LineCheckpointList);
+LIST_IMPL_APPEND_NO_PREALLOC(LineCheckpointList, LineCheckpoint, 4);
+
+void LineTable_init(LineTable* self) {
+  LineDeltaList_init(&(self->deltas));
+  LineCheckpointList_init(&(self->checkpoints));
+  self->entryCount = 0;
+  self->lastOffset = 0;
+  self->lastLine = 0;
+}
+
+void LineTable_free(LineTable* self) {
+  LineDeltaList_free(&(self->deltas));
+  LineCheckpointList_free(&(self->checkpoints));
+}
 
-void LineRunList_appendLine(LineRunList* self, size_t line) {
-  // If the current line is the same as the previous, continue the run
-  if(self->length > 0 && self->items[self->length - 1].line == line) {
-    self->items[self->length - 1].run++;
-    return;
+inline static void LineTable_appendVarint(LineTable* self, uint64_t value) {
+  while(value >= 0x80) {
+    LineDeltaList_append(&(self->deltas), (uint8_t)(value | 0x80));
+    value >>= 7;
+  }
+  LineDeltaList_append(&(self->deltas), (uint8_t)value);
+}
+
+/*
+ * Returns false if the varint runs past `length` or doesn't fit in 64 bits.
+ */
+inline static bool readVarint(
+    const uint8_t* bytes,
+    size_t length,
+    size_t* position,
+    uint64_t* value) {
+  uint64_t result = 0;
+
+  for(unsigned shift = 0; shift < 64; shift += 7) {
+    if(*position >= length) return false;
+
+    uint8_t byte = bytes[(*position)++];
+    result |= (uint64_t)(byte & 0x7f) << shift;
+
+    if((byte & 0x80) == 0) {
+      *value = result;
+      return true;
+    }
   }
 
-  LineRun lineRun;
-  lineRun.line = line;
-  lineRun.run = 1;
+  return false;
+}
+
+/*
+ * Lines can go backwards, for example when a loop's condition is compiled
+ * again after its body, so line deltas are zigzag encoded: 0, -1, 1, -2...
+ * become 0, 1, 2, 3...
+ */
+inline static uint64_t zigzag(int64_t value) {
+  return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+inline static int64_t unzigzag(uint64_t value) {
+  return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static void LineTable_record(LineTable* self, size_t offset, size_t line) {
+  if(self->entryCount > 0 && line == self->lastLine) return;
 
-  LineRunList_append(self, lineRun);
+  assert(offset >= self->lastOffset);
+  assert(offset <= UINT32_MAX && line <= UINT32_MAX); /* TODO Handle this */
+
+  LineTable_appendVarint(self, offset - self->lastOffset);
+  LineTable_appendVarint(self, zigzag((int64_t)line - (int64_t)self->lastLine));
+
+  if(self->entryCount % LINE_CHECKPOINT_INTERVAL == 0) {
+    LineCheckpoint checkpoint;
+    checkpoint.offset = (uint32_t)offset;
+    checkpoint.line = (uint32_t)line;
+    checkpoint.position = (uint32_t)self->deltas.length;
+    LineCheckpointList_append(&(self->checkpoints), checkpoint);
+  }
+
+  self->entryCount++;
+  self->lastOffset = offset;
+  self->lastLine = line;
 }
 
 /*
@@ -81,29 +242,112 @@ LIST_IMPL_APPEND_PREALLOC(InstructionList,uint8_t);
 
 void Code_init(Code* self) {
   ObjList_init(&(self->interns));
-  LineRunList_init(&(self->lineRuns));
+  CalleeList_init(&(self->callees));
+  LineTable_init(&(self->lines));
   InstructionList_init(&(self->instructions));
 };
 
 void Code_free(Code* self) {
   ObjList_free(&(self->interns)); // Free the interns!
-  LineRunList_free(&(self->lineRuns));
+  CalleeList_free(&(self->callees)); // But not the callees, they're interned elsewhere
+  LineTable_free(&(self->lines));
   InstructionList_free(&(self->instructions));
 }
 
-size_t Code_append(Code* self, uint8_t byte, size_t line) {
+size_t Code_appendInstruction(Code* self, uint8_t instruction, size_t line) {
+  size_t result = InstructionList_length(&(self->instructions));
+  InstructionList_append(&(self->instructions), instruction);
+  LineTable_record(&(self->lines), result, line);
+  return result;
+}
+
+size_t Code_append(Code* self, uint8_t byte) {
   size_t result = InstructionList_length(&(self->instructions));
   InstructionList_append(&(self->instructions), byte);
-  LineRunList_appendLine(&(self->lineRuns), line);
   return result;
 }
 
+size_t Code_lineForOffset(Code* self, size_t offset) {
+  LineTable* lines = &(self->lines);
+  if(lines->checkpoints.length == 0) return 0;
+
+  // Find the last checkpoint at or before the offset
+  size_t low = 0;
+  size_t high = lines->checkpoints.length;
+  while(high - low > 1) {
+    size_t middle = low + (high - low) / 2;
+
+    if(lines->checkpoints.items[middle].offset <= offset) {
+      low = middle;
+    } else {
+      high = middle;
+    }
+  }
+
+  LineCheckpoint* checkpoint = &(lines->checkpoints.items[low]);
+  size_t line = checkpoint->line;
+  size_t entryOffset = checkpoint->offset;
+  size_t position = checkpoint->position;
+
+  // Then decode forward from it to the last entry at or before the offset
+  uint64_t offsetDelta;
+  uint64_t lineDelta;
+  while(readVarint(lines->deltas.items, lines->deltas.length, &position, &offsetDelta)) {
+    if(entryOffset + offsetDelta > offset) break;
+
+    bool read = readVarint(lines->deltas.items, lines->deltas.length, &position, &lineDelta);
+    assert(read);
+
+    entryOffset += offsetDelta;
+    line = (size_t)((int64_t)line + unzigzag(lineDelta));
+  }
+
+  return line;
+}
+
+bool Code_decodeLines(Code* self, const uint8_t* deltas, size_t length) {
+  LineTable_free(&(self->lines));
+  LineTable_init(&(self->lines));
+
+  size_t position = 0;
+  size_t offset = 0;
+  int64_t line = 0;
+
+  while(position < length) {
+    uint64_t offsetDelta;
+    uint64_t lineDelta;
+
+    if(!readVarint(deltas, length, &position, &offsetDelta)) return false;
+    if(!readVarint(deltas, length, &position, &lineDelta)) return false;
+    if(offsetDelta >= self->instructions.length - offset) return false;
+    if(offsetDelta == 0 && self->lines.entryCount > 0) return false;
+
+    offset += offsetDelta;
+    line += unzigzag(lineDelta);
+    if(line < 0 || line > UINT32_MAX) return false;
+
+    // Entries are only recorded when the line changes, so this rejects repeats
+    size_t entryCount = self->lines.entryCount;
+    LineTable_record(&(self->lines), offset, (size_t)line);
+    if(self->lines.entryCount == entryCount) return false;
+  }
+
+  return true;
+}
+
 uint8_t Code_getUInt8(Code* self, uint8_t* ip) {
   assert((size_t)(ip - self->instructions.items)
       < self->instructions.length);
   return *ip;
 }
 
+uint16_t Code_getUInt16(Code* self, uint8_t* ip) {
+  /* Note the "<=", not "<" */
+  assert((size_t)(ip - self->instructions.items)
+      <= self->instructions.length - sizeof(uint16_t));
+  return *((uint16_t*)ip);
+}
+
 int16_t Code_getInt16(Code* self, uint8_t* ip) {
   /* Note the "<=", not "<" */
   assert((size_t)(ip - self->instructions.items)
@@ -145,6 +389,7 @@ uint8_t Code_internObject(Code* self, Obj* intern) {
   assert(result < 256); /* TODO Handle this */
 
   ObjList_append(&(self->interns), intern);
+  intern->shared = true;
 
   return (uint8_t) result;
 }
@@ -153,33 +398,28 @@ Obj* Code_getInterned(Code* self, uint8_t index) {
   return self->interns.items[index];
 }
 
-void Code_printAsAssembly(Code* code, size_t startInstructionIndex) {
-  size_t lineRunIndex = 0;
-  size_t lineRunCounter = 0;
+uint8_t Code_addCallee(Code* self, Obj* callee) {
+  assert(callee->type == OBJ_CLOSURE);
+
+  for(size_t i = 0; i < self->callees.length; i++) {
+    if(self->callees.items[i] == callee) return (uint8_t)i;
+  }
 
-  #define INCREMENT_LINE() \
-    do { \
-      assert(lineRunIndex < code->lineRuns.length); \
-      if(lineRunCounter == code->lineRuns.items[lineRunIndex].run) { \
-        lineRunIndex++; \
-      } \
-    } while(false)
+  size_t result = self->callees.length;
+  assert(result < 256); /* TODO Handle this */
 
+  CalleeList_append(&(self->callees), callee);
 
-  // Run the line up to the current spot
-  for(size_t i = 0; i < startInstructionIndex; i++) {
-    INCREMENT_LINE();
-  }
+  return (uint8_t)result;
+}
 
+void Code_printAsAssembly(Code* code, size_t startInstructionIndex) {
   for(size_t i = startInstructionIndex; i < code->instructions.length; i++) {
     char opString[32] = "";
     char argString[32] = "";
 
-    INCREMENT_LINE();
-    #undef INCREMENT_LINE
-
     size_t instructionIndex = i;
-    size_t line = code->lineRuns.items[lineRunIndex].line;
+    size_t line = Code_lineForOffset(code, i);
 
     switch(code->instructions.items[i]) {
       case OP_INTEGER:
@@ -214,9 +454,42 @@ void Code_printAsAssembly(Code* code, size_t startInstructionIndex) {
       ONE_BYTE_ARG(OP_SET, set);
       ONE_BYTE_ARG(OP_GET, get);
       ONE_BYTE_ARG(OP_CALL, call);
-      ONE_BYTE_ARG(OP_NATIVE, native);
+      ONE_BYTE_ARG(OP_GET_UPVALUE, get_upvalue);
+      ONE_BYTE_ARG(OP_SET_UPVALUE, set_upvalue);
+      ONE_BYTE_ARG(OP_CLOSURE, closure);
+      ONE_BYTE_ARG(OP_CALL_DIRECT, call_direct);
+      ONE_BYTE_ARG(OP_CALL_SELF, call_self);
+      ONE_BYTE_ARG(OP_PROP, prop);
       #undef ONE_BYTE_ARG
 
+      #define TWO_BYTE_ARGS(op, name) \
+        case op: \
+          strcpy(opString, #name); \
+          sprintf( \
+              argString, \
+              "%d %d", \
+              code->instructions.items[i + 1], \
+              code->instructions.items[i + 2] \
+          ); \
+          i += 2; \
+          break
+      TWO_BYTE_ARGS(OP_GET_OUTER, get_outer);
+      TWO_BYTE_ARGS(OP_SET_OUTER, set_outer);
+      TWO_BYTE_ARGS(OP_IMPORT, import);
+      TWO_BYTE_ARGS(OP_GET_LATE, get_late);
+      #undef TWO_BYTE_ARGS
+
+      case OP_NATIVE:
+        strcpy(opString, "native");
+        i++;
+        sprintf(
+            argString,
+            "%u",
+            *((uint16_t*)&(code->instructions.items[i]))
+        );
+        i++;
+        break;
+
       #define JUMP(op, name) \
         case op: \
           strcpy(opString, #name); \
@@ -243,6 +516,7 @@ void Code_printAsAssembly(Code* code, size_t startInstructionIndex) {
       MAP(OP_TRUE, push_true);
       MAP(OP_FALSE, push_false);
       MAP(OP_DROP, drop);
+      MAP(OP_DECLARE_GLOBAL, declare_global);
 
       MAP(OP_ADD, add);
       MAP(OP_SUBTRACT, sub);
@@ -259,7 +533,18 @@ void Code_printAsAssembly(Code* code, size_t startInstructionIndex) {
       MAP(OP_NEQ, neq);
       MAP(OP_GEQ, geq);
       MAP(OP_LEQ, leq);
-      MAP(OP_PROP, prop);
+
+      MAP(OP_ADD_INT, add_int);
+      MAP(OP_SUBTRACT_INT, sub_int);
+      MAP(OP_MULTIPLY_INT, mul_int);
+      MAP(OP_DIVIDE_INT, int_div_int);
+      MAP(OP_NEGATE_INT, neg_int);
+      MAP(OP_EQ_INT, eq_int);
+      MAP(OP_NEQ_INT, neq_int);
+      MAP(OP_LT_INT, lt_int);
+      MAP(OP_GT_INT, gt_int);
+      MAP(OP_LEQ_INT, leq_int);
+      MAP(OP_GEQ_INT, geq_int);
       #undef MAP
 
       default:
@@ -1,6 +1,8 @@
 #ifndef FUR_CODE_H
 #define FUR_CODE_H
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 
 #include "list.h"
@@ -29,6 +31,12 @@ typedef enum {
   OP_LEQ,
   OP_SET,
   OP_GET,
+
+  /*
+   * Replaces the module on the top of the stack with its variable named by
+   * the interned string the operand indexes, waiting for the module to
+   * finish if it hasn't.
+   */
   OP_PROP,
   OP_JUMP,
   OP_JUMP_IF_TRUE,
@@ -37,23 +45,112 @@ typedef enum {
   OP_OR,
   OP_CALL,
   OP_RETURN,
+  OP_GET_OUTER,
+  OP_SET_OUTER,
+  OP_GET_UPVALUE,
+  OP_SET_UPVALUE,
+  OP_CLOSURE,
+
+  /*
+   * Versions of arithmetic and comparison instructions for operands which
+   * the compiler has proven are integers. These don't check their operands
+   * unless DEBUG is defined.
+   */
+  OP_ADD_INT,
+  OP_SUBTRACT_INT,
+  OP_MULTIPLY_INT,
+  OP_DIVIDE_INT,
+  OP_NEGATE_INT,
+  OP_EQ_INT,
+  OP_NEQ_INT,
+  OP_LT_INT,
+  OP_GT_INT,
+  OP_LEQ_INT,
+  OP_GEQ_INT,
+
+  /*
+   * Calls a closure the compiler has proven is the callee, with the
+   * arity already checked. The operand indexes the Code's callees.
+   */
+  OP_CALL_DIRECT,
+
+  /*
+   * Calls the currently running closure, for direct recursion in closures
+   * which have upvalues. The operand is the argument count.
+   */
+  OP_CALL_SELF,
+
+  /*
+   * Pushes the module at the path the first operand indexes in the interns,
+   * starting it if nothing has imported it yet. If the second operand is 1,
+   * the module is used straight away, so it runs next on this worker.
+   */
+  OP_IMPORT,
+
+  /*
+   * Records that the module's variables up to the top of the stack have
+   * been assigned, after the module declares one (see OP_GET_LATE).
+   */
+  OP_DECLARE_GLOBAL,
+
+  /*
+   * Reads a module variable declared after the function reading it, whose
+   * index is the first operand. It stops the program if the module hasn't
+   * assigned the variable yet, naming it by the interned string the second
+   * operand indexes.
+   */
+  OP_GET_LATE,
 } Instruction;
 
 void Instruction_print(Instruction);
 
+/*
+ * The number of bytes of operands which follow the instruction, or -1 if
+ * the byte isn't an instruction.
+ */
+int Instruction_operandSize(uint8_t instruction);
+
 LIST_DECL(ObjList, Obj*);
 
+/*
+ * Unlike ObjList, this doesn't own its items.
+ */
+LIST_DECL(CalleeList, Obj*);
+
+/*
+ * Maps instruction offsets to source lines. An entry is recorded for each
+ * instruction whose line differs from the previous instruction's, as a
+ * varint offset delta followed by a zigzag varint line delta, so most
+ * entries take two bytes. Every LINE_CHECKPOINT_INTERVAL entries, a
+ * checkpoint records the absolute offset and line, so a lookup binary
+ * searches the checkpoints and then decodes fewer than
+ * LINE_CHECKPOINT_INTERVAL entries.
+ */
+#define LINE_CHECKPOINT_INTERVAL 16
+
+typedef struct {
+  uint32_t offset;
+  uint32_t line;
+  uint32_t position; // Of the entry after this one in deltas
+} LineCheckpoint;
+
+LIST_DECL(LineCheckpointList, LineCheckpoint);
+LIST_DECL(LineDeltaList, uint8_t);
+
 typedef struct {
-  size_t line;
-  size_t run;
-} LineRun;
+  LineDeltaList deltas;
+  LineCheckpointList checkpoints;
+  size_t entryCount;
+  size_t lastOffset;
+  size_t lastLine;
+} LineTable;
 
-LIST_DECL(LineRunList, LineRun);
 LIST_DECL(InstructionList, uint8_t);
 
 typedef struct {
   ObjList interns;
-  LineRunList lineRuns;
+  CalleeList callees;
+  LineTable lines;
   InstructionList instructions;
 } Code;
 
@@ -62,7 +159,21 @@ inline static ALLOCATE_ONE_IMPL(Code);
 void Code_init(Code*);
 void Code_free(Code*);
 
-size_t Code_append(Code* self, uint8_t instruction, size_t line);
+/*
+ * Instructions are appended with their line, and their operands after them
+ * without one.
+ */
+size_t Code_appendInstruction(Code* self, uint8_t instruction, size_t line);
+size_t Code_append(Code* self, uint8_t byte);
+
+size_t Code_lineForOffset(Code* self, size_t offset);
+
+/*
+ * Replaces the line table with one decoded from `deltas`, which is in the
+ * format of LineTable.deltas. Returns false if it's malformed or refers to
+ * offsets past the end of the instructions.
+ */
+bool Code_decodeLines(Code* self, const uint8_t* deltas, size_t length);
 uint8_t Code_internObject(Code* self, Obj* intern);
 
 // TODO Profile inlining these.
@@ -72,12 +183,20 @@ uint8_t Code_internObject(Code* self, Obj* intern);
  * profile to do anything.
  */
 uint8_t Code_getUInt8(Code*, uint8_t*);
+uint16_t Code_getUInt16(Code*, uint8_t*);
 int16_t Code_getInt16(Code*, uint8_t*);
 int32_t Code_getInt32(Code*, uint8_t*);
 size_t Code_getCurrent(Code*);
 
 Obj* Code_getInterned(Code* self, uint8_t index);
 
+uint8_t Code_addCallee(Code* self, Obj* callee);
+
+inline static Obj* Code_getCallee(Code* self, uint8_t index) {
+  assert(index < self->callees.length);
+  return self->callees.items[index];
+}
+
 void Code_printAsAssembly(Code*, size_t startInstructionIndex);
 
 #endif
@@ -1,9 +1,12 @@
 #include <assert.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
+#include "analysis.h"
 #include "object.h"
 #include "code.h"
 #include "compiler.h"
@@ -58,22 +61,131 @@ inline static int16_t SymbolStack_findSymbol(SymbolStack* self, Symbol* symbol)
   return -1;
 }
 
+static void FunctionScope_init(
+    FunctionScope* self,
+    FunctionScope* parent,
+    Symbol** boundary,
+    Node* body,
+    bool escapes) {
+  self->parent = parent;
+  self->boundary = boundary;
+  self->body = body;
+  self->depth = parent == NULL ? 0 : parent->depth + 1;
+  self->escapes = escapes;
+  self->temporaries = 0;
+  self->closure = NULL;
+  self->selfCallCount = 0;
+  self->upvalueCount = 0;
+}
+
 void Compiler_init(Compiler* self, Runtime* runtime) {
   SymbolStack_init(&(self->stack));
   self->runtime = runtime;
-  self->scopeBoundary = self->stack.items;
+  FunctionScope_init(&(self->module), NULL, self->stack.items, NULL, false);
+  self->scope = &(self->module);
+  self->inlineDepth = 0;
+  self->replacementCount = 0;
+  self->inductionUpdateCount = 0;
+
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  self->workers = cores > 1 ? (unsigned)cores : 1;
+  self->jobs = NULL;
+  self->jobCount = 0;
+
+  self->lazy = false;
+  self->lazyJobs = NULL;
+  NodeList_init(&(self->trees));
+  FlatTree_init(&(self->moduleTree));
+
+  self->path = NULL;
+  self->root = NULL;
+  self->globals = NULL;
+  self->following = NULL;
+  self->moduleVariables = NULL;
+  self->moduleVariableCount = 0;
 }
 
+LIST_IMPL_INIT_NO_PREALLOC(NodeList);
+LIST_IMPL_FREE_WITH_ITEMS(NodeList, Node_free);
+LIST_IMPL_APPEND_NO_PREALLOC(NodeList, Node*, 8);
+
+static void CompileJob_freeList(CompileJob*);
+
 void Compiler_free(Compiler* self) {
   SymbolStack_free(&(self->stack));
+
+  // Closures which were never called are left with empty code
+  CompileJob_freeList(self->lazyJobs);
+  self->lazyJobs = NULL;
+
+  NodeList_free(&(self->trees));
+  FlatTree_free(&(self->moduleTree));
 }
 
 Symbol* Compiler_getSymbol(Compiler* self, size_t length, char* name) {
   return Runtime_getSymbol(self->runtime, length, name);
 }
 
-inline static size_t emitByte(Code* code, size_t line, uint8_t byte) {
-  return Code_append(code, byte, line);
+/*
+ * These ask the analyses about `body`, using the flattened copy if it's the
+ * module's tree.
+ */
+inline static bool Compiler_isFlattened(Compiler* self, Node* body) {
+  return body == self->module.body && self->moduleTree.count > 0;
+}
+
+static bool Compiler_usesAsValue(Compiler* self, Node* body, Symbol* symbol) {
+  if(Compiler_isFlattened(self, body)) {
+    return FlatTree_usesAsValue(&(self->moduleTree), 0, symbol->length, symbol->name);
+  }
+
+  return Node_usesAsValue(body, symbol->length, symbol->name);
+}
+
+static bool Compiler_assignsTo(Compiler* self, Node* body, Symbol* symbol) {
+  if(Compiler_isFlattened(self, body)) {
+    return FlatTree_assignsTo(&(self->moduleTree), 0, symbol->length, symbol->name);
+  }
+
+  return Node_assignsTo(body, symbol->length, symbol->name);
+}
+
+static bool Compiler_assignsInNestedFunctions(Compiler* self, Node* body, Symbol* symbol) {
+  if(Compiler_isFlattened(self, body)) {
+    return FlatTree_assignsInNestedFunctions(
+        &(self->moduleTree),
+        0,
+        symbol->length,
+        symbol->name);
+  }
+
+  return Node_assignsInNestedFunctions(body, symbol->length, symbol->name);
+}
+
+/*
+ * Pushes a symbol onto the symbol stack, forgetting any definition recorded
+ * for a previous occupant of the slot.
+ */
+inline static void Compiler_declare(Compiler* self, Symbol* symbol) {
+  size_t index = self->stack.top - self->stack.items;
+  Node* body = self->scope->body;
+
+  self->definitions[index] = NULL;
+  self->closures[index] = NULL;
+  self->assignedByClosure[index] = symbol != NULL && (body == NULL ||
+      Compiler_assignsInNestedFunctions(self, body, symbol));
+  self->types[index] = STATIC_ANY;
+
+  SymbolStack_push(&(self->stack), symbol);
+}
+
+void Compiler_declareGlobal(Compiler* self, Symbol* symbol) {
+  assert(self->scope == &(self->module));
+  Compiler_declare(self, symbol);
+}
+
+inline static size_t emitByte(Code* code, uint8_t byte) {
+  return Code_append(code, byte);
 }
 
 inline static size_t emitInstruction(Code* code, size_t line, Instruction i) {
@@ -94,25 +206,386 @@ inline static size_t emitInstruction(Code* code, size_t line, Instruction i) {
    * Instead, if we use this function ubiquitously, we'll get this assertion
    * when we emit the first instruction that goes over the 1-byte limit.
    *
-   * We're wrapping emitByte and keeping it around for the case where
-   * we are actually pushing in a uint8_t, not an Instruction that needs
-   * to be cast.
+   * Operands are emitted with emitByte, which doesn't take a line: lines
+   * are only recorded per instruction.
    */
   assert(i <= UINT8_MAX);
 
-  return emitByte(code, line, (uint8_t)i);
+  return Code_appendInstruction(code, (uint8_t)i, line);
+}
+
+/*
+ * Returns the function which declared the variable at the given index on the
+ * symbol stack.
+ */
+inline static FunctionScope* Compiler_findOwner(Compiler* self, int16_t index) {
+  FunctionScope* scope = self->scope;
+
+  while(self->stack.items + index < scope->boundary) {
+    scope = scope->parent;
+    assert(scope != NULL);
+  }
+
+  return scope;
+}
+
+/*
+ * Returns true if any function from `scope` up to (but not including) `owner`
+ * may outlive the frame it was created in. If none do, the owner's frame is
+ * guaranteed to be live, and in the display, whenever `scope` runs.
+ *
+ * The module never returns while its functions can still run, so variables
+ * declared at module level can always be reached through the display.
+ */
+inline static bool FunctionScope_chainEscapes(FunctionScope* scope, FunctionScope* owner) {
+  if(owner->depth == 0) return false;
+
+  for(; scope != owner; scope = scope->parent) {
+    if(scope->escapes) return true;
+  }
+
+  return false;
+}
+
+static uint8_t FunctionScope_resolveUpvalue(
+    FunctionScope* self,
+    FunctionScope* owner,
+    int16_t index,
+    Symbol** stackItems) {
+  for(uint8_t i = 0; i < self->upvalueCount; i++) {
+    if(self->upvalueSlots[i] == index) return i;
+  }
+
+  FunctionScope* parent = self->parent;
+  assert(parent != NULL);
+
+  UpvalueDescriptor descriptor;
+
+  if(parent == owner) {
+    descriptor.kind = UPVALUE_LOCAL;
+    descriptor.depth = owner->depth;
+    descriptor.index = (uint8_t)(stackItems + index - owner->boundary);
+  } else if(!FunctionScope_chainEscapes(parent, owner)) {
+    descriptor.kind = UPVALUE_OUTER;
+    descriptor.depth = owner->depth;
+    descriptor.index = (uint8_t)(stackItems + index - owner->boundary);
+  } else {
+    descriptor.kind = UPVALUE_UPVALUE;
+    descriptor.depth = parent->depth;
+    descriptor.index = FunctionScope_resolveUpvalue(
+        parent,
+        owner,
+        index,
+        stackItems
+      );
+  }
+
+  assert(self->upvalueCount < MAX_UPVALUES); /* TODO Handle this */
+
+  uint8_t result = self->upvalueCount;
+  self->upvalueSlots[result] = index;
+  self->upvalues[result] = descriptor;
+  self->upvalueCount++;
+  return result;
+}
+
+/*
+ * Emits the instruction to get (OP_GET and friends) or set (OP_SET and
+ * friends) the variable at `index` on the symbol stack, depending on
+ * whether it belongs to the current function, can be reached through the
+ * display, or has to be captured as an upvalue.
+ */
+static size_t emitVariable(
+    Compiler* self,
+    Code* code,
+    size_t line,
+    int16_t index,
+    bool set) {
+  assert(index > -1);
+  assert(index <= UINT8_MAX);
+
+  FunctionScope* owner = Compiler_findOwner(self, index);
+  uint8_t slot = (uint8_t)(self->stack.items + index - owner->boundary);
+
+  if(set && owner != self->scope) self->assignedByClosure[index] = true;
+
+  if(owner == self->scope) {
+    size_t result = emitInstruction(code, line, set ? OP_SET : OP_GET);
+    emitByte(code, slot);
+    return result;
+  }
+
+  if(!FunctionScope_chainEscapes(self->scope, owner)) {
+    size_t result = emitInstruction(code, line, set ? OP_SET_OUTER : OP_GET_OUTER);
+    emitByte(code, owner->depth);
+    emitByte(code, slot);
+    return result;
+  }
+
+  uint8_t upvalue = FunctionScope_resolveUpvalue(
+      self->scope,
+      owner,
+      index,
+      self->stack.items
+    );
+
+  size_t result = emitInstruction(code, line, set ? OP_SET_UPVALUE : OP_GET_UPVALUE);
+  emitByte(code, upvalue);
+  return result;
+}
+
+/*
+ * `compiler` is a copy of the compiler as it was when the function's
+ * definition was reached, and `scope` is the function's scope within it, so
+ * the body compiles exactly as it would have then. Compiling the body only
+ * reads what's below the function on the symbol stack.
+ */
+struct CompileJob {
+  CompileJob* next;
+  Compiler* owner;
+  ObjClosure* closure;
+  Compiler compiler;
+  FunctionScope scope;
+  Node* body;
+};
+
+static void CompileJob_freeList(CompileJob* job) {
+  while(job != NULL) {
+    CompileJob* next = job->next;
+    free(job);
+    job = next;
+  }
+}
+
+static CompileJob* Compiler_deferBody(
+    Compiler* self,
+    FunctionScope* scope,
+    ObjClosure* closure,
+    Node* body) {
+  CompileJob* job = malloc(sizeof(CompileJob));
+  assert(job != NULL); /* TODO Handle this */
+
+  job->owner = self;
+  job->closure = closure;
+  job->compiler = *self;
+  job->scope = *scope;
+  job->body = body;
+
+  // Point the copies at each other rather than at the originals
+  Compiler* compiler = &(job->compiler);
+  compiler->stack.top = compiler->stack.items + (self->stack.top - self->stack.items);
+  compiler->module.boundary = compiler->stack.items;
+  compiler->scope = &(job->scope);
+  compiler->workers = 1;
+  compiler->lazy = false;
+  compiler->jobs = NULL;
+  compiler->jobCount = 0;
+  compiler->lazyJobs = NULL;
+  compiler->moduleVariables = NULL;
+  compiler->moduleVariableCount = 0;
+  NodeList_init(&(compiler->trees));
+  FlatTree_init(&(compiler->moduleTree));
+  job->scope.parent = &(compiler->module);
+  job->scope.boundary = compiler->stack.items + (scope->boundary - self->stack.items);
+
+  return job;
+}
+
+/*
+ * By the time a body is compiled as a job, the module has been compiled, so
+ * the body can also read variables the module declared after the function,
+ * such as another function which calls this one, so long as it doesn't
+ * declare them itself (see NODE_IDENTIFIER). Nothing is known about their
+ * values.
+ *
+ * That's skipped unless everything below the function on the stack is
+ * still where it was, since otherwise the variables wouldn't be where the
+ * body expects them.
+ */
+static void CompileJob_findModuleVariables(CompileJob* self) {
+  Compiler* compiler = &(self->compiler);
+  Compiler* owner = self->owner;
+  assert(owner->scope == &(owner->module));
+
+  size_t declared = self->scope.boundary - compiler->stack.items;
+  size_t globals = owner->stack.top - owner->stack.items;
+  if(globals <= declared) return;
+
+  for(size_t i = 0; i < declared; i++) {
+    if(compiler->stack.items[i] != owner->stack.items[i]) return;
+  }
+
+  compiler->moduleVariables = owner->stack.items;
+  compiler->moduleVariableCount = globals;
+}
+
+static void CompileJob_run(CompileJob* self) {
+  Code* code = self->closure->code;
+
+  CompileJob_findModuleVariables(self);
+  emitNode(&(self->compiler), code, self->body, true);
+
+  /* TODO This line number isn't really right */
+  emitInstruction(code, self->body->line, OP_RETURN);
+
+  // The module's functions reach its variables through the display
+  assert(self->scope.upvalueCount == 0);
+}
+
+/*
+ * The parameters are declared again before a lazy body is compiled, as the
+ * body they were declared for may only just have been parsed.
+ */
+static void CompileJob_redeclareParameters(CompileJob* self) {
+  Compiler* compiler = &(self->compiler);
+
+  uint8_t arity = self->closure->arity;
+  Symbol* parameters[UINT8_MAX];
+  memcpy(parameters, self->scope.boundary, sizeof(Symbol*) * arity);
+  compiler->stack.top = self->scope.boundary;
+
+  for(uint8_t i = 0; i < arity; i++) {
+    Compiler_declare(compiler, parameters[i]);
+  }
+}
+
+/*
+ * Threads on several workers may call a function for the first time at
+ * once. Only one compiles it, and the others wait for it to finish.
+ */
+static pthread_mutex_t lazyLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void CompileJob_compileLazy(ObjClosure* closure) {
+  pthread_mutex_lock(&lazyLock);
+
+  CompileJob* self = closure->lazy;
+
+  if(self == NULL) {
+    pthread_mutex_unlock(&lazyLock);
+    return;
+  }
+
+  // A body the pre-parser skipped is only parsed for as long as it compiles
+  Node* parsed = NULL;
+  if(self->body->type == NODE_DEFERRED_BODY) {
+    parsed = parseDeferredBody(self->body);
+    self->body = parsed;
+    self->scope.body = parsed;
+  }
+
+  CompileJob_redeclareParameters(self);
+  CompileJob_run(self);
+
+  Node_free(parsed);
+
+  // The code has to be complete before other threads see it's compiled
+  __atomic_store_n(&(closure->lazy), NULL, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&lazyLock);
+}
+
+typedef struct {
+  CompileJob** jobs;
+  size_t count;
+  size_t next;
+  pthread_mutex_t lock;
+} CompileQueue;
+
+static void* CompileQueue_work(void* queue) {
+  CompileQueue* self = queue;
+
+  for(;;) {
+    pthread_mutex_lock(&(self->lock));
+    size_t index = self->next++;
+    pthread_mutex_unlock(&(self->lock));
+
+    if(index >= self->count) return NULL;
+
+    CompileJob_run(self->jobs[index]);
+  }
 }
 
-inline static Obj* makeObjClosure(Compiler* self, Symbol* name, Node* arguments, Node* body) {
-  assert(self->scopeBoundary - self->stack.items < MAX_SYMBOLSTACK_DEPTH);
-  Symbol** parentScopeBoundary = self->scopeBoundary;
-  self->scopeBoundary = self->stack.top;
+/*
+ * Compiles the queued function bodies, on up to `workers` threads including
+ * this one, and frees the jobs.
+ */
+static void Compiler_runJobs(Compiler* self) {
+  if(self->jobCount == 0) return;
+
+  CompileQueue queue;
+  queue.jobs = malloc(sizeof(CompileJob*) * self->jobCount);
+  assert(queue.jobs != NULL); /* TODO Handle this */
+  queue.count = self->jobCount;
+  queue.next = 0;
+  pthread_mutex_init(&(queue.lock), NULL);
+
+  // The list is newest first, so reverse it to compile in source order
+  size_t index = self->jobCount;
+  for(CompileJob* job = self->jobs; job != NULL; job = job->next) {
+    queue.jobs[--index] = job;
+  }
+
+  size_t threadCount = self->jobCount / MIN_JOBS_PER_WORKER;
+  if(threadCount > self->workers) threadCount = self->workers;
+  if(threadCount < 1) threadCount = 1;
+
+  pthread_t* helpers = malloc(sizeof(pthread_t) * threadCount);
+  assert(helpers != NULL); /* TODO Handle this */
+
+  for(size_t i = 1; i < threadCount; i++) {
+    int error = pthread_create(&(helpers[i]), NULL, CompileQueue_work, &queue);
+    assert(error == 0); /* TODO Handle this */
+  }
+
+  CompileQueue_work(&queue);
+
+  for(size_t i = 1; i < threadCount; i++) {
+    pthread_join(helpers[i], NULL);
+  }
+
+  free(helpers);
+  pthread_mutex_destroy(&(queue.lock));
+
+  for(size_t i = 0; i < queue.count; i++) {
+    free(queue.jobs[i]);
+  }
+  free(queue.jobs);
+
+  self->jobs = NULL;
+  self->jobCount = 0;
+}
 
+/*
+ * `slot` is the index on the symbol stack of the variable the closure will
+ * be stored in if that variable is never reassigned, or -1.
+ */
+inline static ObjClosure* makeObjClosure(
+    Compiler* self,
+    Symbol* name,
+    int16_t slot,
+    Node* arguments,
+    Node* body) {
   /*
    * TODO Allow name == NULL, which we will need for lambdas.
    */
   assert(name != NULL);
 
+  assert(self->scope->depth + 1 < MAX_CLOSURE_DEPTH); /* TODO Handle this */
+
+  /*
+   * If the enclosing function only ever calls this closure by name, and
+   * only calls it from functions which don't outlive it either, it can't
+   * outlive the enclosing function's frame. Whether the module's functions
+   * escape doesn't matter, as the module's variables never go away.
+   */
+  bool escapes = self->scope->body == NULL ||
+    (self->scope == &(self->module)
+      ? Compiler_usesAsValue(self, self->scope->body, name)
+      : Node_functionEscapes(self->scope->body, name->length, name->name));
+
+  FunctionScope scope;
+  FunctionScope_init(&scope, self->scope, self->stack.top, body, escapes);
+  self->scope = &scope;
+
   /*
    * TODO Code_init does a few things which aren't great for functions.
    * Most notably, code is maintaining a separate list of interned
@@ -138,7 +611,7 @@ inline static Obj* makeObjClosure(Compiler* self, Symbol* name, Node* arguments,
      */
     AtomNode* arg = (AtomNode*)arguments;
     Symbol* argSymbol = Runtime_getSymbol(self->runtime, arg->length, arg->text);
-    SymbolStack_push(&(self->stack), argSymbol);
+    Compiler_declare(self, argSymbol);
   } else if(arguments->type == NODE_COMMA_SEPARATED_LIST) {
     ExpressionListNode* argList = (ExpressionListNode*)arguments;
     assert(argList->length <= UINT8_MAX);
@@ -154,7 +627,7 @@ inline static Obj* makeObjClosure(Compiler* self, Symbol* name, Node* arguments,
       assert(argNode->type == NODE_IDENTIFIER);
       AtomNode* arg = (AtomNode*)argNode;
       Symbol* argSymbol = Runtime_getSymbol(self->runtime, arg->length, arg->text);
-      SymbolStack_push(&(self->stack), argSymbol);
+      Compiler_declare(self, argSymbol);
     }
   } else {
     assert(false);
@@ -164,20 +637,75 @@ inline static Obj* makeObjClosure(Compiler* self, Symbol* name, Node* arguments,
     assert(false); /* TODO Allow empty function bodies (just return nil). */
   }
 
-  emitNode(self, functionCode, body, true);
+  ObjClosure* result = ObjClosure_allocateOne();
+  ObjClosure_init(result, name, arity, functionCode);
+  result->depth = scope.depth;
+  result->globals = self->globals;
+
+  scope.closure = result;
+  if(slot > -1) self->closures[slot] = result;
 
-  /* TODO This line number isn't really right */
-  emitInstruction(functionCode, body->line, OP_RETURN);
+  /*
+   * The module's functions don't capture upvalues, so nothing the module
+   * emits after the definition depends on how the body compiles, and it can
+   * be compiled later: when the function is first called if compiling
+   * lazily, or otherwise in parallel with the others.
+   */
+  if(scope.parent == &(self->module) && self->lazy) {
+    CompileJob* job = Compiler_deferBody(self, &scope, result, body);
+    job->next = self->lazyJobs;
+    self->lazyJobs = job;
+
+    result->lazy = job;
+    result->compileLazy = CompileJob_compileLazy;
+  } else if(scope.parent == &(self->module)) {
+    CompileJob* job = Compiler_deferBody(self, &scope, result, body);
+    job->next = self->jobs;
+    self->jobs = job;
+    self->jobCount++;
+  } else {
+    emitNode(self, functionCode, body, true);
+
+    /* TODO This line number isn't really right */
+    emitInstruction(functionCode, body->line, OP_RETURN);
+  }
 
-  while(self->stack.top > self->scopeBoundary) {
+  while(self->stack.top > scope.boundary) {
     SymbolStack_pop(&(self->stack));
   }
 
-  self->scopeBoundary = parentScopeBoundary;
+  self->scope = scope.parent;
 
-  ObjClosure* result = ObjClosure_allocateOne();
-  ObjClosure_init(result, name, arity, functionCode);
-  return (Obj*)result;
+  if(scope.upvalueCount > 0) {
+    for(uint8_t i = 0; i < scope.selfCallCount; i++) {
+      functionCode->instructions.items[scope.selfCalls[i]] = OP_CALL_SELF;
+      functionCode->instructions.items[scope.selfCalls[i] + 1] = arity;
+    }
+
+    result->upvalueCount = scope.upvalueCount;
+    result->upvalueDescriptors = malloc(
+        sizeof(UpvalueDescriptor) * scope.upvalueCount
+      );
+    assert(result->upvalueDescriptors != NULL); /* TODO Handle this */
+    memcpy(
+        result->upvalueDescriptors,
+        scope.upvalues,
+        sizeof(UpvalueDescriptor) * scope.upvalueCount
+      );
+  }
+
+  return result;
+}
+
+// An identifier's name, where makeObjString() is a string literal's value
+inline static Obj* makeObjStringOfName(AtomNode* node) {
+  char* characters = allocateChars(node->length + 1);
+  memcpy(characters, node->text, node->length);
+  characters[node->length] = '\0';
+
+  ObjString* string = ObjString_allocate(1);
+  ObjString_init(string, node->length, characters);
+  return (Obj*)string;
 }
 
 inline static Obj* makeObjString(AtomNode* node) {
@@ -220,136 +748,1162 @@ inline static Obj* makeObjString(AtomNode* node) {
       characters[charactersCount] = node->text[tokenIndex];
     }
 
-    charactersCount++;
+    charactersCount++;
+  }
+
+  /*
+   * Even though we've got the length stored, let's append a null byte
+   * for convenience and potentially safety (though we shouldn't rely on this).
+   */
+  characters[charactersCount] = '\0';
+
+  /*
+   * TODO If there were a lot of escape sequences, the string could be
+   * significantly shorter than the lexeme, so it might be worthwhile
+   * to realloc down. Let's revisit after Unicode support.
+   */
+  ObjString* result = ObjString_allocate(1);
+
+  ObjString_init(result, charactersCount, characters);
+
+  return (Obj*)result;
+}
+
+inline static int32_t parseInteger(AtomNode* node) {
+  int32_t number = 0;
+
+  for(size_t i = 0; i < node->length; i++) {
+    uint8_t digit = node->text[i] - '0';
+    assert(digit < 10);
+    number = number * 10 + digit;
+  }
+
+  return number;
+}
+
+inline static void emitInteger(Code* code, int32_t integer) {
+  /*
+   * TODO If you trace what this does it's sort of a mess.
+   *
+   * However, I don't want to rewrite it now because this code may go
+   * away;  we might remove the OP_INTEGER instruction in favor of an
+   * OP_CONSTANT instruction which places the integer (or any other
+   * constant) in a constant table on the Code object. There are some
+   * tradeoffs here:
+   *
+   * PROS:
+   * - Less space used in bytecode.
+   * - We can deduplicate integers and use less space in the constant
+   *   table as well.
+   * CONS:
+   * - Add a pointer lookup at run time when pushing integers to the
+   *   stack.
+   *
+   * Ultimately, let's wait to make a decision on this until we have
+   * performance tests to be our guide.
+   */
+
+  uint8_t* bytes = (uint8_t*)(&integer);
+  for(int i = 0; i < 4; i++) emitByte(code, bytes[i]);
+}
+
+size_t emitJump(Compiler* self, Code* code, size_t line, Instruction inst) {
+  emitInstruction(code, line, inst);
+
+  assert(sizeof(uint8_t) * 2 == sizeof(int16_t));
+
+  size_t result = emitByte(code, 0);
+  emitByte(code, 0);
+  return result;
+}
+
+/* TODO This should probably be Code_patchJump */
+void Compiler_patchJump(Code* code, size_t jumpIndex, size_t targetIndex) {
+  // TODO Handle these
+  assert(jumpIndex <= INT32_MAX);
+  assert(targetIndex <= INT32_MAX);
+
+  /*
+   * Cast into signed integers so that the result of out subtraction is
+   * signed, i.e. jumpIndex can be greater than targetIndex.
+   */
+  int32_t intJumpIndex = (int32_t)jumpIndex;
+  int32_t intTargetIndex = (int32_t)targetIndex;
+
+  int32_t jump = intTargetIndex - intJumpIndex;
+
+  /*
+   * Now that we have cast into sign, let't catch any overflows and then
+   * cast into the right size.
+   */
+  // TODO Handle these.
+  assert(jump <= INT16_MAX);
+  assert(jump >= INT16_MIN);
+
+  *((int16_t*)(&(code->instructions.items[jumpIndex]))) = (int16_t)jump;
+}
+
+/* TODO This should probably be Code_patchJumpToCurrent */
+void Compiler_patchJumpToCurrent(Code* code, size_t jumpIndex) {
+  Compiler_patchJump(code, jumpIndex, code->instructions.length);
+}
+
+inline static size_t emitBasic(Code* code, size_t line, Instruction i, bool useResult) {
+  if(useResult) {
+    return emitInstruction(code, line, i);
+  } else {
+    return Code_getCurrent(code);
+  }
+}
+
+/*
+ * Returns the types a variable could have according to `types`. Only the
+ * current function's own variables are tracked, since anything else could
+ * be changed by code we aren't compiling right now.
+ */
+static StaticType Compiler_variableType(Compiler* self, StaticType* types, Symbol* name) {
+  int16_t index = SymbolStack_findSymbol(&(self->stack), name);
+
+  if(index < 0) return STATIC_ANY;
+  if(Compiler_findOwner(self, index) != self->scope) return STATIC_ANY;
+  if(self->assignedByClosure[index]) return STATIC_ANY;
+
+  return types[index];
+}
+
+inline static void StaticTypes_join(StaticType* self, StaticType* other) {
+  for(size_t i = 0; i < MAX_SYMBOLSTACK_DEPTH; i++) {
+    self[i] |= other[i];
+  }
+}
+
+static StaticType Compiler_infer(Compiler* self, Node* node, StaticType* types);
+
+/*
+ * Updates `types` from the types on entry to a loop to the types at the top
+ * of every iteration, by iterating over the loop until nothing changes.
+ */
+static void Compiler_inferLoop(Compiler* self, BinaryNode* loop, StaticType* types) {
+  StaticType head[MAX_SYMBOLSTACK_DEPTH];
+  memcpy(head, types, sizeof(head));
+
+  for(;;) {
+    Compiler_infer(self, loop->arg0, types);
+    Compiler_infer(self, loop->arg1, types);
+    StaticTypes_join(types, head);
+
+    if(!memcmp(types, head, sizeof(head))) return;
+
+    memcpy(head, types, sizeof(head));
+  }
+}
+
+/*
+ * Returns the types `node` could evaluate to, updating `types` with the
+ * effects of any assignments in it. Variables `node` declares aren't
+ * tracked, since they don't have a slot on the symbol stack yet.
+ */
+static StaticType Compiler_infer(Compiler* self, Node* node, StaticType* types) {
+  switch(node->type) {
+    case NODE_NIL:
+      return STATIC_NIL;
+
+    case NODE_TRUE:
+    case NODE_FALSE:
+      return STATIC_BOOLEAN;
+
+    case NODE_NUMBER:
+      return STATIC_INTEGER;
+
+    case NODE_STRING:
+      return STATIC_STRING;
+
+    case NODE_IDENTIFIER:
+      return Compiler_variableType(
+          self,
+          types,
+          Compiler_getSymbol(self, ((AtomNode*)node)->length, ((AtomNode*)node)->text)
+        );
+
+    /*
+     * These assert that their operands are integers, so if execution
+     * continues past them, they produced an integer.
+     */
+    case NODE_NEGATE:
+      Compiler_infer(self, ((UnaryNode*)node)->arg, types);
+      return STATIC_INTEGER;
+
+    case NODE_SUBTRACT:
+    case NODE_MULTIPLY:
+    case NODE_DIVIDE:
+      Compiler_infer(self, ((BinaryNode*)node)->arg0, types);
+      Compiler_infer(self, ((BinaryNode*)node)->arg1, types);
+      return STATIC_INTEGER;
+
+    case NODE_NOT:
+      Compiler_infer(self, ((UnaryNode*)node)->arg, types);
+      return STATIC_BOOLEAN;
+
+    case NODE_ADD:
+      {
+        StaticType type0 = Compiler_infer(self, ((BinaryNode*)node)->arg0, types);
+        StaticType type1 = Compiler_infer(self, ((BinaryNode*)node)->arg1, types);
+
+        if(type0 == STATIC_INTEGER && type1 == STATIC_INTEGER) return STATIC_INTEGER;
+        if(type0 == STATIC_STRING && type1 == STATIC_STRING) return STATIC_STRING;
+        return STATIC_INTEGER | STATIC_STRING;
+      }
+
+    case NODE_EQUALS:
+    case NODE_NOT_EQUALS:
+    case NODE_GREATER_THAN_EQUALS:
+    case NODE_LESS_THAN_EQUALS:
+    case NODE_GREATER_THAN:
+    case NODE_LESS_THAN:
+      Compiler_infer(self, ((BinaryNode*)node)->arg0, types);
+      Compiler_infer(self, ((BinaryNode*)node)->arg1, types);
+      return STATIC_BOOLEAN;
+
+    case NODE_PROPERTY:
+      Compiler_infer(self, ((BinaryNode*)node)->arg0, types);
+      return STATIC_ANY;
+
+    case NODE_IMPORT:
+      return STATIC_OTHER;
+
+    case NODE_AND:
+    case NODE_OR:
+      {
+        /*
+         * The right operand might not run.
+         */
+        StaticType type0 = Compiler_infer(self, ((BinaryNode*)node)->arg0, types);
+        StaticType skipped[MAX_SYMBOLSTACK_DEPTH];
+        memcpy(skipped, types, sizeof(skipped));
+        StaticType type1 = Compiler_infer(self, ((BinaryNode*)node)->arg1, types);
+        StaticTypes_join(types, skipped);
+        return type0 | type1;
+      }
+
+    case NODE_ASSIGN:
+      {
+        BinaryNode* bNode = (BinaryNode*)node;
+        StaticType type = Compiler_infer(self, bNode->arg1, types);
+
+        AtomNode* target = (AtomNode*)(bNode->arg0);
+        Symbol* name = Compiler_getSymbol(self, target->length, target->text);
+        int16_t index = SymbolStack_findSymbol(&(self->stack), name);
+
+        if(index > -1 && Compiler_findOwner(self, index) == self->scope) {
+          types[index] = type;
+        }
+
+        return STATIC_NIL;
+      }
+
+    case NODE_WHILE:
+      Compiler_inferLoop(self, (BinaryNode*)node, types);
+      Compiler_infer(self, ((BinaryNode*)node)->arg0, types);
+      return STATIC_NIL;
+
+    case NODE_CALL:
+      Compiler_infer(self, ((BinaryNode*)node)->arg1, types);
+      Compiler_infer(self, ((BinaryNode*)node)->arg0, types);
+      return STATIC_ANY;
+
+    case NODE_FN_DEF:
+      return STATIC_NIL;
+
+    case NODE_IF:
+      {
+        TernaryNode* tNode = (TernaryNode*)node;
+        Compiler_infer(self, tNode->arg0, types);
+
+        StaticType otherwise[MAX_SYMBOLSTACK_DEPTH];
+        memcpy(otherwise, types, sizeof(otherwise));
+
+        StaticType result = Compiler_infer(self, tNode->arg1, types);
+
+        if(tNode->arg2 == NULL) {
+          result |= STATIC_NIL;
+        } else {
+          result |= Compiler_infer(self, tNode->arg2, otherwise);
+        }
+
+        StaticTypes_join(types, otherwise);
+        return result;
+      }
+
+    case NODE_COMMA_SEPARATED_LIST:
+    case NODE_EXPRESSION_LIST:
+      {
+        ExpressionListNode* elNode = (ExpressionListNode*)node;
+        StaticType result = STATIC_NIL;
+
+        for(size_t i = 0; i < elNode->length; i++) {
+          result = Compiler_infer(self, elNode->items[i], types);
+        }
+
+        return result;
+      }
+
+    default:
+      assert(false);
+      return STATIC_ANY;
+  }
+}
+
+/*
+ * Returns the types `node` could evaluate to if it were emitted next.
+ */
+static StaticType Compiler_typeOf(Compiler* self, Node* node) {
+  StaticType types[MAX_SYMBOLSTACK_DEPTH];
+  memcpy(types, self->types, sizeof(types));
+  return Compiler_infer(self, node, types);
+}
+
+/*
+ * Returns true if both operands of `node` are integers when it is emitted
+ * next.
+ */
+static bool Compiler_hasIntegerOperands(Compiler* self, BinaryNode* node) {
+  StaticType types[MAX_SYMBOLSTACK_DEPTH];
+  memcpy(types, self->types, sizeof(types));
+  return Compiler_infer(self, node->arg0, types) == STATIC_INTEGER &&
+    Compiler_infer(self, node->arg1, types) == STATIC_INTEGER;
+}
+
+/*
+ * Variables declared in code which might not have run could hold anything.
+ */
+inline static void Compiler_forgetTypesAbove(Compiler* self, Symbol** top) {
+  for(Symbol** s = top; s < self->stack.top; s++) {
+    self->types[s - self->stack.items] = STATIC_ANY;
+  }
+}
+
+/*
+ * TODO This shoudl take a Symbol* rather than length and name. That Symbol*
+ * should be from the Symbol Table and guaranteed to be pointer-comparable.
+ */
+void emitAssignment(
+    Compiler* self,
+    Code* code,
+    bool allowReassignment,
+    size_t line,
+    Symbol* name,
+    StaticType type) {
+  /*
+   * We are looking to see if there is an existing "declaration"
+   * for this variable, which would cause it to have a location on
+   * the compiler stack. If it does, the location of the variable
+   * on the thread stack is the same as the location of the symbol
+   * on the compiler stack (when read from the bottom).
+   */
+  int16_t index = SymbolStack_findSymbol(&(self->stack), name);
+
+  if(index > -1) {
+    assert(allowReassignment);
+
+    /*
+     * Once a variable is reassigned, we don't know what it holds.
+     */
+    self->definitions[index] = NULL;
+    self->closures[index] = NULL;
+
+    if(Compiler_findOwner(self, index) == self->scope) {
+      self->types[index] = type;
+    }
+
+    emitVariable(self, code, line, index, true);
+    return;
+  }
+
+  /*
+   * We only get here if the symbol is not on the stack, meaning
+   * the compiler has not seen it before.
+   *
+   * This is the implicit "declaration" case of a variable. If the
+   * variable has not been assigned before, we emit no instructions,
+   * because the value we want to store in the variable is already
+   * on the top of the stack, which is where we will store the
+   * variable. However, we must record the stack location *in the
+   * compiler* so that we can emit instructions that reference
+   * this stack location by number.
+   */
+  Compiler_declare(self, name);
+  self->types[self->stack.top - 1 - self->stack.items] = type;
+
+  // Functions may read the module's variables before they're assigned
+  if(self->scope == &(self->module) && self->inlineDepth == 0) {
+    emitInstruction(code, line, OP_DECLARE_GLOBAL);
+  }
+}
+
+typedef struct {
+  Compiler* compiler;
+  Node* parameters;
+  int16_t definitionIndex;
+} InlineContext;
+
+/*
+ * An identifier in an inlined body must mean the same thing at the call site
+ * as it did where the function was defined. Anything declared since then,
+ * including the function itself, could shadow what the body refers to, and
+ * a name which isn't declared yet and isn't a native could be a module
+ * variable declared later, which only the compiled body can read.
+ */
+static bool InlineContext_resolvesSame(void* context, AtomNode* identifier) {
+  InlineContext* self = (InlineContext*)context;
+
+  if(Node_isParameter(self->parameters, identifier)) return true;
+
+  Symbol* name = Compiler_getSymbol(
+      self->compiler,
+      identifier->length,
+      identifier->text
+    );
+
+  int16_t index = SymbolStack_findSymbol(&(self->compiler->stack), name);
+  if(index < 0) return NamedNative_find(name) > -1;
+
+  return index < self->definitionIndex;
+}
+
+/*
+ * Returns the definition of the function called `callee` if a call to it
+ * with `argc` arguments can be inlined here, or NULL otherwise.
+ */
+static TernaryNode* Compiler_findInlineable(Compiler* self, AtomNode* callee, size_t argc) {
+  if(self->inlineDepth == MAX_INLINE_DEPTH) return NULL;
+
+  Symbol* name = Compiler_getSymbol(self, callee->length, callee->text);
+  int16_t index = SymbolStack_findSymbol(&(self->stack), name);
+
+  if(index < 0) return NULL;
+
+  TernaryNode* definition = (TernaryNode*)(self->definitions[index]);
+
+  if(definition == NULL) return NULL;
+
+  for(uint8_t i = 0; i < self->inlineDepth; i++) {
+    if(self->inlining[i] == (Node*)definition) return NULL;
+  }
+
+  Node* parameters = definition->arg1;
+  size_t arity;
+
+  if(parameters == NULL) {
+    arity = 0;
+  } else if(parameters->type == NODE_IDENTIFIER) {
+    arity = 1;
+  } else {
+    arity = ((ExpressionListNode*)parameters)->length;
+  }
+
+  /*
+   * Let the call fail at run time the way it would have.
+   */
+  if(arity != argc) return NULL;
+
+  InlineContext context = {
+    .compiler = self,
+    .parameters = parameters,
+    .definitionIndex = index
+  };
+
+  if(!Node_everyIdentifier(definition->arg2, InlineContext_resolvesSame, &context)) {
+    return NULL;
+  }
+
+  return definition;
+}
+
+/*
+ * Returns the closure called `callee` if a call to it with `argc` arguments
+ * can be bound at compile time, or NULL otherwise.
+ */
+static ObjClosure* Compiler_findDirectCallee(Compiler* self, AtomNode* callee, size_t argc) {
+  Symbol* name = Compiler_getSymbol(self, callee->length, callee->text);
+  int16_t index = SymbolStack_findSymbol(&(self->stack), name);
+
+  if(index < 0) return NULL;
+
+  ObjClosure* closure = self->closures[index];
+
+  if(closure == NULL) return NULL;
+
+  /*
+   * Let the call fail at run time the way it would have.
+   */
+  if(closure->arity != argc) return NULL;
+
+  for(FunctionScope* scope = self->scope; scope != NULL; scope = scope->parent) {
+    if(scope->closure == closure) {
+      /*
+       * The closure is still being compiled, so we don't know yet whether
+       * it has upvalues. Calls from its own body can be patched if it does.
+       */
+      return scope == self->scope && scope->selfCallCount < MAX_SELF_CALLS
+        ? closure
+        : NULL;
+    }
+  }
+
+  /*
+   * Closures with upvalues are instantiated at run time, so the prototype
+   * isn't what the variable holds.
+   */
+  return closure->upvalueCount == 0 ? closure : NULL;
+}
+
+/*
+ * Compiles a call by evaluating the arguments into fresh slots on the stack,
+ * which become the parameters, compiling the body in place, and then
+ * replacing the arguments with the result.
+ */
+static size_t emitInline(
+    Compiler* self,
+    Code* code,
+    TernaryNode* definition,
+    ExpressionListNode* arguments,
+    bool useResult) {
+  size_t result = Code_getCurrent(code);
+  size_t line = definition->arg2->line;
+  Symbol** base = self->stack.top;
+
+  /*
+   * Values already on the stack for the enclosing expression need a place
+   * on the symbol stack, so that the parameters' symbols line up with the
+   * arguments.
+   */
+  uint8_t temporaries = self->scope->temporaries;
+
+  for(uint8_t i = 0; i < temporaries; i++) {
+    Compiler_declare(self, NULL);
+  }
+
+  self->scope->temporaries = 0;
+
+  StaticType argumentTypes[UINT8_MAX];
+
+  for(size_t i = 0; i < arguments->length; i++) {
+    argumentTypes[i] = Compiler_typeOf(self, arguments->items[i]);
+    emitNode(self, code, arguments->items[i], true);
+    self->scope->temporaries++;
+  }
+
+  self->scope->temporaries = 0;
+
+  Node* parameters = definition->arg1;
+
+  if(parameters != NULL && parameters->type == NODE_IDENTIFIER) {
+    AtomNode* parameter = (AtomNode*)parameters;
+    Compiler_declare(
+        self,
+        Compiler_getSymbol(self, parameter->length, parameter->text)
+      );
+  } else if(parameters != NULL) {
+    ExpressionListNode* parameterList = (ExpressionListNode*)parameters;
+
+    for(size_t i = 0; i < parameterList->length; i++) {
+      AtomNode* parameter = (AtomNode*)(parameterList->items[i]);
+      Compiler_declare(
+          self,
+          Compiler_getSymbol(self, parameter->length, parameter->text)
+        );
+    }
+  }
+
+  Symbol** parameterSlots = self->stack.top - arguments->length;
+
+  for(size_t i = 0; i < arguments->length; i++) {
+    self->types[parameterSlots + i - self->stack.items] = argumentTypes[i];
+  }
+
+  self->inlining[self->inlineDepth] = (Node*)definition;
+  self->inlineDepth++;
+
+  emitNode(self, code, definition->arg2, useResult);
+
+  self->inlineDepth--;
+
+  while(self->stack.top > base) {
+    SymbolStack_pop(&(self->stack));
+  }
+
+  self->scope->temporaries = temporaries;
+
+  if(arguments->length > 0) {
+    if(useResult) {
+      /*
+       * Move the result into the first argument's slot and drop the rest.
+       */
+      uint8_t slot = (uint8_t)(base + temporaries - self->scope->boundary);
+      emitInstruction(code, line, OP_SET);
+      emitByte(code, slot);
+    } else {
+      emitInstruction(code, line, OP_DROP);
+    }
+
+    for(size_t i = 1; i < arguments->length; i++) {
+      emitInstruction(code, line, OP_DROP);
+    }
+  }
+
+  return result;
+}
+
+typedef struct {
+  Symbol* variable;
+  Node* assignment;
+  int32_t step;
+} Induction;
+
+typedef struct {
+  size_t induction;
+  int32_t factor;
+  Node* uses[MAX_LOOP_TEMPORARIES];
+  size_t useCount;
+} InductionProduct;
+
+/*
+ * What a while loop changes, and which of its expressions can be computed
+ * once before the loop instead of on every iteration.
+ */
+typedef struct {
+  Compiler* compiler;
+
+  Symbol* assigned[MAX_LOOP_ASSIGNMENTS];
+  size_t assignedCount;
+
+  Induction inductions[MAX_LOOP_ASSIGNMENTS];
+  size_t inductionCount;
+
+  Node* hoisted[MAX_LOOP_TEMPORARIES];
+  size_t hoistedCount;
+
+  InductionProduct products[MAX_LOOP_TEMPORARIES];
+  size_t productCount;
+} LoopPlan;
+
+/*
+ * Returns true if the variable can't change while the loop runs: it belongs
+ * to the current function, the loop doesn't assign it, and no nested
+ * function does either.
+ */
+static bool LoopPlan_isStable(LoopPlan* self, Symbol* variable) {
+  Compiler* compiler = self->compiler;
+  int16_t index = SymbolStack_findSymbol(&(compiler->stack), variable);
+
+  if(index < 0) return false;
+  if(Compiler_findOwner(compiler, index) != compiler->scope) return false;
+  if(compiler->assignedByClosure[index]) return false;
+
+  for(size_t i = 0; i < self->assignedCount; i++) {
+    if(self->assigned[i] == variable) return false;
+  }
+
+  return true;
+}
+
+static bool LoopPlan_isInvariant(LoopPlan* self, Node* node) {
+  switch(node->type) {
+    case NODE_NIL:
+    case NODE_TRUE:
+    case NODE_FALSE:
+    case NODE_NUMBER:
+      return true;
+
+    case NODE_IDENTIFIER:
+      return LoopPlan_isStable(
+          self,
+          Compiler_getSymbol(
+            self->compiler,
+            ((AtomNode*)node)->length,
+            ((AtomNode*)node)->text
+          )
+        );
+
+    case NODE_NEGATE:
+    case NODE_NOT:
+      return LoopPlan_isInvariant(self, ((UnaryNode*)node)->arg);
+
+    case NODE_ADD:
+    case NODE_SUBTRACT:
+    case NODE_MULTIPLY:
+    case NODE_DIVIDE:
+    case NODE_EQUALS:
+    case NODE_NOT_EQUALS:
+    case NODE_GREATER_THAN_EQUALS:
+    case NODE_LESS_THAN_EQUALS:
+    case NODE_GREATER_THAN:
+    case NODE_LESS_THAN:
+      return LoopPlan_isInvariant(self, ((BinaryNode*)node)->arg0) &&
+        LoopPlan_isInvariant(self, ((BinaryNode*)node)->arg1);
+
+    default:
+      /*
+       * Strings are excluded because adding them allocates.
+       */
+      return false;
+  }
+}
+
+/*
+ * Returns the index of the induction variable `node` names, or -1.
+ */
+static int32_t LoopPlan_findInduction(LoopPlan* self, Node* node) {
+  if(node->type != NODE_IDENTIFIER) return -1;
+
+  Symbol* variable = Compiler_getSymbol(
+      self->compiler,
+      ((AtomNode*)node)->length,
+      ((AtomNode*)node)->text
+    );
+
+  for(size_t i = 0; i < self->inductionCount; i++) {
+    if(self->inductions[i].variable == variable) return (int32_t)i;
+  }
+
+  return -1;
+}
+
+/*
+ * Records `node` as a use of an induction variable times a constant, if it
+ * is one.
+ */
+static bool LoopPlan_addProduct(LoopPlan* self, Node* node) {
+  if(node->type != NODE_MULTIPLY) return false;
+
+  BinaryNode* bNode = (BinaryNode*)node;
+  Node* variable = bNode->arg0;
+  Node* factor = bNode->arg1;
+
+  if(variable->type == NODE_NUMBER) {
+    variable = bNode->arg1;
+    factor = bNode->arg0;
+  }
+
+  if(factor->type != NODE_NUMBER) return false;
+
+  int32_t induction = LoopPlan_findInduction(self, variable);
+  if(induction < 0) return false;
+
+  int32_t k = parseInteger((AtomNode*)factor);
+  int64_t step = (int64_t)(self->inductions[induction].step) * k;
+  if(step > INT32_MAX || step < INT32_MIN) return false;
+
+  InductionProduct* product = NULL;
+
+  for(size_t i = 0; i < self->productCount; i++) {
+    if(self->products[i].induction == (size_t)induction &&
+        self->products[i].factor == k) {
+      product = &(self->products[i]);
+    }
+  }
+
+  if(product == NULL) {
+    if(self->productCount == MAX_LOOP_TEMPORARIES) return false;
+    product = &(self->products[self->productCount]);
+    self->productCount++;
+    product->induction = (size_t)induction;
+    product->factor = k;
+    product->useCount = 0;
+  }
+
+  if(product->useCount == MAX_LOOP_TEMPORARIES) return false;
+
+  product->uses[product->useCount] = node;
+  product->useCount++;
+  return true;
+}
+
+/*
+ * Finds the expressions to hoist or strength-reduce in `node`. This only
+ * looks at parts of the loop which run on every iteration, so that hoisting
+ * never evaluates something the loop wouldn't have.
+ */
+static void LoopPlan_scan(LoopPlan* self, Node* node) {
+  if(node == NULL) return;
+
+  if(LoopPlan_addProduct(self, node)) return;
+
+  switch(node->type) {
+    case NODE_NIL:
+    case NODE_TRUE:
+    case NODE_FALSE:
+    case NODE_IDENTIFIER:
+    case NODE_NUMBER:
+    case NODE_STRING:
+      return;
+
+    default:
+      break;
+  }
+
+  if(self->hoistedCount < MAX_LOOP_TEMPORARIES && LoopPlan_isInvariant(self, node)) {
+    self->hoisted[self->hoistedCount] = node;
+    self->hoistedCount++;
+    return;
+  }
+
+  switch(node->type) {
+    case NODE_NEGATE:
+    case NODE_NOT:
+      LoopPlan_scan(self, ((UnaryNode*)node)->arg);
+      return;
+
+    case NODE_ADD:
+    case NODE_SUBTRACT:
+    case NODE_MULTIPLY:
+    case NODE_DIVIDE:
+    case NODE_EQUALS:
+    case NODE_NOT_EQUALS:
+    case NODE_GREATER_THAN_EQUALS:
+    case NODE_LESS_THAN_EQUALS:
+    case NODE_GREATER_THAN:
+    case NODE_LESS_THAN:
+    case NODE_CALL:
+      LoopPlan_scan(self, ((BinaryNode*)node)->arg0);
+      LoopPlan_scan(self, ((BinaryNode*)node)->arg1);
+      return;
+
+    case NODE_ASSIGN:
+      LoopPlan_scan(self, ((BinaryNode*)node)->arg1);
+      return;
+
+    /*
+     * Only the first operand of these is always evaluated.
+     */
+    case NODE_AND:
+    case NODE_OR:
+    case NODE_WHILE:
+      LoopPlan_scan(self, ((BinaryNode*)node)->arg0);
+      return;
+
+    case NODE_IF:
+      LoopPlan_scan(self, ((TernaryNode*)node)->arg0);
+      return;
+
+    case NODE_COMMA_SEPARATED_LIST:
+    case NODE_EXPRESSION_LIST:
+      {
+        ExpressionListNode* elNode = (ExpressionListNode*)node;
+
+        for(size_t i = 0; i < elNode->length; i++) {
+          LoopPlan_scan(self, elNode->items[i]);
+        }
+      } return;
+
+    default:
+      return;
+  }
+}
+
+/*
+ * Records `statement` as an induction variable update if it has the form
+ * `i = i + c` or `i = i - c`, and `i` is assigned nowhere else in the loop.
+ */
+static void LoopPlan_addInduction(LoopPlan* self, Node* statement) {
+  if(statement->type != NODE_ASSIGN) return;
+
+  BinaryNode* assignment = (BinaryNode*)statement;
+  Node* value = assignment->arg1;
+
+  if(value->type != NODE_ADD && value->type != NODE_SUBTRACT) return;
+
+  AtomNode* target = (AtomNode*)(assignment->arg0);
+  Node* operand = ((BinaryNode*)value)->arg0;
+  Node* step = ((BinaryNode*)value)->arg1;
+
+  if(operand->type != NODE_IDENTIFIER) return;
+  if(step->type != NODE_NUMBER) return;
+  if(((AtomNode*)operand)->length != target->length) return;
+  if(memcmp(((AtomNode*)operand)->text, target->text, target->length)) return;
+
+  Compiler* compiler = self->compiler;
+  Symbol* variable = Compiler_getSymbol(compiler, target->length, target->text);
+  int16_t index = SymbolStack_findSymbol(&(compiler->stack), variable);
+
+  if(Compiler_findOwner(compiler, index) != compiler->scope) return;
+  if(compiler->assignedByClosure[index]) return;
+
+  size_t assignments = 0;
+
+  for(size_t i = 0; i < self->assignedCount; i++) {
+    if(self->assigned[i] == variable) assignments++;
+  }
+
+  if(assignments != 1) return;
+
+  int32_t c = parseInteger((AtomNode*)step);
+
+  self->inductions[self->inductionCount] = (Induction) {
+    .variable = variable,
+    .assignment = statement,
+    .step = value->type == NODE_ADD ? c : -c
+  };
+  self->inductionCount++;
+}
+
+/*
+ * Returns true if there is anything to optimize in the loop.
+ */
+static bool LoopPlan_init(LoopPlan* self, Compiler* compiler, BinaryNode* loop) {
+  self->compiler = compiler;
+  self->assignedCount = 0;
+  self->inductionCount = 0;
+  self->hoistedCount = 0;
+  self->productCount = 0;
+
+  /*
+   * Unnamed values on the stack would throw off the positions of the
+   * temporaries, and there's no body to check for closures in the REPL.
+   */
+  if(compiler->scope->temporaries > 0) return false;
+  if(compiler->scope->body == NULL) return false;
+
+  AtomNode* targets[MAX_LOOP_ASSIGNMENTS];
+
+  if(!Node_collectAssignments((Node*)loop, targets, &(self->assignedCount), MAX_LOOP_ASSIGNMENTS)) {
+    return false;
+  }
+
+  for(size_t i = 0; i < self->assignedCount; i++) {
+    self->assigned[i] = Compiler_getSymbol(compiler, targets[i]->length, targets[i]->text);
+
+    /*
+     * A loop which declares variables leaves them on the stack above the
+     * temporaries.
+     */
+    if(SymbolStack_findSymbol(&(compiler->stack), self->assigned[i]) < 0) {
+      return false;
+    }
+  }
+
+  if(loop->arg1->type == NODE_EXPRESSION_LIST) {
+    ExpressionListNode* body = (ExpressionListNode*)(loop->arg1);
+
+    for(size_t i = 0; i < body->length; i++) {
+      LoopPlan_addInduction(self, body->items[i]);
+    }
+  } else {
+    LoopPlan_addInduction(self, loop->arg1);
   }
 
-  /*
-   * Even though we've got the length stored, let's append a null byte
-   * for convenience and potentially safety (though we shouldn't rely on this).
-   */
-  characters[charactersCount] = '\0';
+  LoopPlan_scan(self, loop->arg0);
+  LoopPlan_scan(self, loop->arg1);
 
   /*
-   * TODO If there were a lot of escape sequences, the string could be
-   * significantly shorter than the lexeme, so it might be worthwhile
-   * to realloc down. Let's revisit after Unicode support.
+   * Reading a temporary saves two instructions per use, but updating it
+   * costs four per iteration, so one use isn't worth it.
    */
-  ObjString* result = ObjString_allocate(1);
+  size_t reduced = 0;
 
-  ObjString_init(result, charactersCount, characters);
+  for(size_t i = 0; i < self->productCount; i++) {
+    if(self->products[i].useCount >= 2) reduced++;
+  }
 
-  return (Obj*)result;
+  return self->hoistedCount + reduced > 0;
 }
 
-inline static void emitInteger(Code* code, size_t line, int32_t integer) {
-  /*
-   * TODO If you trace what this does it's sort of a mess.
-   *
-   * However, I don't want to rewrite it now because this code may go
-   * away;  we might remove the OP_INTEGER instruction in favor of an
-   * OP_CONSTANT instruction which places the integer (or any other
-   * constant) in a constant table on the Code object. There are some
-   * tradeoffs here:
-   *
-   * PROS:
-   * - Less space used in bytecode.
-   * - We can deduplicate integers and use less space in the constant
-   *   table as well.
-   * CONS:
-   * - Add a pointer lookup at run time when pushing integers to the
-   *   stack.
-   *
-   * Ultimately, let's wait to make a decision on this until we have
-   * performance tests to be our guide.
-   */
+/*
+ * Pushes a temporary holding the value of `node` and records that `node`
+ * should be replaced by it.
+ */
+static int16_t Compiler_pushTemporary(Compiler* self, Code* code, Node* node) {
+  StaticType type = Compiler_typeOf(self, node);
+  emitNode(self, code, node, true);
+  Compiler_declare(self, NULL);
+
+  int16_t index = (int16_t)(self->stack.top - 1 - self->stack.items);
+  self->types[index] = type;
+  return index;
+}
 
-  uint8_t* bytes = (uint8_t*)(&integer);
-  for(int i = 0; i < 4; i++) emitByte(code, line, bytes[i]);
+static void Compiler_addReplacement(Compiler* self, Node* node, int16_t index) {
+  assert(self->replacementCount < MAX_REPLACEMENTS); /* TODO Handle this */
+  self->replacements[self->replacementCount] = (Replacement) {
+    .node = node,
+    .index = index
+  };
+  self->replacementCount++;
 }
 
-size_t emitJump(Compiler* self, Code* code, size_t line, Instruction inst) {
-  emitInstruction(code, line, inst);
+/*
+ * Compiles a while loop with its invariant expressions computed once after
+ * the first test of the condition:
+ *
+ *       <condition>
+ *       jump_if_false exit
+ *       <temporaries>
+ *     top:
+ *       <body>
+ *       <condition>
+ *       jump_if_true top
+ *       drop (once per temporary)
+ *     exit:
+ */
+static size_t emitOptimizedWhile(
+    Compiler* self,
+    Code* code,
+    BinaryNode* node,
+    LoopPlan* plan,
+    bool useResult) {
+  size_t line = node->node.line;
+  size_t result = emitNode(self, code, node->arg0, true);
+  size_t exitPatch = emitJump(self, code, line, OP_JUMP_IF_FALSE);
+
+  Symbol** base = self->stack.top;
+  uint8_t replacementCount = self->replacementCount;
+  uint8_t inductionUpdateCount = self->inductionUpdateCount;
+
+  for(size_t i = 0; i < plan->hoistedCount; i++) {
+    Node* hoisted = plan->hoisted[i];
+    Compiler_addReplacement(self, hoisted, Compiler_pushTemporary(self, code, hoisted));
+  }
 
-  assert(sizeof(uint8_t) * 2 == sizeof(int16_t));
+  for(size_t i = 0; i < plan->productCount; i++) {
+    InductionProduct* product = &(plan->products[i]);
+    if(product->useCount < 2) continue;
+
+    int16_t index = Compiler_pushTemporary(self, code, product->uses[0]);
+
+    for(size_t j = 0; j < product->useCount; j++) {
+      Compiler_addReplacement(self, product->uses[j], index);
+    }
+
+    Induction* induction = &(plan->inductions[product->induction]);
+
+    assert(self->inductionUpdateCount < MAX_REPLACEMENTS); /* TODO Handle this */
+    self->inductionUpdates[self->inductionUpdateCount] = (InductionUpdate) {
+      .assignment = induction->assignment,
+      .index = index,
+      .step = induction->step * product->factor
+    };
+    self->inductionUpdateCount++;
+  }
+
+  size_t top = Code_getCurrent(code);
 
-  size_t result = emitByte(code, line, 0);
-  emitByte(code, line, 0);
+  emitNode(self, code, node->arg1, false);
+  emitNode(self, code, node->arg0, true);
+
+  size_t backPatch = emitJump(self, code, line, OP_JUMP_IF_TRUE);
+  Compiler_patchJump(code, backPatch, top);
+
+  while(self->stack.top > base) {
+    SymbolStack_pop(&(self->stack));
+    emitInstruction(code, line, OP_DROP);
+  }
+
+  self->replacementCount = replacementCount;
+  self->inductionUpdateCount = inductionUpdateCount;
+
+  Compiler_patchJumpToCurrent(code, exitPatch);
+
+  if(useResult) emitInstruction(code, line, OP_NIL);
   return result;
 }
 
-/* TODO This should probably be Code_patchJump */
-void Compiler_patchJump(Code* code, size_t jumpIndex, size_t targetIndex) {
-  // TODO Handle these
-  assert(jumpIndex <= INT32_MAX);
-  assert(targetIndex <= INT32_MAX);
+/*
+ * Resolves the path of an import: relative to the directory of the file
+ * being compiled if it starts with ./ or ../, or to the root of the program
+ * if it ends in .fur. Anything else names a module of the standard library,
+ * of which there are none yet. The path is made absolute if the file exists,
+ * so that every import of a file gets the same module.
+ */
+static ObjString* Compiler_resolveImport(Compiler* self, AtomNode* node) {
+  ObjString* name = (ObjString*)makeObjString(node);
+  char* directory = self->root;
+  size_t directoryLength = directory == NULL ? 0 : strlen(directory);
+
+  if(!strncmp(name->characters, "./", 2) || !strncmp(name->characters, "../", 3)) {
+    char* slash = self->path == NULL ? NULL : strrchr(self->path, '/');
+    directory = slash == NULL ? NULL : self->path;
+    directoryLength = slash == NULL ? 0 : (size_t)(slash - self->path);
+  } else if(name->length < 4 || strcmp(name->characters + name->length - 4, ".fur")) {
+    printf("There is no standard library module \"%s\"\n", name->characters);
+    fflush(stdout);
+    assert(false); // TODO Handle this
+  }
 
-  /*
-   * Cast into signed integers so that the result of out subtraction is
-   * signed, i.e. jumpIndex can be greater than targetIndex.
-   */
-  int32_t intJumpIndex = (int32_t)jumpIndex;
-  int32_t intTargetIndex = (int32_t)targetIndex;
+  if(directory == NULL) {
+    directory = ".";
+    directoryLength = 1;
+  }
 
-  int32_t jump = intTargetIndex - intJumpIndex;
+  size_t length = directoryLength + 1 + name->length;
+  char* joined = allocateChars(length + 1);
+  memcpy(joined, directory, directoryLength);
+  joined[directoryLength] = '/';
+  memcpy(joined + directoryLength + 1, name->characters, name->length + 1);
 
-  /*
-   * Now that we have cast into sign, let't catch any overflows and then
-   * cast into the right size.
-   */
-  // TODO Handle these.
-  assert(jump <= INT16_MAX);
-  assert(jump >= INT16_MIN);
+  ObjString_free(name);
+  free(name);
 
-  *((int16_t*)(&(code->instructions.items[jumpIndex]))) = (int16_t)jump;
-}
+  // A file which doesn't exist is reported when it's imported
+  char* absolute = realpath(joined, NULL);
 
-/* TODO This should probably be Code_patchJumpToCurrent */
-void Compiler_patchJumpToCurrent(Code* code, size_t jumpIndex) {
-  Compiler_patchJump(code, jumpIndex, code->instructions.length);
+  if(absolute != NULL) {
+    free(joined);
+    joined = absolute;
+    length = strlen(absolute);
+  }
+
+  ObjString* result = ObjString_allocate(1);
+  ObjString_init(result, length, joined);
+  return result;
 }
 
-inline static size_t emitBasic(Code* code, size_t line, Instruction i, bool useResult) {
-  if(useResult) {
-    return emitInstruction(code, line, i);
-  } else {
-    return Code_getCurrent(code);
+/*
+ * True for `import ... as name`, or a list of them.
+ */
+static bool Node_isImport(Node* node) {
+  if(node->type == NODE_ASSIGN) {
+    return ((BinaryNode*)node)->arg1->type == NODE_IMPORT;
+  }
+
+  if(node->type != NODE_EXPRESSION_LIST) return false;
+
+  ExpressionListNode* elNode = (ExpressionListNode*)node;
+
+  for(size_t i = 0; i < elNode->length; i++) {
+    if(!Node_isImport(elNode->items[i])) return false;
   }
+
+  return true;
 }
 
 /*
- * TODO This shoudl take a Symbol* rather than length and name. That Symbol*
- * should be from the Symbol Table and guaranteed to be pointer-comparable.
+ * Returns the first statement after `items[index]` which isn't an import,
+ * or if there's none in the list, the one after the list.
  */
-void emitAssignment(Compiler* self, Code* code, bool allowReassignment, size_t line, Symbol* name) {
-  /*
-   * We are looking to see if there is an existing "declaration"
-   * for this variable, which would cause it to have a location on
-   * the compiler stack. If it does, the location of the variable
-   * on the thread stack is the same as the location of the symbol
-   * on the compiler stack (when read from the bottom).
-   */
-  int16_t index = SymbolStack_findSymbol(&(self->stack), name);
-
-  if(index > -1) {
-    assert(allowReassignment);
-    emitInstruction(code, line, OP_SET);
-    emitByte(code, line, index);
-    return;
+static Node* Compiler_following(Compiler* self, ExpressionListNode* list, size_t index) {
+  for(size_t i = index + 1; i < list->length; i++) {
+    if(!Node_isImport(list->items[i])) return list->items[i];
   }
 
-  /*
-   * We only get here if the symbol is not on the stack, meaning
-   * the compiler has not seen it before.
-   *
-   * This is the implicit "declaration" case of a variable. If the
-   * variable has not been assigned before, we emit no instructions,
-   * because the value we want to store in the variable is already
-   * on the top of the stack, which is where we will store the
-   * variable. However, we must record the stack location *in the
-   * compiler* so that we can emit instructions that reference
-   * this stack location by number.
-   */
-  SymbolStack_push(&(self->stack), name);
+  return self->following;
+}
+
+/*
+ * Emits the import of `node`'s module, which is assigned to `name`. If the
+ * next statement uses it, the importer is about to wait for the module, so
+ * the module runs next on the importer's worker rather than waiting its
+ * turn behind the other threads.
+ */
+static size_t emitImport(Compiler* self, Code* code, UnaryNode* node, AtomNode* name) {
+  ObjString* path = Compiler_resolveImport(self, (AtomNode*)(node->arg));
+  bool next = name != NULL
+    && self->following != NULL
+    && Node_usesAsValue(self->following, name->length, name->text);
+
+  size_t result = emitInstruction(code, node->node.line, OP_IMPORT);
+  emitByte(code, Code_internObject(code, (Obj*)path));
+  emitByte(code, next);
+  return result;
 }
 
 /*
@@ -403,6 +1957,13 @@ void emitAssignment(Compiler* self, Code* code, bool allowReassignment, size_t l
  * going to be used.
  */
 static size_t emitNode(Compiler* self, Code* code, Node* node, bool useResult) {
+  for(uint8_t i = 0; i < self->replacementCount; i++) {
+    if(self->replacements[i].node == node) {
+      if(!useResult) return Code_getCurrent(code);
+      return emitVariable(self, code, node->line, self->replacements[i].index, false);
+    }
+  }
+
   switch(node->type) {
     case NODE_NIL:
       return emitBasic(code, node->line, OP_NIL, useResult);
@@ -435,40 +1996,13 @@ static size_t emitNode(Compiler* self, Code* code, Node* node, bool useResult) {
         int16_t index = SymbolStack_findSymbol(&(self->stack), name);
 
         if(index > -1) {
-          assert(index <= UINT8_MAX);
-          assert(self->scopeBoundary >= self->stack.items);
-          size_t scopeDepth = self->scopeBoundary - self->stack.items;
-          assert(scopeDepth <= UINT8_MAX);
-
-          if((uint8_t)index < (uint8_t)scopeDepth) {
-            /*
-             * This means we're getting a variable outside the current function,
-             * a.k.a. closing over it.
-             */
-            /*
-             * TODO Implement.
-             */
-            assert(false);
-          } else {
-            size_t result = emitInstruction(code, node->line, OP_GET);
-            emitByte(code, node->line, (uint8_t)index - (uint8_t)scopeDepth);
-            return result;
-          }
+          return emitVariable(self, code, node->line, index, false);
         }
 
         /*
          * If we didn't find the variable on the compiler's stack, the
          * compiler hasn't seen it before.
          *
-         * Note that this means we don't (yet!) support late bindings like
-         * this:
-         *
-         * def getFoo():
-         *   foo
-         * end
-         *
-         * foo = 'Hello, world'
-         *
          * Next we try the builtins. Since user defined variables are tried
          * first, this means it's possible to override built in functions.
          */
@@ -486,17 +2020,39 @@ static size_t emitNode(Compiler* self, Code* code, Node* node, bool useResult) {
          * at the time of this writing, which would leave only 255-71 = 184
          * slots for locals.
          */
-        for(size_t i = 0; i < NATIVE_COUNT; i++) {
-          if(!strncmp(NATIVE[i].name, aNode->text, aNode->length)) {
-            size_t result = emitInstruction(code, node->line, OP_NATIVE);
-
-            /*
-             * We can only have UINT8_MAX native functions built in at the
-             * top level (we should namespace others in builtin modules).
-             */
+        int32_t native = NamedNative_find(name);
+
+        if(native > -1) {
+          size_t result = emitInstruction(code, node->line, OP_NATIVE);
+
+          /*
+           * Natives are indexed with 16 bits, so that the builtin namespace
+           * can grow well past UINT8_MAX without resorting to modules.
+           */
+          assert(native <= UINT16_MAX);
+          uint16_t nativeIndex = (uint16_t)native;
+          uint8_t* bytes = (uint8_t*)(&nativeIndex);
+          emitByte(code, bytes[0]);
+          emitByte(code, bytes[1]);
+
+          return result;
+        }
+
+        /*
+         * Last, a function compiled after the module can read the module's
+         * later variables. This never declares anything, so assigning a
+         * name still makes a local even if the module uses it later. The
+         * function may run before the module assigns the variable, so the
+         * read is checked, and names the variable if it fails.
+         */
+        for(size_t i = 0; i < self->moduleVariableCount; i++) {
+          if(self->moduleVariables[i] == name) {
             assert(i <= UINT8_MAX);
-            emitByte(code, node->line, (uint8_t)i);
+            uint8_t nameIndex = Code_internObject(code, makeObjStringOfName(aNode));
 
+            size_t result = emitInstruction(code, node->line, OP_GET_LATE);
+            emitByte(code, (uint8_t)i);
+            emitByte(code, nameIndex);
             return result;
           }
         }
@@ -514,18 +2070,8 @@ static size_t emitNode(Compiler* self, Code* code, Node* node, bool useResult) {
       {
         if(!useResult) return Code_getCurrent(code);
 
-        int32_t number = 0;
-        char* text = ((AtomNode*)node)->text;
-        size_t length = ((AtomNode*)node)->length;
-
-        for(size_t i = 0; i < length; i++) {
-          uint8_t digit = text[i] - '0';
-          assert(digit < 10);
-          number = number * 10 + digit;
-        }
-
         size_t result = emitInstruction(code, node->line, OP_INTEGER);
-        emitInteger(code, node->line, number);
+        emitInteger(code, parseInteger((AtomNode*)node));
         return result;
       } break;
 
@@ -537,10 +2083,30 @@ static size_t emitNode(Compiler* self, Code* code, Node* node, bool useResult) {
 
         uint8_t index = Code_internObject(code, (Obj*)obj);
         size_t result = emitInstruction(code, node->line, OP_INTERN);
-        emitByte(code, node->line, index);
+        emitByte(code, index);
         return result;
       } break;
 
+    case NODE_IMPORT:
+      {
+        size_t result = emitImport(self, code, (UnaryNode*)node, NULL);
+        if(!useResult) emitInstruction(code, node->line, OP_DROP);
+        return result;
+      }
+
+    case NODE_PROPERTY:
+      {
+        BinaryNode* bNode = (BinaryNode*)node;
+        AtomNode* name = (AtomNode*)(bNode->arg1);
+        size_t result = emitNode(self, code, bNode->arg0, true);
+
+        emitInstruction(code, node->line, OP_PROP);
+        emitByte(code, Code_internObject(code, makeObjStringOfName(name)));
+
+        if(!useResult) emitInstruction(code, node->line, OP_DROP);
+        return result;
+      }
+
     #define UNARY_NODE(op) \
       do { \
         size_t result = emitNode( \
@@ -549,37 +2115,52 @@ static size_t emitNode(Compiler* self, Code* code, Node* node, bool useResult) {
             ((UnaryNode*)node)->arg, \
             useResult \
           ); \
-        if(useResult) emitByte(code, node->line, op); \
+        if(useResult) emitInstruction(code, node->line, op); \
         return result; \
       } while(false)
-    case NODE_NEGATE: UNARY_NODE(OP_NEGATE);
+    case NODE_NEGATE:
+      UNARY_NODE(
+          useResult && Compiler_typeOf(self, ((UnaryNode*)node)->arg) == STATIC_INTEGER
+          ? OP_NEGATE_INT
+          : OP_NEGATE
+        );
     case NODE_NOT:    UNARY_NODE(OP_NOT);
     #undef UNARY_NODE
 
-    #define BINARY_NODE(type,op) \
+    /*
+     * intOp is the instruction to use if both operands are known to be
+     * integers.
+     */
+    #define BINARY_NODE(type,op,intOp) \
     case type: \
       do { \
+        Instruction instruction = op; \
+        if(useResult && intOp != op && \
+            Compiler_hasIntegerOperands(self, (BinaryNode*)node)) { \
+          instruction = intOp; \
+        } \
         size_t result = emitNode( \
             self, \
             code, \
             ((BinaryNode*)node)->arg0, \
             useResult \
           ); \
+        if(useResult) self->scope->temporaries++; \
         emitNode(self, code, ((BinaryNode*)node)->arg1, useResult); \
-        if(useResult) emitByte(code, node->line, op); \
+        if(useResult) self->scope->temporaries--; \
+        if(useResult) emitInstruction(code, node->line, instruction); \
         return result; \
       } while(false)
-    BINARY_NODE(NODE_PROPERTY,            OP_PROP);
-    BINARY_NODE(NODE_ADD,                 OP_ADD);
-    BINARY_NODE(NODE_SUBTRACT,            OP_SUBTRACT);
-    BINARY_NODE(NODE_MULTIPLY,            OP_MULTIPLY);
-    BINARY_NODE(NODE_DIVIDE,              OP_DIVIDE);
-    BINARY_NODE(NODE_EQUALS,              OP_EQ);
-    BINARY_NODE(NODE_GREATER_THAN,        OP_GT);
-    BINARY_NODE(NODE_LESS_THAN,           OP_LT);
-    BINARY_NODE(NODE_NOT_EQUALS,          OP_NEQ);
-    BINARY_NODE(NODE_GREATER_THAN_EQUALS, OP_GEQ);
-    BINARY_NODE(NODE_LESS_THAN_EQUALS,    OP_LEQ);
+    BINARY_NODE(NODE_ADD,                 OP_ADD,       OP_ADD_INT);
+    BINARY_NODE(NODE_SUBTRACT,            OP_SUBTRACT,  OP_SUBTRACT_INT);
+    BINARY_NODE(NODE_MULTIPLY,            OP_MULTIPLY,  OP_MULTIPLY_INT);
+    BINARY_NODE(NODE_DIVIDE,              OP_DIVIDE,    OP_DIVIDE_INT);
+    BINARY_NODE(NODE_EQUALS,              OP_EQ,        OP_EQ_INT);
+    BINARY_NODE(NODE_GREATER_THAN,        OP_GT,        OP_GT_INT);
+    BINARY_NODE(NODE_LESS_THAN,           OP_LT,        OP_LT_INT);
+    BINARY_NODE(NODE_NOT_EQUALS,          OP_NEQ,       OP_NEQ_INT);
+    BINARY_NODE(NODE_GREATER_THAN_EQUALS, OP_GEQ,       OP_GEQ_INT);
+    BINARY_NODE(NODE_LESS_THAN_EQUALS,    OP_LEQ,       OP_LEQ_INT);
 
     #undef BINARY_NODE
 
@@ -588,7 +2169,11 @@ static size_t emitNode(Compiler* self, Code* code, Node* node, bool useResult) {
         BinaryNode* bNode = (BinaryNode*)node;
         size_t result = emitNode(self, code, bNode->arg0, true);
         size_t toPatch = emitJump(self, code, node->line, OP_AND);
+
+        StaticType skipped[MAX_SYMBOLSTACK_DEPTH];
+        memcpy(skipped, self->types, sizeof(skipped));
         emitNode(self, code, bNode->arg1, true);
+        StaticTypes_join(self->types, skipped);
 
         Compiler_patchJumpToCurrent(code, toPatch);
 
@@ -608,7 +2193,11 @@ static size_t emitNode(Compiler* self, Code* code, Node* node, bool useResult) {
         BinaryNode* bNode = (BinaryNode*)node;
         size_t result = emitNode(self, code, bNode->arg0, true);
         size_t toPatch = emitJump(self, code, node->line, OP_OR);
+
+        StaticType skipped[MAX_SYMBOLSTACK_DEPTH];
+        memcpy(skipped, self->types, sizeof(skipped));
         emitNode(self, code, bNode->arg1, true);
+        StaticTypes_join(self->types, skipped);
 
         Compiler_patchJumpToCurrent(code, toPatch);
 
@@ -628,8 +2217,17 @@ static size_t emitNode(Compiler* self, Code* code, Node* node, bool useResult) {
         TernaryNode* tNode = (TernaryNode*)node;
         size_t result = emitNode(self, code, tNode->arg0, true);
         size_t patch0 = emitJump(self, code, node->line, OP_JUMP_IF_FALSE);
+
+        Symbol** top = self->stack.top;
+        StaticType otherwise[MAX_SYMBOLSTACK_DEPTH];
+        memcpy(otherwise, self->types, sizeof(otherwise));
+
         emitNode(self, code, tNode->arg1, useResult);
 
+        StaticType then[MAX_SYMBOLSTACK_DEPTH];
+        memcpy(then, self->types, sizeof(then));
+        memcpy(self->types, otherwise, sizeof(otherwise));
+
         size_t patch1 = emitJump(self, code, node->line, OP_JUMP);
         Compiler_patchJumpToCurrent(code, patch0);
 
@@ -644,6 +2242,10 @@ static size_t emitNode(Compiler* self, Code* code, Node* node, bool useResult) {
           emitNode(self, code, tNode->arg2, useResult);
         }
         Compiler_patchJumpToCurrent(code, patch1);
+
+        StaticTypes_join(self->types, then);
+        Compiler_forgetTypesAbove(self, top);
+
         return result;
       }
 
@@ -651,7 +2253,28 @@ static size_t emitNode(Compiler* self, Code* code, Node* node, bool useResult) {
       {
         BinaryNode* bNode = (BinaryNode*)node;
 
-        size_t result = emitNode(self, code, bNode->arg0, true);
+        /*
+         * Emit the loop with the types that hold at the top of every
+         * iteration, and continue after it with the types that hold when
+         * the condition fails.
+         */
+        Symbol** top = self->stack.top;
+        Compiler_inferLoop(self, bNode, self->types);
+
+        StaticType exit[MAX_SYMBOLSTACK_DEPTH];
+        memcpy(exit, self->types, sizeof(exit));
+        Compiler_infer(self, bNode->arg0, exit);
+
+        size_t result;
+        LoopPlan plan;
+
+        if(LoopPlan_init(&plan, self, bNode)) {
+          result = emitOptimizedWhile(self, code, bNode, &plan, useResult);
+          memcpy(self->types, exit, sizeof(exit));
+          return result;
+        }
+
+        result = emitNode(self, code, bNode->arg0, true);
         size_t patch0 = emitJump(self, code, node->line, OP_JUMP_IF_FALSE);
 
         emitNode(self, code, bNode->arg1, false);
@@ -668,6 +2291,9 @@ static size_t emitNode(Compiler* self, Code* code, Node* node, bool useResult) {
 
         Compiler_patchJumpToCurrent(code, patch0);
 
+        memcpy(self->types, exit, sizeof(exit));
+        Compiler_forgetTypesAbove(self, top);
+
         if(useResult) emitInstruction(code, node->line, OP_NIL);
         return result;
       }
@@ -680,7 +2306,10 @@ static size_t emitNode(Compiler* self, Code* code, Node* node, bool useResult) {
          * TODO Consider storing variables in a separate symbol table,
          * as they have separate performance concerns from strings.
          */
-        size_t result = emitNode(self, code, bNode->arg1, true);
+        StaticType type = Compiler_typeOf(self, bNode->arg1);
+        size_t result = bNode->arg1->type == NODE_IMPORT
+          ? emitImport(self, code, (UnaryNode*)(bNode->arg1), (AtomNode*)(bNode->arg0))
+          : emitNode(self, code, bNode->arg1, true);
 
         /*
          * TODO This doesn't support a lot of expressions, like
@@ -700,9 +2329,21 @@ static size_t emitNode(Compiler* self, Code* code, Node* node, bool useResult) {
             code,
             true, /* Allow reassignment */
             node->line,
-            targetSymbol
+            targetSymbol,
+            type
           );
 
+        for(uint8_t i = 0; i < self->inductionUpdateCount; i++) {
+          InductionUpdate* update = &(self->inductionUpdates[i]);
+          if(update->assignment != node) continue;
+
+          emitVariable(self, code, node->line, update->index, false);
+          emitInstruction(code, node->line, OP_INTEGER);
+          emitInteger(code, update->step);
+          emitInstruction(code, node->line, OP_ADD);
+          emitVariable(self, code, node->line, update->index, true);
+        }
+
         if(useResult) emitInstruction(code, node->line, OP_NIL);
 
         return result;
@@ -720,10 +2361,13 @@ static size_t emitNode(Compiler* self, Code* code, Node* node, bool useResult) {
           return emitNode(self, code, elNode->items[0], useResult);
         }
 
+        Node* following = self->following;
+
         /*
          * Emit the first node outside the loop, so we can record
          * where it is and return it.
          */
+        self->following = Compiler_following(self, elNode, 0);
         size_t result = emitNode(self, code, elNode->items[0], false);
 
         for(size_t i = 1; i < elNode->length - 1; i++) {
@@ -731,13 +2375,16 @@ static size_t emitNode(Compiler* self, Code* code, Node* node, bool useResult) {
            * useResult is always false for these, since we are discarding
            * the results anyway.
            */
+          self->following = Compiler_following(self, elNode, i);
           emitNode(self, code, elNode->items[i], false);
+          self->following = following;
         }
 
         /*
          * Emit the last node outside the loop, so we can return its value
          * if necessary.
          */
+        self->following = following;
         emitNode(self, code, elNode->items[elNode->length - 1], useResult);
 
         return result;
@@ -757,6 +2404,28 @@ static size_t emitNode(Compiler* self, Code* code, Node* node, bool useResult) {
          */
         assert(arguments->length <= UINT8_MAX); // TODO Handle this
 
+        if(callee->type == NODE_IDENTIFIER) {
+          TernaryNode* definition = Compiler_findInlineable(
+              self,
+              (AtomNode*)callee,
+              arguments->length
+            );
+
+          if(definition != NULL) {
+            return emitInline(self, code, definition, arguments, useResult);
+          }
+        }
+
+        ObjClosure* direct = NULL;
+
+        if(callee->type == NODE_IDENTIFIER) {
+          direct = Compiler_findDirectCallee(
+              self,
+              (AtomNode*)callee,
+              arguments->length
+            );
+        }
+
         size_t result;
 
         if(arguments->length > 0) {
@@ -765,22 +2434,37 @@ static size_t emitNode(Compiler* self, Code* code, Node* node, bool useResult) {
            * loop so we can capture where it's emitted to.
            */
           result = emitNode(self, code, arguments->items[0], true);
+          self->scope->temporaries++;
 
           for(size_t i = 1; i < arguments->length; i++) {
             emitNode(self, code, arguments->items[i], true);
+            self->scope->temporaries++;
           }
 
-          emitNode(self, code, callee, true);
-        } else {
+          if(direct == NULL) emitNode(self, code, callee, true);
+          self->scope->temporaries -= arguments->length;
+        } else if(direct == NULL) {
           /*
            * If there are not any arguments, we capture the emitted callee
            * location instead.
            */
           result = emitNode(self, code, callee, true);
+        } else {
+          result = Code_getCurrent(code);
         }
 
-        emitInstruction(code, node->line, OP_CALL);
-        emitByte(code, node->line, (uint8_t)arguments->length);
+        if(direct == NULL) {
+          emitInstruction(code, node->line, OP_CALL);
+          emitByte(code, (uint8_t)arguments->length);
+        } else {
+          size_t call = emitInstruction(code, node->line, OP_CALL_DIRECT);
+          emitByte(code, Code_addCallee(code, (Obj*)direct));
+
+          if(direct == self->scope->closure) {
+            self->scope->selfCalls[self->scope->selfCallCount] = call;
+            self->scope->selfCallCount++;
+          }
+        }
 
         /*
          * Function calls always emit a return and it's difficult to change
@@ -807,23 +2491,66 @@ static size_t emitNode(Compiler* self, Code* code, Node* node, bool useResult) {
             code,
             false, /* Don't allow reassignment */
             node->line,
-            name);
+            name,
+            STATIC_OTHER);
+
+        int16_t slot = (int16_t)(self->stack.top - 1 - self->stack.items);
+
+        /*
+         * If the function is never reassigned, calls to it can be bound at
+         * compile time.
+         */
+        bool fixed = self->scope->body != NULL &&
+          !Compiler_assignsTo(self, self->scope->body, name);
+
+        /*
+         * Bodies skipped by the pre-parser are parsed before they're compiled,
+         * which unless they're compiled lazily is now.
+         */
+        TernaryNode* tNode = (TernaryNode*)node;
+        if(tNode->arg2->type == NODE_DEFERRED_BODY
+            && !(self->scope == &(self->module) && self->lazy)) {
+          Node* parsed = parseDeferredBody(tNode->arg2);
+          Node_free(tNode->arg2);
+          tNode->arg2 = parsed;
+        }
 
         /*
          * This needs to be after the emitAssignment, so that the symbiol for
          * the function gets emitted before the symbols for the arguments.
          */
-        Obj* obj = makeObjClosure(
+        ObjClosure* closure = makeObjClosure(
           self,
           name,
+          fixed ? slot : -1,
           ((TernaryNode*)node)->arg1,
           ((TernaryNode*)node)->arg2
         );
 
-        uint8_t index = Code_internObject(code, obj);
+        /*
+         * Small functions which are never reassigned can be inlined at their
+         * call sites.
+         */
+        if(fixed && Node_isInlineable(
+              ((TernaryNode*)node)->arg2,
+              ((TernaryNode*)node)->arg1,
+              INLINE_BUDGET
+            )) {
+          self->definitions[slot] = node;
+        }
+
+        uint8_t index = Code_internObject(code, (Obj*)closure);
 
-        size_t result = emitInstruction(code, node->line, OP_INTERN);
-        emitByte(code, node->line, index);
+        /*
+         * Closures which capture upvalues need a fresh instance each time
+         * the definition runs. Everything else can use the prototype.
+         */
+        size_t result = emitInstruction(
+            code,
+            node->line,
+            closure->upvalueCount > 0 ? OP_CLOSURE : OP_INTERN
+          );
+        emitByte(code, index);
 
         if(useResult) emitInstruction(code, node->line, OP_NIL);
 
@@ -835,11 +2562,84 @@ static size_t emitNode(Compiler* self, Code* code, Node* node, bool useResult) {
   }
 }
 
+/*
+ * Compiles `tree` as the next part of the module, after whatever parts were
+ * compiled before it. Unless `moreToCome`, the bodies of the functions it
+ * defines are compiled before this returns; otherwise they wait for
+ * Compiler_finishModule, so that they can read every variable the module
+ * declares, as they would if the module had been compiled all at once.
+ */
+static size_t Compiler_compilePart(
+    Compiler* self,
+    Code* code,
+    Node* tree,
+    bool useResult,
+    bool moreToCome) {
+  self->module.body = tree;
+  FlatTree_build(&(self->moduleTree), tree);
+
+  /*
+   * In the REPL, variables from previous lines may be assigned by functions
+   * defined in this one.
+   */
+  for(Symbol** s = self->stack.items; s < self->stack.top; s++) {
+    if(*s != NULL && Compiler_assignsInNestedFunctions(self, tree, *s)) {
+      self->assignedByClosure[s - self->stack.items] = true;
+    }
+  }
+
+  CompileJob* lazyJobs = self->lazyJobs;
+  CompileJob* jobs = self->jobs;
+
+  size_t result =  emitNode(self, code, tree, useResult);
+
+  // The functions' bodies refer to the tree, so compile them before it's freed
+  if(!moreToCome) Compiler_runJobs(self);
+
+  /*
+   * The tree is freed after compiling, so we can't inline its definitions
+   * into code compiled later, as in the REPL. Later code may also reassign
+   * functions, so we can't call them directly either.
+   */
+  for(size_t i = 0; i < MAX_SYMBOLSTACK_DEPTH; i++) {
+    self->definitions[i] = NULL;
+    self->closures[i] = NULL;
+  }
+
+  self->module.body = NULL;
+  FlatTree_clear(&(self->moduleTree));
+
+  // Bodies left to compile still refer to the tree
+  if(self->lazyJobs == lazyJobs && self->jobs == jobs) {
+    Node_free(tree);
+  } else {
+    NodeList_append(&(self->trees), tree);
+  }
+
+  return result;
+}
+
 size_t Compiler_compile(Compiler* self, Code* code, Node* tree) {
-  size_t result =  emitNode(self, code, tree, true);
+  size_t line = tree->line;
+  size_t result = Compiler_compilePart(self, code, tree, true, false);
 
   /* TODO This fixes the integration tests but probably broke the repl */
-  emitInstruction(code, tree->line, OP_RETURN);
+  emitInstruction(code, line, OP_RETURN);
 
   return result;
 }
+
+size_t Compiler_compileStatement(Compiler* self, Code* code, Node* statement) {
+  return Compiler_compilePart(self, code, statement, false, true);
+}
+
+void Compiler_finishModule(Compiler* self, Code* code, size_t line) {
+  assert(self->scope == &(self->module));
+
+  Compiler_runJobs(self);
+
+  // The module returns the value of its last statement, but that's unknown
+  // until the end of the file, so modules compiled this way return nil
+  emitInstruction(code, line, OP_NIL);
+  emitInstruction(code, line, OP_RETURN);
+}
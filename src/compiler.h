@@ -2,6 +2,9 @@
 # define FUR_COMPILER_H
 
 #include "code.h"
+#include "flat_tree.h"
+#include "list.h"
+#include "object.h"
 #include "parser.h"
 #include "runtime.h"
 #include "symbol.h"
@@ -21,15 +24,260 @@ void SymbolStack_push(SymbolStack*, Symbol*);
 Symbol* SymbolStack_pop(SymbolStack*);
 Symbol* SymbolStack_peek(SymbolStack*, uint8_t depth);
 
+#define MAX_UPVALUES UINT8_MAX
+#define MAX_SELF_CALLS 16
+
+/*
+ * One FunctionScope exists for each function the compiler is in the middle
+ * of compiling, including the module, linked from innermost to outermost.
+ * Symbols on the stack from boundary upward belong to this function.
+ */
+typedef struct FunctionScope FunctionScope;
+
+struct FunctionScope {
+  FunctionScope* parent;
+  Symbol** boundary;
+
+  /*
+   * The body of the function, used to answer questions about how nested
+   * functions are used. This is NULL if we don't have the whole body.
+   */
+  Node* body;
+
+  uint8_t depth;
+
+  /*
+   * The number of values this function has on the stack which aren't
+   * variables, such as the left operand while the right one is evaluated.
+   * These have no symbol on the symbol stack, so inlined calls have to
+   * account for them to find their arguments.
+   */
+  uint8_t temporaries;
+
+  /*
+   * True if the closure may be called after the frame which created it has
+   * returned, because it is used as a value rather than only being called
+   * by name.
+   */
+  bool escapes;
+
+  /*
+   * The closure being compiled, which is allocated before its body is
+   * compiled so that recursive calls can refer to it. NULL for the module.
+   */
+  ObjClosure* closure;
+
+  /*
+   * Where the body calls the closure directly. If the closure turns out to
+   * have upvalues, these are changed to OP_CALL_SELF so that the running
+   * instance, rather than the prototype, is called.
+   */
+  uint8_t selfCallCount;
+  size_t selfCalls[MAX_SELF_CALLS];
+
+  uint8_t upvalueCount;
+
+  /*
+   * The index on the symbol stack of each variable captured as an upvalue,
+   * so that multiple uses of the same variable share an upvalue.
+   */
+  int16_t upvalueSlots[MAX_UPVALUES];
+  UpvalueDescriptor upvalues[MAX_UPVALUES];
+};
+
+/*
+ * The set of types a value could have, as far as the compiler can tell.
+ */
+typedef uint8_t StaticType;
+
+#define STATIC_NIL      0x01
+#define STATIC_BOOLEAN  0x02
+#define STATIC_INTEGER  0x04
+#define STATIC_STRING   0x08
+#define STATIC_OTHER    0x10
+#define STATIC_ANY      0x1f
+
+/*
+ * Calls to functions with bodies of at most INLINE_BUDGET nodes are compiled
+ * in place, nested at most MAX_INLINE_DEPTH deep.
+ */
+#define INLINE_BUDGET 24
+#define MAX_INLINE_DEPTH 4
+
+/*
+ * While loops keep values which don't change between iterations in unnamed
+ * variables on the stack, which are read in place of the expressions that
+ * computed them. At most MAX_LOOP_TEMPORARIES are kept per loop.
+ */
+#define MAX_LOOP_TEMPORARIES 8
+#define MAX_LOOP_ASSIGNMENTS 32
+#define MAX_REPLACEMENTS 64
+
+typedef struct {
+  Node* node;
+  int16_t index;
+} Replacement;
+
+/*
+ * After `assignment` runs, the temporary at `index` on the symbol stack is
+ * increased by `step`. This keeps a temporary equal to a multiple of an
+ * induction variable without multiplying.
+ */
+typedef struct {
+  Node* assignment;
+  int16_t index;
+  int32_t step;
+} InductionUpdate;
+
+/*
+ * The body of one of the module's functions, waiting to be compiled.
+ */
+typedef struct CompileJob CompileJob;
+
+LIST_DECL(NodeList, Node*);
+void NodeList_init(NodeList*);
+void NodeList_free(NodeList*);
+void NodeList_append(NodeList*, Node*);
+
+/*
+ * Threads only compile in parallel if each would get at least this many
+ * function bodies, since starting them costs more than compiling a few.
+ */
+#define MIN_JOBS_PER_WORKER 8
+
 typedef struct {
   Runtime* runtime;
   SymbolStack stack;
-  Symbol** scopeBoundary;
+  FunctionScope module;
+  FunctionScope* scope;
+
+  /*
+   * For each variable on the symbol stack, the NODE_FN_DEF which declared
+   * it if it is a candidate for inlining, or NULL otherwise.
+   */
+  Node* definitions[MAX_SYMBOLSTACK_DEPTH];
+
+  /*
+   * For each variable on the symbol stack, the closure it is known to hold
+   * if it was declared by a NODE_FN_DEF and is never reassigned, or NULL.
+   */
+  ObjClosure* closures[MAX_SYMBOLSTACK_DEPTH];
+
+  /*
+   * The definitions currently being inlined, to prevent inlining a function
+   * into itself.
+   */
+  Node* inlining[MAX_INLINE_DEPTH];
+  uint8_t inlineDepth;
+
+  /*
+   * For each variable on the symbol stack, true if a nested function
+   * assigns to it, so a call might change it.
+   */
+  bool assignedByClosure[MAX_SYMBOLSTACK_DEPTH];
+
+  /*
+   * For each variable on the symbol stack, the types it could have at the
+   * point in the code currently being emitted.
+   */
+  StaticType types[MAX_SYMBOLSTACK_DEPTH];
+
+  Replacement replacements[MAX_REPLACEMENTS];
+  uint8_t replacementCount;
+  InductionUpdate inductionUpdates[MAX_REPLACEMENTS];
+  uint8_t inductionUpdateCount;
+
+  /*
+   * How many threads may compile the bodies of the module's functions. Each
+   * body is queued in `jobs` when its definition is reached, and the queue
+   * is compiled, in parallel if this is more than one, at the end of
+   * Compiler_compile or Compiler_finishModule. Defaults to one per core.
+   */
+  unsigned workers;
+  CompileJob* jobs;
+  size_t jobCount;
+
+  /*
+   * If true, the bodies of the module's functions aren't compiled until
+   * they're first called, and `lazyJobs` holds them, compiled or not. The
+   * trees they're in are kept in `trees` until the compiler is freed.
+   */
+  bool lazy;
+  CompileJob* lazyJobs;
+  NodeList trees;
+
+  /*
+   * The part of the module being compiled, flattened, since the module's
+   * whole tree is searched again for each variable the module declares.
+   * Empty if the part couldn't be flattened.
+   */
+  FlatTree moduleTree;
+
+  /*
+   * The file being compiled and the directory of the program it's part of,
+   * which imports are relative to (see Compiler_resolveImport). NULL where
+   * there is no file, as in the REPL, for the working directory.
+   */
+  char* path;
+  char* root;
+
+  /*
+   * The variables of the module being compiled, on the stack of the thread
+   * which will run it, for its closures to reach them from any module's
+   * thread (see ObjClosure.globals). NULL if that isn't known yet.
+   */
+  Value* globals;
+
+  /*
+   * The statement after the one being emitted, or NULL, so that an import
+   * which is used straight away can start the module first.
+   */
+  Node* following;
+
+  /*
+   * While a function of the module is compiled after the module (see
+   * CompileJob), all of the module's variables, including those declared
+   * after the function. The body may read them if they'd otherwise be
+   * unknown, checking that they've been assigned (see OP_GET_LATE). NULL
+   * otherwise.
+   */
+  Symbol** moduleVariables;
+  size_t moduleVariableCount;
 } Compiler;
 
 void Compiler_init(Compiler*, Runtime*);
 void Compiler_free(Compiler*);
 
+/*
+ * Declares a variable of the module which wasn't compiled by this compiler,
+ * such as one restored from a snapshot. Nothing is known about its value.
+ */
+void Compiler_declareGlobal(Compiler*, Symbol*);
+
+/*
+ * Compiles the tree into the module's code and returns where it starts. The
+ * compiler takes the tree, and frees it once nothing refers to it.
+ *
+ * The closures a lazy compiler creates refer to it until they've been
+ * called, so it must outlive running them.
+ */
 size_t Compiler_compile(Compiler*, Code*, Node*);
 
+/*
+ * Compiles a module one top-level statement at a time, so that its whole
+ * tree never has to be in memory: call Compiler_compileStatement for each
+ * statement in order, which takes the statement as Compiler_compile does,
+ * then Compiler_finishModule. The module starts where the first statement
+ * does.
+ *
+ * As with lines in the REPL, each statement is analyzed without seeing the
+ * ones after it, so functions are only inlined or called directly from the
+ * statement which defines them. Unlike in the REPL, functions' bodies can
+ * read variables declared after them, so a statement which defines one is
+ * kept until Compiler_finishModule compiles the body, or until the body is
+ * compiled lazily.
+ */
+size_t Compiler_compileStatement(Compiler*, Code*, Node*);
+void Compiler_finishModule(Compiler*, Code*, size_t line);
+
 #endif
@@ -0,0 +1,448 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "document.h"
+#include "parser.h"
+#include "scanner.h"
+
+struct DocumentBlock {
+  size_t references;
+  char text[];
+};
+
+static DocumentBlock* DocumentBlock_allocate(size_t length) {
+  DocumentBlock* self = malloc(sizeof(DocumentBlock) + length + 1);
+  assert(self != NULL); /* TODO Handle this */
+
+  self->references = 0;
+  self->text[length] = '\0';
+  return self;
+}
+
+static void DocumentBlock_release(DocumentBlock* self) {
+  assert(self->references > 0);
+  self->references--;
+  if(self->references == 0) free(self);
+}
+
+void Document_init(Document* self) {
+  self->count = 0;
+  self->capacity = 0;
+  self->statements = NULL;
+  self->length = 0;
+  self->complete = true;
+}
+
+static void DocumentStatement_free(DocumentStatement* self) {
+  Node_free(self->tree);
+  DocumentBlock_release(self->block);
+}
+
+void Document_free(Document* self) {
+  for(size_t i = 0; i < self->count; i++) {
+    DocumentStatement_free(&(self->statements[i]));
+  }
+
+  free(self->statements);
+  Document_init(self);
+}
+
+static size_t countNewlines(const char* text, size_t length) {
+  size_t count = 0;
+  const char* end = text + length;
+
+  while((text = memchr(text, '\n', end - text)) != NULL) {
+    count++;
+    text++;
+  }
+
+  return count;
+}
+
+inline static bool canEndStatement(TokenType type) {
+  switch(type) {
+    case TOKEN_NIL:
+    case TOKEN_TRUE:
+    case TOKEN_FALSE:
+    case TOKEN_IDENTIFIER:
+    case TOKEN_NUMBER:
+    case TOKEN_SQSTR:
+    case TOKEN_DQSTR:
+    case TOKEN_CLOSE_PAREN:
+    case TOKEN_END:
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+/*
+ * Tokens which can't continue the expression before them, so that one
+ * after a token which can end a statement starts the next statement.
+ */
+inline static bool canOnlyStartStatement(TokenType type) {
+  switch(type) {
+    case TOKEN_NIL:
+    case TOKEN_TRUE:
+    case TOKEN_FALSE:
+    case TOKEN_NOT:
+    case TOKEN_IDENTIFIER:
+    case TOKEN_NUMBER:
+    case TOKEN_SQSTR:
+    case TOKEN_DQSTR:
+    case TOKEN_DEF:
+    case TOKEN_IF:
+    case TOKEN_WHILE:
+    case TOKEN_IMPORT:
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+/*
+ * Returns how much of `text` is whole statements, which can be parsed: all
+ * of it if every block and parenthesis is closed, the last token can end a
+ * statement, and every token can be scanned. Otherwise it's the text up to
+ * the last token which certainly starts a statement outside any block,
+ * before whatever is wrong: usually a statement still being written.
+ */
+static size_t wholeStatementsLength(char* text, size_t length) {
+  Scanner scanner;
+  Scanner_init(&scanner, 1, text);
+
+  long blocks = 0;
+  long parentheses = 0;
+  TokenType last = TOKEN_EOF;
+  size_t whole = 0;
+  Token token;
+
+  while((token = Scanner_scan(&scanner)).type != TOKEN_EOF) {
+    if(token.type == TOKEN_ERROR) return whole;
+
+    if(blocks == 0 && parentheses == 0 &&
+        canEndStatement(last) && canOnlyStartStatement(token.type)) {
+      whole = token.text - text;
+    }
+
+    switch(token.type) {
+      case TOKEN_DEF:
+      case TOKEN_IF:
+      case TOKEN_WHILE:
+        blocks++;
+        break;
+
+      case TOKEN_END:
+        blocks--;
+        break;
+
+      case TOKEN_OPEN_PAREN:
+        parentheses++;
+        break;
+
+      case TOKEN_CLOSE_PAREN:
+        parentheses--;
+        break;
+
+      default:
+        break;
+    }
+
+    if(blocks < 0 || parentheses < 0) return whole;
+    last = token.type;
+  }
+
+  if(blocks > 0 || parentheses > 0) return whole;
+  if(last != TOKEN_EOF && !canEndStatement(last)) return whole;
+
+  return length;
+}
+
+typedef struct {
+  size_t count;
+  size_t capacity;
+  DocumentStatement* items;
+} StatementBuffer;
+
+static DocumentStatement* StatementBuffer_add(
+    StatementBuffer* self,
+    DocumentBlock* block,
+    size_t start) {
+  if(self->count == self->capacity) {
+    self->capacity = self->capacity == 0 ? 8 : self->capacity * 2;
+    self->items = realloc(self->items, sizeof(DocumentStatement) * self->capacity);
+    assert(self->items != NULL); /* TODO Handle this */
+  }
+
+  DocumentStatement* statement = &(self->items[self->count++]);
+  statement->block = block;
+  statement->text = block->text + start;
+  statement->length = 0;
+  statement->leading = 0;
+  statement->tree = NULL;
+  block->references++;
+  return statement;
+}
+
+static void StatementBuffer_free(StatementBuffer* self) {
+  for(size_t i = 0; i < self->count; i++) {
+    DocumentStatement_free(&(self->items[i]));
+  }
+
+  free(self->items);
+}
+
+/*
+ * Parses the text of `block` into statements, the first of which starts on
+ * `line`. Unless `atEnd`, the text is followed by more of the document, and
+ * this fails unless the text is whole statements and one of them starts at
+ * `alignAt`, since otherwise where the last one ends could depend on what
+ * follows. At the end, text after the whole statements becomes a single
+ * statement with no tree, as does the text from a statement which doesn't
+ * parse to the end, since where that statement ends is unknown.
+ */
+static bool Document_parseBlock(
+    DocumentBlock* block,
+    size_t length,
+    size_t line,
+    bool atEnd,
+    size_t alignAt,
+    StatementBuffer* result,
+    bool* complete) {
+  size_t whole = wholeStatementsLength(block->text, length);
+  *complete = whole == length;
+
+  if(!*complete && !atEnd) return false;
+
+  // Stop the scanner at the end of the whole statements
+  char after = block->text[whole];
+  block->text[whole] = '\0';
+
+  Scanner scanner;
+  Scanner_init(&scanner, line, block->text);
+
+  bool aligned = atEnd;
+  bool failed = false;
+  size_t start = 0;
+  Token token;
+
+  while((token = Scanner_peek(&scanner)).type != TOKEN_EOF) {
+    size_t tokenStart = token.text - block->text;
+    if(tokenStart == alignAt) aligned = true;
+
+    // The first statement also holds the whitespace before it
+    if(result->count > 0) {
+      result->items[result->count - 1].length = tokenStart - start;
+      start = tokenStart;
+    }
+
+    DocumentStatement* statement = StatementBuffer_add(result, block, start);
+    statement->leading = tokenStart - start;
+    statement->tree = tryParseStatement(&scanner);
+
+    if(statement->tree == NULL) {
+      failed = true;
+      break;
+    }
+  }
+
+  block->text[whole] = after;
+
+  if(failed) {
+    *complete = false;
+    if(!atEnd) return false;
+    whole = length;
+  }
+
+  if(result->count > 0) {
+    result->items[result->count - 1].length = whole - start;
+  }
+
+  // Whitespace with no statements, or the unfinished statement
+  if(whole < length || (result->count == 0 && length > 0)) {
+    size_t rest = result->count == 0 ? 0 : whole;
+    StatementBuffer_add(result, block, rest)->length = length - rest;
+  }
+
+  for(size_t i = 0; i < result->count; i++) {
+    DocumentStatement* statement = &(result->items[i]);
+    statement->line = line;
+    statement->newlines = countNewlines(statement->text, statement->length);
+    line += statement->newlines;
+  }
+
+  return aligned;
+}
+
+/*
+ * Copies the bytes from `from` up to `to` of the text of statements
+ * `first` to `stop` - 1, counting from the start of statement `first`.
+ */
+static char* Document_copyRange(
+    Document* self,
+    size_t first,
+    size_t stop,
+    size_t from,
+    size_t to,
+    char* destination) {
+  size_t offset = 0;
+
+  for(size_t i = first; i < stop && offset < to; i++) {
+    DocumentStatement* statement = &(self->statements[i]);
+    size_t statementEnd = offset + statement->length;
+
+    if(statementEnd > from) {
+      size_t copyStart = from > offset ? from - offset : 0;
+      size_t copyEnd = (to < statementEnd ? to : statementEnd) - offset;
+      memcpy(destination, statement->text + copyStart, copyEnd - copyStart);
+      destination += copyEnd - copyStart;
+    }
+
+    offset = statementEnd;
+  }
+
+  return destination;
+}
+
+DocumentChange Document_edit(
+    Document* self,
+    size_t start,
+    size_t end,
+    const char* text,
+    size_t length) {
+  assert(start <= end && end <= self->length);
+
+  // Find the statement the edit starts in, and the one it ends in
+  size_t touched = 0;
+  size_t touchedOffset = 0;
+
+  while(touched + 1 < self->count &&
+      start >= touchedOffset + self->statements[touched].length) {
+    touchedOffset += self->statements[touched].length;
+    touched++;
+  }
+
+  size_t last = touched;
+  size_t lastOffset = touchedOffset;
+  size_t lastByte = end > start ? end - 1 : start;
+
+  while(last + 1 < self->count &&
+      lastByte >= lastOffset + self->statements[last].length) {
+    lastOffset += self->statements[last].length;
+    last++;
+  }
+
+  /*
+   * The first token the edit touches may be what ended the statement
+   * before it, and the statement after the last one touched shows where
+   * the last one ends.
+   */
+  size_t first = touched > 0 ? touched - 1 : 0;
+  size_t firstOffset = touched > 0 ?
+    touchedOffset - self->statements[first].length : touchedOffset;
+  size_t stop = self->count < last + 2 ? self->count : last + 2;
+
+  long delta = (long)length - (long)(end - start);
+  StatementBuffer parsed = { .count=0, .capacity=0, .items=NULL };
+  bool complete;
+
+  for(;;) {
+    size_t oldLength = 0;
+    for(size_t i = first; i < stop; i++) oldLength += self->statements[i].length;
+
+    size_t regionLength = oldLength + delta;
+    DocumentBlock* block = DocumentBlock_allocate(regionLength);
+    block->references++;
+
+    char* cursor = Document_copyRange(self, first, stop, 0, start - firstOffset, block->text);
+    memcpy(cursor, text, length);
+    Document_copyRange(self, first, stop, end - firstOffset, oldLength, cursor + length);
+
+    bool atEnd = stop == self->count;
+    size_t alignAt = SIZE_MAX;
+
+    if(!atEnd) {
+      DocumentStatement* following = &(self->statements[stop - 1]);
+      alignAt = oldLength - following->length + following->leading + delta;
+    }
+
+    size_t line = self->count > 0 ? self->statements[first].line : 1;
+    bool parsedAll = Document_parseBlock(
+        block,
+        regionLength,
+        line,
+        atEnd,
+        alignAt,
+        &parsed,
+        &complete);
+
+    DocumentBlock_release(block);
+    if(parsedAll) break;
+
+    // Take in more of the statements which follow, and try again
+    StatementBuffer_free(&parsed);
+    parsed.count = 0;
+    parsed.capacity = 0;
+    parsed.items = NULL;
+
+    size_t more = stop - first;
+    stop = self->count - stop < more ? self->count : stop + more;
+  }
+
+  long lineDelta = 0;
+
+  for(size_t i = first; i < stop; i++) {
+    lineDelta -= (long)self->statements[i].newlines;
+    DocumentStatement_free(&(self->statements[i]));
+  }
+
+  for(size_t i = 0; i < parsed.count; i++) {
+    lineDelta += (long)parsed.items[i].newlines;
+  }
+
+  size_t count = self->count - (stop - first) + parsed.count;
+
+  if(count > self->capacity) {
+    self->capacity = count * 2;
+    self->statements = realloc(self->statements, sizeof(DocumentStatement) * self->capacity);
+    assert(self->statements != NULL); /* TODO Handle this */
+  }
+
+  memmove(
+      self->statements + first + parsed.count,
+      self->statements + stop,
+      sizeof(DocumentStatement) * (self->count - stop));
+  memcpy(self->statements + first, parsed.items, sizeof(DocumentStatement) * parsed.count);
+  free(parsed.items);
+
+  for(size_t i = first + parsed.count; i < count && lineDelta != 0; i++) {
+    self->statements[i].line += lineDelta;
+    Node_shiftLines(self->statements[i].tree, lineDelta);
+  }
+
+  DocumentChange change = {
+    .first=first,
+    .count=parsed.count,
+    .replaced=stop - first
+  };
+
+  if(stop == self->count) self->complete = complete;
+  self->count = count;
+  self->length += delta;
+
+  return change;
+}
+
+char* Document_text(Document* self) {
+  char* result = malloc(self->length + 1);
+  assert(result != NULL); /* TODO Handle this */
+
+  Document_copyRange(self, 0, self->count, 0, self->length, result);
+  result[self->length] = '\0';
+  return result;
+}
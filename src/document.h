@@ -0,0 +1,88 @@
+#ifndef FUR_DOCUMENT_H
+#define FUR_DOCUMENT_H
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "parser.h"
+
+/*
+ * A source which is edited in place, as in an editor, and parsed again a
+ * top-level statement at a time, so that an edit only costs scanning and
+ * parsing the statements around it.
+ *
+ * The text is divided into one DocumentStatement per top-level statement,
+ * each holding the statement, the whitespace after it and its tree. The
+ * first also holds any whitespace the document starts with. The text is
+ * kept in blocks shared by the statements parsed together, which their
+ * trees point into, so statements an edit doesn't touch keep their text
+ * and trees as they are; only their line numbers change.
+ *
+ * A statement's extent depends on the statements either side of it, since
+ * the first token of the next statement ends it, so an edit is parsed from
+ * the statement before it until a statement starts where one started
+ * before the edit.
+ */
+typedef struct DocumentBlock DocumentBlock;
+
+typedef struct {
+  DocumentBlock* block;
+  char* text;
+  size_t length;
+
+  // The whitespace before the statement's first token
+  size_t leading;
+
+  size_t line;
+  size_t newlines;
+
+  /*
+   * NULL if the statement is only whitespace, or is the rest of the text
+   * after a statement which isn't finished yet, such as a `def` with no
+   * `end`, or from a statement which doesn't parse. Either way this is the
+   * last statement.
+   */
+  Node* tree;
+} DocumentStatement;
+
+typedef struct {
+  size_t count;
+  size_t capacity;
+  DocumentStatement* statements;
+  size_t length;
+
+  // False if the text ends in a statement which isn't finished or doesn't parse
+  bool complete;
+} Document;
+
+/*
+ * The statements a Document_edit parsed, which replaced the ones which were
+ * there. The statements after them are the ones which were after the
+ * replaced ones.
+ */
+typedef struct {
+  size_t first;
+  size_t count;
+  size_t replaced;
+} DocumentChange;
+
+void Document_init(Document*);
+void Document_free(Document*);
+
+/*
+ * Replaces the text from `start` up to `end` with `length` bytes of `text`.
+ * Offsets are in bytes from the start of the document.
+ */
+DocumentChange Document_edit(
+    Document*,
+    size_t start,
+    size_t end,
+    const char* text,
+    size_t length);
+
+/*
+ * Returns a newly allocated, NUL terminated copy of the whole text.
+ */
+char* Document_text(Document*);
+
+#endif
@@ -0,0 +1,271 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "flat_tree.h"
+#include "parser.h"
+
+void FlatTree_init(FlatTree* self) {
+  self->source = NULL;
+  self->count = 0;
+  self->capacity = 0;
+  self->kinds = NULL;
+  self->lines = NULL;
+  self->ends = NULL;
+  self->offsets = NULL;
+  self->lengths = NULL;
+}
+
+void FlatTree_free(FlatTree* self) {
+  free(self->kinds);
+  free(self->lines);
+  free(self->ends);
+  free(self->offsets);
+  free(self->lengths);
+  FlatTree_init(self);
+}
+
+void FlatTree_clear(FlatTree* self) {
+  self->source = NULL;
+  self->count = 0;
+}
+
+/*
+ * The range of memory the tree's text is in.
+ */
+typedef struct {
+  char* low;
+  char* high;
+} TextRange;
+
+inline static void TextRange_include(TextRange* self, char* text, size_t length) {
+  if(self->low == NULL || text < self->low) self->low = text;
+  if(self->high == NULL || text + length > self->high) self->high = text + length;
+}
+
+/*
+ * Returns the number of nodes `node` flattens to.
+ */
+static size_t FlatTree_measure(Node* node, TextRange* range) {
+  if(node == NULL) return 1;
+
+  switch(node->type) {
+    case NODE_NIL:
+    case NODE_TRUE:
+    case NODE_FALSE:
+    case NODE_IDENTIFIER:
+    case NODE_NUMBER:
+    case NODE_STRING:
+      TextRange_include(range, ((AtomNode*)node)->text, ((AtomNode*)node)->length);
+      return 1;
+
+    case NODE_NEGATE:
+    case NODE_NOT:
+    case NODE_IMPORT:
+      return 1 + FlatTree_measure(((UnaryNode*)node)->arg, range);
+
+    case NODE_PROPERTY:
+    case NODE_ADD:
+    case NODE_SUBTRACT:
+    case NODE_MULTIPLY:
+    case NODE_DIVIDE:
+    case NODE_EQUALS:
+    case NODE_NOT_EQUALS:
+    case NODE_GREATER_THAN_EQUALS:
+    case NODE_LESS_THAN_EQUALS:
+    case NODE_GREATER_THAN:
+    case NODE_LESS_THAN:
+    case NODE_AND:
+    case NODE_OR:
+    case NODE_ASSIGN:
+    case NODE_WHILE:
+    case NODE_CALL:
+      return 1 + FlatTree_measure(((BinaryNode*)node)->arg0, range) +
+        FlatTree_measure(((BinaryNode*)node)->arg1, range);
+
+    case NODE_FN_DEF:
+    case NODE_IF:
+      return 1 + FlatTree_measure(((TernaryNode*)node)->arg0, range) +
+        FlatTree_measure(((TernaryNode*)node)->arg1, range) +
+        FlatTree_measure(((TernaryNode*)node)->arg2, range);
+
+    case NODE_COMMA_SEPARATED_LIST:
+    case NODE_EXPRESSION_LIST:
+      {
+        ExpressionListNode* elNode = (ExpressionListNode*)node;
+        size_t count = 1;
+
+        for(size_t i = 0; i < elNode->length; i++) {
+          count += FlatTree_measure(elNode->items[i], range);
+        }
+
+        return count;
+      }
+
+    case NODE_DEFERRED_BODY:
+      {
+        DeferredBodyNode* dNode = (DeferredBodyNode*)node;
+        TextRange_include(range, dNode->text, 0);
+
+        for(size_t i = 0; i < dNode->nameCount; i++) {
+          TextRange_include(range, dNode->names[i].text, dNode->names[i].length);
+        }
+
+        // Each assignment is the assignment, the name and the empty value
+        return 1 + dNode->assignedCount * 3 + (dNode->nameCount - dNode->assignedCount);
+      }
+
+    default:
+      assert(false);
+      return 0;
+  }
+}
+
+inline static uint32_t FlatTree_start(
+    FlatTree* self,
+    uint8_t kind,
+    size_t line,
+    char* text,
+    size_t length) {
+  uint32_t index = self->count++;
+  assert(index < self->capacity);
+
+  self->kinds[index] = kind;
+  self->lines[index] = (uint32_t)line;
+  self->offsets[index] = text == NULL ? 0 : (uint32_t)(text - self->source);
+  self->lengths[index] = (uint32_t)length;
+  return index;
+}
+
+inline static void FlatTree_finish(FlatTree* self, uint32_t index) {
+  self->ends[index] = self->count;
+}
+
+static void FlatTree_addName(FlatTree* self, size_t line, BodyName name) {
+  FlatTree_finish(self, FlatTree_start(self, NODE_IDENTIFIER, line, name.text, name.length));
+}
+
+static void FlatTree_add(FlatTree* self, Node* node) {
+  if(node == NULL) {
+    FlatTree_finish(self, FlatTree_start(self, FLAT_EMPTY, 0, NULL, 0));
+    return;
+  }
+
+  uint32_t index;
+
+  switch(node->type) {
+    case NODE_NIL:
+    case NODE_TRUE:
+    case NODE_FALSE:
+    case NODE_IDENTIFIER:
+    case NODE_NUMBER:
+    case NODE_STRING:
+      {
+        AtomNode* aNode = (AtomNode*)node;
+        index = FlatTree_start(self, node->type, node->line, aNode->text, aNode->length);
+      } break;
+
+    case NODE_NEGATE:
+    case NODE_NOT:
+    case NODE_IMPORT:
+      index = FlatTree_start(self, node->type, node->line, NULL, 0);
+      FlatTree_add(self, ((UnaryNode*)node)->arg);
+      break;
+
+    case NODE_PROPERTY:
+    case NODE_ADD:
+    case NODE_SUBTRACT:
+    case NODE_MULTIPLY:
+    case NODE_DIVIDE:
+    case NODE_EQUALS:
+    case NODE_NOT_EQUALS:
+    case NODE_GREATER_THAN_EQUALS:
+    case NODE_LESS_THAN_EQUALS:
+    case NODE_GREATER_THAN:
+    case NODE_LESS_THAN:
+    case NODE_AND:
+    case NODE_OR:
+    case NODE_ASSIGN:
+    case NODE_WHILE:
+    case NODE_CALL:
+      index = FlatTree_start(self, node->type, node->line, NULL, 0);
+      FlatTree_add(self, ((BinaryNode*)node)->arg0);
+      FlatTree_add(self, ((BinaryNode*)node)->arg1);
+      break;
+
+    case NODE_FN_DEF:
+    case NODE_IF:
+      index = FlatTree_start(self, node->type, node->line, NULL, 0);
+      FlatTree_add(self, ((TernaryNode*)node)->arg0);
+      FlatTree_add(self, ((TernaryNode*)node)->arg1);
+      FlatTree_add(self, ((TernaryNode*)node)->arg2);
+      break;
+
+    case NODE_COMMA_SEPARATED_LIST:
+    case NODE_EXPRESSION_LIST:
+      {
+        ExpressionListNode* elNode = (ExpressionListNode*)node;
+        index = FlatTree_start(self, node->type, node->line, NULL, 0);
+
+        for(size_t i = 0; i < elNode->length; i++) {
+          FlatTree_add(self, elNode->items[i]);
+        }
+      } break;
+
+    case NODE_DEFERRED_BODY:
+      {
+        DeferredBodyNode* dNode = (DeferredBodyNode*)node;
+        index = FlatTree_start(self, node->type, node->line, dNode->text, 0);
+
+        for(size_t i = 0; i < dNode->assignedCount; i++) {
+          uint32_t assignment = FlatTree_start(self, NODE_ASSIGN, node->line, NULL, 0);
+          FlatTree_addName(self, node->line, dNode->names[i]);
+          FlatTree_add(self, NULL);
+          FlatTree_finish(self, assignment);
+        }
+
+        for(size_t i = dNode->assignedCount; i < dNode->nameCount; i++) {
+          FlatTree_addName(self, node->line, dNode->names[i]);
+        }
+      } break;
+
+    default:
+      assert(false);
+      return;
+  }
+
+  FlatTree_finish(self, index);
+}
+
+bool FlatTree_build(FlatTree* self, Node* tree) {
+  FlatTree_clear(self);
+  if(tree == NULL) return false;
+
+  TextRange range = { .low=NULL, .high=NULL };
+  size_t count = FlatTree_measure(tree, &range);
+
+  if(count >= UINT32_MAX) return false;
+  if(range.low != NULL && (size_t)(range.high - range.low) >= UINT32_MAX) return false;
+
+  if(count > self->capacity) {
+    self->capacity = (uint32_t)count;
+    self->kinds = realloc(self->kinds, sizeof(uint8_t) * count);
+    self->lines = realloc(self->lines, sizeof(uint32_t) * count);
+    self->ends = realloc(self->ends, sizeof(uint32_t) * count);
+    self->offsets = realloc(self->offsets, sizeof(uint32_t) * count);
+    self->lengths = realloc(self->lengths, sizeof(uint32_t) * count);
+
+    assert(self->kinds != NULL); /* TODO Handle this */
+    assert(self->lines != NULL); /* TODO Handle this */
+    assert(self->ends != NULL); /* TODO Handle this */
+    assert(self->offsets != NULL); /* TODO Handle this */
+    assert(self->lengths != NULL); /* TODO Handle this */
+  }
+
+  self->source = range.low;
+  FlatTree_add(self, tree);
+  assert(self->count == count);
+
+  return true;
+}
@@ -0,0 +1,51 @@
+#ifndef FUR_FLAT_TREE_H
+#define FUR_FLAT_TREE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "parser.h"
+
+/*
+ * A tree of Nodes flattened into parallel arrays, for passes which walk a
+ * large tree many times: they read a few contiguous arrays instead of
+ * chasing pointers around the heap, and a node takes 17 bytes instead of
+ * a separate allocation of 24 to 40.
+ *
+ * Nodes are in pre-order, so a node's descendants are the nodes from the
+ * one after it up to its end. Its first child is the next node, and each
+ * child after that starts at the end of the one before it. NULL children
+ * are FLAT_EMPTY nodes.
+ *
+ * Atoms keep their text as an offset from `source` and a length, as does
+ * a deferred body for where it starts. A deferred body's children are the
+ * names it recorded: an assignment of each name it assigns, with an empty
+ * value, then each name it uses.
+ */
+#define FLAT_EMPTY 0xff
+
+typedef struct {
+  char* source;
+  uint32_t count;
+  uint32_t capacity;
+  uint8_t* kinds;
+  uint32_t* lines;
+  uint32_t* ends;
+  uint32_t* offsets;
+  uint32_t* lengths;
+} FlatTree;
+
+void FlatTree_init(FlatTree*);
+void FlatTree_free(FlatTree*);
+
+/*
+ * Replaces the contents of the flat tree with `tree`, whose root is then at
+ * index 0. Returns false, leaving the flat tree empty, if `tree` is NULL or
+ * its text is too spread out in memory to be reached by 32-bit offsets.
+ */
+bool FlatTree_build(FlatTree*, Node* tree);
+
+void FlatTree_clear(FlatTree*);
+
+#endif
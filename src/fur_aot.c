@@ -0,0 +1,344 @@
+#include <assert.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "aot.h"
+#include "code.h"
+#include "compiler.h"
+#include "furc.h"
+#include "parser.h"
+#include "read_file.h"
+#include "runtime.h"
+#include "scanner.h"
+
+/*
+ * Translates a program into C, which links against the VM's objects instead
+ * of running in its interpreter:
+ *
+ *     fur_aot -o program.c program.fur
+ *     gcc -O2 -pthread -I src program.c src/aot.o src/code.o src/furc.o src/io.o \
+ *         src/module.o src/object.o src/runtime.o src/scheduler.o src/symbol.o \
+ *         src/symbol_table.o src/thread.o src/value.o -o program
+ *
+ * See aot.h for what the generated code looks like.
+ */
+
+#define MAX_CODES 1024
+
+static uint16_t readUInt16(uint8_t* bytes) {
+  uint16_t result;
+  memcpy(&result, bytes, sizeof(result));
+  return result;
+}
+
+static int16_t readInt16(uint8_t* bytes) {
+  int16_t result;
+  memcpy(&result, bytes, sizeof(result));
+  return result;
+}
+
+static int32_t readInt32(uint8_t* bytes) {
+  int32_t result;
+  memcpy(&result, bytes, sizeof(result));
+  return result;
+}
+
+static size_t indexOfCode(Code** codes, size_t count, Code* code) {
+  for(size_t i = 0; i < count; i++) {
+    if(codes[i] == code) return i;
+  }
+
+  assert(false);
+  return 0;
+}
+
+/*
+ * Jumps are relative to the byte after the instruction, as in the
+ * interpreter.
+ */
+static size_t jumpTarget(Code* code, size_t offset) {
+  return offset + 1 + readInt16(code->instructions.items + offset + 1);
+}
+
+static bool isJump(uint8_t instruction) {
+  switch(instruction) {
+    case OP_JUMP:
+    case OP_JUMP_IF_TRUE:
+    case OP_JUMP_IF_FALSE:
+    case OP_AND:
+    case OP_OR:
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+static bool needsScheduler(NativeFunction call) {
+  return call == nativeSpawn || call == nativeSend || call == nativeReceive;
+}
+
+static void emitFunction(
+    FILE* out,
+    Code** codes,
+    size_t count,
+    size_t index,
+    size_t startIndex) {
+  Code* code = codes[index];
+  uint8_t* instructions = code->instructions.items;
+  size_t length = code->instructions.length;
+
+  // Only label the instructions which are jumped to, so the C has no unused labels
+  bool* targets = calloc(length + 1, sizeof(bool));
+  assert(targets != NULL); /* TODO Handle this */
+
+  for(size_t i = 0; i < length; i += 1 + Instruction_operandSize(instructions[i])) {
+    if(isJump(instructions[i])) {
+      size_t target = jumpTarget(code, i);
+      assert(target <= length);
+      targets[target] = true;
+    }
+  }
+
+  fprintf(out, "static void fur_%zu(Thread* self, ObjClosure* current, Value* fp) {\n", index);
+  fprintf(out, "  Code* code = codes[%zu];\n", index);
+  fprintf(out, "  (void)current;\n");
+  fprintf(out, "  (void)fp;\n");
+  fprintf(out, "  (void)code;\n\n");
+
+  if(startIndex > 0) {
+    targets[startIndex] = true;
+    fprintf(out, "  goto L%zu;\n", startIndex);
+  }
+
+  for(size_t i = 0; i < length; i += 1 + Instruction_operandSize(instructions[i])) {
+    uint8_t* operands = instructions + i + 1;
+
+    if(targets[i]) fprintf(out, "L%zu:\n", i);
+
+    fprintf(out, "  ");
+
+    switch(instructions[i]) {
+      case OP_NIL:            fprintf(out, "AOT_NIL();"); break;
+      case OP_TRUE:           fprintf(out, "AOT_TRUE();"); break;
+      case OP_FALSE:          fprintf(out, "AOT_FALSE();"); break;
+      case OP_DROP:           fprintf(out, "AOT_DROP();"); break;
+      case OP_ADD:            fprintf(out, "AOT_ADD();"); break;
+      case OP_SUBTRACT:       fprintf(out, "AOT_BINARY(subtract);"); break;
+      case OP_MULTIPLY:       fprintf(out, "AOT_BINARY(multiply);"); break;
+      case OP_DIVIDE:         fprintf(out, "AOT_BINARY(divide);"); break;
+      case OP_EQ:             fprintf(out, "AOT_BINARY(equals);"); break;
+      case OP_NEQ:            fprintf(out, "AOT_BINARY(notEquals);"); break;
+      case OP_LT:             fprintf(out, "AOT_BINARY(lessThan);"); break;
+      case OP_GT:             fprintf(out, "AOT_BINARY(greaterThan);"); break;
+      case OP_LEQ:            fprintf(out, "AOT_BINARY(lessThanEquals);"); break;
+      case OP_GEQ:            fprintf(out, "AOT_BINARY(greaterThanEquals);"); break;
+      case OP_NEGATE:         fprintf(out, "AOT_UNARY(negate);"); break;
+      case OP_NOT:            fprintf(out, "AOT_UNARY(logicalNot);"); break;
+      case OP_ADD_INT:        fprintf(out, "AOT_INT_ARITHMETIC(+);"); break;
+      case OP_SUBTRACT_INT:   fprintf(out, "AOT_INT_ARITHMETIC(-);"); break;
+      case OP_MULTIPLY_INT:   fprintf(out, "AOT_INT_ARITHMETIC(*);"); break;
+      case OP_DIVIDE_INT:     fprintf(out, "AOT_INT_ARITHMETIC(/);"); break;
+      case OP_NEGATE_INT:     fprintf(out, "AOT_NEGATE_INT();"); break;
+      case OP_EQ_INT:         fprintf(out, "AOT_INT_COMPARISON(==);"); break;
+      case OP_NEQ_INT:        fprintf(out, "AOT_INT_COMPARISON(!=);"); break;
+      case OP_LT_INT:         fprintf(out, "AOT_INT_COMPARISON(<);"); break;
+      case OP_GT_INT:         fprintf(out, "AOT_INT_COMPARISON(>);"); break;
+      case OP_LEQ_INT:        fprintf(out, "AOT_INT_COMPARISON(<=);"); break;
+      case OP_GEQ_INT:        fprintf(out, "AOT_INT_COMPARISON(>=);"); break;
+
+      case OP_INTEGER:
+        {
+          int32_t integer = readInt32(operands);
+
+          // -2147483648 is the negation of a literal which doesn't fit in an int
+          if(integer == INT32_MIN) {
+            fprintf(out, "AOT_INTEGER(INT32_MIN);");
+          } else {
+            fprintf(out, "AOT_INTEGER(%" PRId32 ");", integer);
+          }
+        } break;
+
+      case OP_INTERN:       fprintf(out, "AOT_INTERN(%u);", operands[0]); break;
+      case OP_NATIVE:
+        // Threads need a scheduler, which can't resume generated C
+        if(needsScheduler(NATIVE[readUInt16(operands)].call)) {
+          fprintf(stderr, "%s isn't supported in generated C.\n", NATIVE[readUInt16(operands)].name);
+          exit(1);
+        }
+
+        fprintf(out, "AOT_NATIVE(%u);", readUInt16(operands));
+        break;
+
+      case OP_GET:          fprintf(out, "AOT_GET(%u);", operands[0]); break;
+      case OP_SET:          fprintf(out, "AOT_SET(%u);", operands[0]); break;
+      case OP_GET_OUTER:    fprintf(out, "AOT_GET_OUTER(%u, %u);", operands[0], operands[1]); break;
+      case OP_SET_OUTER:    fprintf(out, "AOT_SET_OUTER(%u, %u);", operands[0], operands[1]); break;
+      case OP_GET_LATE:     fprintf(out, "AOT_GET_LATE(%u, %u);", operands[0], operands[1]); break;
+      case OP_DECLARE_GLOBAL: fprintf(out, "AOT_DECLARE_GLOBAL();"); break;
+      case OP_GET_UPVALUE:  fprintf(out, "AOT_GET_UPVALUE(%u);", operands[0]); break;
+      case OP_SET_UPVALUE:  fprintf(out, "AOT_SET_UPVALUE(%u);", operands[0]); break;
+      case OP_CLOSURE:      fprintf(out, "AOT_CLOSURE(%u);", operands[0]); break;
+
+      case OP_JUMP:           fprintf(out, "AOT_JUMP(L%zu);", jumpTarget(code, i)); break;
+      case OP_JUMP_IF_TRUE:   fprintf(out, "AOT_JUMP_IF_TRUE(L%zu);", jumpTarget(code, i)); break;
+      case OP_JUMP_IF_FALSE:  fprintf(out, "AOT_JUMP_IF_FALSE(L%zu);", jumpTarget(code, i)); break;
+      case OP_AND:            fprintf(out, "AOT_AND(L%zu);", jumpTarget(code, i)); break;
+      case OP_OR:             fprintf(out, "AOT_OR(L%zu);", jumpTarget(code, i)); break;
+
+      case OP_CALL:
+        fprintf(out, "AOT_CALL(program, %u);", operands[0]);
+        break;
+
+      case OP_CALL_DIRECT:
+        {
+          ObjClosure* callee = (ObjClosure*)Code_getCallee(code, operands[0]);
+          fprintf(
+              out,
+              "AOT_CALL_DIRECT(%u, fur_%zu);",
+              operands[0],
+              indexOfCode(codes, count, callee->code));
+        } break;
+
+      case OP_CALL_SELF:
+        fprintf(out, "AOT_CALL_SELF(%u, fur_%zu);", operands[0], index);
+        break;
+
+      case OP_IMPORT:
+      case OP_PROP:
+        fprintf(stderr, "import isn't supported in generated C.\n");
+        exit(1);
+
+      case OP_RETURN:
+        fprintf(out, index == 0 ? "AOT_RETURN_MODULE();" : "AOT_RETURN();");
+        break;
+
+      default:
+        fprintf(stderr, "Unknown instruction %u.\n", instructions[i]);
+        exit(1);
+    }
+
+    fprintf(out, "\n");
+  }
+
+  // A jump past the last instruction would need somewhere to land
+  if(targets[length]) fprintf(out, "L%zu:\n  return;\n", length);
+
+  fprintf(out, "}\n\n");
+
+  free(targets);
+}
+
+static void emitImage(FILE* out, Code* code, size_t startIndex, FurcSource* source) {
+  FILE* image = tmpfile();
+  assert(image != NULL); /* TODO Handle this */
+
+  bool written = Furc_write(image, code, startIndex, source);
+  assert(written); /* TODO Handle this */
+
+  fseek(image, 0L, SEEK_END);
+  long length = ftell(image);
+  rewind(image);
+
+  fprintf(out, "static const uint8_t image[%ld] = {", length);
+
+  for(long i = 0; i < length; i++) {
+    if(i % 16 == 0) fprintf(out, "\n ");
+    fprintf(out, " %d,", fgetc(image));
+  }
+
+  fprintf(out, "\n};\n\n");
+
+  fclose(image);
+}
+
+static void emitProgram(
+    FILE* out,
+    char* filename,
+    Code* module,
+    size_t startIndex,
+    FurcSource* source) {
+  Code* codes[MAX_CODES];
+  size_t count = Aot_numberCodes(module, codes, MAX_CODES);
+  assert(count <= MAX_CODES); /* TODO Handle this */
+
+  fprintf(out, "/*\n * Generated by fur_aot from %s. DO NOT EDIT IT BY HAND.\n */\n", filename);
+  fprintf(out, "#include \"aot.h\"\n\n");
+
+  for(size_t i = 0; i < count; i++) {
+    fprintf(out, "static void fur_%zu(Thread*, ObjClosure*, Value*);\n", i);
+  }
+
+  fprintf(out, "\nstatic Code* codes[%zu];\n\n", count);
+  fprintf(out, "static const AotFunction functions[%zu] = {\n", count);
+  for(size_t i = 0; i < count; i++) {
+    fprintf(out, "  fur_%zu,\n", i);
+  }
+  fprintf(out, "};\n\n");
+
+  fprintf(out, "static AotProgram program = {\n");
+  fprintf(out, "  .count=%zu,\n", count);
+  fprintf(out, "  .codes=codes,\n");
+  fprintf(out, "  .functions=functions,\n");
+  fprintf(out, "};\n\n");
+
+  for(size_t i = 0; i < count; i++) {
+    emitFunction(out, codes, count, i, i == 0 ? startIndex : 0);
+  }
+
+  emitImage(out, module, startIndex, source);
+
+  fprintf(out, "int main() {\n");
+  fprintf(out, "  return Aot_main(&program, image, sizeof(image));\n");
+  fprintf(out, "}\n");
+}
+
+int main(int argc, char** argv) {
+  assert(argc == 4 && !strcmp(argv[1], "-o"));
+
+  char* output = argv[2];
+  char* filename = argv[3];
+
+  SourceFile source;
+  SourceFile_read(&source, filename);
+
+  Scanner scanner;
+  Scanner_init(&scanner, 1, source.text);
+
+  Node* tree = parse(&scanner);
+
+  Runtime runtime;
+  Runtime_init(&runtime);
+  Compiler compiler;
+  Compiler_init(&compiler, &runtime);
+  Code code;
+  Code_init(&code);
+
+  size_t startIndex = Compiler_compile(&compiler, &code, tree);
+
+  FurcSource furcSource;
+  bool stated = FurcSource_stat(&furcSource, filename);
+  assert(stated); /* TODO Handle this */
+  furcSource.hash = Furc_hashSource(source.text, source.length);
+
+  FILE* out = fopen(output, "w");
+
+  if(out == NULL) {
+    fprintf(stderr, "Could not open file \"%s\".\n", output);
+    exit(1);
+  }
+
+  emitProgram(out, filename, &code, startIndex, &furcSource);
+  fclose(out);
+
+  Compiler_free(&compiler);
+  Code_free(&code);
+  Runtime_free(&runtime);
+  SourceFile_free(&source);
+
+  return 0;
+}
@@ -1,21 +1,41 @@
 #include <assert.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "code.h"
 #include "compiler.h"
+#include "furc.h"
 #include "parser.h"
 #include "read_file.h"
 #include "runtime.h"
 #include "scanner.h"
 
+/*
+ * Prints the assembly for a program:
+ *
+ *     fur_compile program.fur
+ *
+ * Or writes its compiled code to a .furc file, which `fur` loads instead of
+ * compiling the program if the program hasn't changed:
+ *
+ *     fur_compile -o program.furc program.fur
+ */
 int main(int argc, char** argv) {
-  assert(argc == 2);
+  char* output = NULL;
 
-  char* filename = argv[1];
-  char* source = readFile(filename);
+  if(argc == 4 && !strcmp(argv[1], "-o")) {
+    output = argv[2];
+  } else {
+    assert(argc == 2);
+  }
+
+  char* filename = argv[argc - 1];
+  SourceFile source;
+  SourceFile_read(&source, filename);
 
   Scanner scanner;
-  Scanner_init(&scanner, 1, source);
+  Scanner_init(&scanner, 1, source.text);
 
   Node* tree = parse(&scanner);
 
@@ -24,17 +44,44 @@ int main(int argc, char** argv) {
   Compiler compiler;
   Compiler_init(&compiler, &runtime);
   Code code;
+
+  // Imports are resolved as they would be if the file were run
+  char* slash = strrchr(filename, '/');
+  char* root = slash == NULL ? NULL : strndup(filename, slash - filename);
+  compiler.path = filename;
+  compiler.root = root;
   Code_init(&code);
 
   size_t startIndex = Compiler_compile(&compiler, &code, tree);
-  Node_free(tree);
 
-  Code_printAsAssembly(&code, startIndex);
+  if(output == NULL) {
+    Code_printAsAssembly(&code, startIndex);
+  } else {
+    FurcSource furcSource;
+    bool stated = FurcSource_stat(&furcSource, filename);
+    assert(stated); /* TODO Handle this */
+    furcSource.hash = Furc_hashSource(source.text, source.length);
+
+    FILE* file = fopen(output, "wb");
+
+    if(file == NULL) {
+      fprintf(stderr, "Could not open file \"%s\".\n", output);
+      exit(1);
+    }
+
+    if(!Furc_write(file, &code, startIndex, &furcSource)) {
+      fprintf(stderr, "Could not write file \"%s\".\n", output);
+      exit(1);
+    }
+
+    fclose(file);
+  }
 
   Compiler_free(&compiler);
   Code_free(&code);
   Runtime_free(&runtime);
-  free(source);
+  SourceFile_free(&source);
+  free(root);
 
   return 0;
 }
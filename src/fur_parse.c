@@ -1,24 +1,86 @@
 #include <assert.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "document.h"
 #include "parser.h"
 #include "read_file.h"
 #include "scanner.h"
 
+/*
+ * With --document, the file is loaded into a Document, and edits read from
+ * stdin are applied to it one at a time, as an editor would. Each edit is
+ * a line "start end length", followed by `length` bytes which replace the
+ * bytes from `start` up to `end`. Then each statement is printed with its
+ * line, so the result can be compared with parsing the edited file.
+ */
+static void applyEdits(Document* document) {
+  size_t start, end, length;
+
+  while(scanf("%zu %zu %zu", &start, &end, &length) == 3) {
+    int newline = getchar();
+    assert(newline == '\n');
+    assert(start <= end && end <= document->length);
+
+    char* text = malloc(length + 1);
+    assert(text != NULL); /* TODO Handle this */
+    size_t read = fread(text, 1, length, stdin);
+    assert(read == length);
+
+    DocumentChange change = Document_edit(document, start, end, text, length);
+    free(text);
+
+    printf(
+        "edit: parsed %zu statements in place of %zu, from statement %zu of %zu\n",
+        change.count,
+        change.replaced,
+        change.first,
+        document->count);
+  }
+}
+
+static void printDocument(Document* document) {
+  for(size_t i = 0; i < document->count; i++) {
+    DocumentStatement* statement = &(document->statements[i]);
+    if(statement->tree == NULL) continue;
+
+    printf("%zu: ", statement->tree->line);
+    Node_print(statement->tree);
+    printf("\n");
+  }
+
+  if(!document->complete) {
+    printf("incomplete from line %zu\n", document->statements[document->count - 1].line);
+  }
+}
+
 int main(int argc, char** argv) {
-  assert(argc == 2);
+  assert(argc == 2 || (argc == 3 && !strcmp(argv[1], "--document")));
+
+  char* filename = argv[argc - 1];
+  SourceFile source;
+  SourceFile_read(&source, filename);
+
+  if(argc == 3) {
+    Document document;
+    Document_init(&document);
+    Document_edit(&document, 0, 0, source.text, source.length);
 
-  char* filename = argv[1];
-  char* source = readFile(filename);
+    applyEdits(&document);
+    printDocument(&document);
 
-  Scanner scanner;
-  Scanner_init(&scanner, 1, source);
+    Document_free(&document);
+  } else {
+    Scanner scanner;
+    Scanner_init(&scanner, 1, source.text);
 
-  Node* tree = parse(&scanner);
-  Node_print(tree);
-  Node_free(tree);
+    Node* tree = parse(&scanner);
+    Node_print(tree);
+    Node_free(tree);
+  }
 
-  free(source);
+  SourceFile_free(&source);
 
   return 0;
 }
@@ -1,20 +1,162 @@
 #include <assert.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "read_file.h"
 #include "scanner.h"
+#include "symbol_table.h"
+
+/*
+ * Scans the source repeatedly, without printing the tokens, for at least
+ * BENCHMARK_SECONDS, and reports the throughput.
+ */
+#define BENCHMARK_SECONDS 1.0
+
+typedef struct {
+  bool benchmark;
+  bool stream;
+  char* filename;
+} Options;
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t countTokens(Scanner* scanner) {
+  size_t tokens = 0;
+
+  Token token;
+  while((token = Scanner_scan(scanner)).type != TOKEN_EOF) {
+    assert(token.type != TOKEN_ERROR);
+    tokens++;
+  }
+
+  return tokens;
+}
+
+static void benchmark(Options* options) {
+  SourceFile source;
+  int fd = -1;
+  size_t length;
+
+  if(options->stream) {
+    fd = open(options->filename, O_RDONLY);
+    assert(fd >= 0); /* TODO Handle this */
+
+    struct stat status;
+    assert(fstat(fd, &status) == 0);
+    length = status.st_size;
+  } else {
+    SourceFile_read(&source, options->filename);
+    length = source.length;
+  }
+
+  size_t passes = 0;
+  size_t tokens = 0;
+  double start = now();
+  double elapsed;
+
+  do {
+    Scanner scanner;
+
+    if(options->stream) {
+      lseek(fd, 0, SEEK_SET);
+
+      SymbolTable symbols;
+      SymbolTable_init(&symbols);
+      ScannerStream stream;
+      ScannerStream_init(&stream, fd, &symbols);
+      Scanner_initStream(&scanner, &stream);
+
+      tokens += countTokens(&scanner);
+
+      ScannerStream_free(&stream);
+      SymbolTable_free(&symbols);
+    } else {
+      Scanner_init(&scanner, 1, source.text);
+      tokens += countTokens(&scanner);
+    }
+
+    passes++;
+    elapsed = now() - start;
+  } while(elapsed < BENCHMARK_SECONDS);
+
+#if defined(__SSE2__) && !defined(FUR_NO_SIMD)
+  const char* path = "sse2";
+#else
+  const char* path = "scalar";
+#endif
+
+  printf(
+    "%s%s: %zu bytes, %zu tokens, %zu passes in %.3fs: %.1f MB/s\n",
+    path,
+    options->stream ? ", streamed" : "",
+    length,
+    tokens / passes,
+    passes,
+    elapsed,
+    (double)(length * passes) / elapsed / 1e6
+  );
+
+  if(options->stream) {
+    close(fd);
+  } else {
+    SourceFile_free(&source);
+  }
+}
 
 int main(int argc, char** argv) {
-  assert(argc == 2);
+  Options options = { .benchmark=false, .stream=false, .filename=NULL };
+
+  for(int i = 1; i < argc; i++) {
+    if(!strcmp(argv[i], "--benchmark")) {
+      options.benchmark = true;
+    } else if(!strcmp(argv[i], "--stream")) {
+      options.stream = true;
+    } else {
+      assert(options.filename == NULL);
+      options.filename = argv[i];
+    }
+  }
+
+  assert(options.filename != NULL);
+
+  if(options.benchmark) {
+    benchmark(&options);
+  } else if(options.stream) {
+    int fd = open(options.filename, O_RDONLY);
+    assert(fd >= 0); /* TODO Handle this */
+
+    SymbolTable symbols;
+    SymbolTable_init(&symbols);
+    ScannerStream stream;
+    ScannerStream_init(&stream, fd, &symbols);
+
+    Scanner scanner;
+    Scanner_initStream(&scanner, &stream);
+    Scanner_printScan(&scanner);
 
-  char* filename = argv[1];
-  char* source = readFile(filename);
+    ScannerStream_free(&stream);
+    SymbolTable_free(&symbols);
+    close(fd);
+  } else {
+    SourceFile source;
+    SourceFile_read(&source, options.filename);
 
-  Scanner scanner;
-  Scanner_init(&scanner, 1, source);
-  Scanner_printScan(&scanner);
+    Scanner scanner;
+    Scanner_init(&scanner, 1, source.text);
+    Scanner_printScan(&scanner);
 
-  free(source);
+    SourceFile_free(&source);
+  }
 
   return 0;
 }
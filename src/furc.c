@@ -0,0 +1,850 @@
+#include <assert.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "code.h"
+#include "furc.h"
+#include "memory.h"
+#include "object.h"
+#include "runtime.h"
+
+#define FURC_MAGIC "FURC"
+#define FURC_HEADER_SIZE 48
+
+#define FNV_OFFSET_BASIS 14695981039346656037ull
+#define FNV_PRIME 1099511628211ull
+
+static uint64_t fnv1a(uint64_t result, const uint8_t* bytes, size_t length) {
+  for(size_t i = 0; i < length; i++) {
+    result ^= bytes[i];
+    result *= FNV_PRIME;
+  }
+  return result;
+}
+
+uint64_t Furc_hashSource(const char* source, size_t length) {
+  return fnv1a(FNV_OFFSET_BASIS, (const uint8_t*)source, length);
+}
+
+/*
+ * OP_NATIVE refers to natives by their index in NATIVE, so a .furc file
+ * compiled against a different native table would call the wrong natives.
+ */
+static uint32_t nativesFingerprint() {
+  uint64_t result = FNV_OFFSET_BASIS;
+
+  for(size_t i = 0; i < NATIVE_COUNT; i++) {
+    result = fnv1a(result, (const uint8_t*)NATIVE[i].name, NATIVE[i].length + 1);
+  }
+
+  return (uint32_t)(result ^ (result >> 32));
+}
+
+bool FurcSource_stat(FurcSource* self, const char* path) {
+  struct stat info;
+  if(stat(path, &info) != 0) return false;
+
+  self->hash = 0;
+  self->size = (uint64_t)info.st_size;
+#ifdef __APPLE__
+  struct timespec modified = info.st_mtimespec;
+#else
+  struct timespec modified = info.st_mtim;
+#endif
+  self->mtime = (int64_t)modified.tv_sec * 1000000000 + modified.tv_nsec;
+  return true;
+}
+
+char* Furc_cachePath(const char* path) {
+  size_t length = strlen(path);
+  char* result = allocateChars(length + 2);
+  memcpy(result, path, length);
+  result[length] = 'c';
+  result[length + 1] = '\0';
+  return result;
+}
+
+/*
+ * Writing
+ */
+
+typedef struct {
+  FILE* file;
+  uint64_t checksum;
+  bool ok;
+
+  size_t closureCount;
+  size_t closureCapacity;
+  ObjClosure** closures;
+} FurcWriter;
+
+static void FurcWriter_bytes(FurcWriter* self, const void* bytes, size_t length) {
+  self->checksum = fnv1a(self->checksum, bytes, length);
+  if(fwrite(bytes, 1, length, self->file) != length) self->ok = false;
+}
+
+static void FurcWriter_u8(FurcWriter* self, uint8_t value) {
+  FurcWriter_bytes(self, &value, 1);
+}
+
+static void FurcWriter_u32(FurcWriter* self, uint32_t value) {
+  uint8_t bytes[4];
+  for(size_t i = 0; i < 4; i++) bytes[i] = (uint8_t)(value >> (8 * i));
+  FurcWriter_bytes(self, bytes, 4);
+}
+
+static void FurcWriter_u64(FurcWriter* self, uint64_t value) {
+  uint8_t bytes[8];
+  for(size_t i = 0; i < 8; i++) bytes[i] = (uint8_t)(value >> (8 * i));
+  FurcWriter_bytes(self, bytes, 8);
+}
+
+/*
+ * Numbers the closures in `code` in the order FurcWriter_code writes them.
+ */
+static void FurcWriter_number(FurcWriter* self, Code* code) {
+  for(size_t i = 0; i < code->interns.length; i++) {
+    Obj* intern = code->interns.items[i];
+    if(intern->type != OBJ_CLOSURE) continue;
+
+    if(self->closureCount == self->closureCapacity) {
+      self->closureCapacity = self->closureCapacity == 0 ? 16 : self->closureCapacity * 2;
+      ObjClosure** tmp = realloc(self->closures, sizeof(ObjClosure*) * self->closureCapacity);
+      assert(tmp != NULL); /* TODO Handle this */
+      self->closures = tmp;
+    }
+
+    ObjClosure* closure = (ObjClosure*)intern;
+    self->closures[self->closureCount++] = closure;
+    FurcWriter_number(self, closure->code);
+  }
+}
+
+static void FurcWriter_code(FurcWriter* self, Code* code) {
+  FurcWriter_u32(self, (uint32_t)code->instructions.length);
+  FurcWriter_bytes(self, code->instructions.items, code->instructions.length);
+
+  FurcWriter_u32(self, (uint32_t)code->lines.deltas.length);
+  FurcWriter_bytes(self, code->lines.deltas.items, code->lines.deltas.length);
+
+  FurcWriter_u32(self, (uint32_t)code->interns.length);
+  for(size_t i = 0; i < code->interns.length; i++) {
+    Obj* intern = code->interns.items[i];
+    FurcWriter_u8(self, (uint8_t)intern->type);
+
+    switch(intern->type) {
+      case OBJ_STRING:
+        {
+          ObjString* string = (ObjString*)intern;
+          FurcWriter_u32(self, (uint32_t)string->length);
+          FurcWriter_bytes(self, string->characters, string->length);
+        } break;
+
+      case OBJ_CLOSURE:
+        {
+          ObjClosure* closure = (ObjClosure*)intern;
+          FurcWriter_u8(self, closure->name->length);
+          FurcWriter_bytes(self, closure->name->name, closure->name->length);
+          FurcWriter_u8(self, closure->arity);
+          FurcWriter_u8(self, closure->depth);
+          FurcWriter_u8(self, closure->upvalueCount);
+
+          for(size_t j = 0; j < closure->upvalueCount; j++) {
+            FurcWriter_u8(self, closure->upvalueDescriptors[j].kind);
+            FurcWriter_u8(self, closure->upvalueDescriptors[j].depth);
+            FurcWriter_u8(self, closure->upvalueDescriptors[j].index);
+          }
+
+          FurcWriter_code(self, closure->code);
+        } break;
+
+      default:
+        self->ok = false;
+        break;
+    }
+  }
+
+  FurcWriter_u32(self, (uint32_t)code->callees.length);
+  for(size_t i = 0; i < code->callees.length; i++) {
+    size_t id = 0;
+    while(id < self->closureCount
+        && (Obj*)(self->closures[id]) != code->callees.items[i]) id++;
+
+    // Callees are always somewhere in the tree we're writing
+    if(id == self->closureCount) self->ok = false;
+
+    FurcWriter_u32(self, (uint32_t)id);
+  }
+}
+
+/*
+ * Tags for the values of a snapshot's globals.
+ */
+typedef enum {
+  FURC_NIL,
+  FURC_BOOLEAN,
+  FURC_INTEGER,
+  FURC_STRING,
+  FURC_CLOSURE,
+  FURC_NATIVE,
+} FurcValueTag;
+
+/*
+ * Prototypes are numbered with the code, but instances' upvalues aren't
+ * saved, and closures of other modules aren't in the code. Returns
+ * closureCount for those.
+ */
+static size_t FurcWriter_closureId(FurcWriter* self, Obj* closure) {
+  size_t id = 0;
+  while(id < self->closureCount && (Obj*)(self->closures[id]) != closure) id++;
+  return id;
+}
+
+static size_t nativeIndex(ObjNative* native) {
+  size_t index = 0;
+  while(index < NATIVE_COUNT && NATIVE[index].call != native->call) index++;
+  return index;
+}
+
+static bool FurcWriter_canWrite(FurcWriter* self, Value value) {
+  switch(value.is_a) {
+    case TYPE_NIL:
+    case TYPE_BOOLEAN:
+    case TYPE_INTEGER:
+      return true;
+
+    case TYPE_OBJ:
+      break;
+
+    default:
+      return false;
+  }
+
+  switch(value.as.obj->type) {
+    case OBJ_STRING:
+      return true;
+
+    case OBJ_CLOSURE:
+      return FurcWriter_closureId(self, value.as.obj) < self->closureCount;
+
+    case OBJ_NATIVE:
+      return nativeIndex((ObjNative*)value.as.obj) < NATIVE_COUNT;
+
+    default:
+      return false;
+  }
+}
+
+static void FurcWriter_value(FurcWriter* self, Value value) {
+  switch(value.is_a) {
+    case TYPE_NIL:
+      FurcWriter_u8(self, FURC_NIL);
+      return;
+
+    case TYPE_BOOLEAN:
+      FurcWriter_u8(self, FURC_BOOLEAN);
+      FurcWriter_u8(self, value.as.boolean);
+      return;
+
+    case TYPE_INTEGER:
+      FurcWriter_u8(self, FURC_INTEGER);
+      FurcWriter_u32(self, (uint32_t)value.as.integer);
+      return;
+
+    case TYPE_OBJ:
+      break;
+
+    default:
+      self->ok = false;
+      return;
+  }
+
+  switch(value.as.obj->type) {
+    case OBJ_STRING:
+      {
+        ObjString* string = (ObjString*)value.as.obj;
+        FurcWriter_u8(self, FURC_STRING);
+        FurcWriter_u32(self, (uint32_t)string->length);
+        FurcWriter_bytes(self, string->characters, string->length);
+      } break;
+
+    case OBJ_CLOSURE:
+      {
+        size_t id = FurcWriter_closureId(self, value.as.obj);
+        if(id == self->closureCount) self->ok = false;
+
+        FurcWriter_u8(self, FURC_CLOSURE);
+        FurcWriter_u32(self, (uint32_t)id);
+      } break;
+
+    case OBJ_NATIVE:
+      {
+        size_t index = nativeIndex((ObjNative*)value.as.obj);
+        if(index == NATIVE_COUNT) self->ok = false;
+
+        FurcWriter_u8(self, FURC_NATIVE);
+        FurcWriter_u32(self, (uint32_t)index);
+      } break;
+
+    default:
+      self->ok = false;
+      break;
+  }
+}
+
+static bool writeImage(
+    FILE* file,
+    Code* code,
+    size_t startIndex,
+    FurcSource* source,
+    FurcGlobals* globals,
+    size_t* unwritable) {
+  FurcWriter writer;
+  writer.file = file;
+  writer.checksum = FNV_OFFSET_BASIS;
+  writer.ok = true;
+  writer.closureCount = 0;
+  writer.closureCapacity = 0;
+  writer.closures = NULL;
+
+  FurcWriter_number(&writer, code);
+
+  size_t globalCount = globals == NULL ? 0 : globals->count;
+
+  // Check the globals first, so that nothing is written if one can't be
+  for(size_t i = 0; i < globalCount; i++) {
+    if(!FurcWriter_canWrite(&writer, globals->values[i])) {
+      *unwritable = i;
+      free(writer.closures);
+      return false;
+    }
+  }
+
+  /*
+   * The checksum covers the body, which follows the header, so write a
+   * placeholder header and come back to it.
+   */
+  uint8_t header[FURC_HEADER_SIZE] = { 0 };
+  if(fwrite(header, 1, FURC_HEADER_SIZE, file) != FURC_HEADER_SIZE) writer.ok = false;
+
+  FurcWriter_code(&writer, code);
+
+  FurcWriter_u32(&writer, (uint32_t)globalCount);
+
+  for(size_t i = 0; i < globalCount; i++) {
+    Symbol* name = globals->names[i];
+
+    if(name == NULL) {
+      FurcWriter_u8(&writer, 0);
+    } else {
+      FurcWriter_u8(&writer, name->length);
+      FurcWriter_bytes(&writer, name->name, name->length);
+    }
+
+    FurcWriter_value(&writer, globals->values[i]);
+  }
+
+  free(writer.closures);
+
+  uint64_t checksum = writer.checksum;
+
+  if(fseek(file, 0L, SEEK_SET) != 0) return false;
+  FurcWriter_bytes(&writer, FURC_MAGIC, 4);
+  FurcWriter_u8(&writer, (uint8_t)FURC_VERSION);
+  FurcWriter_u8(&writer, (uint8_t)(FURC_VERSION >> 8));
+  FurcWriter_u8(&writer, 0);
+  FurcWriter_u8(&writer, 0);
+  FurcWriter_u32(&writer, nativesFingerprint());
+  FurcWriter_u32(&writer, (uint32_t)startIndex);
+  FurcWriter_u64(&writer, source->hash);
+  FurcWriter_u64(&writer, source->size);
+  FurcWriter_u64(&writer, (uint64_t)source->mtime);
+  FurcWriter_u64(&writer, checksum);
+
+  return writer.ok && fflush(file) == 0;
+}
+
+bool Furc_write(FILE* file, Code* code, size_t startIndex, FurcSource* source) {
+  return writeImage(file, code, startIndex, source, NULL, NULL);
+}
+
+bool Furc_writeSnapshot(FILE* file, Code* code, FurcGlobals* globals, size_t* unwritable) {
+  *unwritable = globals->count;
+
+  // A snapshot has already run, so it starts at the end of its code
+  FurcSource none = { .hash=0, .size=0, .mtime=0 };
+  return writeImage(file, code, code->instructions.length, &none, globals, unwritable);
+}
+
+/*
+ * Reading
+ */
+
+bool FurcImage_map(FurcImage* self, const char* path) {
+  int fd = open(path, O_RDONLY);
+  if(fd < 0) return false;
+
+  struct stat info;
+  if(fstat(fd, &info) != 0 || info.st_size < FURC_HEADER_SIZE) {
+    close(fd);
+    return false;
+  }
+
+  void* data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+  // The mapping stays valid after the descriptor is closed
+  close(fd);
+
+  if(data == MAP_FAILED) return false;
+
+  self->data = data;
+  self->length = (size_t)info.st_size;
+  return true;
+}
+
+void FurcImage_unmap(FurcImage* self) {
+  munmap((void*)self->data, self->length);
+  self->data = NULL;
+  self->length = 0;
+}
+
+typedef struct {
+  Code* code;
+  uint8_t index;
+  uint32_t id;
+} FurcFixup;
+
+/*
+ * Every read is bounds checked: once a read runs off the end of the image,
+ * `ok` is false and all further reads return zeroes.
+ */
+typedef struct {
+  const uint8_t* data;
+  size_t length;
+  size_t position;
+  bool ok;
+
+  Runtime* runtime;
+
+  size_t closureCount;
+  size_t closureCapacity;
+  ObjClosure** closures;
+
+  size_t fixupCount;
+  size_t fixupCapacity;
+  FurcFixup* fixups;
+} FurcReader;
+
+static const uint8_t* FurcReader_bytes(FurcReader* self, size_t length) {
+  if(!self->ok || length > self->length - self->position) {
+    self->ok = false;
+    return NULL;
+  }
+
+  const uint8_t* result = self->data + self->position;
+  self->position += length;
+  return result;
+}
+
+static uint8_t FurcReader_u8(FurcReader* self) {
+  const uint8_t* bytes = FurcReader_bytes(self, 1);
+  return bytes == NULL ? 0 : bytes[0];
+}
+
+static uint32_t FurcReader_u32(FurcReader* self) {
+  const uint8_t* bytes = FurcReader_bytes(self, 4);
+  if(bytes == NULL) return 0;
+
+  uint32_t result = 0;
+  for(size_t i = 0; i < 4; i++) result |= (uint32_t)bytes[i] << (8 * i);
+  return result;
+}
+
+static uint64_t FurcReader_u64(FurcReader* self) {
+  const uint8_t* bytes = FurcReader_bytes(self, 8);
+  if(bytes == NULL) return 0;
+
+  uint64_t result = 0;
+  for(size_t i = 0; i < 8; i++) result |= (uint64_t)bytes[i] << (8 * i);
+  return result;
+}
+
+static bool FurcReader_header(
+    FurcReader* self,
+    FurcSource* source,
+    size_t* startIndex,
+    uint64_t* checksum) {
+  const uint8_t* magic = FurcReader_bytes(self, 4);
+  if(magic == NULL || memcmp(magic, FURC_MAGIC, 4) != 0) return false;
+
+  uint16_t version = FurcReader_u8(self);
+  version |= (uint16_t)(FurcReader_u8(self) << 8);
+  if(version != FURC_VERSION) return false;
+
+  FurcReader_u8(self);
+  FurcReader_u8(self);
+
+  if(FurcReader_u32(self) != nativesFingerprint()) return false;
+
+  *startIndex = FurcReader_u32(self);
+  source->hash = FurcReader_u64(self);
+  source->size = FurcReader_u64(self);
+  source->mtime = (int64_t)FurcReader_u64(self);
+  *checksum = FurcReader_u64(self);
+
+  return self->ok;
+}
+
+bool FurcImage_source(FurcImage* self, FurcSource* source) {
+  FurcReader reader = { .data=self->data, .length=self->length, .ok=true };
+  size_t startIndex;
+  uint64_t checksum;
+  return FurcReader_header(&reader, source, &startIndex, &checksum);
+}
+
+static bool FurcReader_code(FurcReader*, Code*, size_t depth, size_t entry);
+
+static bool isInterned(Code* code, uint8_t index, ObjType type) {
+  return index < code->interns.length && code->interns.items[index]->type == type;
+}
+
+/*
+ * Checks each instruction against the code it's in, so that a damaged file
+ * can't make the interpreter read outside of it: every instruction is one
+ * this build knows, with all of its operands, the interned values and
+ * callees it indexes exist, and jumps and `entry`, where the code starts,
+ * land on an instruction or the end. Variable indices aren't checked.
+ */
+static bool validInstructions(Code* code, size_t calleeCount, size_t entry) {
+  uint8_t* instructions = code->instructions.items;
+  size_t length = code->instructions.length;
+
+  bool* starts = calloc(length + 1, sizeof(bool));
+  assert(starts != NULL); /* TODO Handle this */
+  starts[length] = true;
+
+  bool result = true;
+
+  for(size_t i = 0; result && i < length; i += 1 + Instruction_operandSize(instructions[i])) {
+    int size = Instruction_operandSize(instructions[i]);
+    starts[i] = true;
+    result = size >= 0 && (size_t)size < length - i;
+  }
+
+  for(size_t i = 0; result && i < length; i += 1 + Instruction_operandSize(instructions[i])) {
+    uint8_t* operands = instructions + i + 1;
+
+    switch(instructions[i]) {
+      case OP_INTERN:
+        result = operands[0] < code->interns.length;
+        break;
+
+      case OP_CLOSURE:
+        result = isInterned(code, operands[0], OBJ_CLOSURE);
+        break;
+
+      case OP_PROP:
+      case OP_IMPORT:
+        result = isInterned(code, operands[0], OBJ_STRING);
+        break;
+
+      case OP_GET_LATE:
+        result = isInterned(code, operands[1], OBJ_STRING);
+        break;
+
+      case OP_CALL_DIRECT:
+        result = operands[0] < calleeCount;
+        break;
+
+      case OP_NATIVE:
+        result = Code_getUInt16(code, operands) < NATIVE_COUNT;
+        break;
+
+      case OP_JUMP:
+      case OP_JUMP_IF_TRUE:
+      case OP_JUMP_IF_FALSE:
+      case OP_AND:
+      case OP_OR:
+        {
+          // Jumps are relative to their operand
+          ptrdiff_t target = (ptrdiff_t)(i + 1) + Code_getInt16(code, operands);
+          result = target >= 0 && (size_t)target <= length && starts[target];
+        } break;
+
+      default:
+        break;
+    }
+  }
+
+  result = result && entry <= length && starts[entry];
+  free(starts);
+  return result;
+}
+
+static ObjClosure* FurcReader_closure(FurcReader* self, Code* code, size_t depth) {
+  uint8_t nameLength = FurcReader_u8(self);
+  const uint8_t* name = FurcReader_bytes(self, nameLength);
+  uint8_t arity = FurcReader_u8(self);
+  uint8_t closureDepth = FurcReader_u8(self);
+  uint8_t upvalueCount = FurcReader_u8(self);
+
+  if(!self->ok || nameLength == 0) return NULL;
+  if(closureDepth == 0 || closureDepth >= MAX_CLOSURE_DEPTH) return NULL;
+
+  Code* closureCode = Code_allocateOne();
+  Code_init(closureCode);
+
+  ObjClosure* closure = ObjClosure_allocateOne();
+  ObjClosure_init(
+      closure,
+      Runtime_getSymbol(self->runtime, nameLength, (char*)name),
+      arity,
+      closureCode);
+  closure->depth = closureDepth;
+
+  // From here on, the closure is freed with `code` if loading fails
+  Code_internObject(code, (Obj*)closure);
+
+  if(self->closureCount == self->closureCapacity) {
+    self->closureCapacity = self->closureCapacity == 0 ? 16 : self->closureCapacity * 2;
+    ObjClosure** tmp = realloc(self->closures, sizeof(ObjClosure*) * self->closureCapacity);
+    assert(tmp != NULL); /* TODO Handle this */
+    self->closures = tmp;
+  }
+  self->closures[self->closureCount++] = closure;
+
+  if(upvalueCount > 0) {
+    closure->upvalueDescriptors = malloc(sizeof(UpvalueDescriptor) * upvalueCount);
+    assert(closure->upvalueDescriptors != NULL); /* TODO Handle this */
+    closure->upvalueCount = upvalueCount;
+
+    for(size_t i = 0; i < upvalueCount; i++) {
+      UpvalueDescriptor* descriptor = &(closure->upvalueDescriptors[i]);
+      descriptor->kind = FurcReader_u8(self);
+      descriptor->depth = FurcReader_u8(self);
+      descriptor->index = FurcReader_u8(self);
+
+      if(descriptor->kind > UPVALUE_UPVALUE) return NULL;
+    }
+  }
+
+  if(!FurcReader_code(self, closureCode, depth + 1, 0)) return NULL;
+
+  return closure;
+}
+
+static bool FurcReader_code(FurcReader* self, Code* code, size_t depth, size_t entry) {
+  // Don't let a malicious file recurse until the C stack overflows
+  if(depth >= MAX_CLOSURE_DEPTH) return false;
+
+  uint32_t instructionCount = FurcReader_u32(self);
+  const uint8_t* instructions = FurcReader_bytes(self, instructionCount);
+
+  uint32_t lineDeltaCount = FurcReader_u32(self);
+  const uint8_t* lineDeltas = FurcReader_bytes(self, lineDeltaCount);
+
+  if(!self->ok) return false;
+
+  for(uint32_t i = 0; i < instructionCount; i++) {
+    Code_append(code, instructions[i]);
+  }
+
+  if(!Code_decodeLines(code, lineDeltas, lineDeltaCount)) return false;
+
+  uint32_t internCount = FurcReader_u32(self);
+  if(internCount > 256) return false;
+
+  for(uint32_t i = 0; i < internCount; i++) {
+    switch(FurcReader_u8(self)) {
+      case OBJ_STRING:
+        {
+          uint32_t length = FurcReader_u32(self);
+          const uint8_t* characters = FurcReader_bytes(self, length);
+          if(characters == NULL) return false;
+
+          // Allocate at least one byte, since malloc(0) may return NULL
+          char* copy = allocateChars(length + 1);
+          memcpy(copy, characters, length);
+
+          ObjString* string = ObjString_allocateOne();
+          ObjString_init(string, length, copy);
+          Code_internObject(code, (Obj*)string);
+        } break;
+
+      case OBJ_CLOSURE:
+        if(FurcReader_closure(self, code, depth) == NULL) return false;
+        break;
+
+      default:
+        return false;
+    }
+  }
+
+  /*
+   * Callees can be closures that appear later in the file, so they're
+   * resolved once everything has been loaded.
+   */
+  uint32_t calleeCount = FurcReader_u32(self);
+  if(calleeCount > 256) return false;
+
+  for(uint32_t i = 0; i < calleeCount; i++) {
+    if(self->fixupCount == self->fixupCapacity) {
+      self->fixupCapacity = self->fixupCapacity == 0 ? 16 : self->fixupCapacity * 2;
+      FurcFixup* tmp = realloc(self->fixups, sizeof(FurcFixup) * self->fixupCapacity);
+      assert(tmp != NULL); /* TODO Handle this */
+      self->fixups = tmp;
+    }
+
+    FurcFixup* fixup = &(self->fixups[self->fixupCount++]);
+    fixup->code = code;
+    fixup->index = (uint8_t)i;
+    fixup->id = FurcReader_u32(self);
+  }
+
+  return self->ok
+    && validInstructions(code, calleeCount, entry);
+}
+
+static bool FurcReader_globals(FurcReader* self, FurcGlobals* globals) {
+  uint32_t count = FurcReader_u32(self);
+  if(!self->ok) return false;
+
+  if(globals == NULL) return count == 0;
+  if(count > MAX_FURC_GLOBALS) return false;
+
+  globals->count = 0;
+
+  for(uint32_t i = 0; i < count; i++) {
+    uint8_t nameLength = FurcReader_u8(self);
+    const uint8_t* name = FurcReader_bytes(self, nameLength);
+    uint8_t tag = FurcReader_u8(self);
+    if(!self->ok) return false;
+
+    Value value;
+
+    switch(tag) {
+      case FURC_NIL:
+        value.is_a = TYPE_NIL;
+        break;
+
+      case FURC_BOOLEAN:
+        value = Value_fromBool(FurcReader_u8(self) != 0);
+        break;
+
+      case FURC_INTEGER:
+        value = Value_fromInt32((int32_t)FurcReader_u32(self));
+        break;
+
+      case FURC_STRING:
+        {
+          uint32_t length = FurcReader_u32(self);
+          const uint8_t* characters = FurcReader_bytes(self, length);
+          if(characters == NULL) return false;
+
+          char* copy = allocateChars(length + 1);
+          memcpy(copy, characters, length);
+
+          ObjString* string = ObjString_allocateOne();
+          ObjString_init(string, length, copy);
+          value = Value_fromObj((Obj*)string);
+        } break;
+
+      case FURC_CLOSURE:
+        {
+          uint32_t id = FurcReader_u32(self);
+          if(id >= self->closureCount) return false;
+          value = Value_fromObj((Obj*)(self->closures[id]));
+        } break;
+
+      case FURC_NATIVE:
+        {
+          uint32_t index = FurcReader_u32(self);
+          if(index >= NATIVE_COUNT) return false;
+
+          ObjNative* native = ObjNative_allocateOne();
+          ObjNative_init(native, NATIVE[index].call);
+          value = Value_fromObj((Obj*)native);
+        } break;
+
+      default:
+        return false;
+    }
+
+    if(!self->ok) return false;
+
+    globals->names[i] = nameLength == 0
+      ? NULL
+      : Runtime_getSymbol(self->runtime, nameLength, (char*)name);
+    globals->values[i] = value;
+    globals->count++;
+  }
+
+  return true;
+}
+
+bool FurcImage_load(
+    FurcImage* self,
+    Runtime* runtime,
+    Code* code,
+    size_t* startIndex,
+    FurcGlobals* globals) {
+  FurcReader reader = {
+    .data=self->data,
+    .length=self->length,
+    .position=0,
+    .ok=true,
+    .runtime=runtime,
+    .closureCount=0,
+    .closureCapacity=0,
+    .closures=NULL,
+    .fixupCount=0,
+    .fixupCapacity=0,
+    .fixups=NULL,
+  };
+
+  if(globals != NULL) globals->count = 0;
+
+  FurcSource source;
+  uint64_t checksum;
+  bool result = FurcReader_header(&reader, &source, startIndex, &checksum)
+    && fnv1a(FNV_OFFSET_BASIS, self->data + FURC_HEADER_SIZE, self->length - FURC_HEADER_SIZE) == checksum
+    && FurcReader_code(&reader, code, 0, *startIndex)
+    && FurcReader_globals(&reader, globals)
+    && reader.position == reader.length;
+
+  for(size_t i = 0; result && i < reader.fixupCount; i++) {
+    FurcFixup* fixup = &(reader.fixups[i]);
+
+    // Code_addCallee deduplicates, so a duplicate would shift the indices
+    result = fixup->id < reader.closureCount
+      && Code_addCallee(fixup->code, (Obj*)(reader.closures[fixup->id])) == fixup->index;
+  }
+
+  free(reader.closures);
+  free(reader.fixups);
+
+  if(!result) {
+    // Closures belong to the code, but strings and natives were made for the globals
+    for(size_t i = 0; globals != NULL && i < globals->count; i++) {
+      Value value = globals->values[i];
+
+      if(value.is_a == TYPE_OBJ && value.as.obj->type != OBJ_CLOSURE) {
+        Obj_free(value.as.obj);
+      }
+    }
+    if(globals != NULL) globals->count = 0;
+
+    Code_free(code);
+    Code_init(code);
+  }
+
+  return result;
+}
@@ -0,0 +1,146 @@
+#ifndef FUR_FURC_H
+#define FUR_FURC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "code.h"
+#include "runtime.h"
+#include "symbol.h"
+#include "value.h"
+
+/*
+ * A .furc file is a compiled Code tree, so that `fur` can skip scanning,
+ * parsing and compiling a program which hasn't changed since it was last
+ * compiled. All integers are little-endian.
+ *
+ *   header:
+ *     "FURC"              magic
+ *     u16 version         FURC_VERSION
+ *     u16 reserved        0
+ *     u32 natives         Fingerprint of the native table (OP_NATIVE indices)
+ *     u32 startIndex      Where Thread_start starts in the module's code
+ *     u64 sourceHash      FNV-1a of the source the file was compiled from
+ *     u64 sourceSize
+ *     i64 sourceMtime     In nanoseconds
+ *     u64 checksum        FNV-1a of everything after the header
+ *
+ *   code:
+ *     u32 count, count bytes           instructions
+ *     u32 count, count bytes           line table, as LineTable.deltas
+ *     u32 count, count * intern        interns
+ *     u32 count, count * u32           callees, as closure ids
+ *
+ *   globals:
+ *     u32 count, count * (u8 length, name, value)
+ *
+ *   value:
+ *     u8 FURC_NIL
+ *     u8 FURC_BOOLEAN, u8 boolean
+ *     u8 FURC_INTEGER, u32 integer
+ *     u8 FURC_STRING, u32 length, bytes
+ *     u8 FURC_CLOSURE, u32 closure id
+ *     u8 FURC_NATIVE, u32 index in NATIVE
+ *
+ *   intern:
+ *     u8 OBJ_STRING, u32 length, bytes
+ *     u8 OBJ_CLOSURE, u8 length, name, u8 arity, u8 depth,
+ *       u8 upvalueCount, upvalueCount * (u8 kind, u8 depth, u8 index), code
+ *
+ * Closures are numbered in the order they appear in the file, which is how
+ * callees and globals refer to them.
+ *
+ * A file written by fur_compile has no globals. A snapshot, written by
+ * `fur --snapshot`, holds the module's code and its variables as they were
+ * after the module ran, so another program or the REPL can start from
+ * there without running the module again. Its startIndex is the end of the
+ * code.
+ *
+ * The loader can't tell whether the instructions were compiled by the same
+ * version of the compiler, so bump FURC_VERSION whenever the instruction set
+ * or this layout changes.
+ */
+#define FURC_VERSION 5
+
+typedef struct {
+  uint64_t hash;
+  uint64_t size;
+  int64_t mtime;
+} FurcSource;
+
+/*
+ * A read-only mapping of a .furc file. Closure names in the loaded Code are
+ * symbols, which don't own their text, so the image must stay mapped until
+ * the Runtime is freed.
+ */
+typedef struct {
+  const uint8_t* data;
+  size_t length;
+} FurcImage;
+
+uint64_t Furc_hashSource(const char* source, size_t length);
+
+/*
+ * Fills in the size and modification time of the file at `path`, but not
+ * the hash. Returns false if the file can't be stat'ed.
+ */
+bool FurcSource_stat(FurcSource*, const char* path);
+
+/*
+ * Returns a newly allocated path for the cache of the source file at `path`,
+ * which is the same path with a "c" appended: "program.fur" is cached in
+ * "program.furc".
+ */
+char* Furc_cachePath(const char* path);
+
+#define MAX_FURC_GLOBALS 256
+
+/*
+ * The module's variables, in stack order. Names are NULL for the
+ * compiler's unnamed temporaries.
+ */
+typedef struct {
+  size_t count;
+  Symbol* names[MAX_FURC_GLOBALS];
+  Value values[MAX_FURC_GLOBALS];
+} FurcGlobals;
+
+bool Furc_write(FILE*, Code*, size_t startIndex, FurcSource*);
+
+/*
+ * Fails without writing anything if a global can't be saved, setting
+ * `unwritable` to its index: a closure with upvalues, whose upvalues aren't
+ * saved, or a value the code doesn't have, such as a channel, a module or
+ * a closure from another module. Otherwise `unwritable` is the count of
+ * globals, and a false result means writing the file failed.
+ */
+bool Furc_writeSnapshot(FILE*, Code*, FurcGlobals*, size_t* unwritable);
+
+bool FurcImage_map(FurcImage*, const char* path);
+void FurcImage_unmap(FurcImage*);
+
+/*
+ * Reads the source the image was compiled from. Returns false if the image
+ * isn't a .furc file this build of Fur can load.
+ */
+bool FurcImage_source(FurcImage*, FurcSource*);
+
+/*
+ * Loads the image into `code`, which must be initialized and empty, and its
+ * globals into `globals`, which may be NULL if it isn't a snapshot. Strings
+ * and natives in the globals are newly allocated and belong to the caller;
+ * closures belong to `code`. Returns false if the image is invalid, in which
+ * case `code` is left empty and there are no globals. Instructions are checked
+ * against the code they're in, but not the variables they use, so an image
+ * should only be loaded if it was written by Fur.
+ */
+bool FurcImage_load(
+    FurcImage*,
+    Runtime*,
+    Code*,
+    size_t* startIndex,
+    FurcGlobals* globals);
+
+#endif
@@ -1,6 +1,8 @@
 import os
 import os.path
 import subprocess
+import tempfile
+import threading
 import unittest
 
 # Go to the directory of the current file so we know where we are in the filesystem
@@ -44,6 +46,158 @@ def add_output_test(filename):
 
     setattr(OutputTests, 'test_' + filename[:-4], test)
 
+class CompiledOutputTests(unittest.TestCase):
+    pass
+
+def add_compiled_output_test(filename):
+    def test(self):
+        with tempfile.TemporaryDirectory() as directory:
+            compiled_path = os.path.join(directory, filename + 'c')
+
+            compile_return = subprocess.call(
+                (
+                    './fur_compile',
+                    '-o',
+                    compiled_path,
+                    os.path.join('test', filename),
+                ),
+                stdout=subprocess.DEVNULL,
+                stderr=subprocess.DEVNULL,
+            )
+
+            self.assertEqual(0, compile_return)
+
+            p = subprocess.Popen(
+                (
+                    './fur',
+                    compiled_path,
+                ),
+                stdout=subprocess.PIPE,
+                stderr=subprocess.PIPE,
+            )
+
+            actual_stdout, actual_stderr = p.communicate()
+
+        expected_stdout_path = os.path.join('test', filename[:-3] + 'stdout.txt')
+
+        if os.path.isfile(expected_stdout_path):
+            with open(expected_stdout_path, 'rb') as f:
+                expected_stdout = f.read()
+        else:
+            expected_stdout = b''
+
+        self.assertEqual(expected_stdout, actual_stdout)
+
+    setattr(CompiledOutputTests, 'test_' + filename[:-4], test)
+
+class StreamedOutputTests(unittest.TestCase):
+    pass
+
+class PipelinedOutputTests(unittest.TestCase):
+    pass
+
+class EagerPipelinedOutputTests(unittest.TestCase):
+    pass
+
+class ParallelCompileOutputTests(unittest.TestCase):
+    pass
+
+class WorkerOutputTests(unittest.TestCase):
+    pass
+
+def add_output_test_with_options(test_class, options, filename):
+    def test(self):
+        p = subprocess.Popen(
+            ('./fur',) + options + (os.path.join('test', filename),),
+            stdout=subprocess.PIPE,
+            stderr=subprocess.PIPE,
+        )
+
+        actual_stdout, actual_stderr = p.communicate()
+
+        expected_stdout_path = os.path.join('test', filename[:-3] + 'stdout.txt')
+
+        if os.path.isfile(expected_stdout_path):
+            with open(expected_stdout_path, 'rb') as f:
+                expected_stdout = f.read()
+        else:
+            expected_stdout = b''
+
+        self.assertEqual(expected_stdout, actual_stdout)
+
+    setattr(test_class, 'test_' + filename[:-4], test)
+
+class AotOutputTests(unittest.TestCase):
+    pass
+
+# What fur_aot reports for the programs it can't translate: those which
+# spawn threads or import modules
+AOT_UNSUPPORTED = b" isn't supported in generated C.\n"
+
+# The objects a program generated by fur_aot links against
+AOT_OBJECTS = (
+    'aot.o',
+    'code.o',
+    'furc.o',
+    'io.o',
+    'module.o',
+    'object.o',
+    'runtime.o',
+    'scheduler.o',
+    'symbol.o',
+    'symbol_table.o',
+    'thread.o',
+    'value.o',
+)
+
+def add_aot_output_test(filename):
+    def test(self):
+        with tempfile.TemporaryDirectory() as directory:
+            c_path = os.path.join(directory, filename[:-4] + '.c')
+            executable_path = os.path.join(directory, filename[:-4])
+
+            translate = subprocess.Popen(
+                (
+                    './fur_aot',
+                    '-o',
+                    c_path,
+                    os.path.join('test', filename),
+                ),
+                stdout=subprocess.DEVNULL,
+                stderr=subprocess.PIPE,
+            )
+
+            _, translate_stderr = translate.communicate()
+
+            if translate.returncode != 0 and translate_stderr.endswith(AOT_UNSUPPORTED):
+                self.skipTest(translate_stderr.decode().strip())
+
+            self.assertEqual(0, translate.returncode, translate_stderr)
+
+            subprocess.check_call(
+                ('cc', '-pthread', '-I.', c_path) + AOT_OBJECTS + ('-o', executable_path),
+            )
+
+            p = subprocess.Popen(
+                (executable_path,),
+                stdout=subprocess.PIPE,
+                stderr=subprocess.PIPE,
+            )
+
+            actual_stdout, actual_stderr = p.communicate()
+
+        expected_stdout_path = os.path.join('test', filename[:-3] + 'stdout.txt')
+
+        if os.path.isfile(expected_stdout_path):
+            with open(expected_stdout_path, 'rb') as f:
+                expected_stdout = f.read()
+        else:
+            expected_stdout = b''
+
+        self.assertEqual(expected_stdout, actual_stdout)
+
+    setattr(AotOutputTests, 'test_' + filename[:-4], test)
+
 class MemoryLeakTests(unittest.TestCase):
     pass
 
@@ -80,6 +234,13 @@ filenames = (
 
 for filename in filenames:
     add_output_test(filename)
+    add_compiled_output_test(filename)
+    add_output_test_with_options(StreamedOutputTests, ('--stream',), filename)
+    add_output_test_with_options(PipelinedOutputTests, ('--pipeline',), filename)
+    add_output_test_with_options(EagerPipelinedOutputTests, ('--eager', '--pipeline'), filename)
+    add_output_test_with_options(ParallelCompileOutputTests, ('--jobs', '4'), filename)
+    add_output_test_with_options(WorkerOutputTests, ('--workers', '4'), filename)
+    add_aot_output_test(filename)
     add_memory_leak_test(filename)
 
 class ScannerTests(unittest.TestCase):
@@ -123,6 +284,598 @@ def add_scanner_test(filename):
 
     setattr(ScannerTests, 'test_' + filename[:-len('.source.txt')], test)
 
+class SnapshotTests(unittest.TestCase):
+    def test_program_uses_library_snapshot(self):
+        with tempfile.TemporaryDirectory() as directory:
+            snapshot_path = os.path.join(directory, 'lib.furc')
+
+            subprocess.check_call(
+                (
+                    './fur',
+                    '--snapshot',
+                    snapshot_path,
+                    os.path.join('test', 'snapshot', 'lib.fur'),
+                ),
+            )
+
+            p = subprocess.Popen(
+                (
+                    './fur',
+                    '-i',
+                    snapshot_path,
+                    os.path.join('test', 'snapshot', 'program.fur'),
+                ),
+                stdout=subprocess.PIPE,
+                stderr=subprocess.PIPE,
+            )
+
+            actual_stdout, actual_stderr = p.communicate()
+
+        with open(os.path.join('test', 'snapshot', 'program.stdout.txt'), 'rb') as f:
+            expected_stdout = f.read()
+
+        self.assertEqual(expected_stdout, actual_stdout)
+        self.assertEqual(b'', actual_stderr)
+
+    def assert_snapshot_fails(self, source, message):
+        with tempfile.TemporaryDirectory() as directory:
+            source_path = os.path.join(directory, 'lib.fur')
+            snapshot_path = os.path.join(directory, 'lib.furc')
+
+            with open(source_path, 'w') as f:
+                f.write(source)
+
+            p = subprocess.Popen(
+                ('./fur', '--snapshot', snapshot_path, source_path),
+                stdout=subprocess.PIPE,
+                stderr=subprocess.PIPE,
+            )
+
+            actual_stdout, actual_stderr = p.communicate()
+
+            self.assertFalse(os.path.exists(snapshot_path))
+
+        self.assertEqual(1, p.returncode)
+        self.assertIn(message, actual_stderr)
+
+    def test_snapshot_with_channel_fails(self):
+        self.assert_snapshot_fails(
+            'c = channel(1)\n',
+            b'Variable "c" is a channel, which can\'t be saved.',
+        )
+
+    def test_snapshot_with_closure_with_upvalues_fails(self):
+        self.assert_snapshot_fails(
+            'def make(n):\n  def get(): n end\n  get\nend\ng = make(2)\n',
+            b'Variable "g" is a closure with upvalues, which can\'t be saved.',
+        )
+
+class CompiledImageTests(unittest.TestCase):
+    HEADER_SIZE = 48
+
+    def run_damaged_image(self, damage):
+        with tempfile.TemporaryDirectory() as directory:
+            source_path = os.path.join(directory, 'program.fur')
+            compiled_path = source_path + 'c'
+
+            with open(source_path, 'w') as f:
+                f.write('x = 1000\nprint(x)\n')
+
+            subprocess.check_call(('./fur_compile', '-o', compiled_path, source_path), stdout=subprocess.DEVNULL)
+
+            with open(compiled_path, 'rb') as f:
+                image = bytearray(f.read())
+
+            damage(image)
+
+            # Fix the checksum, so that only the damage is wrong
+            checksum = 14695981039346656037
+            for byte in image[self.HEADER_SIZE:]:
+                checksum = ((checksum ^ byte) * 1099511628211) % 2 ** 64
+            image[40:48] = checksum.to_bytes(8, 'little')
+
+            with open(compiled_path, 'wb') as f:
+                f.write(image)
+
+            p = subprocess.Popen(('./fur', compiled_path), stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+            actual_stdout, actual_stderr = p.communicate()
+
+        self.assertEqual(1, p.returncode)
+        self.assertEqual(b'', actual_stdout)
+        self.assertIn(b'Invalid compiled file', actual_stderr)
+
+    def test_unknown_instruction_is_rejected(self):
+        def damage(image):
+            image[self.HEADER_SIZE + 4] = 0xff
+
+        self.run_damaged_image(damage)
+
+    def test_start_inside_instruction_is_rejected(self):
+        def damage(image):
+            image[12:16] = (1).to_bytes(4, 'little')
+
+        self.run_damaged_image(damage)
+
+class LineTableTests(unittest.TestCase):
+    def assembly_lines(self, source):
+        with tempfile.TemporaryDirectory() as directory:
+            source_path = os.path.join(directory, 'lines.fur')
+
+            with open(source_path, 'w') as f:
+                f.write(source)
+
+            output = subprocess.check_output(('./fur_compile', source_path))
+
+        # Each line ends with "; inst: <offset>, line:<line>"
+        return [
+            (line.split()[0], int(line.rsplit('line:', 1)[1]))
+            for line in output.decode().splitlines()
+        ]
+
+    def test_operators_spanning_lines(self):
+        lines = self.assembly_lines('x = 1\ny = x +\n  2\nz = -\n  x\n')
+
+        self.assertIn(('add_int', 2), lines)
+        self.assertIn(('neg_int', 4), lines)
+
+class StreamTests(unittest.TestCase):
+    def write_large_program(self, path):
+        # Long enough that tokens straddle several refills of the buffer
+        lines = ['total = 0']
+
+        for i in range(20000):
+            lines.append('{}a_rather_long_variable_name_{} = total + {}'.format(' ' * (i % 7), i % 100, i))
+            lines.append('total = a_rather_long_variable_name_{}'.format(i % 100))
+
+            # Each string literal is interned, so only a few of them
+            if i % 1000 == 0:
+                lines.append("label = '{}'".format('x' * (1000 + i)))
+
+        lines.append('print(total)')
+        lines.append("print('\\n')")
+        lines.append('print(label)')
+
+        with open(path, 'w') as f:
+            f.write('\n'.join(lines) + '\n')
+
+    def run_large_program(self, options):
+        with tempfile.TemporaryDirectory() as directory:
+            source_path = os.path.join(directory, 'large.fur')
+            self.write_large_program(source_path)
+
+            p = subprocess.Popen(
+                ('./fur',) + options + (source_path,),
+                stdout=subprocess.PIPE,
+                stderr=subprocess.PIPE,
+            )
+
+            actual_stdout, actual_stderr = p.communicate()
+
+        expected_stdout = '{}\n{}'.format(sum(range(20000)), 'x' * 20000).encode()
+
+        self.assertEqual(expected_stdout, actual_stdout)
+        self.assertEqual(b'', actual_stderr)
+
+    def test_program_larger_than_stream_buffer(self):
+        self.run_large_program(('--stream',))
+
+    def test_pipelined_program_larger_than_stream_buffer(self):
+        self.run_large_program(('--stream', '--pipeline'))
+
+class SchedulerTests(unittest.TestCase):
+    def run_threads(self, workers):
+        # Each thread spawns another, so workers steal from each other
+        source = '\n'.join((
+            'def leaf(n):',
+            '  i = 0',
+            '  while i < n:',
+            '    i = i + 1',
+            '  end',
+            "  print('.')",
+            'end',
+            'def branch(n):',
+            '  spawn(leaf, n)',
+            'end',
+            'k = 0',
+            'while k < 5000:',
+            '  spawn(branch, k)',
+            '  spawn(leaf, 5000 - k)',
+            '  k = k + 1',
+            'end',
+        )) + '\n'
+
+        with tempfile.TemporaryDirectory() as directory:
+            source_path = os.path.join(directory, 'threads.fur')
+
+            with open(source_path, 'w') as f:
+                f.write(source)
+
+            p = subprocess.Popen(
+                ('./fur', '--workers', str(workers), source_path),
+                stdout=subprocess.PIPE,
+                stderr=subprocess.PIPE,
+            )
+
+            actual_stdout, actual_stderr = p.communicate()
+
+        self.assertEqual(b'.' * 10000, actual_stdout)
+        self.assertEqual(b'', actual_stderr)
+
+    def test_ten_thousand_threads_on_one_worker(self):
+        self.run_threads(1)
+
+    def test_ten_thousand_threads_on_several_workers(self):
+        self.run_threads(4)
+
+    def run_source(self, source, workers):
+        with tempfile.TemporaryDirectory() as directory:
+            source_path = os.path.join(directory, 'threads.fur')
+
+            with open(source_path, 'w') as f:
+                f.write(source)
+
+            p = subprocess.Popen(
+                ('./fur', '--workers', str(workers), source_path),
+                stdout=subprocess.PIPE,
+                stderr=subprocess.PIPE,
+            )
+
+            actual_stdout, actual_stderr = p.communicate()
+
+        return p.returncode, actual_stdout, actual_stderr
+
+    def test_channel_between_many_threads(self):
+        # Senders outnumber the channel's capacity, so most of them wait
+        source = '\n'.join((
+            'values = channel(2)',
+            'def produce(n):',
+            '  i = 0',
+            '  while i < n:',
+            '    send(values, 1)',
+            '    i = i + 1',
+            '  end',
+            'end',
+            'k = 0',
+            'while k < 100:',
+            '  spawn(produce, 100)',
+            '  k = k + 1',
+            'end',
+            'total = 0',
+            'while total < 10000:',
+            '  total = total + receive(values)',
+            'end',
+            "if total == 10000:",
+            "  print('ok')",
+            'end',
+        )) + '\n'
+
+        for workers in (1, 4):
+            returncode, actual_stdout, actual_stderr = self.run_source(source, workers)
+            self.assertEqual(0, returncode)
+            self.assertEqual(b'ok', actual_stdout)
+            self.assertEqual(b'', actual_stderr)
+
+    def test_busy_thread_takes_turns(self):
+        # The loop would run for seconds if the other thread waited for it
+        source = '\n'.join((
+            'def spin(n):',
+            '  i = 0',
+            '  while i < n:',
+            '    i = i + 1',
+            '  end',
+            "  print('slow')",
+            'end',
+            'def quick():',
+            "  print('fast')",
+            'end',
+            'spawn(spin, 1000000)',
+            'spawn(quick)',
+        )) + '\n'
+
+        returncode, actual_stdout, actual_stderr = self.run_source(source, 1)
+        self.assertEqual(0, returncode)
+        self.assertEqual(b'fastslow', actual_stdout)
+        self.assertEqual(b'', actual_stderr)
+
+    def test_threads_waiting_for_input(self):
+        # Readers wait for input while the only worker runs the rest
+        source = '\n'.join((
+            'def read():',
+            "  input('')",
+            "  print('.')",
+            'end',
+            'k = 0',
+            'while k < 100:',
+            '  spawn(read)',
+            '  k = k + 1',
+            'end',
+            'i = 0',
+            'while i < 100000:',
+            '  i = i + 1',
+            'end',
+            "print('ready\\n')",
+        )) + '\n'
+
+        with tempfile.TemporaryDirectory() as directory:
+            source_path = os.path.join(directory, 'threads.fur')
+
+            with open(source_path, 'w') as f:
+                f.write(source)
+
+            p = subprocess.Popen(
+                ('./fur', '--workers', '1', source_path),
+                stdin=subprocess.PIPE,
+                stdout=subprocess.PIPE,
+                stderr=subprocess.PIPE,
+            )
+
+            timer = threading.Timer(10, p.kill)
+            timer.start()
+
+            try:
+                ready = p.stdout.readline()
+                actual_stdout, actual_stderr = p.communicate(b'line\n' * 100)
+            finally:
+                timer.cancel()
+
+        self.assertEqual(b'ready\n', ready)
+        self.assertEqual(b'.' * 100, actual_stdout)
+        self.assertEqual(b'', actual_stderr)
+
+    def test_every_thread_waiting(self):
+        source = "values = channel(2)\nprint(receive(values))\n"
+
+        for workers in (1, 4):
+            returncode, actual_stdout, actual_stderr = self.run_source(source, workers)
+            self.assertEqual(1, returncode)
+            self.assertEqual(b'Every thread is waiting, so none can go on.\n', actual_stderr)
+
+class ImportTests(unittest.TestCase):
+    def run_program(self, files, workers):
+        with tempfile.TemporaryDirectory() as directory:
+            for name, source in files.items():
+                with open(os.path.join(directory, name), 'w') as f:
+                    f.write(source)
+
+            p = subprocess.Popen(
+                ('./fur', '--workers', str(workers), os.path.join(directory, 'main.fur')),
+                stdout=subprocess.PIPE,
+                stderr=subprocess.PIPE,
+            )
+
+            actual_stdout, actual_stderr = p.communicate()
+
+        return p.returncode, actual_stdout, actual_stderr
+
+    def test_module_imported_by_many_modules_runs_once(self):
+        count = 50
+        files = {
+            'shared.fur': "print('shared ')\nvalue = 1\n",
+            'main.fur': ''.join(
+                "import './part{}.fur' as part{}\n".format(i, i)
+                for i in range(count)
+            ) + 'total = 0\n' + ''.join(
+                'total = total + part{}.value\n'.format(i)
+                for i in range(count)
+            ) + 'print(total)\n',
+        }
+
+        for i in range(count):
+            files['part{}.fur'.format(i)] = (
+                "import 'shared.fur' as shared\n"
+                'value = shared.value + {}\n'.format(i)
+            )
+
+        expected = 'shared {}'.format(count + count * (count - 1) // 2).encode()
+
+        for workers in (1, 4):
+            returncode, actual_stdout, actual_stderr = self.run_program(files, workers)
+            self.assertEqual(0, returncode)
+            self.assertEqual(expected, actual_stdout)
+            self.assertEqual(b'', actual_stderr)
+
+    def test_modules_waiting_for_each_other(self):
+        files = {
+            'main.fur': "import 'a.fur' as a\nprint(a.x)\n",
+            'a.fur': "import 'b.fur' as b\nx = b.y\n",
+            'b.fur': "import 'a.fur' as a\ny = a.x\n",
+        }
+
+        for workers in (1, 4):
+            returncode, actual_stdout, actual_stderr = self.run_program(files, workers)
+            self.assertEqual(1, returncode)
+            self.assertEqual(b'Every thread is waiting, so none can go on.\n', actual_stderr)
+
+class CollectorTests(unittest.TestCase):
+    def run_garbage(self, source, workers):
+        with tempfile.TemporaryDirectory() as directory:
+            source_path = os.path.join(directory, 'garbage.fur')
+            stdout_path = os.path.join(directory, 'stdout.txt')
+
+            with open(source_path, 'w') as f:
+                f.write(source)
+
+            # Waits with wait4 rather than communicate, for the peak memory
+            with open(stdout_path, 'wb') as stdout:
+                p = subprocess.Popen(
+                    ('./fur', '--workers', str(workers), source_path),
+                    stdout=stdout,
+                    stderr=subprocess.DEVNULL,
+                )
+
+                _, status, usage = os.wait4(p.pid, 0)
+
+            with open(stdout_path, 'rb') as f:
+                actual_stdout = f.read()
+
+        return os.waitstatus_to_exitcode(status), actual_stdout, usage.ru_maxrss
+
+    def test_garbage_is_collected(self):
+        # Without collecting, the strings alone take several hundred megabytes
+        source = '\n'.join((
+            'def churn(n):',
+            "  s = ''",
+            '  i = 0',
+            '  while i < n:',
+            "    s = 'garbage ' + 'string'",
+            '    i = i + 1',
+            '  end',
+            '  s',
+            'end',
+            'print(churn(3000000))',
+        )) + '\n'
+
+        for workers in (1, 4):
+            returncode, actual_stdout, max_rss_kb = self.run_garbage(source, workers)
+            self.assertEqual(0, returncode)
+            self.assertEqual(b'garbage string', actual_stdout)
+            self.assertLess(max_rss_kb, 64 * 1024)
+
+    def test_garbage_is_collected_on_spawned_threads(self):
+        source = '\n'.join((
+            'results = channel(4)',
+            'def churn(n):',
+            "  s = ''",
+            '  i = 0',
+            '  while i < n:',
+            "    s = 'garbage ' + 'string'",
+            '    i = i + 1',
+            '  end',
+            '  send(results, s)',
+            'end',
+            'k = 0',
+            'while k < 4:',
+            '  spawn(churn, 1000000)',
+            '  k = k + 1',
+            'end',
+            'k = 0',
+            'while k < 4:',
+            '  print(receive(results))',
+            '  k = k + 1',
+            'end',
+        )) + '\n'
+
+        for workers in (1, 4):
+            returncode, actual_stdout, max_rss_kb = self.run_garbage(source, workers)
+            self.assertEqual(0, returncode)
+            self.assertEqual(b'garbage string' * 4, actual_stdout)
+            self.assertLess(max_rss_kb, 64 * 1024)
+
+class DocumentTests(unittest.TestCase):
+    def parse_document(self, source, edits=()):
+        with tempfile.TemporaryDirectory() as directory:
+            source_path = os.path.join(directory, 'document.fur')
+
+            with open(source_path, 'w') as f:
+                f.write(source)
+
+            stdin = b''.join(
+                '{} {} {}\n'.format(start, end, len(text.encode())).encode() + text.encode()
+                for start, end, text in edits
+            )
+
+            p = subprocess.Popen(
+                ('./fur_parse', '--document', source_path),
+                stdin=subprocess.PIPE,
+                stdout=subprocess.PIPE,
+                stderr=subprocess.PIPE,
+            )
+
+            actual_stdout, actual_stderr = p.communicate(stdin)
+
+        self.assertEqual(b'', actual_stderr)
+        self.assertEqual(0, p.returncode)
+
+        lines = actual_stdout.decode().splitlines()
+        reports = [line for line in lines if line.startswith('edit: ')]
+        statements = [line for line in lines if not line.startswith('edit: ')]
+        return reports, statements
+
+    def assert_edits_match_parse(self, source, edits):
+        reports, statements = self.parse_document(source, edits)
+
+        for start, end, text in edits:
+            source = source[:start] + text + source[end:]
+
+        _, expected = self.parse_document(source)
+        self.assertEqual(expected, statements)
+        return reports
+
+    def test_edits_reparse_only_nearby_statements(self):
+        with open(os.path.join('test', '59_many_functions.fur')) as f:
+            source = f.read()
+
+        middle = source.index('def f20(')
+        body = source.index('\n', middle) + 1
+        edits = (
+            (middle, middle, 'inserted = 1\n'),
+            (middle, middle + len('inserted'), 'renamed'),
+            (body + len('renamed = 1\n'), body + len('renamed = 1\n'), '  extra = 2\n'),
+            (len(source) + len('renamed = 1\n  extra = 2\n'),) * 2 + ('print(renamed)\n',),
+        )
+
+        reports = self.assert_edits_match_parse(source, edits)
+
+        for report in reports:
+            self.assertLessEqual(int(report.split()[2]), 4, report)
+
+    def test_breaking_and_fixing_a_definition(self):
+        with open(os.path.join('test', '59_many_functions.fur')) as f:
+            source = f.read()
+
+        middle = source.index('def f20(')
+        edits = (
+            (middle, middle + len('def'), 'df'),
+            (middle, middle + len('df'), 'def'),
+        )
+
+        self.assert_edits_match_parse(source, edits)
+
+    def test_unfinished_statement_at_end(self):
+        source = 'x = 1\ny = 2\n'
+        edits = (
+            (len(source), len(source), 'def f(n):\n  n + x\n'),
+        )
+
+        self.assertEqual(
+            ['1: (= x 1)', '2: (= y 2)', 'incomplete from line 3'],
+            self.parse_document(source, edits)[1],
+        )
+
+        edits += ((len(source) + len('def f(n):\n  n + x\n'), len(source) + len('def f(n):\n  n + x\n'), 'end\n'),)
+        self.assert_edits_match_parse(source, edits)
+
+    def test_edit_which_joins_statements(self):
+        source = 'x = 1\ny = 2\nprint(x)\n'
+        self.assert_edits_match_parse(source, ((6, 10, '- '),))
+
+    def test_statement_which_does_not_parse(self):
+        source = 'x = 1\ny = 2\nprint(x)\n'
+
+        for text in ('1 + * 2', 'else 2'):
+            edits = ((10, 11, text),)
+
+            self.assertEqual(
+                ['1: (= x 1)', 'incomplete from line 2'],
+                self.parse_document(source, edits)[1],
+            )
+
+            self.assert_edits_match_parse(source, edits + ((10, 10 + len(text), '2'),))
+
+    def test_token_which_no_expression_uses(self):
+        self.assertEqual(
+            ['incomplete from line 1'],
+            self.parse_document('def f(): 1 + end\n(1)\n')[1],
+        )
+
+        self.assertEqual(
+            ['1: (= x 1)', 'incomplete from line 1'],
+            self.parse_document('x = 1 as 2\n')[1],
+        )
+
+        source = 'x = 1\n'
+        self.assert_edits_match_parse(source, ((5, 5, ' as 2'), (5, 10, '')))
+
 #filenames = (
 #    entry.name
 #    for entry in os.scandir(os.path.join('test','scanner'))
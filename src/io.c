@@ -0,0 +1,202 @@
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "object.h"
+#include "scheduler.h"
+#include "thread.h"
+#include "value.h"
+
+/*
+ * In a scheduler, print and input don't make the OS thread wait: they only
+ * read or write when poll() says the file descriptor is ready, and
+ * otherwise park the calling thread with Scheduler_waitForIo until it is.
+ * A parked native is called again from the start once it's woken, so
+ * `ioProgress` counts the bytes of its output the thread has written.
+ *
+ * Standard input and output aren't made non-blocking, since other
+ * processes may share them. Instead at most PIPE_BUF bytes are written at
+ * a time, which a pipe that polls as writable takes without blocking.
+ */
+
+#define INPUT_CHUNK 4096
+
+static pthread_mutex_t outputLock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * What has been read from standard input and not yet taken by input, so
+ * that what was read past a line is kept for the next.
+ */
+static pthread_mutex_t inputLock = PTHREAD_MUTEX_INITIALIZER;
+static char* inputText = NULL;
+static size_t inputLength = 0;
+static size_t inputCapacity = 0;
+static bool inputEnded = false;
+
+inline static bool isReady(int fd, short events) {
+  struct pollfd pollFd = { .fd=fd, .events=events, .revents=0 };
+  return poll(&pollFd, 1, 0) > 0;
+}
+
+/*
+ * Writes a piece of a print's output, which starts `*offset` bytes into
+ * it, skipping whatever was written before the thread was parked, and
+ * moves `*offset` past it. Returns false if the thread was parked.
+ */
+static bool writeOutput(Thread* thread, const char* text, size_t length, size_t* offset) {
+  size_t start = *offset;
+  *offset += length;
+
+  while(thread->ioProgress < *offset) {
+    size_t from = thread->ioProgress - start;
+    size_t chunk = length - from < PIPE_BUF ? length - from : PIPE_BUF;
+    ssize_t written = 0;
+
+    pthread_mutex_lock(&outputLock);
+
+    // Anything printed with stdio, like the REPL's results, goes first
+    fflush(stdout);
+
+    if(isReady(STDOUT_FILENO, POLLOUT)) {
+      written = write(STDOUT_FILENO, text + from, chunk);
+    }
+
+    pthread_mutex_unlock(&outputLock);
+
+    if(written > 0) {
+      thread->ioProgress += written;
+    } else if(written < 0 && errno == EINTR) {
+      continue;
+    } else if(written < 0 && errno != EAGAIN) {
+      // Output which can't be written is dropped, as printf would drop it
+      thread->ioProgress = *offset;
+    } else if(Scheduler_waitForIo(thread, STDOUT_FILENO, POLLOUT)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static bool printValues(Thread* thread, uint8_t argc, Value* argv) {
+  size_t offset = 0;
+
+  for(uint8_t i = 0; i < argc; i++) {
+    bool written;
+
+    switch(argv[i].is_a) {
+      case TYPE_NIL:
+        written = writeOutput(thread, "nil", 3, &offset);
+        break;
+
+      case TYPE_BOOLEAN:
+        if(argv[i].as.boolean) {
+          written = writeOutput(thread, "true", 4, &offset);
+        } else {
+          written = writeOutput(thread, "false", 5, &offset);
+        } break;
+
+      case TYPE_INTEGER:
+        {
+          char buffer[32];
+          int length = snprintf(buffer, sizeof(buffer), "%i", argv[i].as.integer);
+          written = writeOutput(thread, buffer, length, &offset);
+        } break;
+
+      case TYPE_OBJ:
+        {
+          assert(argv[i].as.obj->type == OBJ_STRING);
+
+          ObjString* s = (ObjString*)(argv[i].as.obj);
+          written = writeOutput(thread, s->characters, s->length, &offset);
+        } break;
+
+      default:
+        assert(false); // TODO Handle other types
+    }
+
+    if(!written) return false;
+  }
+
+  return true;
+}
+
+Value nativePrint(Thread* thread, uint8_t argc, Value* argv) {
+  Value result;
+  result.is_a = TYPE_NIL;
+
+  if(printValues(thread, argc, argv)) thread->ioProgress = 0;
+  return result;
+}
+
+inline static char* findNewline(void) {
+  return inputLength == 0 ? NULL : memchr(inputText, '\n', inputLength);
+}
+
+Value nativeInput(Thread* thread, uint8_t argc, Value* argv) {
+  assert(argc == 1);
+  Value v = *argv;
+  assert(v.is_a == TYPE_OBJ);
+  assert(v.as.obj->type == OBJ_STRING);
+
+  Value result;
+  result.is_a = TYPE_NIL;
+
+  // Once the prompt is written, this skips it when called again
+  if(!printValues(thread, 1, argv)) return result;
+
+  pthread_mutex_lock(&inputLock);
+  char* newline;
+
+  while((newline = findNewline()) == NULL && !inputEnded) {
+    if(!isReady(STDIN_FILENO, POLLIN)) {
+      pthread_mutex_unlock(&inputLock);
+      if(Scheduler_waitForIo(thread, STDIN_FILENO, POLLIN)) return result;
+
+      pthread_mutex_lock(&inputLock);
+      continue;
+    }
+
+    if(inputLength + INPUT_CHUNK > inputCapacity) {
+      inputCapacity = (inputLength + INPUT_CHUNK) * 2;
+      inputText = realloc(inputText, inputCapacity);
+      assert(inputText != NULL); /* TODO Handle this */
+    }
+
+    ssize_t count = read(STDIN_FILENO, inputText + inputLength, INPUT_CHUNK);
+
+    if(count > 0) {
+      inputLength += count;
+    } else if(count == 0 || (errno != EINTR && errno != EAGAIN)) {
+      inputEnded = true;
+    }
+  }
+
+  // Like fgets, this keeps the newline, and at the end takes what's left
+  size_t length = newline == NULL ? inputLength : (size_t)(newline - inputText) + 1;
+
+  char* buffer = malloc(length + 1);
+  assert(buffer != NULL); /* TODO Handle this */
+  memcpy(buffer, inputText, length);
+  buffer[length] = '\0';
+
+  memmove(inputText, inputText + length, inputLength - length);
+  inputLength -= length;
+
+  pthread_mutex_unlock(&inputLock);
+  thread->ioProgress = 0;
+
+  ObjString* objString = malloc(sizeof(ObjString));
+  ObjString_init(objString, length, buffer);
+  Thread_addToHeap(thread, (Obj*)objString);
+
+  v.as.obj = (Obj*)objString;
+  return v;
+}
@@ -0,0 +1,60 @@
+/*
+ * THIS FILE IS GENERATED BY perfect_hash.py. DO NOT EDIT IT BY HAND.
+ */
+#ifndef FUR_KEYWORD_TABLE_H
+#define FUR_KEYWORD_TABLE_H
+
+#include <stdint.h>
+
+#include "scanner.h"
+
+#define KEYWORD_MAX_LENGTH 6
+#define KEYWORD_HASH_MASK 31
+
+#define KEYWORD_HASH(text, length) \
+  (((uint32_t)(uint8_t)(text)[0] * 1u \
+    + (uint32_t)(uint8_t)(text)[(length) - 1] * 10u \
+    + (uint32_t)(length)) & KEYWORD_HASH_MASK)
+
+typedef struct {
+  const char* text;
+  uint8_t length;
+  TokenType type;
+} Keyword;
+
+static const Keyword KEYWORD_TABLE[KEYWORD_HASH_MASK + 1] = {
+  { .text=NULL, .length=0, .type=TOKEN_IDENTIFIER },
+  { .text="as", .length=2, .type=TOKEN_AS },
+  { .text=NULL, .length=0, .type=TOKEN_IDENTIFIER },
+  { .text="def", .length=3, .type=TOKEN_DEF },
+  { .text=NULL, .length=0, .type=TOKEN_IDENTIFIER },
+  { .text="or", .length=2, .type=TOKEN_OR },
+  { .text=NULL, .length=0, .type=TOKEN_IDENTIFIER },
+  { .text="if", .length=2, .type=TOKEN_IF },
+  { .text=NULL, .length=0, .type=TOKEN_IDENTIFIER },
+  { .text="nil", .length=3, .type=TOKEN_NIL },
+  { .text="true", .length=4, .type=TOKEN_TRUE },
+  { .text=NULL, .length=0, .type=TOKEN_IDENTIFIER },
+  { .text="and", .length=3, .type=TOKEN_AND },
+  { .text=NULL, .length=0, .type=TOKEN_IDENTIFIER },
+  { .text="while", .length=5, .type=TOKEN_WHILE },
+  { .text=NULL, .length=0, .type=TOKEN_IDENTIFIER },
+  { .text="end", .length=3, .type=TOKEN_END },
+  { .text=NULL, .length=0, .type=TOKEN_IDENTIFIER },
+  { .text=NULL, .length=0, .type=TOKEN_IDENTIFIER },
+  { .text=NULL, .length=0, .type=TOKEN_IDENTIFIER },
+  { .text=NULL, .length=0, .type=TOKEN_IDENTIFIER },
+  { .text=NULL, .length=0, .type=TOKEN_IDENTIFIER },
+  { .text=NULL, .length=0, .type=TOKEN_IDENTIFIER },
+  { .text="import", .length=6, .type=TOKEN_IMPORT },
+  { .text=NULL, .length=0, .type=TOKEN_IDENTIFIER },
+  { .text="not", .length=3, .type=TOKEN_NOT },
+  { .text=NULL, .length=0, .type=TOKEN_IDENTIFIER },
+  { .text="else", .length=4, .type=TOKEN_ELSE },
+  { .text=NULL, .length=0, .type=TOKEN_IDENTIFIER },
+  { .text="false", .length=5, .type=TOKEN_FALSE },
+  { .text=NULL, .length=0, .type=TOKEN_IDENTIFIER },
+  { .text=NULL, .length=0, .type=TOKEN_IDENTIFIER },
+};
+
+#endif
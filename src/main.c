@@ -1,26 +1,39 @@
 #include <assert.h>
+#include <fcntl.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "code.h"
 #include "compiler.h"
+#include "furc.h"
 #include "memory.h"
+#include "module.h"
 #include "parser.h"
 #include "read_file.h"
 #include "scanner.h"
+#include "scheduler.h"
 #include "thread.h"
 #include "value.h"
 
 typedef struct {
   bool help;
   bool version;
+  char* image;
+  char* snapshot;
+  bool stream;
+  bool pipeline;
+  bool eager;
+  char* jobs;
+  char* workers;
 } Options;
 
 Value runString(
     Compiler* compiler,
     Code* code,
+    Scheduler* scheduler,
     Thread* thread,
     Node* tree) {
 
@@ -31,10 +44,259 @@ Value runString(
    */
   size_t startIndex = Compiler_compile(compiler, code, tree);
 
-  return Thread_run(thread, code, startIndex);
+  return Scheduler_run(scheduler, thread, code, startIndex);
 }
 
-static int repl() {
+/*
+ * Functions are compiled when they're first called, unless a snapshot will
+ * be written, which needs all of them compiled.
+ */
+static void configureCompiler(Compiler* compiler, Options* options) {
+  compiler->lazy = !options->eager && options->snapshot == NULL;
+
+  if(options->jobs == NULL) return;
+
+  char* end;
+  long jobs = strtol(options->jobs, &end, 10);
+
+  if(*end != '\0' || jobs < 1 || jobs > 1024) {
+    fprintf(stderr, "Invalid number of jobs: %s\n", options->jobs);
+    exit(1);
+  }
+
+  compiler->workers = (unsigned)jobs;
+}
+
+/*
+ * What compiling a module needs, which is the same for every module.
+ */
+typedef struct {
+  Runtime* runtime;
+  Options* options;
+  char* root;
+} ModuleContext;
+
+/*
+ * A module's compiler and source, kept until the program ends, since the
+ * module's functions may be compiled from them when they're first called.
+ */
+typedef struct {
+  Compiler compiler;
+  SourceFile source;
+} LoadedModule;
+
+static void loadModule(ObjModule* module, void* context) {
+  ModuleContext* modules = context;
+  LoadedModule* loaded = malloc(sizeof(LoadedModule));
+  assert(loaded != NULL); /* TODO Handle this */
+
+  Compiler* compiler = &(loaded->compiler);
+  Compiler_init(compiler, modules->runtime);
+  configureCompiler(compiler, modules->options);
+
+  // Modules imported together are already compiled in parallel
+  compiler->workers = 1;
+  compiler->path = module->path;
+  compiler->root = modules->root;
+  compiler->globals = module->thread.stack.items;
+
+  SourceFile_read(&(loaded->source), module->path);
+  Scanner scanner;
+  Scanner_init(&scanner, 1, loaded->source.text);
+
+  Node* tree = compiler->lazy ? preparse(&scanner) : parse(&scanner);
+  module->start = Compiler_compile(compiler, &(module->code), tree);
+
+  module->variableCount = compiler->stack.top - compiler->stack.items;
+  module->variables = malloc(sizeof(Symbol*) * (module->variableCount + 1));
+  assert(module->variables != NULL); /* TODO Handle this */
+  memcpy(module->variables, compiler->stack.items, sizeof(Symbol*) * module->variableCount);
+
+  module->loaded = loaded;
+}
+
+static void unloadModule(ObjModule* module, void* context) {
+  (void)context;
+
+  LoadedModule* loaded = module->loaded;
+
+  Compiler_free(&(loaded->compiler));
+  SourceFile_free(&(loaded->source));
+  free(loaded);
+}
+
+/*
+ * The directory of the program's main file, which imports of files not
+ * starting with ./ or ../ are relative to, or NULL for the working
+ * directory. The caller frees it.
+ */
+static char* programRoot(char* filename) {
+  char* slash = strrchr(filename, '/');
+  if(slash == NULL) return NULL;
+
+  size_t length = slash - filename;
+  char* root = malloc(length + 1);
+  assert(root != NULL); /* TODO Handle this */
+  memcpy(root, filename, length);
+  root[length] = '\0';
+  return root;
+}
+
+/*
+ * Threads run on one worker per core, unless --workers says otherwise.
+ */
+static void initScheduler(Scheduler* scheduler, Options* options) {
+  long workers = sysconf(_SC_NPROCESSORS_ONLN);
+  if(workers < 1) workers = 1;
+
+  if(options->workers != NULL) {
+    char* end;
+    workers = strtol(options->workers, &end, 10);
+
+    if(*end != '\0' || workers < 1 || workers > 1024) {
+      fprintf(stderr, "Invalid number of workers: %s\n", options->workers);
+      exit(1);
+    }
+  }
+
+  Scheduler_init(scheduler, (size_t)workers);
+}
+
+/*
+ * Compiles and frees each statement as soon as it's parsed, so that only one
+ * statement's tree is in memory at a time.
+ */
+static size_t compilePipelined(
+    Compiler* compiler,
+    Code* code,
+    Scanner* scanner,
+    Node* (*parseNext)(Scanner*)) {
+  size_t startIndex = Code_getCurrent(code);
+  size_t line = 1;
+  Node* statement;
+
+  while((statement = parseNext(scanner)) != NULL) {
+    line = statement->line;
+    Compiler_compileStatement(compiler, code, statement);
+  }
+
+  Compiler_finishModule(compiler, code, line);
+
+  return startIndex;
+}
+
+/*
+ * Starts from a snapshot written by --snapshot: loads its code, declares its
+ * variables in the compiler and pushes their values, as if the module it was
+ * taken from had just run. The image stays mapped, since the symbols point
+ * into it.
+ */
+static void loadSnapshot(
+    char* path,
+    FurcImage* image,
+    Compiler* compiler,
+    Code* code,
+    Thread* thread) {
+  if(!FurcImage_map(image, path)) {
+    fprintf(stderr, "Could not open file \"%s\".\n", path);
+    exit(1);
+  }
+
+  FurcGlobals globals;
+  size_t startIndex;
+
+  if(!FurcImage_load(image, compiler->runtime, code, &startIndex, &globals)) {
+    fprintf(stderr, "Invalid snapshot \"%s\".\n", path);
+    exit(1);
+  }
+
+  for(size_t i = 0; i < globals.count; i++) {
+    Value value = globals.values[i];
+
+    Compiler_declareGlobal(compiler, globals.names[i]);
+    Stack_push(&(thread->stack), value);
+
+    // Closures belong to the code; everything else is the thread's
+    if(value.is_a == TYPE_OBJ && value.as.obj->type != OBJ_CLOSURE) {
+      Thread_addToHeap(thread, value.as.obj);
+    }
+  }
+
+  Thread_declareGlobal(thread);
+}
+
+/*
+ * Saves the module's code and variables after it has run.
+ */
+static const char* describeUnwritable(Value value) {
+  assert(value.is_a == TYPE_OBJ);
+
+  switch(value.as.obj->type) {
+    case OBJ_CHANNEL:
+      return "a channel";
+
+    case OBJ_MODULE:
+      return "a module";
+
+    case OBJ_CLOSURE:
+      return ((ObjClosure*)value.as.obj)->upvalueCount > 0
+        ? "a closure with upvalues"
+        : "a function of another module";
+
+    default:
+      assert(false);
+      return "a value";
+  }
+}
+
+static void writeSnapshot(char* path, Compiler* compiler, Code* code, Thread* thread) {
+  FurcGlobals globals;
+  globals.count = thread->stack.top - thread->stack.items;
+
+  // The module leaves exactly its variables on the stack
+  assert(globals.count == (size_t)(compiler->stack.top - compiler->stack.items));
+  assert(globals.count <= MAX_FURC_GLOBALS);
+
+  for(size_t i = 0; i < globals.count; i++) {
+    globals.names[i] = compiler->stack.items[i];
+    globals.values[i] = thread->stack.items[i];
+  }
+
+  FILE* file = fopen(path, "wb");
+
+  if(file == NULL) {
+    fprintf(stderr, "Could not open file \"%s\".\n", path);
+    exit(1);
+  }
+
+  size_t unwritable;
+
+  if(!Furc_writeSnapshot(file, code, &globals, &unwritable)) {
+    // Don't leave a partial snapshot behind
+    fclose(file);
+    remove(path);
+
+    if(unwritable == globals.count) {
+      fprintf(stderr, "Could not write snapshot \"%s\".\n", path);
+    } else {
+      Symbol* name = globals.names[unwritable];
+
+      fprintf(
+          stderr,
+          "Could not write snapshot \"%s\". Variable \"%.*s\" is %s, which can't be saved.\n",
+          path,
+          name == NULL ? 0 : (int)name->length,
+          name == NULL ? "" : name->name,
+          describeUnwritable(globals.values[unwritable]));
+    }
+
+    exit(1);
+  }
+
+  fclose(file);
+}
+
+static int repl(Options* options) {
   /*
    * We want a consistent thread and code to maintain state across evals, so
    * that users can do things in the REPL like:
@@ -50,10 +312,24 @@ static int repl() {
   Runtime_init(&runtime);
   Compiler compiler;
   Compiler_init(&compiler, &runtime);
+  configureCompiler(&compiler, options);
   Code code;
   Code_init(&code);
   Thread thread;
   Thread_init(&thread);
+  Scheduler scheduler;
+  initScheduler(&scheduler, options);
+
+  compiler.globals = thread.stack.items;
+  ModuleContext context = { .runtime=&runtime, .options=options, .root=NULL };
+  ModuleLoader loader = { .load=loadModule, .unload=unloadModule, .context=&context };
+  Modules_init(&loader);
+
+  FurcImage image = { .data=NULL, .length=0 };
+  if(options->image != NULL) {
+    loadSnapshot(options->image, &image, &compiler, &code, &thread);
+    Code_setGlobals(&code, thread.stack.items);
+  }
 
   /*
    * The scanner inserts pointers to the source into the tokens. These pointers
@@ -107,12 +383,11 @@ static int repl() {
     Value result = runString(
       &compiler,
       &code,
+      &scheduler,
       &thread,
       tree
     );
 
-    Node_free(tree);
-
     printf("=> ");
     Value_printRepr(result);
     printf("\n");
@@ -125,40 +400,160 @@ static int repl() {
   }
   free(lineList.items);
 
+  Scheduler_free(&scheduler);
+  Modules_free();
   Compiler_free(&compiler);
   Code_free(&code);
   Thread_free(&thread);
   Runtime_free(&runtime);
+  if(image.data != NULL) FurcImage_unmap(&image);
 
   return 0;
 }
 
-int runFile(char* filename) {
-  char* source = readFile(filename);
+static bool endsWith(const char* text, const char* suffix) {
+  size_t textLength = strlen(text);
+  size_t suffixLength = strlen(suffix);
+  return textLength >= suffixLength
+    && !strcmp(text + textLength - suffixLength, suffix);
+}
+
+/*
+ * Maps the cache of `filename` into `image` if it was compiled from the
+ * source as it is now. An unchanged size and modification time are trusted
+ * without reading the source; otherwise the source is read into `source`
+ * and compared by hash, so that touching a file doesn't invalidate its cache.
+ */
+static bool mapFreshCache(char* filename, SourceFile* source, FurcImage* image) {
+  FurcSource current;
+  if(!FurcSource_stat(&current, filename)) return false;
+
+  char* cachePath = Furc_cachePath(filename);
+  bool mapped = FurcImage_map(image, cachePath);
+  free(cachePath);
+  if(!mapped) return false;
+
+  FurcSource cached;
+  if(FurcImage_source(image, &cached) && cached.size == current.size) {
+    if(cached.mtime == current.mtime) return true;
+
+    SourceFile_read(source, filename);
+    if(cached.hash == Furc_hashSource(source->text, source->length)) return true;
+  }
 
+  FurcImage_unmap(image);
+  return false;
+}
+
+int runFile(char* filename, Options* options) {
   Runtime runtime;
   Runtime_init(&runtime);
   Compiler compiler;
   Compiler_init(&compiler, &runtime);
+  configureCompiler(&compiler, options);
   Code code;
   Code_init(&code);
   Thread thread;
   Thread_init(&thread);
+  Scheduler scheduler;
+  initScheduler(&scheduler, options);
+
+  char* root = programRoot(filename);
+  compiler.path = filename;
+  compiler.root = root;
+  compiler.globals = thread.stack.items;
+  ModuleContext context = { .runtime=&runtime, .options=options, .root=root };
+  ModuleLoader loader = { .load=loadModule, .unload=unloadModule, .context=&context };
+  Modules_init(&loader);
+
+  SourceFile source = { .text=NULL, .length=0, .mappedLength=0 };
+  FurcImage image = { .data=NULL, .length=0 };
+  size_t startIndex;
+  bool loaded = false;
+
+  if(options->image != NULL) {
+    // Caches are compiled without the snapshot's variables, so can't be used
+    loadSnapshot(options->image, &image, &compiler, &code, &thread);
+  } else if(endsWith(filename, ".furc")) {
+    if(!FurcImage_map(&image, filename)) {
+      fprintf(stderr, "Could not open file \"%s\".\n", filename);
+      exit(1);
+    }
 
-  Scanner scanner;
-  Scanner_init(&scanner, 1, source);
+    loaded = FurcImage_load(&image, &runtime, &code, &startIndex, NULL);
 
-  Node* tree = parse(&scanner);
+    if(!loaded) {
+      fprintf(stderr, "Invalid compiled file \"%s\".\n", filename);
+      exit(1);
+    }
+  } else if(options->snapshot == NULL
+      && !options->stream
+      && mapFreshCache(filename, &source, &image)) {
+    // A cache that fails to load is ignored, and the source compiled instead
+    loaded = FurcImage_load(&image, &runtime, &code, &startIndex, NULL);
+  }
+
+  // Closures loaded from a file weren't compiled knowing where they'd run
+  Code_setGlobals(&code, thread.stack.items);
+
+  if(loaded) {
+    Scheduler_run(&scheduler, &thread, &code, startIndex);
+  } else {
+    Scanner scanner;
+    ScannerStream stream;
+    int fd = -1;
+
+    if(options->stream) {
+      fd = open(filename, O_RDONLY);
+
+      if(fd < 0) {
+        fprintf(stderr, "Could not open file \"%s\".\n", filename);
+        exit(1);
+      }
+
+      ScannerStream_init(&stream, fd, &(runtime.symbols));
+      Scanner_initStream(&scanner, &stream);
+    } else {
+      if(source.text == NULL) SourceFile_read(&source, filename);
+      Scanner_init(&scanner, 1, source.text);
+    }
+
+    /*
+     * Bodies compiled lazily needn't be parsed until then either, as long as
+     * the source is still there to parse them from.
+     */
+    bool skipBodies = compiler.lazy && !options->stream;
+
+    if(options->pipeline) {
+      size_t startIndex = compilePipelined(
+          &compiler,
+          &code,
+          &scanner,
+          skipBodies ? preparseNextStatement : parseNextStatement);
+      Scheduler_run(&scheduler, &thread, &code, startIndex);
+    } else {
+      runString(&compiler, &code, &scheduler, &thread, skipBodies ? preparse(&scanner) : parse(&scanner));
+    }
 
-  runString(&compiler, &code, &thread, tree);
+    if(options->snapshot != NULL) {
+      writeSnapshot(options->snapshot, &compiler, &code, &thread);
+    }
 
-  Node_free(tree);
+    if(options->stream) {
+      ScannerStream_free(&stream);
+      close(fd);
+    }
+  }
 
+  Scheduler_free(&scheduler);
+  Modules_free();
   Compiler_free(&compiler);
   Code_free(&code);
   Thread_free(&thread);
   Runtime_free(&runtime);
-  free(source);
+  if(image.data != NULL) FurcImage_unmap(&image);
+  if(source.text != NULL) SourceFile_free(&source);
+  free(root);
 
   return 0;
 }
@@ -180,6 +575,14 @@ void printHelp() {
   printf("Examples:\n");
   printf("%-30s %-49s\n", "fur",                                  "Run the repl");
   printf("%-30s %-49s\n", "fur program.fur 1 2 3",                "Run `program.fur` with arguments `1`, `2`, and `3`");
+  printf("%-30s %-49s\n", "fur program.furc",                     "Run `program.furc`, compiled by `fur_compile -o`");
+  printf("%-30s %-49s\n", "fur --snapshot lib.furc lib.fur",      "Run `lib.fur` and save its variables to `lib.furc`");
+  printf("%-30s %-49s\n", "fur -i lib.furc program.fur",          "Run `program.fur` with the variables from `lib.furc`");
+
+  printf("\n");
+
+  printf("If `program.furc` is next to `program.fur` and was compiled from it as it\n");
+  printf("is now, `fur program.fur` runs `program.furc` instead of compiling again.\n");
 
   printf("\n");
 
@@ -194,12 +597,53 @@ void printHelp() {
   printf("Options:\n");
   printf("%-20s %-59s\n", "-h, --help",             "Print this help text and exit");
   printf("%-20s %-59s\n", "-v, --version",          "Print version information and exit");
+  printf("%-20s %-59s\n", "-i, --image <file>",     "Start from a snapshot instead of an empty module");
+  printf("%-20s %-59s\n", "-j, --jobs <n>",         "Compile functions on up to n threads (default: one per core)");
+  printf("%-20s %-59s\n", "-w, --workers <n>",      "Run threads on n OS threads (default: one per core)");
+  printf("%-20s %-59s\n", "--eager",                "Compile every function before running, not on its first call");
+  printf("%-20s %-59s\n", "--snapshot <file>",      "After running the program, save a snapshot of it");
+  printf("%-20s %-59s\n", "--stream",               "Read the program a chunk at a time instead of all at once");
+  printf("%-20s %-59s\n", "--pipeline",             "Compile each statement as it's parsed instead of parsing all first");
+}
+
+/*
+ * If argv[*i] is the option `name` followed by "=" and its argument, or is
+ * just `name` and the next argument is its argument, stores the argument,
+ * advances past it, and returns true.
+ */
+static bool optionArgument(int argc, char** argv, int* i, const char* name, char** argument) {
+  size_t length = strlen(name);
+  if(strncmp(name, argv[*i], length)) return false;
+
+  if(argv[*i][length] == '=') {
+    *argument = argv[*i] + length + 1;
+    return true;
+  }
+
+  if(argv[*i][length] != '\0') return false;
+
+  if(*i + 1 == argc) {
+    fprintf(stderr, "Option %s requires an argument\n", name);
+    printf("Pass -h or --help for more information.\n");
+    exit(1);
+  }
+
+  (*i)++;
+  *argument = argv[*i];
+  return true;
 }
 
 int main(int argc, char** argv) {
   Options options;
   options.help = false;
   options.version = false;
+  options.image = NULL;
+  options.snapshot = NULL;
+  options.stream = false;
+  options.pipeline = false;
+  options.eager = false;
+  options.jobs = NULL;
+  options.workers = NULL;
 
   for(int i = 1; i < argc; i++) {
     if(argv[i][0] == '-') {
@@ -209,15 +653,28 @@ int main(int argc, char** argv) {
           options.help = true;
         } else if(!strcmp("--version", argv[i])) {
           options.version = true;
+        } else if(!strcmp("--stream", argv[i])) {
+          options.stream = true;
+        } else if(!strcmp("--pipeline", argv[i])) {
+          options.pipeline = true;
+        } else if(!strcmp("--eager", argv[i])) {
+          options.eager = true;
+        } else if(optionArgument(argc, argv, &i, "--image", &(options.image))) {
+        } else if(optionArgument(argc, argv, &i, "--snapshot", &(options.snapshot))) {
+        } else if(optionArgument(argc, argv, &i, "--jobs", &(options.jobs))) {
+        } else if(optionArgument(argc, argv, &i, "--workers", &(options.workers))) {
         } else {
           fprintf(stderr, "Unknown argument: %s\n", argv[i]);
           printUsage();
           printf("Pass -h or --help for more information.\n");
           return 1;
         }
+      } else if(optionArgument(argc, argv, &i, "-i", &(options.image))) {
+      } else if(optionArgument(argc, argv, &i, "-j", &(options.jobs))) {
+      } else if(optionArgument(argc, argv, &i, "-w", &(options.workers))) {
       } else {
         for(int j = 1; argv[i][j] != '\0'; j++) {
-          if(argv[i][j] == 'i') {
+          if(argv[i][j] == 'i' || argv[i][j] == 'j' || argv[i][j] == 'w') {
             fprintf(stderr, "Short-form argument -%c cannot be combined with other short-form options because it takes an argument\n", argv[i][j]);
             printf("Pass -h or --help for more information.\n");
             return 1;
@@ -236,7 +693,7 @@ int main(int argc, char** argv) {
         }
       }
     } else {
-      return runFile(argv[i]);
+      return runFile(argv[i], &options);
     }
   }
 
@@ -246,7 +703,7 @@ int main(int argc, char** argv) {
   } else if(options.version) {
     printVersion();
   } else {
-    return repl();
+    return repl(&options);
   }
 
   return 0;
@@ -0,0 +1,150 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "module.h"
+
+/*
+ * Every module imported so far, so that each path is only run once. Imports
+ * are rare next to reading modules' variables, so one lock is enough.
+ */
+static pthread_mutex_t modulesLock = PTHREAD_MUTEX_INITIALIZER;
+static ObjModule* modules = NULL;
+static ModuleLoader* loader = NULL;
+
+void Modules_init(ModuleLoader* moduleLoader) {
+  loader = moduleLoader;
+}
+
+void Modules_free() {
+  pthread_mutex_lock(&modulesLock);
+  ObjModule* module = modules;
+  modules = NULL;
+  pthread_mutex_unlock(&modulesLock);
+
+  while(module != NULL) {
+    ObjModule* next = module->nextModule;
+
+    Thread_free(&(module->thread));
+    if(module->loaded != NULL) loader->unload(module, loader->context);
+    Code_free(&(module->code));
+    pthread_mutex_destroy(&(module->lock));
+    free(module->variables);
+    free(module->path);
+    free(module);
+
+    module = next;
+  }
+}
+
+static ObjModule* ObjModule_new(ObjString* path) {
+  ObjModule* self = malloc(sizeof(ObjModule));
+  assert(self != NULL); /* TODO Handle this */
+
+  Obj_init(&(self->obj), OBJ_MODULE);
+  self->obj.shared = true;
+  self->path = malloc(path->length + 1);
+  assert(self->path != NULL); /* TODO Handle this */
+  memcpy(self->path, path->characters, path->length);
+  self->path[path->length] = '\0';
+  self->nextModule = NULL;
+
+  // The thread is started once the module is loaded
+  Thread_init(&(self->thread));
+  self->thread.module = self;
+  Code_init(&(self->code));
+  self->start = 0;
+
+  self->variableCount = 0;
+  self->variables = NULL;
+  self->loaded = NULL;
+
+  pthread_mutex_init(&(self->lock), NULL);
+  atomic_init(&(self->finished), false);
+  self->waiters.first = NULL;
+  self->waiters.last = NULL;
+
+  return self;
+}
+
+ObjModule* Module_import(ObjString* path, bool next) {
+  pthread_mutex_lock(&modulesLock);
+
+  for(ObjModule* module = modules; module != NULL; module = module->nextModule) {
+    if(strlen(module->path) == path->length
+        && !memcmp(module->path, path->characters, path->length)) {
+      pthread_mutex_unlock(&modulesLock);
+      return module;
+    }
+  }
+
+  ObjModule* module = ObjModule_new(path);
+  module->nextModule = modules;
+  modules = module;
+  pthread_mutex_unlock(&modulesLock);
+
+  Scheduler_spawn(&(module->thread), next);
+  return module;
+}
+
+void Module_load(ObjModule* self) {
+  assert(loader != NULL); /* TODO Handle this */
+  loader->load(self, loader->context);
+  Thread_start(&(self->thread), &(self->code), self->start);
+}
+
+void Module_finish(ObjModule* self, Scheduler* scheduler) {
+  // Every thread importing the module may read its variables from now on
+  Thread_shareHeap(&(self->thread));
+
+  pthread_mutex_lock(&(self->lock));
+  atomic_store_explicit(&(self->finished), true, memory_order_release);
+  WaitQueue waiters = self->waiters;
+  self->waiters.first = NULL;
+  self->waiters.last = NULL;
+  pthread_mutex_unlock(&(self->lock));
+
+  Thread* thread;
+
+  while((thread = WaitQueue_pop(&waiters)) != NULL) {
+    Scheduler_unpark(scheduler, thread);
+  }
+}
+
+void Module_get(ObjModule* self, Thread* thread, ObjString* name, Value* value) {
+  if(!atomic_load_explicit(&(self->finished), memory_order_acquire)) {
+    pthread_mutex_lock(&(self->lock));
+
+    if(!atomic_load_explicit(&(self->finished), memory_order_relaxed)) {
+      WaitQueue_push(&(self->waiters), thread);
+      Thread_park(thread);
+      pthread_mutex_unlock(&(self->lock));
+      return;
+    }
+
+    pthread_mutex_unlock(&(self->lock));
+  }
+
+  for(size_t i = 0; i < self->variableCount; i++) {
+    Symbol* variable = self->variables[i];
+
+    if(variable->length == name->length
+        && !memcmp(variable->name, name->characters, name->length)) {
+      *value = self->thread.stack.items[i];
+      return;
+    }
+  }
+
+  fprintf(
+      stderr,
+      "Module \"%s\" has no variable \"%.*s\".\n",
+      self->path,
+      (int)name->length,
+      name->characters);
+  exit(1);
+}
+
+void ObjModule_printRepr(ObjModule* self) {
+  printf("<module '%s'>", self->path);
+}
@@ -0,0 +1,101 @@
+#ifndef FUR_MODULE_H
+#define FUR_MODULE_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include "code.h"
+#include "object.h"
+#include "scheduler.h"
+#include "symbol.h"
+#include "thread.h"
+#include "value.h"
+
+/*
+ * A module imported with `import 'path' as name`.
+ *
+ * Each module is run once, however many threads import it, by a thread of
+ * its own on the scheduler, so importing doesn't wait for it. The first
+ * import of a path creates the module and spawns its thread, which compiles
+ * the module when it first runs (see Module_load), so that modules imported
+ * together are read, compiled and run in parallel.
+ *
+ * Reading a variable of the module (OP_PROP) waits until the module has
+ * finished: a thread which gets there first is parked in `waiters` until
+ * Module_finish wakes it. `finished` only changes while holding `lock`, so
+ * it's only taken when a thread might have to wait.
+ *
+ * The module's variables stay on its thread's stack after it finishes,
+ * since its functions reach them there through display[0]. So the module
+ * keeps its thread, code and whatever compiled it until Modules_free.
+ */
+struct ObjModule {
+  Obj obj;
+  char* path;
+  ObjModule* nextModule;
+
+  Thread thread;
+  Code code;
+  size_t start;
+
+  // The names of the module's variables, in the order they're on the stack
+  size_t variableCount;
+  Symbol** variables;
+
+  // Whatever the loader keeps for the module while its code may run
+  void* loaded;
+
+  pthread_mutex_t lock;
+  atomic_bool finished;
+  WaitQueue waiters;
+};
+
+/*
+ * Compiles the module at `module->path` into `module->code`, and sets
+ * `start` and `variables`; and frees what that kept in `loaded`. The
+ * interpreter provides these, since the runtime doesn't include the
+ * compiler.
+ */
+typedef struct {
+  void (*load)(ObjModule*, void* context);
+  void (*unload)(ObjModule*, void* context);
+  void* context;
+} ModuleLoader;
+
+void Modules_init(ModuleLoader*);
+
+/*
+ * Frees every module. No thread may be running.
+ */
+void Modules_free(void);
+
+/*
+ * Returns the module at `path`, which the compiler has already resolved (see
+ * OP_IMPORT), creating it and spawning its thread if this is the first
+ * import of it. If `next`, the thread runs next on this worker, as the
+ * importer is about to wait for it.
+ */
+ObjModule* Module_import(ObjString* path, bool next);
+
+/*
+ * Called by the scheduler before the module's thread first runs.
+ */
+void Module_load(ObjModule*);
+
+/*
+ * Called by the scheduler once the module's thread has finished, to wake
+ * the threads waiting for it.
+ */
+void Module_finish(ObjModule*, Scheduler*);
+
+/*
+ * Replaces the module at `*value` with its variable `name`. If the module
+ * hasn't finished, parks `thread` as a native does, leaving `*value` as it
+ * is.
+ */
+void Module_get(ObjModule*, Thread*, ObjString* name, Value* value);
+
+void ObjModule_printRepr(ObjModule*);
+
+#endif
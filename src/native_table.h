@@ -0,0 +1,34 @@
+/*
+ * THIS FILE IS GENERATED BY perfect_hash.py. DO NOT EDIT IT BY HAND.
+ */
+#ifndef FUR_NATIVE_TABLE_H
+#define FUR_NATIVE_TABLE_H
+
+#include <stdint.h>
+
+#define NATIVE_COUNT 6
+#define NATIVE_HASH_BITS 3
+
+#define NATIVE_HASH(hash) \
+  ((uint32_t)((uint32_t)(hash) * 23u) >> (32 - NATIVE_HASH_BITS))
+
+#define NATIVE_LIST(X) \
+  X(input, nativeInput) \
+  X(print, nativePrint) \
+  X(spawn, nativeSpawn) \
+  X(channel, nativeChannel) \
+  X(send, nativeSend) \
+  X(receive, nativeReceive) \
+
+static const uint16_t NATIVE_SLOTS[1 << NATIVE_HASH_BITS] = {
+  4,
+  3,
+  5,
+  1,
+  0,
+  0,
+  6,
+  2,
+};
+
+#endif
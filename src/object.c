@@ -1,7 +1,9 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "module.h"
 #include "object.h"
+#include "thread.h"
 
 ALLOCATE_ONE_IMPL(ObjClosure);
 
@@ -10,19 +12,178 @@ void ObjClosure_init(ObjClosure* self, Symbol* name, uint8_t arity, Code* code)
   self->name = name;
   self->arity = arity;
   self->code = code;
+  self->depth = 1;
+  self->upvalueCount = 0;
+  self->upvalueDescriptors = NULL;
+  self->upvalues = NULL;
+  self->lazy = NULL;
+  self->compileLazy = NULL;
+  self->globals = NULL;
+}
+
+void ObjClosure_initInstance(ObjClosure* self, ObjClosure* prototype) {
+  assert(prototype->upvalues == NULL);
+  assert(prototype->upvalueCount > 0);
+
+  Obj_init(&(self->obj), OBJ_CLOSURE);
+  self->name = prototype->name;
+  self->arity = prototype->arity;
+  self->code = prototype->code;
+  self->depth = prototype->depth;
+  self->upvalueCount = prototype->upvalueCount;
+  self->upvalueDescriptors = prototype->upvalueDescriptors;
+  self->lazy = NULL;
+  self->compileLazy = NULL;
+  self->globals = prototype->globals;
+
+  /*
+   * The upvalues themselves are filled in by OP_CLOSURE, which knows where
+   * they come from.
+   */
+  self->upvalues = malloc(sizeof(ObjUpvalue*) * self->upvalueCount);
+  assert(self->upvalues != NULL); /* TODO Handle this */
 }
 
 void ObjClosure_free(ObjClosure* self) {
+  if(self->upvalues != NULL) {
+    /*
+     * This is an instance: the code and descriptors belong to the prototype,
+     * and the upvalues are on the heap of the thread that created them.
+     */
+    free(self->upvalues);
+    return;
+  }
+
   Code_free(self->code);
+  free(self->code);
+  free(self->upvalueDescriptors);
+}
+
+void Code_setGlobals(Code* self, Value* globals) {
+  for(size_t i = 0; i < self->interns.length; i++) {
+    Obj* intern = self->interns.items[i];
+    if(intern->type != OBJ_CLOSURE) continue;
+
+    ObjClosure* closure = (ObjClosure*)intern;
+    closure->globals = globals;
+    Code_setGlobals(closure->code, globals);
+  }
+}
+
+ALLOCATE_ONE_IMPL(ObjUpvalue);
+
+void ObjUpvalue_init(ObjUpvalue* self, Value* location) {
+  Obj_init(&(self->obj), OBJ_UPVALUE);
+  self->location = location;
+  self->closed.is_a = TYPE_NIL;
+  self->nextOpen = NULL;
 }
 
 ALLOCATE_ONE_IMPL(ObjNative);
 
-void ObjNative_init(ObjNative* self, Value (*call)(uint8_t, Value*)) {
+void ObjNative_init(ObjNative* self, NativeFunction call) {
   Obj_init(&(self->obj), OBJ_NATIVE);
   self->call = call;
 }
 
+ALLOCATE_ONE_IMPL(ObjChannel);
+
+void ObjChannel_init(ObjChannel* self, size_t capacity) {
+  Obj_init(&(self->obj), OBJ_CHANNEL);
+
+  size_t size = 2;
+  while(size < capacity) size *= 2;
+
+  self->mask = size - 1;
+  self->cells = malloc(sizeof(ChannelCell) * size);
+  assert(self->cells != NULL); /* TODO Handle this */
+
+  // Cell i is ready to be written at position i
+  for(size_t i = 0; i < size; i++) {
+    atomic_init(&(self->cells[i].sequence), i);
+  }
+
+  atomic_init(&(self->sendPosition), 0);
+  atomic_init(&(self->receivePosition), 0);
+
+  pthread_mutex_init(&(self->waitersLock), NULL);
+  atomic_init(&(self->sendersWaiting), 0);
+  atomic_init(&(self->receiversWaiting), 0);
+  self->senders.first = NULL;
+  self->senders.last = NULL;
+  self->receivers.first = NULL;
+  self->receivers.last = NULL;
+}
+
+void ObjChannel_free(ObjChannel* self) {
+  free(self->cells);
+  pthread_mutex_destroy(&(self->waitersLock));
+}
+
+/*
+ * The cell at position p is ready to be written when its sequence is p, and
+ * ready to be read when it's p + 1. Reading it sets it to p + capacity,
+ * when it's next written.
+ */
+bool ObjChannel_trySend(ObjChannel* self, Value value) {
+  size_t position = atomic_load_explicit(&(self->sendPosition), memory_order_relaxed);
+
+  for(;;) {
+    ChannelCell* cell = &(self->cells[position & self->mask]);
+    size_t sequence = atomic_load_explicit(&(cell->sequence), memory_order_acquire);
+    intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+
+    if(difference == 0) {
+      if(atomic_compare_exchange_weak_explicit(
+            &(self->sendPosition),
+            &position,
+            position + 1,
+            memory_order_relaxed,
+            memory_order_relaxed)) {
+        cell->value = value;
+        atomic_store_explicit(&(cell->sequence), position + 1, memory_order_release);
+        return true;
+      }
+    } else if(difference < 0) {
+      // Not yet read since it was last written, so the channel is full
+      return false;
+    } else {
+      position = atomic_load_explicit(&(self->sendPosition), memory_order_relaxed);
+    }
+  }
+}
+
+bool ObjChannel_tryReceive(ObjChannel* self, Value* value) {
+  size_t position = atomic_load_explicit(&(self->receivePosition), memory_order_relaxed);
+
+  for(;;) {
+    ChannelCell* cell = &(self->cells[position & self->mask]);
+    size_t sequence = atomic_load_explicit(&(cell->sequence), memory_order_acquire);
+    intptr_t difference = (intptr_t)sequence - (intptr_t)(position + 1);
+
+    if(difference == 0) {
+      if(atomic_compare_exchange_weak_explicit(
+            &(self->receivePosition),
+            &position,
+            position + 1,
+            memory_order_relaxed,
+            memory_order_relaxed)) {
+        *value = cell->value;
+        atomic_store_explicit(
+            &(cell->sequence),
+            position + self->mask + 1,
+            memory_order_release);
+        return true;
+      }
+    } else if(difference < 0) {
+      // Not yet written since it was last read, so the channel is empty
+      return false;
+    } else {
+      position = atomic_load_explicit(&(self->receivePosition), memory_order_relaxed);
+    }
+  }
+}
+
 ALLOCATE_ONE_IMPL(ObjString);
 ALLOCATOR_IMPL(ObjString);
 
@@ -38,10 +199,18 @@ void ObjString_free(ObjString* self) {
 
 void Obj_free(Obj* self) {
   switch(self->type) {
+    case OBJ_CHANNEL:
+      ObjChannel_free((ObjChannel*)self);
+      break;
+
     case OBJ_CLOSURE:
       ObjClosure_free((ObjClosure*)self);
       break;
 
+    case OBJ_MODULE:
+      // Modules are never on a heap: they're freed by Modules_free
+      assert(false);
+
     case OBJ_NATIVE:
       break;
 
@@ -49,6 +218,9 @@ void Obj_free(Obj* self) {
       ObjString_free((ObjString*)self);
       break;
 
+    case OBJ_UPVALUE:
+      break;
+
     default:
       assert(false);
   }
@@ -68,9 +240,15 @@ bool Obj_equals(Obj* self, Obj* other) {
   if(self == other) return true;
 
   switch(self->type) {
+    case OBJ_CHANNEL:
+      return false;
+
     case OBJ_CLOSURE:
       assert(false);
 
+    case OBJ_MODULE:
+      return false;
+
     case OBJ_NATIVE:
       return other->type == OBJ_NATIVE &&
         ((ObjNative*)self)->call == ((ObjNative*)other)->call;
@@ -78,6 +256,9 @@ bool Obj_equals(Obj* self, Obj* other) {
     case OBJ_STRING:
       return other->type == OBJ_STRING &&
         ObjString_equals((ObjString*)self, (ObjString*)other);
+
+    case OBJ_UPVALUE:
+      assert(false);
   }
 
   assert(false);
@@ -89,6 +270,14 @@ void ObjClosure_printRepr(ObjClosure* self) {
   printf(">");
 }
 
+void ObjUpvalue_printRepr(ObjUpvalue* self) {
+  printf("<upvalue %p>", (void*)self);
+}
+
+void ObjChannel_printRepr(ObjChannel* self) {
+  printf("<channel %p>", (void*)self);
+}
+
 void ObjNative_printRepr(ObjNative* self) {
   printf("<native %p>", (void*)self);
 }
@@ -179,84 +368,31 @@ void Obj_printRepr(Obj* self) {
     case OBJ_NATIVE:
       return ObjNative_printRepr((ObjNative*) self);
 
+    case OBJ_CHANNEL:
+      return ObjChannel_printRepr((ObjChannel*) self);
+
+    case OBJ_MODULE:
+      return ObjModule_printRepr((ObjModule*) self);
+
     case OBJ_STRING:
       return ObjString_printRepr((ObjString*) self);
 
+    case OBJ_UPVALUE:
+      return ObjUpvalue_printRepr((ObjUpvalue*) self);
+
     default:
       assert(false);
   }
 }
 
-Value nativeInput(uint8_t argc, Value* argv) {
-  assert(argc == 1);
-  Value v = *argv;
-  assert(v.is_a == TYPE_OBJ);
-  assert(v.as.obj->type == OBJ_STRING);
-
-  nativePrint(1, argv);
-
-  #define BUFF_LENGTH 1024
-  char* buffer = malloc(BUFF_LENGTH);
-
-  if(!fgets(buffer, BUFF_LENGTH, stdin)) {
-    buffer[0] = '\0';
-  }
-
-  size_t length;
-
-  for(length = 0; length < BUFF_LENGTH; length++) {
-    if(buffer[length] == '\0') break;
-  }
-
-  char* tmp = realloc(buffer, length + 1);
-  assert(tmp != NULL); /* TODO Handle this. */
-  buffer = tmp;
-
-  ObjString* objString = malloc(sizeof(ObjString));
-  ObjString_init(objString, length, buffer);
-
-  v.as.obj = (Obj*)objString;
-  return v;
-  #undef BUFF_LENGTH
-}
-
-Value nativePrint(uint8_t argc, Value* argv) {
-  for(uint8_t i = 0; i < argc; i++) {
-    switch(argv[i].is_a) {
-      case TYPE_NIL:
-        printf("nil");
-        break;
-
-      case TYPE_BOOLEAN:
-        if(argv[i].as.boolean) {
-          printf("true");
-        } else {
-          printf("false");
-        } break;
-
-      case TYPE_INTEGER:
-        printf("%i", argv[i].as.integer);
-        break;
-
-      case TYPE_OBJ:
-        {
-          assert(argv[i].as.obj->type == OBJ_STRING);
-
-          ObjString* s = (ObjString*)(argv[i].as.obj);
-
-          for(size_t c = 0; c < s->length; c++) {
-            printf("%c", s->characters[c]);
-          }
-        } break;
-
-      default:
-        assert(false); // TODO Handle other types
-    }
-  }
+Value nativeChannel(Thread* thread, uint8_t argc, Value* argv) {
+  assert(argc == 1); /* TODO Handle this */
+  assert(argv[0].is_a == TYPE_INTEGER); /* TODO Handle this */
+  assert(argv[0].as.integer > 0); /* TODO Handle this */
 
-  fflush(stdout);
+  ObjChannel* channel = ObjChannel_allocateOne();
+  ObjChannel_init(channel, (size_t)argv[0].as.integer);
+  Thread_addToHeap(thread, (Obj*)channel);
 
-  Value result;
-  result.is_a = TYPE_NIL;
-  return result;
+  return Value_fromObj((Obj*)channel);
 }
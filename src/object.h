@@ -1,36 +1,180 @@
 #ifndef FUR_OBJECT_H
 #define FUR_OBJECT_H
 
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "code.h"
 #include "memory.h"
+#include "native_table.h"
 #include "symbol.h"
 #include "value.h"
 
 typedef enum {
+  OBJ_CHANNEL,
   OBJ_CLOSURE,
+  OBJ_MODULE,
   OBJ_NATIVE,
-  OBJ_STRING
+  OBJ_STRING,
+  OBJ_UPVALUE
 } ObjType;
 
+/*
+ * Each thread collects its own objects (see Thread_collect), so it can only
+ * free an object no other thread can see. An object another thread might
+ * see is `shared`: its thread keeps it until the thread is freed, and no
+ * collector marks it or looks inside it. Interned strings and closures are
+ * shared from the start, as they belong to the code, which every thread
+ * running it reads and nobody changes; so are modules.
+ */
 struct Obj {
   Obj* next;
   ObjType type;
+  bool shared;
+  bool marked;
 };
 
+/*
+ * Functions can be nested at most this deeply, counting the module as depth
+ * 0. This is the size of the display (see Thread) which lets closures reach
+ * variables of enclosing functions while they are still on the stack.
+ */
+#define MAX_CLOSURE_DEPTH 64
+
+/*
+ * Closures read the variables of enclosing functions in one of two ways.
+ *
+ * If the compiler can prove that no closure between the variable and its use
+ * outlives its frame, the variable stays on the stack where it was declared,
+ * and the closure reads it through the display (OP_GET_OUTER). This doesn't
+ * allocate anything.
+ *
+ * Otherwise, the closure captures the variable in an ObjUpvalue when the
+ * closure is created (OP_CLOSURE), and reads it through that
+ * (OP_GET_UPVALUE). While the frame which declared the variable is running,
+ * the upvalue points at the variable's slot on the stack; when the frame
+ * returns, the value is moved into the upvalue.
+ */
+typedef enum {
+  UPVALUE_LOCAL,    // A slot in the frame creating the closure
+  UPVALUE_OUTER,    // A slot reached through the display
+  UPVALUE_UPVALUE,  // An upvalue of the closure creating the closure
+} UpvalueKind;
+
 typedef struct {
+  uint8_t kind;
+  uint8_t depth;
+  uint8_t index;
+} UpvalueDescriptor;
+
+typedef struct ObjUpvalue ObjUpvalue;
+
+struct ObjUpvalue {
+  Obj obj;
+  Value* location;
+  Value closed;
+  ObjUpvalue* nextOpen;
+};
+
+/*
+ * Closures which don't capture upvalues are created once, at compile time,
+ * and are pushed with OP_INTERN. Closures which do are instantiated from that
+ * prototype by OP_CLOSURE. Instances share the prototype's code and upvalue
+ * descriptors, but own their upvalues array.
+ */
+typedef struct ObjClosure ObjClosure;
+
+struct ObjClosure {
   Obj obj;
   Code* code;
   Symbol* name;
+  UpvalueDescriptor* upvalueDescriptors;
+  ObjUpvalue** upvalues;
+
+  /*
+   * If not NULL, the closure's body hasn't been compiled yet and its code is
+   * empty: `compileLazy` compiles it from `lazy`, which belongs to whatever
+   * deferred it, and sets `lazy` to NULL. See ObjClosure_ensureCompiled.
+   */
+  void* lazy;
+  void (*compileLazy)(ObjClosure*);
+
+  /*
+   * The variables of the module which declared the closure, which it reaches
+   * through display[0], so that it can be called from another module's
+   * thread. NULL if it uses those of whichever thread calls it.
+   */
+  Value* globals;
+
   uint8_t arity;
-} ObjClosure;
+  uint8_t depth;
+  uint8_t upvalueCount;
+};
+
+typedef struct Thread Thread;
+
+/*
+ * Natives are called with the thread calling them, and add any objects they
+ * create to its heap themselves, since what they return may not be new.
+ */
+typedef Value (*NativeFunction)(Thread*, uint8_t argc, Value* argv);
 
 typedef struct {
   Obj obj;
-  Value (*call)(uint8_t argc, Value* argv);
+  NativeFunction call;
 } ObjNative;
 
+typedef struct {
+  atomic_size_t sequence;
+  Value value;
+} ChannelCell;
+
+/*
+ * Threads waiting on a channel, linked through Thread.nextWaiting, in the
+ * order they started waiting.
+ */
+typedef struct {
+  Thread* first;
+  Thread* last;
+} WaitQueue;
+
+/*
+ * A bounded queue of values from any number of threads to any number of
+ * threads. Values are passed as they are, so sending an object shares it
+ * without copying it; it stays on the heap of the thread which created it.
+ *
+ * The queue is a ring of cells, each with a sequence number which says
+ * whether it's ready to be written or read at a given position, so that
+ * sending and receiving only take a compare-and-swap of the position
+ * (see ObjChannel_trySend). The capacity is a power of two, at least two,
+ * so the sequence numbers of a full and an empty cell differ.
+ *
+ * Threads which can't send because the channel is full, or can't receive
+ * because it's empty, wait in `senders` or `receivers`. Those lists and
+ * their counts only change while holding `waitersLock`, so it's only taken
+ * when a thread has to wait, or there may be one waiting to wake.
+ */
+typedef struct {
+  Obj obj;
+  size_t mask;
+  ChannelCell* cells;
+  atomic_size_t sendPosition;
+  atomic_size_t receivePosition;
+
+  pthread_mutex_t waitersLock;
+  atomic_size_t sendersWaiting;
+  atomic_size_t receiversWaiting;
+  WaitQueue senders;
+  WaitQueue receivers;
+} ObjChannel;
+
+/*
+ * Defined in module.h, since a module is run by a thread of its own.
+ */
+typedef struct ObjModule ObjModule;
+
 struct ObjString {
   Obj obj;
   size_t length;
@@ -40,6 +184,8 @@ struct ObjString {
 inline static void Obj_init(Obj* self, ObjType type) {
   self->next = NULL;
   self->type = type;
+  self->shared = false;
+  self->marked = false;
 }
 void Obj_free(Obj*);
 void Obj_printRepr(Obj*);
@@ -47,10 +193,39 @@ bool Obj_equals(Obj*, Obj*);
 
 ALLOCATE_ONE_DECL(ObjClosure);
 void ObjClosure_init(ObjClosure*, Symbol*, uint8_t, Code*);
+void ObjClosure_initInstance(ObjClosure*, ObjClosure* prototype);
 void ObjClosure_free(ObjClosure*);
 
+/*
+ * Sets the globals of the closures interned in `code`, and of those nested
+ * in them, for code which wasn't compiled with them (see Compiler.globals).
+ */
+void Code_setGlobals(Code*, Value* globals);
+
+/*
+ * Compiles the closure's body if that was put off until it was first called.
+ * `lazy` is read with acquire ordering, pairing with compileLazy clearing
+ * it, so a thread which sees it cleared also sees the compiled code.
+ */
+inline static void ObjClosure_ensureCompiled(ObjClosure* self) {
+  if(__atomic_load_n(&(self->lazy), __ATOMIC_ACQUIRE) != NULL) self->compileLazy(self);
+}
+
+ALLOCATE_ONE_DECL(ObjUpvalue);
+void ObjUpvalue_init(ObjUpvalue*, Value*);
+
 ALLOCATE_ONE_DECL(ObjNative);
-void ObjNative_init(ObjNative*, Value (*call)(uint8_t, Value*));
+void ObjNative_init(ObjNative*, NativeFunction call);
+
+ALLOCATE_ONE_DECL(ObjChannel);
+void ObjChannel_init(ObjChannel*, size_t capacity);
+void ObjChannel_free(ObjChannel*);
+
+/*
+ * These return false, without waiting, if the channel is full or empty.
+ */
+bool ObjChannel_trySend(ObjChannel*, Value);
+bool ObjChannel_tryReceive(ObjChannel*, Value*);
 
 ALLOCATE_ONE_DECL(ObjString);
 ALLOCATOR_DECL(ObjString);
@@ -58,19 +233,55 @@ void ObjString_init(ObjString*, size_t, char*);
 void ObjString_free(ObjString*);
 bool ObjString_equals(ObjString*, ObjString*);
 
-Value nativeInput(uint8_t argc, Value* argv);
-Value nativePrint(uint8_t argc, Value* argv);
+Value nativeChannel(Thread*, uint8_t argc, Value* argv);
+
+// Defined in io.c
+Value nativeInput(Thread*, uint8_t argc, Value* argv);
+Value nativePrint(Thread*, uint8_t argc, Value* argv);
+
+/*
+ * Defined in scheduler.c, since they start threads on the running
+ * scheduler, or make the calling thread wait.
+ */
+Value nativeSpawn(Thread*, uint8_t argc, Value* argv);
+Value nativeSend(Thread*, uint8_t argc, Value* argv);
+Value nativeReceive(Thread*, uint8_t argc, Value* argv);
 
 typedef struct {
   const char* name;
-  Value (*call)(uint8_t, Value*);
+  uint8_t length;
+  NativeFunction call;
 } NamedNative;
 
-#define NATIVE_COUNT 2
+/*
+ * The list of natives and the perfect hash used to find them live in
+ * native_table.h, which is generated by perfect_hash.py.
+ */
+#define NAMED_NATIVE(identifier, function) \
+  { .name=#identifier, .length=sizeof(#identifier) - 1, .call=function },
 
 static const NamedNative NATIVE[NATIVE_COUNT] = {
-  { .name="input", .call=nativeInput },
-  { .name="print", .call=nativePrint }
+  NATIVE_LIST(NAMED_NATIVE)
 };
 
+#undef NAMED_NATIVE
+
+/*
+ * Returns the index of the native with the given name in NATIVE, or -1 if
+ * there is no such native. Since the hash is perfect, this is a single probe
+ * plus a comparison to rule out identifiers which aren't natives at all.
+ */
+inline static int32_t NamedNative_find(Symbol* name) {
+  uint16_t slot = NATIVE_SLOTS[NATIVE_HASH(name->hash)];
+
+  if(slot == 0) return -1;
+
+  const NamedNative* native = &(NATIVE[slot - 1]);
+
+  if(native->length != name->length) return -1;
+  if(memcmp(native->name, name->name, name->length)) return -1;
+
+  return (int32_t)(slot - 1);
+}
+
 #endif
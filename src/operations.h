@@ -0,0 +1,117 @@
+#ifndef FUR_OPERATIONS_H
+#define FUR_OPERATIONS_H
+
+#include <assert.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "memory.h"
+#include "object.h"
+#include "value.h"
+
+/*
+ * The operations behind the generic arithmetic, comparison and logic
+ * instructions, shared by the interpreter and by C generated by fur_aot.
+ */
+
+inline static Value logicalNot(Value arg) {
+  assert(arg.is_a == TYPE_BOOLEAN);
+  arg.as.boolean = !(arg.as.boolean);
+  return arg;
+}
+
+inline static Value negate(Value arg) {
+  assert(isInteger(arg));
+  arg.as.integer = -arg.as.integer;
+  return arg;
+}
+
+#define INT_BINARY_FUNCTION(name, op) \
+  inline static Value name(Value arg0, Value arg1) { \
+    assert(isInteger(arg0)); \
+    assert(isInteger(arg1)); \
+    arg0.as.integer = arg0.as.integer op arg1.as.integer; \
+    return arg0; \
+  }
+INT_BINARY_FUNCTION(add, +)
+INT_BINARY_FUNCTION(subtract, -)
+INT_BINARY_FUNCTION(multiply, *)
+INT_BINARY_FUNCTION(divide, /)
+#undef INT_BINARY_FUNCTION
+
+inline static Value concat(Value arg0, Value arg1) {
+  assert(isObj(arg0));
+  assert(isObj(arg1));
+  assert(arg0.as.obj->type == OBJ_STRING);
+  assert(arg1.as.obj->type == OBJ_STRING);
+
+  ObjString* arg0s = (ObjString*)(arg0.as.obj);
+  ObjString* arg1s = (ObjString*)(arg1.as.obj);
+
+  size_t length = arg0s->length + arg1s->length;
+
+  /* Add room for trailing null char */
+  char* characters = allocateChars(length + 1);
+  *characters = '\0';
+
+  strncat(characters, arg0s->characters, arg0s->length);
+  strncat(characters, arg1s->characters, arg1s->length);
+
+  ObjString* s = ObjString_allocateOne();
+  ObjString_init(s, length, characters);
+
+  Value v;
+  v.is_a = TYPE_OBJ;
+  v.as.obj = (Obj*)s;
+
+  return v;
+}
+
+#define ORDER_BINARY_FUNCTION(name, op) \
+  inline static Value name(Value arg0, Value arg1) { \
+    assert(isInteger(arg0)); \
+    assert(isInteger(arg1)); \
+    arg0.is_a = TYPE_BOOLEAN; \
+    arg0.as.boolean = (arg0.as.integer op arg1.as.integer); \
+    return arg0; \
+  }
+ORDER_BINARY_FUNCTION(lessThan, <)
+ORDER_BINARY_FUNCTION(greaterThan, >)
+ORDER_BINARY_FUNCTION(lessThanEquals, <=)
+ORDER_BINARY_FUNCTION(greaterThanEquals, >=)
+#undef ORDER_BINARY_FUNCTION
+
+inline static Value equals(Value arg0, Value arg1) {
+  switch(arg0.is_a) {
+    case TYPE_NIL:
+      return Value_fromBool(arg0.is_a == arg1.is_a);
+
+    case TYPE_BOOLEAN:
+      return Value_fromBool(
+        arg1.is_a == TYPE_BOOLEAN &&
+        arg0.as.boolean == arg1.as.boolean
+      );
+
+    case TYPE_INTEGER:
+      return Value_fromBool(
+        arg1.is_a == TYPE_INTEGER &&
+        arg0.as.integer == arg1.as.integer
+      );
+
+    case TYPE_OBJ:
+      return Value_fromBool(
+          arg1.is_a == TYPE_OBJ &&
+          Obj_equals(arg0.as.obj, arg1.as.obj)
+        );
+
+    default:
+      assert(false);
+  }
+}
+
+inline static Value notEquals(Value arg0, Value arg1) {
+  /* TODO Are there ways to optimzie this? */
+  return logicalNot(equals(arg0, arg1));
+}
+
+#endif
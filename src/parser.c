@@ -13,9 +13,11 @@
 #include "scanner.h"
 
 #include <assert.h>
+#include <setjmp.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 
 void NodeType_print(NodeType type) {
   switch(type) {
@@ -28,6 +30,7 @@ void NodeType_print(NodeType type) {
       MAP(NODE_STRING);
       MAP(NODE_NEGATE);
       MAP(NODE_NOT);
+      MAP(NODE_IMPORT);
       MAP(NODE_PROPERTY);
       MAP(NODE_ADD);
       MAP(NODE_SUBTRACT);
@@ -48,6 +51,7 @@ void NodeType_print(NodeType type) {
       MAP(NODE_IF);
       MAP(NODE_COMMA_SEPARATED_LIST);
       MAP(NODE_EXPRESSION_LIST);
+      MAP(NODE_DEFERRED_BODY);
     #undef MAP
     default:
       assert(false);
@@ -114,6 +118,9 @@ void Node_print(Node* node) {
     case NODE_NOT:
       UnaryNode_print("not", (UnaryNode*)node);
       break;
+    case NODE_IMPORT:
+      UnaryNode_print("import", (UnaryNode*)node);
+      break;
 
     #define MAP_INFIX(type, s) \
     case type: \
@@ -224,6 +231,10 @@ void Node_print(Node* node) {
         printf("))");
       } break;
 
+    case NODE_DEFERRED_BODY:
+      printf("(deferred)");
+      break;
+
     default:
       assert(false);
   }
@@ -241,6 +252,52 @@ static Node makeNode(NodeType type, size_t line) {
   return result;
 }
 
+/*
+ * While tryParseStatement() runs, a syntax error jumps back to it instead of
+ * failing an assertion, and every node allocated is recorded, so that the
+ * nodes of the statement which didn't parse can be freed. The nodes don't
+ * form a tree until the statement is finished, so each is freed alone.
+ */
+typedef struct {
+  jmp_buf failed;
+  size_t count;
+  size_t capacity;
+  Node** nodes;
+} Recovery;
+
+static _Thread_local Recovery* recovery = NULL;
+
+static void Recovery_track(Node* node) {
+  if(recovery == NULL) return;
+
+  if(recovery->count == recovery->capacity) {
+    recovery->capacity = recovery->capacity == 0 ? 16 : recovery->capacity * 2;
+    recovery->nodes = realloc(recovery->nodes, sizeof(Node*) * recovery->capacity);
+    assert(recovery->nodes != NULL); // TODO Handle this
+  }
+
+  recovery->nodes[recovery->count++] = node;
+}
+
+static void Recovery_freeNodes(Recovery* self) {
+  for(size_t i = 0; i < self->count; i++) {
+    Node* node = self->nodes[i];
+
+    if(node->type == NODE_EXPRESSION_LIST || node->type == NODE_COMMA_SEPARATED_LIST) {
+      free(((ExpressionListNode*)node)->items);
+    }
+
+    free(node);
+  }
+}
+
+// Checks the source is as the grammar requires
+static void expect(bool condition) {
+  if(condition) return;
+  if(recovery != NULL) longjmp(recovery->failed, 1);
+  assert(false); // TODO Handle this
+}
+
 static Node* makeAtomNode(Token token) {
   NodeType type;
 
@@ -266,13 +323,14 @@ static Node* makeAtomNode(Token token) {
       break;
 
     default:
-      assert(false); // TODO Better handling.
+      expect(false);
   }
 
   AtomNode* node = AtomNode_allocateOne();
   node->node = makeNode(type, token.line);
   node->text = token.text;
   node->length = token.length;
+  Recovery_track((Node*)node);
   return (Node*)node;
 }
 
@@ -284,12 +342,13 @@ static Node* makeUnaryNode(Token operator, Node* arg) {
     case TOKEN_NOT:   type = NODE_NOT;    break;
 
     default:
-      assert(false);
+      expect(false);
   }
 
   UnaryNode* node = UnaryNode_allocateOne();
   node->node = makeNode(type, operator.line);
   node->arg = arg;
+  Recovery_track((Node*)node);
   return (Node*)node;
 }
 
@@ -298,6 +357,7 @@ static Node* makeBinaryNode(NodeType type, size_t line, Node* arg0, Node* arg1)
   node->node = makeNode(type, line);
   node->arg0 = arg0;
   node->arg1 = arg1;
+  Recovery_track((Node*)node);
   return (Node*)node;
 }
 
@@ -307,6 +367,7 @@ static Node* makeTernaryNode(NodeType type, size_t line, Node* arg0, Node* arg1,
   node->arg0 = arg0;
   node->arg1 = arg1;
   node->arg2 = arg2;
+  Recovery_track((Node*)node);
   return (Node*)node;
 }
 
@@ -375,6 +436,7 @@ static void ExpressionListNode_init(
   self->length = 0;
   self->capacity = 0;
   self->items = NULL;
+  Recovery_track((Node*)self);
 }
 
 static void ExpressionListNode_append(ExpressionListNode* self, Node* item) {
@@ -441,18 +503,148 @@ static Node* parseCall(Scanner* scanner, size_t line) {
       ExpressionListNode_snug(elNode);
       return (Node*)elNode;
     } else {
-      assert(close.type == TOKEN_COMMA);
+      expect(close.type == TOKEN_COMMA);
     }
   }
 }
 
-Node* parseFunctionDefinition(Scanner* scanner, size_t line) {
+static Node* parseFunctionBody(Scanner* scanner) {
+  TokenType expectedExit = TOKEN_END;
+
+  Node* body = parseExpressionList(scanner, 1, &expectedExit);
+
   Token token = Scanner_scan(scanner);
-  assert(token.type == TOKEN_IDENTIFIER);
+  expect(token.type == TOKEN_END);
+
+  return body;
+}
+
+static void DeferredBodyNode_addName(
+    DeferredBodyNode* self,
+    size_t* capacity,
+    Token token,
+    bool assigned) {
+  size_t start = assigned ? 0 : self->assignedCount;
+  size_t end = assigned ? self->assignedCount : self->nameCount;
+
+  for(size_t i = start; i < end; i++) {
+    if(self->names[i].length == token.length &&
+        !memcmp(self->names[i].text, token.text, token.length)) {
+      return;
+    }
+  }
+
+  if(self->nameCount == *capacity) {
+    *capacity = *capacity == 0 ? 8 : *capacity * 2;
+    self->names = realloc(self->names, sizeof(BodyName) * *capacity);
+    assert(self->names != NULL); // TODO Handle this
+  }
+
+  BodyName name = { .text=token.text, .length=token.length };
+
+  if(assigned) {
+    // Keep the assigned names in front of the used ones
+    self->names[self->nameCount] = self->names[self->assignedCount];
+    self->names[self->assignedCount] = name;
+    self->assignedCount++;
+  } else {
+    self->names[self->nameCount] = name;
+  }
+
+  self->nameCount++;
+}
+
+/*
+ * Scans to the `end` of a function body, counting the `def`, `if` and
+ * `while` blocks opened inside it, and notes its identifiers. Short bodies
+ * are parsed after all.
+ */
+static Node* skipFunctionBody(Scanner* scanner) {
+  assert(scanner->stream == NULL && !scanner->hasLookahead);
+  Scanner start = *scanner;
+
+  DeferredBodyNode* node = DeferredBodyNode_allocateOne();
+  node->node = makeNode(NODE_DEFERRED_BODY, scanner->line);
+  node->text = scanner->current;
+  node->assignedCount = 0;
+  node->nameCount = 0;
+  node->names = NULL;
+
+  size_t capacity = 0;
+  size_t depth = 1;
+  size_t tokens = 0;
+  Token before = { .type=TOKEN_COLON };
+  Token previous = before;
+
+  for(;;) {
+    Token token = Scanner_scan(scanner);
+    tokens++;
+
+    // The name after a dot is a property name, and after `as` is assigned
+    if(previous.type == TOKEN_IDENTIFIER && before.type != TOKEN_DOT) {
+      if(token.type == TOKEN_ASSIGN || before.type == TOKEN_AS) {
+        DeferredBodyNode_addName(node, &capacity, previous, true);
+      } else if(token.type != TOKEN_OPEN_PAREN) {
+        DeferredBodyNode_addName(node, &capacity, previous, false);
+      }
+    }
+
+    switch(token.type) {
+      case TOKEN_DEF:
+      case TOKEN_IF:
+      case TOKEN_WHILE:
+        depth++;
+        break;
+
+      case TOKEN_END:
+        depth--;
+        break;
+
+      case TOKEN_ERROR:
+      case TOKEN_EOF:
+        assert(false); // TODO Handle this
+        break;
+
+      default:
+        break;
+    }
+
+    if(depth == 0) break;
+
+    before = previous;
+    previous = token;
+  }
+
+  if(tokens <= PREPARSE_MIN_SKIPPED_TOKENS) {
+    Node_free((Node*)node);
+    *scanner = start;
+    return parseFunctionBody(scanner);
+  }
+
+  if(node->nameCount < capacity) {
+    node->names = realloc(node->names, sizeof(BodyName) * node->nameCount);
+    assert(node->names != NULL || node->nameCount == 0); // TODO Handle this
+  }
+
+  return (Node*)node;
+}
+
+Node* parseDeferredBody(Node* node) {
+  assert(node->type == NODE_DEFERRED_BODY);
+
+  Scanner scanner;
+  Scanner_init(&scanner, node->line, ((DeferredBodyNode*)node)->text);
+
+  return parseFunctionBody(&scanner);
+}
+
+static Node* parseFunctionDefinition(Scanner* scanner, size_t line, bool skipBody) {
+  Token token = Scanner_scan(scanner);
+  expect(token.type == TOKEN_IDENTIFIER);
   Node* name = makeAtomNode(token);
 
   token = Scanner_scan(scanner);
-  assert(token.type == TOKEN_OPEN_PAREN);
+  expect(token.type == TOKEN_OPEN_PAREN);
 
   Node* arguments = NULL;
   token = Scanner_scan(scanner);
@@ -463,19 +655,20 @@ Node* parseFunctionDefinition(Scanner* scanner, size_t line) {
   }
 
   if(token.type == TOKEN_COMMA) {
+    expect(arguments != NULL);
     ExpressionListNode* argumentList = ExpressionListNode_allocateOne();
     ExpressionListNode_init(argumentList, NODE_COMMA_SEPARATED_LIST, arguments->line);
     ExpressionListNode_append(argumentList, arguments);
 
     token = Scanner_scan(scanner);
-    assert(token.type == TOKEN_IDENTIFIER);
+    expect(token.type == TOKEN_IDENTIFIER);
     ExpressionListNode_append(argumentList, (Node*)makeAtomNode(token));
 
     token = Scanner_scan(scanner);
 
     while(token.type == TOKEN_COMMA) {
       token = Scanner_scan(scanner);
-      assert(token.type == TOKEN_IDENTIFIER);
+      expect(token.type == TOKEN_IDENTIFIER);
       AtomNode* aNode = (AtomNode*)makeAtomNode(token);
       ExpressionListNode_append(argumentList, (Node*)aNode);
       token = Scanner_scan(scanner);
@@ -484,17 +677,12 @@ Node* parseFunctionDefinition(Scanner* scanner, size_t line) {
     arguments = (Node*)argumentList;
   }
 
-  assert(token.type == TOKEN_CLOSE_PAREN);
+  expect(token.type == TOKEN_CLOSE_PAREN);
 
   token = Scanner_scan(scanner);
-  assert(token.type == TOKEN_COLON);
+  expect(token.type == TOKEN_COLON);
 
-  TokenType expectedExit = TOKEN_END;
-
-  Node* body = parseExpressionList(scanner, 1, &expectedExit);
-
-  token = Scanner_scan(scanner);
-  assert(token.type == TOKEN_END);
+  Node* body = skipBody ? skipFunctionBody(scanner) : parseFunctionBody(scanner);
 
   return makeTernaryNode(NODE_FN_DEF, line, name, arguments, body);
 }
@@ -504,7 +692,7 @@ Node* parseIf(Scanner* scanner, size_t line) {
   Node* test = parseExpression(scanner, PREC_ANY);
 
   Token token = Scanner_scan(scanner);
-  assert(token.type == TOKEN_COLON);
+  expect(token.type == TOKEN_COLON);
 
   TokenType leftBranchExpectedExits[] = {
     TOKEN_ELSE,
@@ -516,7 +704,7 @@ Node* parseIf(Scanner* scanner, size_t line) {
   Node* rightBranch = NULL;
 
   token = Scanner_scan(scanner);
-  assert(token.type == TOKEN_ELSE || token.type == TOKEN_END);
+  expect(token.type == TOKEN_ELSE || token.type == TOKEN_END);
 
   if(token.type == TOKEN_ELSE) {
     TokenType rightBranchExpecteExit = TOKEN_END;
@@ -526,24 +714,69 @@ Node* parseIf(Scanner* scanner, size_t line) {
     token = Scanner_scan(scanner);
   }
 
-  assert(token.type == TOKEN_END);
+  expect(token.type == TOKEN_END);
 
   return makeTernaryNode(NODE_IF, line, test, leftBranch, rightBranch);
 }
 
+/*
+ * import 'path' as name, 'path' as name, ...
+ *
+ * Each becomes `name = import 'path'`, so that the analyses see the name
+ * assigned like any other variable. Several become an expression list.
+ */
+static Node* parseImport(Scanner* scanner, size_t line) {
+  ExpressionListNode* list = NULL;
+  Node* assignment;
+
+  for(;;) {
+    Token path = Scanner_scan(scanner);
+    expect(path.type == TOKEN_SQSTR || path.type == TOKEN_DQSTR);
+
+    Token as = Scanner_scan(scanner);
+    expect(as.type == TOKEN_AS);
+
+    Token name = Scanner_scan(scanner);
+    expect(name.type == TOKEN_IDENTIFIER);
+
+    UnaryNode* import = UnaryNode_allocateOne();
+    import->node = makeNode(NODE_IMPORT, path.line);
+    Recovery_track((Node*)import);
+    import->arg = makeAtomNode(path);
+
+    assignment = makeBinaryNode(NODE_ASSIGN, name.line, makeAtomNode(name), (Node*)import);
+
+    if(Scanner_peek(scanner).type != TOKEN_COMMA) break;
+    Scanner_scan(scanner);
+
+    if(list == NULL) {
+      list = ExpressionListNode_allocateOne();
+      ExpressionListNode_init(list, NODE_EXPRESSION_LIST, line);
+    }
+
+    ExpressionListNode_append(list, assignment);
+  }
+
+  if(list == NULL) return assignment;
+
+  ExpressionListNode_append(list, assignment);
+  ExpressionListNode_snug(list);
+  return (Node*)list;
+}
+
 Node* parseWhile(Scanner* scanner, size_t line) {
   // TODO Can we set a precedence that ensures this is a boolean?
   Node* test = parseExpression(scanner, PREC_ANY);
 
   Token token = Scanner_scan(scanner);
-  assert(token.type == TOKEN_COLON);
+  expect(token.type == TOKEN_COLON);
 
   TokenType expectedExit = TOKEN_END;
 
   Node* body = parseExpressionList(scanner, 1, &expectedExit);
 
   token = Scanner_scan(scanner);
-  assert(token.type == TOKEN_END);
+  expect(token.type == TOKEN_END);
 
   return makeBinaryNode(NODE_WHILE, line, test, body);
 }
@@ -576,6 +809,12 @@ static const PrecedenceRule PRECEDENCE_TABLE[] = {
   [TOKEN_CLOSE_PAREN] = { PREC_NONE,  PREC_NONE,        PREC_NONE         },
   [TOKEN_IF] =          { PREC_NONE,  PREC_NONE,        PREC_NONE         },
   [TOKEN_WHILE] =       { PREC_NONE,  PREC_NONE,        PREC_NONE         },
+  [TOKEN_ELSE] =        { PREC_NONE,  PREC_NONE,        PREC_NONE         },
+  [TOKEN_END] =         { PREC_NONE,  PREC_NONE,        PREC_NONE         },
+  [TOKEN_IMPORT] =      { PREC_NONE,  PREC_NONE,        PREC_NONE         },
+  [TOKEN_AS] =          { PREC_NONE,  PREC_NONE,        PREC_NONE         },
+  [TOKEN_ERROR] =       { PREC_NONE,  PREC_NONE,        PREC_NONE         },
+  [TOKEN_EOF] =         { PREC_NONE,  PREC_NONE,        PREC_NONE         },
 };
 
 Node* parseExpression(Scanner* scanner, Precedence minimumBindingPower) {
@@ -608,7 +847,7 @@ Node* parseExpression(Scanner* scanner, Precedence minimumBindingPower) {
       break;
 
     case TOKEN_DEF:
-      return parseFunctionDefinition(scanner, token.line);
+      return parseFunctionDefinition(scanner, token.line, false);
 
     case TOKEN_IF:
       return parseIf(scanner, token.line);
@@ -616,13 +855,15 @@ Node* parseExpression(Scanner* scanner, Precedence minimumBindingPower) {
     case TOKEN_OPEN_PAREN:
       leftOperand = parseExpression(scanner, PREC_ANY);
       token = Scanner_scan(scanner);
-      // TODO Handle this
-      assert(token.type == TOKEN_CLOSE_PAREN);
+      expect(token.type == TOKEN_CLOSE_PAREN);
       break;
 
     case TOKEN_WHILE:
       return parseWhile(scanner, token.line);
 
+    case TOKEN_IMPORT:
+      return parseImport(scanner, token.line);
+
     default:
       {
         if(PRECEDENCE_TABLE[token.type].prefix > PREC_NONE) {
@@ -631,8 +872,7 @@ Node* parseExpression(Scanner* scanner, Precedence minimumBindingPower) {
               PRECEDENCE_TABLE[token.type].prefix
             );
 
-          // TODO Handle this
-          assert(prefixOperand != NULL);
+          expect(prefixOperand != NULL);
 
           leftOperand = makeUnaryNode(token, prefixOperand);
         }
@@ -640,13 +880,16 @@ Node* parseExpression(Scanner* scanner, Precedence minimumBindingPower) {
   }
 
   if(leftOperand == NULL) {
-    printf(
-        "Unable to parse %s on line %zu\n",
-        TokenType_asString(token.type),
-        token.line
-      );
-    fflush(stdout);
-    assert(false);
+    if(recovery == NULL) {
+      printf(
+          "Unable to parse %s on line %zu\n",
+          TokenType_asString(token.type),
+          token.line
+        );
+      fflush(stdout);
+    }
+
+    expect(false);
   }
 
   /*
@@ -664,6 +907,7 @@ Node* parseExpression(Scanner* scanner, Precedence minimumBindingPower) {
           Node* arguments = parseCall(scanner, leftOperand->line);
           BinaryNode* call = BinaryNode_allocateOne();
           Node_init((Node*)call, NODE_CALL, leftOperand->line);
+          Recovery_track((Node*)call);
 
           call->arg0 = leftOperand;
           call->arg1 = arguments;
@@ -687,7 +931,17 @@ Node* parseExpression(Scanner* scanner, Precedence minimumBindingPower) {
 
     Scanner_scan(scanner);
 
-    Node* rightOperand = parseExpression(scanner, PRECEDENCE_TABLE[operator.type].infixRight);
+    Node* rightOperand;
+
+    if(operator.type == TOKEN_DOT) {
+      // Only the name, so that in `a.b(c)` the property is what's called
+      Token name = Scanner_scan(scanner);
+      expect(name.type == TOKEN_IDENTIFIER);
+      rightOperand = makeAtomNode(name);
+    } else {
+      rightOperand = parseExpression(scanner, PRECEDENCE_TABLE[operator.type].infixRight);
+      expect(rightOperand != NULL);
+    }
 
     NodeType infixOperatorType;
 
@@ -710,8 +964,17 @@ Node* parseExpression(Scanner* scanner, Precedence minimumBindingPower) {
       MAP_INFIX(TOKEN_DOT,    NODE_PROPERTY);
       #undef MAP_INFIX
       default:
-        printf("Unkown infix operator: \"%.*s\"", (int)operator.length, operator.text);
-        exit(1);
+        if(recovery == NULL) {
+          printf(
+              "Unknown infix operator \"%.*s\" on line %zu\n",
+              (int)operator.length,
+              operator.text,
+              operator.line
+            );
+          fflush(stdout);
+        }
+
+        expect(false);
     }
 
     leftOperand = makeBinaryNode(
@@ -758,6 +1021,7 @@ void Node_free(Node* self) {
 
     case NODE_NEGATE:
     case NODE_NOT:
+    case NODE_IMPORT:
       Node_free(((UnaryNode*)self)->arg);
       break;
 
@@ -783,6 +1047,10 @@ void Node_free(Node* self) {
         free(el->items);
       } break;
 
+    case NODE_DEFERRED_BODY:
+      free(((DeferredBodyNode*)self)->names);
+      break;
+
     default:
       assert(false);
   }
@@ -790,6 +1058,60 @@ void Node_free(Node* self) {
   free(self);
 }
 
+void Node_shiftLines(Node* self, long delta) {
+  if(self == NULL) return;
+
+  self->line += delta;
+
+  switch(self->type) {
+    case NODE_IF:
+    case NODE_FN_DEF:
+      Node_shiftLines(((TernaryNode*)self)->arg0, delta);
+      Node_shiftLines(((TernaryNode*)self)->arg1, delta);
+      Node_shiftLines(((TernaryNode*)self)->arg2, delta);
+      break;
+
+    case NODE_ADD:
+    case NODE_AND:
+    case NODE_ASSIGN:
+    case NODE_CALL:
+    case NODE_DIVIDE:
+    case NODE_EQUALS:
+    case NODE_GREATER_THAN:
+    case NODE_GREATER_THAN_EQUALS:
+    case NODE_LESS_THAN:
+    case NODE_LESS_THAN_EQUALS:
+    case NODE_MULTIPLY:
+    case NODE_NOT_EQUALS:
+    case NODE_OR:
+    case NODE_PROPERTY:
+    case NODE_SUBTRACT:
+    case NODE_WHILE:
+      Node_shiftLines(((BinaryNode*)self)->arg0, delta);
+      Node_shiftLines(((BinaryNode*)self)->arg1, delta);
+      break;
+
+    case NODE_NEGATE:
+    case NODE_NOT:
+    case NODE_IMPORT:
+      Node_shiftLines(((UnaryNode*)self)->arg, delta);
+      break;
+
+    case NODE_COMMA_SEPARATED_LIST:
+    case NODE_EXPRESSION_LIST:
+      {
+        ExpressionListNode* el = (ExpressionListNode*)self;
+
+        for(size_t i = 0; i < el->length; i++) {
+          Node_shiftLines(el->items[i], delta);
+        }
+      } break;
+
+    default:
+      break;
+  }
+}
+
 inline static bool isExpectedExit(TokenType t, uint8_t expectedExitCount, TokenType* expectedExits) {
   switch(t) {
     case TOKEN_ELSE:
@@ -800,7 +1122,8 @@ inline static bool isExpectedExit(TokenType t, uint8_t expectedExitCount, TokenT
           return true;
         }
       }
-      assert(false);
+      expect(false);
+      return false;
 
     default:
       return false;
@@ -808,7 +1131,11 @@ inline static bool isExpectedExit(TokenType t, uint8_t expectedExitCount, TokenT
 }
 
 
-Node* parseExpressionList(Scanner* scanner, uint8_t expectedExitCount, TokenType* expectedExits) {
+static Node* parseStatementList(
+    Scanner* scanner,
+    uint8_t expectedExitCount,
+    TokenType* expectedExits,
+    Node* (*parseOne)(Scanner*)) {
   /*
    * TODO Don't return an ExpressionList if it would contain only one
    * node. Instead just return the one node.
@@ -819,7 +1146,7 @@ Node* parseExpressionList(Scanner* scanner, uint8_t expectedExitCount, TokenType
     return NULL;
   }
 
-  Node* first = parseStatement(scanner);
+  Node* first = parseOne(scanner);
 
   token = Scanner_peek(scanner);
 
@@ -837,11 +1164,15 @@ Node* parseExpressionList(Scanner* scanner, uint8_t expectedExitCount, TokenType
       return (Node*)node;
     }
 
-    ExpressionListNode_append(node, parseStatement(scanner));
+    ExpressionListNode_append(node, parseOne(scanner));
     token = Scanner_peek(scanner);
   }
 }
 
+Node* parseExpressionList(Scanner* scanner, uint8_t expectedExitCount, TokenType* expectedExits) {
+  return parseStatementList(scanner, expectedExitCount, expectedExits, parseStatement);
+}
+
 Node* parse(Scanner* scanner) {
   TokenType exit = TOKEN_EOF;
 
@@ -851,3 +1182,45 @@ Node* parse(Scanner* scanner) {
 Node* parseStatement(Scanner* scanner) {
   return parseExpression(scanner, PREC_ANY);
 }
+
+Node* tryParseStatement(Scanner* scanner) {
+  assert(recovery == NULL);
+
+  Recovery self = { .count=0, .capacity=0, .nodes=NULL };
+  Node* result = NULL;
+
+  if(setjmp(self.failed) == 0) {
+    recovery = &self;
+    result = parseStatement(scanner);
+  } else {
+    Recovery_freeNodes(&self);
+  }
+
+  recovery = NULL;
+  free(self.nodes);
+  return result;
+}
+
+Node* parseNextStatement(Scanner* scanner) {
+  if(Scanner_peek(scanner).type == TOKEN_EOF) return NULL;
+  return parseStatement(scanner);
+}
+
+static Node* preparseStatement(Scanner* scanner) {
+  Token token = Scanner_peek(scanner);
+  if(token.type != TOKEN_DEF) return parseStatement(scanner);
+
+  Scanner_scan(scanner);
+  return parseFunctionDefinition(scanner, token.line, true);
+}
+
+Node* preparse(Scanner* scanner) {
+  TokenType exit = TOKEN_EOF;
+
+  return parseStatementList(scanner, 1, &exit, preparseStatement);
+}
+
+Node* preparseNextStatement(Scanner* scanner) {
+  if(Scanner_peek(scanner).type == TOKEN_EOF) return NULL;
+  return preparseStatement(scanner);
+}
@@ -18,6 +18,7 @@ typedef enum {
   // Unary Nodes
   NODE_NEGATE,
   NODE_NOT,
+  NODE_IMPORT,
 
   // Binary nodes
   NODE_PROPERTY,
@@ -45,6 +46,8 @@ typedef enum {
   NODE_COMMA_SEPARATED_LIST,
   NODE_EXPRESSION_LIST,
 
+  NODE_DEFERRED_BODY,
+
 } NodeType;
 
 void NodeType_print(NodeType);
@@ -63,6 +66,10 @@ typedef struct {
 
 inline static ALLOCATE_ONE_IMPL(AtomNode);
 
+/*
+ * NODE_IMPORT's argument is the NODE_STRING naming the module. The parser
+ * makes each import an assignment of a NODE_IMPORT to the name after `as`.
+ */
 typedef struct {
   Node node;
   Node* arg;
@@ -97,10 +104,72 @@ typedef struct {
 
 inline static ALLOCATE_ONE_IMPL(ExpressionListNode);
 
+typedef struct {
+  char* text;
+  size_t length;
+} BodyName;
+
+/*
+ * NODE_DEFERRED_BODY: a function body which preparse() skipped over without
+ * building its tree. `text` is where the body starts in the source, which
+ * must outlive the node, and the node's line is the line it starts on.
+ *
+ * So that the analyses can still answer for the body, the skip records the
+ * distinct identifiers assigned in it, in names[0] to names[assignedCount - 1],
+ * and the distinct identifiers otherwise used in it other than being called,
+ * in the rest. Parameters of functions nested in the body count as used.
+ */
+typedef struct {
+  Node node;
+  char* text;
+  size_t assignedCount;
+  size_t nameCount;
+  BodyName* names;
+} DeferredBodyNode;
+
+inline static ALLOCATE_ONE_IMPL(DeferredBodyNode);
+
+/*
+ * Bodies with at most this many tokens are parsed by preparse() anyway:
+ * they're cheap to parse, and may be small enough to inline.
+ */
+#define PREPARSE_MIN_SKIPPED_TOKENS 64
+
 Node* parse(Scanner*);
 Node* parseStatement(Scanner*);
 
+/*
+ * Like parseStatement(), but returns NULL if the statement has a syntax
+ * error instead of failing an assertion, for text still being edited. The
+ * scanner is left somewhere inside the statement.
+ */
+Node* tryParseStatement(Scanner*);
+
+/*
+ * Parses the next top-level statement of a module, or returns NULL at the end
+ * of the file, so a module can be compiled a statement at a time instead of
+ * parsing all of it with parse().
+ */
+Node* parseNextStatement(Scanner*);
+
+/*
+ * Like parse() and parseNextStatement(), but the bodies of functions defined
+ * by top-level statements are only scanned, to find where they end, and are
+ * left as NODE_DEFERRED_BODY for parseDeferredBody() to parse when they're
+ * compiled. The scanner can't be a stream, since the source is read again.
+ */
+Node* preparse(Scanner*);
+Node* preparseNextStatement(Scanner*);
+
+Node* parseDeferredBody(Node*);
+
 void Node_free(Node*);
 void Node_print(Node*);
 
+/*
+ * Adds `delta` to the line of every node in the tree, for a tree whose
+ * source has moved.
+ */
+void Node_shiftLines(Node*, long delta);
+
 #endif
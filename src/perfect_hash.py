@@ -0,0 +1,179 @@
+'''
+Generates keyword_table.h and native_table.h, which contain perfect hash
+tables for the scanner's keywords and the compiler's native functions.
+
+Run this after adding a keyword or a native:
+
+    python3 perfect_hash.py
+
+The generated headers are checked in, so building Fur doesn't require Python.
+'''
+
+import os
+
+# Go to the directory of the current file so we know where we are in the filesystem
+os.chdir(os.path.dirname(os.path.abspath(__file__)))
+
+KEYWORDS = (
+    ('and',     'TOKEN_AND'),
+    ('as',      'TOKEN_AS'),
+    ('def',     'TOKEN_DEF'),
+    ('else',    'TOKEN_ELSE'),
+    ('end',     'TOKEN_END'),
+    ('false',   'TOKEN_FALSE'),
+    ('if',      'TOKEN_IF'),
+    ('import',  'TOKEN_IMPORT'),
+    ('nil',     'TOKEN_NIL'),
+    ('not',     'TOKEN_NOT'),
+    ('or',      'TOKEN_OR'),
+    ('true',    'TOKEN_TRUE'),
+    ('while',   'TOKEN_WHILE'),
+)
+
+# The index of a native in this list is the operand of OP_NATIVE, so
+# reordering this list changes the bytecode format.
+NATIVES = (
+    ('input',   'nativeInput'),
+    ('print',   'nativePrint'),
+    ('spawn',   'nativeSpawn'),
+    ('channel', 'nativeChannel'),
+    ('send',    'nativeSend'),
+    ('receive', 'nativeReceive'),
+)
+
+UINT32_MASK = 0xffffffff
+
+def keyword_hash(a, b, word):
+    '''
+    Must match KEYWORD_HASH in keyword_table.h. This only looks at the first
+    byte, last byte and length, so the scanner doesn't have to loop over the
+    identifier a second time to find out whether it's a keyword.
+    '''
+    return (ord(word[0]) * a + ord(word[-1]) * b + len(word)) & UINT32_MASK
+
+def fnv1a(word):
+    '''
+    Must match hash() in symbol_table.c, since the compiler probes the native
+    table with Symbol.hash.
+    '''
+    result = 2166136261
+    for ch in word.encode('utf-8'):
+        result ^= ch
+        result = (result * 16777619) & UINT32_MASK
+    return result
+
+def native_hash(multiplier, bits, word):
+    '''
+    Must match NATIVE_HASH in native_table.h.
+    '''
+    return ((fnv1a(word) * multiplier) & UINT32_MASK) >> (32 - bits)
+
+def is_perfect(indices):
+    return len(set(indices)) == len(indices)
+
+def minimum_bits(count):
+    bits = 1
+    while (1 << bits) < count:
+        bits += 1
+    return bits
+
+def find_keyword_hash():
+    bits = minimum_bits(len(KEYWORDS))
+
+    while True:
+        mask = (1 << bits) - 1
+
+        for a in range(1, 256):
+            for b in range(1, 256):
+                indices = [keyword_hash(a, b, w) & mask for w, _ in KEYWORDS]
+                if is_perfect(indices):
+                    return a, b, bits
+
+        bits += 1
+
+def find_native_hash():
+    bits = minimum_bits(len(NATIVES))
+
+    while True:
+        for multiplier in range(1, 1 << 16, 2):
+            indices = [native_hash(multiplier, bits, w) for w, _ in NATIVES]
+            if is_perfect(indices):
+                return multiplier, bits
+
+        bits += 1
+
+HEADER = '''/*
+ * THIS FILE IS GENERATED BY perfect_hash.py. DO NOT EDIT IT BY HAND.
+ */
+'''
+
+def write_keyword_table():
+    a, b, bits = find_keyword_hash()
+    mask = (1 << bits) - 1
+
+    slots = [None] * (1 << bits)
+    for word, token_type in KEYWORDS:
+        slots[keyword_hash(a, b, word) & mask] = (word, token_type)
+
+    max_length = max(len(w) for w, _ in KEYWORDS)
+
+    with open('keyword_table.h', 'w') as f:
+        f.write(HEADER)
+        f.write('#ifndef FUR_KEYWORD_TABLE_H\n')
+        f.write('#define FUR_KEYWORD_TABLE_H\n\n')
+        f.write('#include <stdint.h>\n\n')
+        f.write('#include "scanner.h"\n\n')
+        f.write('#define KEYWORD_MAX_LENGTH {}\n'.format(max_length))
+        f.write('#define KEYWORD_HASH_MASK {}\n\n'.format(mask))
+        f.write('#define KEYWORD_HASH(text, length) \\\n')
+        f.write('  (((uint32_t)(uint8_t)(text)[0] * {}u \\\n'.format(a))
+        f.write('    + (uint32_t)(uint8_t)(text)[(length) - 1] * {}u \\\n'.format(b))
+        f.write('    + (uint32_t)(length)) & KEYWORD_HASH_MASK)\n\n')
+        f.write('typedef struct {\n')
+        f.write('  const char* text;\n')
+        f.write('  uint8_t length;\n')
+        f.write('  TokenType type;\n')
+        f.write('} Keyword;\n\n')
+        f.write('static const Keyword KEYWORD_TABLE[KEYWORD_HASH_MASK + 1] = {\n')
+        for slot in slots:
+            if slot is None:
+                f.write('  { .text=NULL, .length=0, .type=TOKEN_IDENTIFIER },\n')
+            else:
+                word, token_type = slot
+                f.write('  {{ .text="{}", .length={}, .type={} }},\n'.format(
+                    word,
+                    len(word),
+                    token_type,
+                ))
+        f.write('};\n\n')
+        f.write('#endif\n')
+
+def write_native_table():
+    multiplier, bits = find_native_hash()
+
+    slots = [0] * (1 << bits)
+    for index, (word, _) in enumerate(NATIVES):
+        # Slots store index + 1 so that 0 can mean "empty"
+        slots[native_hash(multiplier, bits, word)] = index + 1
+
+    with open('native_table.h', 'w') as f:
+        f.write(HEADER)
+        f.write('#ifndef FUR_NATIVE_TABLE_H\n')
+        f.write('#define FUR_NATIVE_TABLE_H\n\n')
+        f.write('#include <stdint.h>\n\n')
+        f.write('#define NATIVE_COUNT {}\n'.format(len(NATIVES)))
+        f.write('#define NATIVE_HASH_BITS {}\n\n'.format(bits))
+        f.write('#define NATIVE_HASH(hash) \\\n')
+        f.write('  ((uint32_t)((uint32_t)(hash) * {}u) >> (32 - NATIVE_HASH_BITS))\n\n'.format(multiplier))
+        f.write('#define NATIVE_LIST(X) \\\n')
+        for word, function in NATIVES:
+            f.write('  X({}, {}) \\\n'.format(word, function))
+        f.write('\n')
+        f.write('static const uint16_t NATIVE_SLOTS[1 << NATIVE_HASH_BITS] = {\n')
+        for slot in slots:
+            f.write('  {},\n'.format(slot))
+        f.write('};\n\n')
+        f.write('#endif\n')
+
+write_keyword_table()
+write_native_table()
@@ -1,34 +1,117 @@
+#include <assert.h>
+#include <fcntl.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "memory.h"
 #include "read_file.h"
 
-char* readFile(const char* path) {
-  FILE* file = fopen(path, "rb");
+/*
+ * Maps `length` bytes of `fd` followed by at least one zero byte.
+ *
+ * When the length isn't a multiple of the page size, the kernel zero-fills
+ * the rest of the last page, but when it is, reading one past the end would
+ * fault. So reserve enough zeroed anonymous pages for the text and the NUL
+ * first, then map the file over the start of them.
+ */
+static bool mapFile(SourceFile* self, int fd, size_t length) {
+  size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+  size_t mappedLength = (length + 1 + pageSize - 1) / pageSize * pageSize;
 
-  if (file == NULL) {
-    fprintf(stderr, "Could not open file \"%s\".\n", path);
-    exit(1);
+  void* reserved = mmap(
+      NULL,
+      mappedLength,
+      PROT_READ,
+      MAP_PRIVATE | MAP_ANONYMOUS,
+      -1,
+      0);
+  if(reserved == MAP_FAILED) return false;
+
+  void* text = mmap(reserved, length, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0);
+
+  if(text == MAP_FAILED) {
+    munmap(reserved, mappedLength);
+    return false;
+  }
+
+  self->text = text;
+  self->length = length;
+  self->mappedLength = mappedLength;
+  return true;
+}
+
+/*
+ * Reads until end of file, for files whose size isn't known up front.
+ */
+static bool readStream(SourceFile* self, int fd) {
+  size_t capacity = 4096;
+  size_t length = 0;
+  char* buffer = allocateChars(capacity);
+
+  for(;;) {
+    // Always leave room for the NUL
+    if(capacity - length < 2) {
+      capacity = capacity * 2;
+      char* tmp = realloc(buffer, capacity);
+      assert(tmp != NULL); /* TODO Handle this */
+      buffer = tmp;
+    }
+
+    ssize_t bytesRead = read(fd, buffer + length, capacity - length - 1);
+
+    if(bytesRead < 0) {
+      free(buffer);
+      return false;
+    }
+
+    if(bytesRead == 0) break;
+
+    length += (size_t)bytesRead;
   }
 
-  fseek(file, 0L, SEEK_END);
-  size_t fileSize = ftell(file);
-  rewind(file);
+  buffer[length] = '\0';
 
-  char* buffer = allocateChars(fileSize + 1);
+  self->text = buffer;
+  self->length = length;
+  self->mappedLength = 0;
+  return true;
+}
+
+void SourceFile_read(SourceFile* self, const char* path) {
+  int fd = open(path, O_RDONLY);
 
-  if (buffer == NULL) {
-    fprintf(stderr, "Not enough memory to read \"%s\".\n", path);
+  if (fd < 0) {
+    fprintf(stderr, "Could not open file \"%s\".\n", path);
     exit(1);
   }
 
-  size_t bytesRead = fread(buffer, sizeof(char), fileSize, file);
-  if (bytesRead < fileSize) {
+  struct stat info;
+  bool mapped = fstat(fd, &info) == 0
+    && S_ISREG(info.st_mode)
+    && info.st_size > 0
+    && mapFile(self, fd, (size_t)info.st_size);
+
+  if (!mapped && !readStream(self, fd)) {
     fprintf(stderr, "Could not read file \"%s\".\n", path);
     exit(1);
   }
-  buffer[bytesRead] = '\0';
 
-  fclose(file);
-  return buffer;
+  // Mappings stay valid after the descriptor is closed
+  close(fd);
+}
+
+void SourceFile_free(SourceFile* self) {
+  if(self->mappedLength > 0) {
+    munmap(self->text, self->mappedLength);
+  } else {
+    free(self->text);
+  }
+
+  self->text = NULL;
+  self->length = 0;
+  self->mappedLength = 0;
 }
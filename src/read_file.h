@@ -1,6 +1,28 @@
 #ifndef FUR_READ_FILE_H
 #define FUR_READ_FILE_H
 
-char* readFile(const char*);
+#include <stdlib.h>
+
+/*
+ * The scanner, the parser and the symbol table all keep pointers into the
+ * text of a source file, so it has to outlive everything compiled from it.
+ *
+ * Regular files are mapped read-only rather than copied, so a large source
+ * costs no upfront copy and processes running the same file share its pages.
+ * The mapping is followed by at least one zero byte, so `text` is NUL
+ * terminated like a string. Anything that can't be mapped, like a pipe, is
+ * read into the heap instead.
+ */
+typedef struct {
+  char* text;
+  size_t length;
+  size_t mappedLength; // 0 if the text is on the heap
+} SourceFile;
+
+/*
+ * Exits the process if the file can't be read.
+ */
+void SourceFile_read(SourceFile*, const char* path);
+void SourceFile_free(SourceFile*);
 
 #endif
@@ -11,13 +11,20 @@ Symbol* Runtime_getSymbol(Runtime* self, size_t length, char* name) {
   assert(self != NULL);
   assert(name != NULL);
   assert(length <= UINT8_MAX);
-  return SymbolTable_getSymbol(&(self->symbols), (uint8_t)length, name);
+
+  pthread_mutex_lock(&(self->symbolsLock));
+  Symbol* result = SymbolTable_getSymbol(&(self->symbols), (uint8_t)length, name);
+  pthread_mutex_unlock(&(self->symbolsLock));
+
+  return result;
 }
 
 void Runtime_init(Runtime* self) {
   SymbolTable_init(&(self->symbols));
+  pthread_mutex_init(&(self->symbolsLock), NULL);
 }
 
 void Runtime_free(Runtime* self) {
   SymbolTable_free(&(self->symbols));
+  pthread_mutex_destroy(&(self->symbolsLock));
 }
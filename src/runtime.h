@@ -1,11 +1,20 @@
 #ifndef FUR_RUNTIME_H
 #define FUR_RUNTIME_H
 
+#include <pthread.h>
+
 #include "symbol.h"
 #include "symbol_table.h"
 
+/*
+ * Runtime_getSymbol may be called from several threads at once, such as
+ * when the compiler compiles functions in parallel. Using `symbols`
+ * directly isn't synchronized, so it's only safe while no other thread is
+ * using the runtime.
+ */
 typedef struct {
   SymbolTable symbols;
+  pthread_mutex_t symbolsLock;
 } Runtime;
 
 void Runtime_init(Runtime*);
@@ -1,8 +1,24 @@
 #include <assert.h>
+#include <errno.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+
+/*
+ * Whitespace, identifiers and string bodies are scanned 16 bytes at a time
+ * with SSE2 where it's available. Define FUR_NO_SIMD to build the scalar
+ * scanner instead, for example to compare the two with `fur_scan
+ * --benchmark`.
+ */
+#if defined(__SSE2__) && !defined(FUR_NO_SIMD)
+#define FUR_SCANNER_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "keyword_table.h"
 #include "scanner.h"
 
 const char* TokenType_asString(TokenType type) {
@@ -39,6 +55,8 @@ const char* TokenType_asString(TokenType type) {
       MAP(TOKEN_END);
       MAP(TOKEN_WHILE);
       MAP(TOKEN_COMMA);
+      MAP(TOKEN_IMPORT);
+      MAP(TOKEN_AS);
 
       MAP(TOKEN_ERROR);
       MAP(TOKEN_EOF);
@@ -53,10 +71,273 @@ void Scanner_init(Scanner* self, size_t startLine, char* source) {
   self->current = source;
   self->line = startLine;
   self->hasLookahead = false;
+  self->stream = NULL;
 }
 
-static void Scanner_scanWhitespace(Scanner* self) {
+/*
+ * Token text copied out of a stream's buffer. Blocks are at least as large
+ * as the longest token a stream can scan, so a token always fits in a new
+ * block.
+ */
+struct ScannerTextBlock {
+  ScannerTextBlock* next;
+  size_t used;
+  char text[SCANNER_CHUNK_SIZE];
+};
+
+/*
+ * The extra 16 bytes keep the aligned 16-byte loads of the SIMD scanner
+ * inside the buffer when the end of the source is near the end of it.
+ */
+#define STREAM_BUFFER_SIZE (2 * SCANNER_CHUNK_SIZE + 16)
+
+void ScannerStream_init(ScannerStream* self, int fd, SymbolTable* symbols) {
+  self->fd = fd;
+  self->atEnd = false;
+  self->buffer = calloc(STREAM_BUFFER_SIZE, 1);
+  assert(self->buffer != NULL); /* TODO Handle this */
+  self->end = self->buffer;
+  self->symbols = symbols;
+  self->text = NULL;
+
+  for(size_t i = 0; i <= TOKEN_EOF; i++) {
+    self->fixedText[i] = NULL;
+  }
+}
+
+void ScannerStream_free(ScannerStream* self) {
+  free(self->buffer);
+
+  while(self->text != NULL) {
+    ScannerTextBlock* next = self->text->next;
+    free(self->text);
+    self->text = next;
+  }
+}
+
+/*
+ * If fewer than a chunk's worth of bytes are buffered after `*current`,
+ * moves them to the front of the buffer and reads until it's full or the
+ * source ends.
+ */
+static void ScannerStream_fill(ScannerStream* self, char** current) {
+  size_t ahead = self->end - *current;
+  if(self->atEnd || ahead >= SCANNER_CHUNK_SIZE) return;
+
+  memmove(self->buffer, *current, ahead);
+  *current = self->buffer;
+  self->end = self->buffer + ahead;
+
+  char* limit = self->buffer + 2 * SCANNER_CHUNK_SIZE;
+
+  while(self->end < limit) {
+    ssize_t count = read(self->fd, self->end, limit - self->end);
+
+    if(count < 0 && errno == EINTR) continue;
+    assert(count >= 0); /* TODO Handle this */
+
+    if(count == 0) {
+      self->atEnd = true;
+      break;
+    }
+
+    self->end += count;
+  }
+
+  *(self->end) = '\0';
+}
+
+static char* ScannerStream_copyText(ScannerStream* self, char* text, size_t length) {
+  assert(length <= SCANNER_CHUNK_SIZE);
+
+  if(self->text == NULL || self->text->used + length > SCANNER_CHUNK_SIZE) {
+    ScannerTextBlock* block = malloc(sizeof(ScannerTextBlock));
+    assert(block != NULL); /* TODO Handle this */
+    block->next = self->text;
+    block->used = 0;
+    self->text = block;
+  }
+
+  char* copy = self->text->text + self->text->used;
+  memcpy(copy, text, length);
+  self->text->used += length;
+  return copy;
+}
+
+static Token ScannerStream_copyToken(ScannerStream* self, Token token) {
+  switch(token.type) {
+    case TOKEN_IDENTIFIER:
+      assert(token.length <= UINT8_MAX);
+      token.text = SymbolTable_copySymbol(
+        self->symbols,
+        (uint8_t)token.length,
+        token.text
+      )->name;
+      break;
+
+    case TOKEN_NUMBER:
+    case TOKEN_SQSTR:
+    case TOKEN_DQSTR:
+      token.text = ScannerStream_copyText(self, token.text, token.length);
+      break;
+
+    case TOKEN_ERROR:
+      // Error messages are string constants
+      break;
+
+    default:
+      if(self->fixedText[token.type] == NULL) {
+        self->fixedText[token.type] = ScannerStream_copyText(
+          self,
+          token.text,
+          token.length
+        );
+      }
+
+      token.text = self->fixedText[token.type];
+      break;
+  }
+
+  return token;
+}
+
+void Scanner_initStream(Scanner* self, ScannerStream* stream) {
+  Scanner_init(self, 1, stream->buffer);
+  self->stream = stream;
+}
+
+#ifdef FUR_SCANNER_SSE2
+
+/*
+ * Most whitespace runs, identifiers and strings are only a few bytes long,
+ * which the scalar loops handle faster than it takes to set up a block, so
+ * the block versions only take over after SCALAR_PREFIX bytes.
+ */
+#define SCALAR_PREFIX 8
+
+/*
+ * Loads the aligned 16-byte block containing `p`, and sets `offset` to the
+ * number of bytes in the block before `p`. An aligned load never crosses a
+ * page boundary, so this can't fault when `p` is near the terminating '\0'
+ * at the end of the source, although it may read bytes after it which the
+ * caller must ignore.
+ */
+inline static __m128i loadBlock(const char* p, unsigned* offset) {
+  uintptr_t address = (uintptr_t)p;
+  *offset = address & 15;
+  return _mm_load_si128((const __m128i*)(address & ~(uintptr_t)15));
+}
+
+/*
+ * Returns a bit for each byte of the block at or after `offset` for which
+ * the corresponding byte of `matches` is set, shifted so bit 0 is `offset`.
+ */
+inline static unsigned blockMask(__m128i matches, unsigned offset) {
+  return (unsigned)_mm_movemask_epi8(matches) >> offset;
+}
+
+inline static __m128i matchByte(__m128i block, char ch) {
+  return _mm_cmpeq_epi8(block, _mm_set1_epi8(ch));
+}
+
+static void Scanner_scanWhitespaceBlocks(Scanner* self) {
+  for(;;) {
+    unsigned offset;
+    __m128i block = loadBlock(self->current, &offset);
+
+    __m128i newlines = matchByte(block, '\n');
+    __m128i whitespace = _mm_or_si128(
+      _mm_or_si128(newlines, matchByte(block, ' ')),
+      _mm_or_si128(matchByte(block, '\t'), matchByte(block, '\r'))
+    );
+
+    unsigned newlineMask = blockMask(newlines, offset);
+    unsigned stops = ~blockMask(whitespace, offset) & (0xffffu >> offset);
+
+    if(stops) {
+      unsigned length = __builtin_ctz(stops);
+      self->line += __builtin_popcount(newlineMask & ((1u << length) - 1));
+      self->current += length;
+      return;
+    }
+
+    self->line += __builtin_popcount(newlineMask);
+    self->current += 16 - offset;
+  }
+}
+
+/*
+ * Advances past [A-Za-z0-9_]. Letters are found by setting the 0x20 bit,
+ * which maps 'A'-'Z' onto 'a'-'z' and nothing else into that range, then
+ * comparing against the range; bytes above 0x7f are negative in the signed
+ * comparisons and so are never matched.
+ */
+static void Scanner_skipIdentifierBlocks(Scanner* self) {
   for(;;) {
+    unsigned offset;
+    __m128i block = loadBlock(self->current, &offset);
+
+    __m128i lower = _mm_or_si128(block, _mm_set1_epi8(0x20));
+    __m128i letters = _mm_and_si128(
+      _mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+      _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1))
+    );
+    __m128i digits = _mm_and_si128(
+      _mm_cmpgt_epi8(block, _mm_set1_epi8('0' - 1)),
+      _mm_cmplt_epi8(block, _mm_set1_epi8('9' + 1))
+    );
+    __m128i identifier = _mm_or_si128(
+      _mm_or_si128(letters, digits),
+      matchByte(block, '_')
+    );
+
+    unsigned stops = ~blockMask(identifier, offset) & (0xffffu >> offset);
+
+    if(stops) {
+      self->current += __builtin_ctz(stops);
+      return;
+    }
+
+    self->current += 16 - offset;
+  }
+}
+
+/*
+ * Advances to the next byte in a string body which needs looking at: the
+ * closing quote, an escape, or the end of the line or file.
+ */
+static void Scanner_skipStringBodyBlocks(Scanner* self, char quoteChar) {
+  for(;;) {
+    unsigned offset;
+    __m128i block = loadBlock(self->current, &offset);
+
+    __m128i specials = _mm_or_si128(
+      _mm_or_si128(matchByte(block, quoteChar), matchByte(block, '\\')),
+      _mm_or_si128(matchByte(block, '\n'), matchByte(block, '\0'))
+    );
+
+    unsigned stops = blockMask(specials, offset);
+
+    if(stops) {
+      self->current += __builtin_ctz(stops);
+      return;
+    }
+
+    self->current += 16 - offset;
+  }
+}
+
+#endif
+
+static void Scanner_scanWhitespace(Scanner* self) {
+  for(int i = 0;; i++) {
+#ifdef FUR_SCANNER_SSE2
+    if(i == SCALAR_PREFIX) {
+      Scanner_scanWhitespaceBlocks(self);
+      return;
+    }
+#endif
+
     switch(*(self->current)) {
       case '\n':
         self->line++;
@@ -180,8 +461,38 @@ static bool isNumeric(char ch) {
   }
 }
 
+static void Scanner_skipIdentifier(Scanner* self) {
+  for(int i = 0;; i++) {
+#ifdef FUR_SCANNER_SSE2
+    if(i == SCALAR_PREFIX) {
+      Scanner_skipIdentifierBlocks(self);
+      return;
+    }
+#endif
+
+    char ch = *(self->current);
+    if(!isAlphaNumeric(ch) && ch != '_') return;
+    self->current++;
+  }
+}
+
+static void Scanner_skipStringBody(Scanner* self, char quoteChar) {
+  for(int i = 0;; i++) {
+#ifdef FUR_SCANNER_SSE2
+    if(i == SCALAR_PREFIX) {
+      Scanner_skipStringBodyBlocks(self, quoteChar);
+      return;
+    }
+#endif
+
+    char ch = *(self->current);
+    if(ch == quoteChar || ch == '\\' || ch == '\n' || ch == '\0') return;
+    self->current++;
+  }
+}
+
 static Token Scanner_scanIdentifier(Scanner* self, char* start) {
-  while(isAlphaNumeric(*(self->current)) || *(self->current) == '_') self->current++;
+  Scanner_skipIdentifier(self);
 
   /*
    * Identifiers may not be any longer than 255 characters.
@@ -190,7 +501,23 @@ static Token Scanner_scanIdentifier(Scanner* self, char* start) {
     assert(false); // TODO Handle this.
   }
 
-  return makeToken(TOKEN_IDENTIFIER, start, self->current - start, self->line);
+  size_t length = self->current - start;
+
+  /*
+   * Keywords are recognized with a perfect hash on the first byte, last byte
+   * and length (see perfect_hash.py), so this is a single probe into
+   * KEYWORD_TABLE followed by a comparison, regardless of how many keywords
+   * there are.
+   */
+  if(length <= KEYWORD_MAX_LENGTH) {
+    const Keyword* keyword = &(KEYWORD_TABLE[KEYWORD_HASH(start, length)]);
+
+    if(keyword->length == length && !memcmp(keyword->text, start, length)) {
+      return makeToken(keyword->type, start, length, self->line);
+    }
+  }
+
+  return makeToken(TOKEN_IDENTIFIER, start, length, self->line);
 }
 
 static Token Scanner_scanNumber(Scanner* self, char* start) {
@@ -201,9 +528,9 @@ static Token Scanner_scanNumber(Scanner* self, char* start) {
 
 inline static Token Scanner_scanString(Scanner* self, char* start, char quoteChar) {
   for(;;) {
-    char ch = *(self->current);
+    Scanner_skipStringBody(self, quoteChar);
 
-    switch(ch) {
+    switch(*(self->current)) {
       case '\n':
         return makeError(
           "Unexpected end of line while scanning string literal",
@@ -218,9 +545,8 @@ inline static Token Scanner_scanString(Scanner* self, char* start, char quoteCha
 
       case '\\':
         self->current++;
-        ch = *(self->current);
 
-        switch(ch) {
+        switch(*(self->current)) {
           // TODO Support more escape sequences
           case '\'':
           case '\"':
@@ -229,11 +555,7 @@ inline static Token Scanner_scanString(Scanner* self, char* start, char quoteCha
           case 'r':
           case 't':
             self->current++;
-            /*
-             * Recursing avoids a problem with breaking from nested
-             * switch statements.
-             */
-            return Scanner_scanString(self, start, quoteChar);
+            continue;
 
           default:
             return makeError(
@@ -242,156 +564,46 @@ inline static Token Scanner_scanString(Scanner* self, char* start, char quoteCha
             );
         }
 
-      case '\'':
-        if(ch == quoteChar) {
-          self->current++;
-          return makeToken(
-            TOKEN_SQSTR,
-            start,
-            self->current - start,
-            self->line
-          );
-        } break;
-
-      case '"':
-        if(ch == quoteChar) {
-          self->current++;
-          return makeToken(
-            TOKEN_DQSTR,
-            start,
-            self->current - start,
-            self->line
-          );
-        } break;
-    }
-
-    self->current++;
-  }
-}
-
-static Token Scanner_scanKeyword(Scanner* self, char* start, const char* suffix, TokenType type) {
-  for(;;) {
-    if(*suffix == *(self->current)) {
-      suffix++;
-      self->current++;
-    } else if(isAlphaNumeric(*(self->current))) {
-      self->current++;
-      return Scanner_scanIdentifier(self, start);
-    } else if(*suffix == '\0') {
-      return makeToken(type, start, self->current - start, self->line);
-    } else {
-      return makeToken(TOKEN_IDENTIFIER, start, self->current - start, self->line);
+      default:
+        assert(*(self->current) == quoteChar);
+        self->current++;
+        return makeToken(
+          quoteChar == '\'' ? TOKEN_SQSTR : TOKEN_DQSTR,
+          start,
+          self->current - start,
+          self->line
+        );
     }
   }
 }
 
-static Token Scanner_scanInternal(Scanner* self) {
-  /*
-   * This is the core function of the scanner, but it's wrapped in the
-   * Scanner_scan() and Scanner_peek() functions. The only purpose of
-   * this wrapping is to manage the self->lookahead and self->hasLookahead
-   * properties.
-   */
+static Token Scanner_scanToken(Scanner* self) {
   Scanner_scanWhitespace(self);
 
   switch(*(self->current)) {
     case 'a':
-      {
-        char* start = self->current;
-        self->current++;
-        return Scanner_scanKeyword(self, start, "nd", TOKEN_AND);
-      }
-
+    case 'b':
+    case 'c':
     case 'd':
-      {
-        char* start = self->current;
-        self->current++;
-        return Scanner_scanKeyword(self, start, "ef", TOKEN_DEF);
-      }
-
     case 'e':
-      {
-        char* start = self->current;
-        self->current++;
-
-        switch(*(self->current)) {
-          case 'l':
-            self->current++;
-            return Scanner_scanKeyword(self, start, "se", TOKEN_ELSE);
-          case 'n':
-            self->current++;
-            return Scanner_scanKeyword(self, start, "d", TOKEN_END);
-          default:
-            return Scanner_scanIdentifier(self, start);
-        }
-      }
-
     case 'f':
-      {
-        char* start = self->current;
-        self->current++;
-        return Scanner_scanKeyword(self, start, "alse", TOKEN_FALSE);
-      }
-
-    case 'i':
-      {
-        char* start = self->current;
-        self->current++;
-        return Scanner_scanKeyword(self, start, "f", TOKEN_IF);
-      }
-
-    case 'n':
-      {
-        char* start = self->current;
-        self->current++;
-
-        switch(*(self->current)) {
-          case 'i':
-            self->current++;
-            return Scanner_scanKeyword(self, start, "l", TOKEN_NIL);
-          case 'o':
-            self->current++;
-            return Scanner_scanKeyword(self, start, "t", TOKEN_NOT);
-          default:
-            return Scanner_scanIdentifier(self, start);
-        }
-      }
-
-    case 'o':
-      {
-        char* start = self->current;
-        self->current++;
-        return Scanner_scanKeyword(self, start, "r", TOKEN_OR);
-      }
-
-    case 't':
-      {
-        char* start = self->current;
-        self->current++;
-        return Scanner_scanKeyword(self, start, "rue", TOKEN_TRUE);
-      }
-
-    case 'w':
-      {
-        char* start = self->current;
-        self->current++;
-        return Scanner_scanKeyword(self, start, "hile", TOKEN_WHILE);
-      }
-
-    case 'b':
-    case 'c':
     case 'g':
     case 'h':
+    case 'i':
     case 'j':
     case 'k':
     case 'l':
     case 'm':
+    case 'n':
+    case 'o':
     case 'p':
     case 'q':
     case 'r':
     case 's':
+    case 't':
     case 'u':
     case 'v':
+    case 'w':
     case 'x':
     case 'y':
     case 'z':
@@ -552,6 +764,42 @@ static Token Scanner_scanInternal(Scanner* self) {
   }
 }
 
+static Token Scanner_scanInternal(Scanner* self) {
+  /*
+   * This is the core function of the scanner, but it's wrapped in the
+   * Scanner_scan() and Scanner_peek() functions. The only purpose of
+   * this wrapping is to manage the self->lookahead and self->hasLookahead
+   * properties.
+   */
+  ScannerStream* stream = self->stream;
+  if(stream == NULL) return Scanner_scanToken(self);
+
+  // Whitespace may run past the end of the buffer, so skip it a buffer at a time
+  do {
+    ScannerStream_fill(stream, &(self->current));
+    Scanner_scanWhitespace(self);
+  } while(self->current == stream->end && !stream->atEnd);
+
+  ScannerStream_fill(stream, &(self->current));
+
+  Token token = Scanner_scanToken(self);
+
+  /*
+   * At least a chunk was buffered ahead of the token, so if it reached the
+   * end of the buffer it was too long, and was cut off.
+   */
+  bool cutOff = self->current == stream->end && !stream->atEnd;
+
+  if(cutOff || token.length > SCANNER_CHUNK_SIZE) {
+    return makeError(
+      "Token too long to scan from a stream",
+      self->line
+    );
+  }
+
+  return ScannerStream_copyToken(stream, token);
+}
+
 Token Scanner_scan(Scanner* self) {
   if(self->hasLookahead) {
     self->hasLookahead = false;
@@ -4,6 +4,8 @@
 #include <stdbool.h>
 #include <stdlib.h>
 
+#include "symbol_table.h"
+
 typedef enum {
   TOKEN_NIL,
   TOKEN_TRUE,
@@ -45,6 +47,9 @@ typedef enum {
   TOKEN_WHILE,
   TOKEN_END,
 
+  TOKEN_IMPORT,
+  TOKEN_AS,
+
   TOKEN_ERROR,
   TOKEN_EOF,
 } TokenType;
@@ -58,15 +63,51 @@ typedef struct {
   size_t line;
 } Token;
 
+/*
+ * The size of the reads a ScannerStream makes. The stream keeps at least
+ * this much of the source buffered ahead of each token, so in a stream no
+ * token may be longer than this.
+ */
+#define SCANNER_CHUNK_SIZE (64 * 1024)
+
+typedef struct ScannerTextBlock ScannerTextBlock;
+
+/*
+ * A source read from a file descriptor a chunk at a time, for sources which
+ * are too large to hold in memory. The buffer holds two chunks: once fewer
+ * than a chunk's worth of bytes are left ahead of the scanner, they're moved
+ * to the front and the rest of the buffer is read into behind them.
+ *
+ * Since the buffer is reused, token text is copied out of it: identifiers
+ * into `symbols`, numbers and string literals into blocks owned by the
+ * stream, and tokens which are always spelled the same way are copied once.
+ * Tokens are valid until the stream is freed, and identifiers until the
+ * symbol table is.
+ */
+typedef struct {
+  int fd;
+  bool atEnd;
+  char* buffer;
+  char* end;
+  SymbolTable* symbols;
+  ScannerTextBlock* text;
+  char* fixedText[TOKEN_EOF + 1];
+} ScannerStream;
+
+void ScannerStream_init(ScannerStream*, int fd, SymbolTable* symbols);
+void ScannerStream_free(ScannerStream*);
+
 typedef struct {
   char* source;
   char* current;
   size_t line;
   Token lookahead;
   bool hasLookahead; // TODO This feels like a hack--is there a better way?
+  ScannerStream* stream;
 } Scanner;
 
 void Scanner_init(Scanner*, size_t, char*);
+void Scanner_initStream(Scanner*, ScannerStream*);
 
 Token Scanner_scan(Scanner*);
 Token Scanner_peek(Scanner*);
@@ -0,0 +1,710 @@
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "code.h"
+#include "module.h"
+#include "object.h"
+#include "scheduler.h"
+#include "thread.h"
+#include "value.h"
+
+#define INITIAL_DEQUE_CAPACITY 64
+
+/*
+ * The circular array of a ThreadDeque. When the owner grows the deque, the
+ * old array may still be being read by a thief, so it's kept, linked from
+ * the new one, until the deque is freed.
+ */
+struct ThreadArray {
+  size_t capacity;
+  ThreadArray* previous;
+  _Atomic(Thread*) items[];
+};
+
+static ThreadArray* ThreadArray_allocate(size_t capacity, ThreadArray* previous) {
+  assert((capacity & (capacity - 1)) == 0);
+
+  ThreadArray* self = malloc(sizeof(ThreadArray) + sizeof(_Atomic(Thread*)) * capacity);
+  assert(self != NULL); /* TODO Handle this */
+
+  self->capacity = capacity;
+  self->previous = previous;
+  return self;
+}
+
+static void ThreadDeque_init(ThreadDeque* self) {
+  atomic_init(&(self->top), 0);
+  atomic_init(&(self->bottom), 0);
+  atomic_init(&(self->array), ThreadArray_allocate(INITIAL_DEQUE_CAPACITY, NULL));
+}
+
+static void ThreadDeque_free(ThreadDeque* self) {
+  ThreadArray* array = atomic_load(&(self->array));
+
+  while(array != NULL) {
+    ThreadArray* previous = array->previous;
+    free(array);
+    array = previous;
+  }
+}
+
+/*
+ * Only the worker which owns the deque may push onto it.
+ */
+static void ThreadDeque_push(ThreadDeque* self, Thread* thread) {
+  size_t bottom = atomic_load_explicit(&(self->bottom), memory_order_relaxed);
+  size_t top = atomic_load_explicit(&(self->top), memory_order_acquire);
+  ThreadArray* array = atomic_load_explicit(&(self->array), memory_order_relaxed);
+
+  if(bottom - top == array->capacity) {
+    ThreadArray* grown = ThreadArray_allocate(array->capacity * 2, array);
+
+    for(size_t i = top; i < bottom; i++) {
+      atomic_store_explicit(
+          &(grown->items[i & (grown->capacity - 1)]),
+          atomic_load_explicit(&(array->items[i & (array->capacity - 1)]), memory_order_relaxed),
+          memory_order_relaxed);
+    }
+
+    atomic_store_explicit(&(self->array), grown, memory_order_release);
+    array = grown;
+  }
+
+  atomic_store_explicit(
+      &(array->items[bottom & (array->capacity - 1)]),
+      thread,
+      memory_order_relaxed);
+  atomic_store_explicit(&(self->bottom), bottom + 1, memory_order_release);
+}
+
+/*
+ * Takes the thread at the top of the deque, or returns NULL if it's empty.
+ * Any worker may call this, including the owner.
+ */
+static Thread* ThreadDeque_take(ThreadDeque* self) {
+  for(;;) {
+    size_t top = atomic_load_explicit(&(self->top), memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    size_t bottom = atomic_load_explicit(&(self->bottom), memory_order_acquire);
+
+    if(top >= bottom) return NULL;
+
+    ThreadArray* array = atomic_load_explicit(&(self->array), memory_order_acquire);
+    Thread* thread = atomic_load_explicit(
+        &(array->items[top & (array->capacity - 1)]),
+        memory_order_relaxed);
+
+    // Otherwise another worker took it first, so try the next one
+    if(atomic_compare_exchange_strong_explicit(
+          &(self->top),
+          &top,
+          top + 1,
+          memory_order_seq_cst,
+          memory_order_relaxed)) {
+      return thread;
+    }
+  }
+}
+
+static bool ThreadDeque_isEmpty(ThreadDeque* self) {
+  size_t top = atomic_load(&(self->top));
+  size_t bottom = atomic_load(&(self->bottom));
+  return top >= bottom;
+}
+
+/*
+ * The worker running on this OS thread, for the natives which need the
+ * scheduler. NULL outside a scheduler.
+ */
+static _Thread_local Worker* currentWorker = NULL;
+
+static bool Scheduler_hasWork(Scheduler* self) {
+  if(atomic_load(&(self->readyCount)) > 0) return true;
+
+  for(size_t i = 0; i < self->workerCount; i++) {
+    if(!ThreadDeque_isEmpty(&(self->workers[i].deque))) return true;
+  }
+
+  return false;
+}
+
+/*
+ * Wakes a sleeping worker, if there is one, to take work which was just
+ * made available.
+ *
+ * A worker counts itself as sleeping before it checks the deques a last
+ * time, and work is pushed before this checks whether any are sleeping, so
+ * either the worker sees the work or this sees the worker.
+ */
+static void Scheduler_wake(Scheduler* self) {
+  if(atomic_load(&(self->sleeping)) == 0) return;
+
+  pthread_mutex_lock(&(self->lock));
+  pthread_cond_signal(&(self->wake));
+  pthread_mutex_unlock(&(self->lock));
+}
+
+static void Scheduler_wakeAll(Scheduler* self) {
+  pthread_mutex_lock(&(self->lock));
+  pthread_cond_broadcast(&(self->wake));
+  pthread_mutex_unlock(&(self->lock));
+}
+
+static unsigned Worker_random(Worker* self) {
+  // xorshift
+  self->seed ^= self->seed << 13;
+  self->seed ^= self->seed >> 17;
+  self->seed ^= self->seed << 5;
+  return self->seed;
+}
+
+static Thread* Scheduler_takeReady(Scheduler* self) {
+  if(atomic_load(&(self->readyCount)) == 0) return NULL;
+
+  pthread_mutex_lock(&(self->lock));
+  Thread* thread = WaitQueue_pop(&(self->ready));
+  if(thread != NULL) atomic_fetch_sub(&(self->readyCount), 1);
+  pthread_mutex_unlock(&(self->lock));
+
+  return thread;
+}
+
+/*
+ * Returns the next thread this worker should run: the one it was asked to
+ * run next, or one from its own deque, or one woken from outside the
+ * workers, or else one stolen from another worker's deque, starting from a
+ * random one so that thieves spread out.
+ */
+static Thread* Worker_find(Worker* self) {
+  Thread* thread = self->next;
+
+  if(thread != NULL) {
+    self->next = NULL;
+    return thread;
+  }
+
+  thread = ThreadDeque_take(&(self->deque));
+  if(thread != NULL) return thread;
+
+  Scheduler* scheduler = self->scheduler;
+
+  thread = Scheduler_takeReady(scheduler);
+  if(thread != NULL) return thread;
+
+  size_t start = Worker_random(self) % scheduler->workerCount;
+
+  for(size_t i = 0; i < scheduler->workerCount; i++) {
+    Worker* victim = &(scheduler->workers[(start + i) % scheduler->workerCount]);
+    if(victim == self) continue;
+
+    thread = ThreadDeque_take(&(victim->deque));
+    if(thread != NULL) return thread;
+  }
+
+  return NULL;
+}
+
+/*
+ * The objects the thread shared are freed with the scheduler rather than
+ * with the thread, since others may still refer to them. A module's thread
+ * is kept by the module, along with its objects.
+ */
+static void Worker_finish(Worker* self, Thread* thread) {
+  Scheduler* scheduler = self->scheduler;
+
+  if(thread->module != NULL) {
+    Module_finish(thread->module, scheduler);
+  } else if(thread != scheduler->root) {
+    // Moves objects shared since the last collection to `sharedHeap`
+    Thread_collect(thread);
+    Obj* heap = thread->sharedHeap;
+
+    if(heap != NULL) {
+      Obj* last = heap;
+      while(last->next != NULL) last = last->next;
+
+      last->next = self->heap;
+      self->heap = heap;
+      thread->sharedHeap = NULL;
+    }
+
+    Thread_free(thread);
+    free(thread);
+  }
+
+  if(atomic_fetch_sub(&(scheduler->live), 1) == 1) {
+    Scheduler_wakeAll(scheduler);
+  }
+}
+
+/*
+ * Runs threads until `done` returns true, sleeping whenever there are none
+ * to run.
+ */
+static void Worker_loop(Worker* self, bool (*done)(Scheduler*)) {
+  Scheduler* scheduler = self->scheduler;
+  currentWorker = self;
+
+  while(!done(scheduler)) {
+    Thread* thread = Worker_find(self);
+
+    if(thread == NULL) {
+      pthread_mutex_lock(&(scheduler->lock));
+      size_t sleeping = atomic_fetch_add(&(scheduler->sleeping), 1) + 1;
+
+      if(!done(scheduler) && !Scheduler_hasWork(scheduler)) {
+        /*
+         * If no worker is running a thread and none are waiting on I/O,
+         * nothing can wake those which are parked, so they never will be.
+         */
+        if(sleeping == scheduler->workerCount
+            && atomic_load(&(scheduler->live)) > 0
+            && atomic_load(&(scheduler->ioWaiting)) == 0) {
+          fprintf(stderr, "Every thread is waiting, so none can go on.\n");
+          exit(1);
+        }
+
+        pthread_cond_wait(&(scheduler->wake), &(scheduler->lock));
+      }
+
+      atomic_fetch_sub(&(scheduler->sleeping), 1);
+      pthread_mutex_unlock(&(scheduler->lock));
+      continue;
+    }
+
+    if(thread->code == NULL) Module_load(thread->module);
+
+    switch(Thread_resume(thread)) {
+      case THREAD_YIELDED:
+        ThreadDeque_push(&(self->deque), thread);
+        break;
+
+      case THREAD_BLOCKED:
+        {
+          // Unless it was woken while it was still running
+          int parking = THREAD_PARKING;
+          if(!atomic_compare_exchange_strong(&(thread->parking), &parking, THREAD_PARKED)) {
+            ThreadDeque_push(&(self->deque), thread);
+          }
+        } break;
+
+      case THREAD_FINISHED:
+        Worker_finish(self, thread);
+        break;
+    }
+  }
+
+  currentWorker = NULL;
+}
+
+static bool Scheduler_isStopping(Scheduler* self) {
+  return atomic_load(&(self->stopping));
+}
+
+static bool Scheduler_isFinished(Scheduler* self) {
+  return atomic_load(&(self->live)) == 0;
+}
+
+static void* Worker_run(void* worker) {
+  Worker_loop(worker, Scheduler_isStopping);
+  return NULL;
+}
+
+/*
+ * Waits for the file descriptors of the threads waiting on I/O, and wakes
+ * the threads whose file descriptors are ready.
+ */
+static void* Scheduler_poll(void* scheduler) {
+  Scheduler* self = scheduler;
+  size_t capacity = 0;
+  struct pollfd* fds = NULL;
+
+  for(;;) {
+    pthread_mutex_lock(&(self->ioLock));
+    size_t count = self->ioWaiterCount;
+
+    if(count + 1 > capacity) {
+      capacity = (count + 1) * 2;
+      fds = realloc(fds, sizeof(struct pollfd) * capacity);
+      assert(fds != NULL); /* TODO Handle this */
+    }
+
+    fds[0].fd = self->ioWake[0];
+    fds[0].events = POLLIN;
+
+    for(size_t i = 0; i < count; i++) {
+      fds[i + 1].fd = self->ioWaiters[i].fd;
+      fds[i + 1].events = self->ioWaiters[i].events;
+    }
+
+    pthread_mutex_unlock(&(self->ioLock));
+
+    if(Scheduler_isStopping(self)) break;
+
+    if(poll(fds, count + 1, -1) < 0) {
+      assert(errno == EINTR); /* TODO Handle this */
+      continue;
+    }
+
+    if(fds[0].revents != 0) {
+      char buffer[64];
+      while(read(self->ioWake[0], buffer, sizeof(buffer)) > 0);
+    }
+
+    /*
+     * Only this thread removes waiters, so the first `count` are still the
+     * ones polled, although more may have been added after them.
+     */
+    WaitQueue woken = { .first=NULL, .last=NULL };
+    pthread_mutex_lock(&(self->ioLock));
+
+    size_t kept = 0;
+
+    for(size_t i = 0; i < self->ioWaiterCount; i++) {
+      if(i < count && fds[i + 1].revents != 0) {
+        WaitQueue_push(&woken, self->ioWaiters[i].thread);
+      } else {
+        self->ioWaiters[kept++] = self->ioWaiters[i];
+      }
+    }
+
+    self->ioWaiterCount = kept;
+    pthread_mutex_unlock(&(self->ioLock));
+
+    Thread* thread;
+
+    while((thread = WaitQueue_pop(&woken)) != NULL) {
+      Scheduler_unpark(self, thread);
+      atomic_fetch_sub(&(self->ioWaiting), 1);
+    }
+  }
+
+  free(fds);
+  return NULL;
+}
+
+void Scheduler_init(Scheduler* self, size_t workerCount) {
+  assert(workerCount > 0);
+
+  self->workerCount = workerCount;
+  self->workers = malloc(sizeof(Worker) * workerCount);
+  assert(self->workers != NULL); /* TODO Handle this */
+
+  self->root = NULL;
+  atomic_init(&(self->live), 0);
+  pthread_mutex_init(&(self->lock), NULL);
+  pthread_cond_init(&(self->wake), NULL);
+  atomic_init(&(self->sleeping), 0);
+  atomic_init(&(self->stopping), false);
+
+  self->ready.first = NULL;
+  self->ready.last = NULL;
+  atomic_init(&(self->readyCount), 0);
+
+  pthread_mutex_init(&(self->ioLock), NULL);
+  self->ioWaiterCount = 0;
+  self->ioWaiterCapacity = 0;
+  self->ioWaiters = NULL;
+  atomic_init(&(self->ioWaiting), 0);
+
+  // Writing to a full pipe mustn't block, since the poller will wake anyway
+  int error = pipe(self->ioWake);
+  assert(error == 0); /* TODO Handle this */
+  fcntl(self->ioWake[0], F_SETFL, O_NONBLOCK);
+  fcntl(self->ioWake[1], F_SETFL, O_NONBLOCK);
+
+  error = pthread_create(&(self->poller), NULL, Scheduler_poll, self);
+  assert(error == 0); /* TODO Handle this */
+
+  Code_init(&(self->spawnCode));
+
+  for(uint8_t argc = 0; argc <= MAX_SPAWN_ARGUMENTS; argc++) {
+    Code_appendInstruction(&(self->spawnCode), OP_CALL, 0);
+    Code_append(&(self->spawnCode), argc);
+    Code_appendInstruction(&(self->spawnCode), OP_RETURN, 0);
+  }
+
+  for(size_t i = 0; i < workerCount; i++) {
+    Worker* worker = &(self->workers[i]);
+    worker->scheduler = self;
+    ThreadDeque_init(&(worker->deque));
+    worker->next = NULL;
+    worker->heap = NULL;
+    worker->seed = 2463534242u + (unsigned)i;
+  }
+
+  // Worker 0 is whichever thread calls Scheduler_run
+  for(size_t i = 1; i < workerCount; i++) {
+    error = pthread_create(&(self->workers[i].pthread), NULL, Worker_run, &(self->workers[i]));
+    assert(error == 0); /* TODO Handle this */
+  }
+}
+
+void Scheduler_free(Scheduler* self) {
+  atomic_store(&(self->stopping), true);
+  Scheduler_wakeAll(self);
+
+  for(size_t i = 1; i < self->workerCount; i++) {
+    pthread_join(self->workers[i].pthread, NULL);
+  }
+
+  if(write(self->ioWake[1], "", 1) < 0) assert(errno == EAGAIN);
+  pthread_join(self->poller, NULL);
+  close(self->ioWake[0]);
+  close(self->ioWake[1]);
+  free(self->ioWaiters);
+  pthread_mutex_destroy(&(self->ioLock));
+
+  for(size_t i = 0; i < self->workerCount; i++) {
+    Worker* worker = &(self->workers[i]);
+    ThreadDeque_free(&(worker->deque));
+
+    Obj* heap = worker->heap;
+
+    while(heap != NULL) {
+      Obj* next = heap->next;
+      Obj_free(heap);
+      heap = next;
+    }
+  }
+
+  free(self->workers);
+  Code_free(&(self->spawnCode));
+  pthread_mutex_destroy(&(self->lock));
+  pthread_cond_destroy(&(self->wake));
+}
+
+Value Scheduler_run(Scheduler* self, Thread* root, Code* code, size_t startIndex) {
+  assert(atomic_load(&(self->live)) == 0);
+
+  Thread_start(root, code, startIndex);
+  self->root = root;
+  atomic_store(&(self->live), 1);
+
+  ThreadDeque_push(&(self->workers[0].deque), root);
+  Worker_loop(&(self->workers[0]), Scheduler_isFinished);
+
+  self->root = NULL;
+  return root->result;
+}
+
+void Scheduler_spawn(Thread* thread, bool next) {
+  assert(currentWorker != NULL); /* TODO Handle this */
+  Scheduler* scheduler = currentWorker->scheduler;
+  atomic_fetch_add(&(scheduler->live), 1);
+
+  if(next) {
+    if(currentWorker->next != NULL) {
+      ThreadDeque_push(&(currentWorker->deque), currentWorker->next);
+    }
+
+    currentWorker->next = thread;
+    return;
+  }
+
+  ThreadDeque_push(&(currentWorker->deque), thread);
+  Scheduler_wake(scheduler);
+}
+
+/*
+ * spawn(f, args...) starts a thread which calls `f` with `args`, and
+ * returns nil without waiting for it.
+ *
+ * The new thread shares the module's variables with the thread which
+ * spawned it, through display[0], since the module doesn't return until
+ * every thread has finished.
+ *
+ * TODO Spawning outside a scheduler, as in C compiled by fur_aot.
+ */
+Value nativeSpawn(Thread* spawner, uint8_t argc, Value* argv) {
+  assert(currentWorker != NULL); /* TODO Handle this */
+  assert(argc >= 1 && argc <= MAX_SPAWN_ARGUMENTS + 1); /* TODO Handle this */
+
+  Value callee = argv[0];
+  assert(callee.is_a == TYPE_OBJ); /* TODO Handle this */
+  assert(callee.as.obj->type == OBJ_CLOSURE); /* TODO Handle this */
+  assert(((ObjClosure*)(callee.as.obj))->arity == argc - 1); /* TODO Handle this */
+
+  Scheduler* scheduler = currentWorker->scheduler;
+
+  // The new thread reads the spawner's variables, and the arguments
+  Thread_shareHeap(spawner);
+
+  Thread* thread = Thread_allocateOne();
+  Thread_init(thread);
+  Thread_start(thread, &(scheduler->spawnCode), (argc - 1) * SPAWN_ENTRY_LENGTH);
+  thread->display[0] = spawner->display[0];
+
+  for(uint8_t i = 1; i < argc; i++) {
+    Stack_push(&(thread->stack), argv[i]);
+  }
+  Stack_push(&(thread->stack), callee);
+  Scheduler_spawn(thread, false);
+
+  Value result;
+  result.is_a = TYPE_NIL;
+  return result;
+}
+
+void Thread_park(Thread* self) {
+  atomic_store(&(self->parking), THREAD_PARKING);
+  self->blocked = true;
+}
+
+/*
+ * A thread which is still parking, on whichever worker ran it, is only
+ * marked runnable, and that worker puts it back itself. Otherwise it goes on
+ * the deque of the worker waking it, or if it's woken from outside the
+ * workers, in `ready`.
+ */
+void Scheduler_unpark(Scheduler* self, Thread* thread) {
+  int parking = THREAD_PARKING;
+  if(atomic_compare_exchange_strong(&(thread->parking), &parking, THREAD_RUNNABLE)) return;
+
+  assert(parking == THREAD_PARKED);
+  atomic_store(&(thread->parking), THREAD_RUNNABLE);
+
+  if(currentWorker != NULL) {
+    ThreadDeque_push(&(currentWorker->deque), thread);
+  } else {
+    pthread_mutex_lock(&(self->lock));
+    WaitQueue_push(&(self->ready), thread);
+    atomic_fetch_add(&(self->readyCount), 1);
+    pthread_mutex_unlock(&(self->lock));
+  }
+
+  Scheduler_wake(self);
+}
+
+bool Scheduler_waitForIo(Thread* thread, int fd, short events) {
+  if(currentWorker == NULL) {
+    struct pollfd pollFd = { .fd=fd, .events=events, .revents=0 };
+    while(poll(&pollFd, 1, -1) < 0 && errno == EINTR);
+    return false;
+  }
+
+  Scheduler* scheduler = currentWorker->scheduler;
+  atomic_fetch_add(&(scheduler->ioWaiting), 1);
+
+  pthread_mutex_lock(&(scheduler->ioLock));
+
+  if(scheduler->ioWaiterCount == scheduler->ioWaiterCapacity) {
+    scheduler->ioWaiterCapacity = scheduler->ioWaiterCapacity == 0 ? 8 : scheduler->ioWaiterCapacity * 2;
+    scheduler->ioWaiters = realloc(
+        scheduler->ioWaiters,
+        sizeof(IoWaiter) * scheduler->ioWaiterCapacity);
+    assert(scheduler->ioWaiters != NULL); /* TODO Handle this */
+  }
+
+  IoWaiter* waiter = &(scheduler->ioWaiters[scheduler->ioWaiterCount++]);
+  waiter->fd = fd;
+  waiter->events = events;
+  waiter->thread = thread;
+  Thread_park(thread);
+
+  pthread_mutex_unlock(&(scheduler->ioLock));
+
+  // If the pipe is full, the poller is already going to start again
+  if(write(scheduler->ioWake[1], "", 1) < 0) assert(errno == EAGAIN);
+
+  return true;
+}
+
+/*
+ * Wakes the first thread in `queue`, if any, after sending or receiving has
+ * made room or a value for it. `waiting` is counted before a thread checks
+ * the channel a last time and waits, and the channel is changed before
+ * this checks `waiting`, so either the thread sees the change or this sees
+ * the thread.
+ */
+static void ObjChannel_wake(ObjChannel* self, WaitQueue* queue, atomic_size_t* waiting) {
+  atomic_thread_fence(memory_order_seq_cst);
+  if(atomic_load(waiting) == 0) return;
+
+  pthread_mutex_lock(&(self->waitersLock));
+  Thread* thread = WaitQueue_pop(queue);
+  if(thread != NULL) atomic_fetch_sub(waiting, 1);
+  pthread_mutex_unlock(&(self->waitersLock));
+
+  if(thread != NULL) Scheduler_unpark(currentWorker->scheduler, thread);
+}
+
+static ObjChannel* channelArgument(Value value) {
+  assert(value.is_a == TYPE_OBJ); /* TODO Handle this */
+  assert(value.as.obj->type == OBJ_CHANNEL); /* TODO Handle this */
+  return (ObjChannel*)(value.as.obj);
+}
+
+/*
+ * send(channel, value) puts the value on the channel, waiting while it's
+ * full, and returns nil.
+ */
+Value nativeSend(Thread* thread, uint8_t argc, Value* argv) {
+  assert(currentWorker != NULL); /* TODO Handle this */
+  assert(argc == 2); /* TODO Handle this */
+
+  ObjChannel* channel = channelArgument(argv[0]);
+  Value result;
+  result.is_a = TYPE_NIL;
+
+  Thread_share(thread, argv[1]);
+
+  if(!ObjChannel_trySend(channel, argv[1])) {
+    pthread_mutex_lock(&(channel->waitersLock));
+    atomic_fetch_add(&(channel->sendersWaiting), 1);
+
+    if(!ObjChannel_trySend(channel, argv[1])) {
+      WaitQueue_push(&(channel->senders), thread);
+      Thread_park(thread);
+      pthread_mutex_unlock(&(channel->waitersLock));
+      return result;
+    }
+
+    atomic_fetch_sub(&(channel->sendersWaiting), 1);
+    pthread_mutex_unlock(&(channel->waitersLock));
+  }
+
+  ObjChannel_wake(channel, &(channel->receivers), &(channel->receiversWaiting));
+  return result;
+}
+
+/*
+ * receive(channel) takes the next value from the channel, waiting while
+ * it's empty.
+ */
+Value nativeReceive(Thread* thread, uint8_t argc, Value* argv) {
+  assert(currentWorker != NULL); /* TODO Handle this */
+  assert(argc == 1); /* TODO Handle this */
+
+  ObjChannel* channel = channelArgument(argv[0]);
+  Value result;
+
+  if(!ObjChannel_tryReceive(channel, &result)) {
+    pthread_mutex_lock(&(channel->waitersLock));
+    atomic_fetch_add(&(channel->receiversWaiting), 1);
+
+    if(!ObjChannel_tryReceive(channel, &result)) {
+      WaitQueue_push(&(channel->receivers), thread);
+      Thread_park(thread);
+      pthread_mutex_unlock(&(channel->waitersLock));
+
+      result.is_a = TYPE_NIL;
+      return result;
+    }
+
+    atomic_fetch_sub(&(channel->receiversWaiting), 1);
+    pthread_mutex_unlock(&(channel->waitersLock));
+  }
+
+  ObjChannel_wake(channel, &(channel->senders), &(channel->sendersWaiting));
+  return result;
+}
@@ -0,0 +1,161 @@
+#ifndef FUR_SCHEDULER_H
+#define FUR_SCHEDULER_H
+
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "code.h"
+#include "thread.h"
+#include "value.h"
+
+/*
+ * Runs many Fur Threads on a pool of OS threads, one per core by default.
+ *
+ * Each worker has a deque of the threads waiting to run. A worker runs the
+ * thread at the top of its own deque until it yields (see THREAD_REDUCTIONS) or
+ * finishes, and pushes it back onto the bottom if it yielded. Threads
+ * spawned by a thread go onto the bottom of the deque of the worker running
+ * it. A worker whose deque is empty steals from the top of another's, and
+ * sleeps if there's nothing to steal.
+ *
+ * The deques are Chase-Lev deques: only the worker which owns one pushes
+ * onto it, without locking, and taking from the top is a single
+ * compare-and-swap. The owner takes from the same end as thieves, so that
+ * a thread which yields waits behind the others rather than running again
+ * at once.
+ */
+
+typedef struct ThreadArray ThreadArray;
+
+typedef struct {
+  atomic_size_t top;
+  atomic_size_t bottom;
+  _Atomic(ThreadArray*) array;
+} ThreadDeque;
+
+typedef struct Scheduler Scheduler;
+
+typedef struct {
+  Scheduler* scheduler;
+  pthread_t pthread;
+  ThreadDeque deque;
+
+  /*
+   * A thread to run before any on the deque, once the one running yields or
+   * waits. Only the worker uses it, so it can't be stolen.
+   */
+  Thread* next;
+
+  /*
+   * The shared objects of the threads which finished on this worker. Other
+   * threads may still refer to them, so they're freed with the scheduler.
+   */
+  Obj* heap;
+
+  // For choosing which worker to steal from
+  unsigned seed;
+} Worker;
+
+/*
+ * A thread spawned with n arguments starts at n * SPAWN_ENTRY_LENGTH in
+ * the scheduler's spawnCode, which calls the closure on the top of the
+ * stack with the n values below it as arguments, and returns.
+ */
+#define MAX_SPAWN_ARGUMENTS 8
+#define SPAWN_ENTRY_LENGTH 3
+
+// A thread waiting until it can read or write a file descriptor
+typedef struct {
+  int fd;
+  short events;
+  Thread* thread;
+} IoWaiter;
+
+struct Scheduler {
+  size_t workerCount;
+  Worker* workers;
+
+  /*
+   * The thread Scheduler_run was called with, which belongs to the caller,
+   * and how many threads haven't finished, including it.
+   */
+  Thread* root;
+  atomic_size_t live;
+
+  /*
+   * Workers with nothing to run wait on `wake` while holding `lock`.
+   * `sleeping` is how many are waiting, so that making work available only
+   * takes the lock if someone might be waiting for it.
+   */
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  atomic_size_t sleeping;
+  atomic_bool stopping;
+
+  /*
+   * Threads woken by something other than a worker, which can't push onto
+   * a deque, wait here for a worker to take them. `readyCount` is how many
+   * there are, so workers only take `lock` to look if there are some.
+   */
+  WaitQueue ready;
+  atomic_size_t readyCount;
+
+  /*
+   * Threads waiting on I/O are in `ioWaiters`, guarded by `ioLock`, and the
+   * poller thread waits on their file descriptors with poll(). A byte
+   * written to `ioWake` makes it start again with any new ones.
+   * `ioWaiting` counts them until they've been woken, so that workers with
+   * nothing to do while threads wait on I/O don't think they're stuck.
+   */
+  pthread_t poller;
+  pthread_mutex_t ioLock;
+  size_t ioWaiterCount;
+  size_t ioWaiterCapacity;
+  IoWaiter* ioWaiters;
+  int ioWake[2];
+  atomic_size_t ioWaiting;
+
+  Code spawnCode;
+};
+
+/*
+ * Starts `workerCount` - 1 OS threads. The thread which calls
+ * Scheduler_run is the other worker.
+ */
+void Scheduler_init(Scheduler*, size_t workerCount);
+void Scheduler_free(Scheduler*);
+
+/*
+ * Runs `root` from `startIndex` in `code`, and every thread it spawns, and
+ * returns the result of `root` once they have all finished.
+ */
+Value Scheduler_run(Scheduler*, Thread* root, Code*, size_t startIndex);
+
+/*
+ * Starts running `thread`, which has been started with Thread_start or is a
+ * module's (see Module_load), on the calling worker. If `next`, the worker
+ * runs it as soon as the thread calling this yields or waits.
+ */
+void Scheduler_spawn(Thread*, bool next);
+
+/*
+ * Makes the calling native return without finishing, to be called again
+ * once the thread is woken with Scheduler_unpark. The caller must hold
+ * whatever lock guards the queue the thread was put in, so it isn't woken
+ * before it's parking.
+ */
+void Thread_park(Thread*);
+void Scheduler_unpark(Scheduler*, Thread*);
+
+/*
+ * For a native which can't go on until `fd` is ready for `events` (POLLIN
+ * or POLLOUT). In a scheduler, this parks `thread` until it is, and
+ * returns true, and the native must return. Otherwise it waits for `fd`
+ * with the OS thread, and returns false for the native to go on.
+ */
+bool Scheduler_waitForIo(Thread*, int fd, short events);
+
+#endif
@@ -2,6 +2,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "symbol.h"
 #include "symbol_table.h"
@@ -100,7 +101,11 @@ inline static void SymbolTable_expand(SymbolTable* self) {
  * it seems probable that we would lose more time by checking to see if symbols
  * already exist before expanding the table.
  */
-Symbol* SymbolTable_getSymbol(SymbolTable* self, uint8_t length, char* name) {
+inline static Symbol* SymbolTable_lookup(
+    SymbolTable* self,
+    uint8_t length,
+    char* name,
+    bool copyName) {
   if(self->capacity == 0) {
     assert(self->items == NULL);
     self->capacity = 64;
@@ -116,8 +121,23 @@ Symbol* SymbolTable_getSymbol(SymbolTable* self, uint8_t length, char* name) {
 
   for(;;) {
     if(self->items[index] == NULL) {
-      Symbol* newSymbol = malloc(sizeof(Symbol));
-      Symbol_init(newSymbol, h, length, name);
+      Symbol* newSymbol;
+
+      if(copyName) {
+        /*
+         * The name is stored right after the symbol, so SymbolTable_free
+         * frees both at once.
+         */
+        newSymbol = malloc(sizeof(Symbol) + length);
+        assert(newSymbol != NULL);
+        char* copy = (char*)(newSymbol + 1);
+        memcpy(copy, name, length);
+        Symbol_init(newSymbol, h, length, copy);
+      } else {
+        newSymbol = malloc(sizeof(Symbol));
+        Symbol_init(newSymbol, h, length, name);
+      }
+
       self->items[index] = newSymbol;
       self->load++;
       return newSymbol;
@@ -131,4 +151,12 @@ Symbol* SymbolTable_getSymbol(SymbolTable* self, uint8_t length, char* name) {
   assert(false);
 }
 
+Symbol* SymbolTable_getSymbol(SymbolTable* self, uint8_t length, char* name) {
+  return SymbolTable_lookup(self, length, name, false);
+}
+
+Symbol* SymbolTable_copySymbol(SymbolTable* self, uint8_t length, char* name) {
+  return SymbolTable_lookup(self, length, name, true);
+}
+
 #undef MAX_LOAD
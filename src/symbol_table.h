@@ -13,4 +13,11 @@ void SymbolTable_init(SymbolTable*);
 void SymbolTable_free(SymbolTable*);
 Symbol* SymbolTable_getSymbol(SymbolTable*, uint8_t length, char* name);
 
+/*
+ * Like SymbolTable_getSymbol, but if the symbol is new, its name is copied
+ * into memory owned by the table rather than pointing at `name`, for names
+ * which don't outlive the table.
+ */
+Symbol* SymbolTable_copySymbol(SymbolTable*, uint8_t length, char* name);
+
 #endif
@@ -1,10 +1,13 @@
 #include <assert.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 
 #include "code.h"
 #include "memory.h"
+#include "module.h"
+#include "operations.h"
 #include "thread.h"
 #include "value.h"
 
@@ -111,18 +114,39 @@ void Stack_binary(Stack* self, Value (*binary)(Value, Value)) {
   *ptr = binary(*ptr, *(self->top));
 }
 
+LIST_IMPL_INIT_NO_PREALLOC(GrayList);
+LIST_IMPL_FREE_WITHOUT_ITEMS(GrayList);
+LIST_IMPL_APPEND_NO_PREALLOC(GrayList, Obj*, 64);
+
 void Thread_init(Thread* self) {
   FrameStack_init(&(self->frames));
   Stack_init(&(self->stack));
   self->heap = NULL;
+  self->sharedHeap = NULL;
+  self->heapCount = 0;
+  self->nextCollection = THREAD_COLLECTION_THRESHOLD;
+  self->sharing = false;
+  GrayList_init(&(self->gray));
+  self->display[0] = self->stack.items;
+  atomic_init(&(self->globalCount), 0);
+  self->openUpvalues = NULL;
+
+  self->current = NULL;
+  self->code = NULL;
+  self->rootCode = NULL;
+  self->ip = NULL;
+  self->fp = self->stack.items;
+  self->reductions = THREAD_REDUCTIONS;
+  self->result.is_a = TYPE_NIL;
+
+  self->blocked = false;
+  atomic_init(&(self->parking), THREAD_RUNNABLE);
+  self->ioProgress = 0;
+  self->nextWaiting = NULL;
+  self->module = NULL;
 }
 
-void Thread_free(Thread* self) {
-  FrameStack_free(&(self->frames));
-  Stack_free(&(self->stack));
-
-  Obj* heap = self->heap;
-
+static void Heap_free(Obj* heap) {
   while(heap != NULL) {
     Obj* next = heap->next;
     Obj_free(heap);
@@ -130,6 +154,15 @@ void Thread_free(Thread* self) {
   }
 }
 
+void Thread_free(Thread* self) {
+  FrameStack_free(&(self->frames));
+  Stack_free(&(self->stack));
+  GrayList_free(&(self->gray));
+
+  Heap_free(self->heap);
+  Heap_free(self->sharedHeap);
+}
+
 void Thread_addToHeap(Thread* self, Obj* o) {
   /*
    * Obj_init sets o->next to NULL, and o->next should only be used by this
@@ -138,126 +171,362 @@ void Thread_addToHeap(Thread* self, Obj* o) {
    */
   assert(o->next == NULL);
 
+  if(self->sharing) {
+    o->shared = true;
+    o->next = self->sharedHeap;
+    self->sharedHeap = o;
+    return;
+  }
+
   o->next = self->heap;
   self->heap = o;
+  self->heapCount++;
+}
+
+void Thread_share(Thread* self, Value value) {
+  if(value.is_a != TYPE_OBJ || value.as.obj->shared) return;
+
+  /*
+   * The objects shared here stay on `heap` until the next collection moves
+   * them to `sharedHeap`. Anything unshared which `value` reaches is this
+   * thread's, since other threads only ever see shared objects.
+   */
+  GrayList* pending = &(self->gray);
+  assert(pending->length == 0);
+  GrayList_append(pending, value.as.obj);
+
+  while(pending->length > 0) {
+    Obj* obj = pending->items[--(pending->length)];
+    if(obj->shared) continue;
+    obj->shared = true;
+
+    switch(obj->type) {
+      case OBJ_CLOSURE:
+        {
+          ObjClosure* closure = (ObjClosure*)obj;
+
+          // Prototypes are interned, so this is an instance
+          for(uint8_t i = 0; i < closure->upvalueCount; i++) {
+            GrayList_append(pending, (Obj*)(closure->upvalues[i]));
+          }
+        } break;
+
+      case OBJ_UPVALUE:
+        {
+          ObjUpvalue* upvalue = (ObjUpvalue*)obj;
+
+          // Other threads will see the variable change on our stack
+          if(upvalue->location != &(upvalue->closed)) {
+            pending->length = 0;
+            Thread_shareHeap(self);
+            return;
+          }
+
+          if(isObj(upvalue->closed)) {
+            GrayList_append(pending, upvalue->closed.as.obj);
+          }
+        } break;
+
+      default:
+        // Channels only hold shared values, and the rest hold none
+        break;
+    }
+  }
 }
 
-inline static Value logicalNot(Value arg) {
-  assert(arg.is_a == TYPE_BOOLEAN);
-  arg.as.boolean = !(arg.as.boolean);
-  return arg;
+void Thread_shareHeap(Thread* self) {
+  if(self->sharing) return;
+  self->sharing = true;
+
+  Obj* heap = self->heap;
+  if(heap == NULL) return;
+
+  Obj* last = heap;
+
+  for(;;) {
+    last->shared = true;
+    if(last->next == NULL) break;
+    last = last->next;
+  }
+
+  last->next = self->sharedHeap;
+  self->sharedHeap = heap;
+  self->heap = NULL;
+  self->heapCount = 0;
 }
 
-inline static Value negate(Value arg) {
-  assert(isInteger(arg));
-  arg.as.integer = -arg.as.integer;
-  return arg;
+inline static void Thread_mark(Thread* self, Value value) {
+  if(!isObj(value)) return;
+
+  Obj* obj = value.as.obj;
+  if(obj->shared || obj->marked) return;
+
+  obj->marked = true;
+  GrayList_append(&(self->gray), obj);
 }
 
-#define INT_BINARY_FUNCTION(name, op) \
-  inline static Value name(Value arg0, Value arg1) { \
-    assert(isInteger(arg0)); \
-    assert(isInteger(arg1)); \
-    arg0.as.integer = arg0.as.integer op arg1.as.integer; \
-    return arg0; \
+void Thread_collect(Thread* self) {
+  if(self->sharing) return;
+
+  for(Value* slot = self->stack.items; slot < self->stack.top; slot++) {
+    Thread_mark(self, *slot);
   }
-INT_BINARY_FUNCTION(add, +)
-INT_BINARY_FUNCTION(subtract, -)
-INT_BINARY_FUNCTION(multiply, *)
-INT_BINARY_FUNCTION(divide, /)
-#undef OPERATOR_BINARY_FUNCTION
 
-inline static Value concat(Value arg0, Value arg1) {
-  assert(isObj(arg0));
-  assert(isObj(arg1));
-  assert(arg0.as.obj->type == OBJ_STRING);
-  assert(arg1.as.obj->type == OBJ_STRING);
+  for(Frame* frame = self->frames.items; frame < self->frames.top; frame++) {
+    if(frame->closure != NULL) {
+      Thread_mark(self, Value_fromObj((Obj*)(frame->closure)));
+    }
+  }
 
-  ObjString* arg0s = (ObjString*)(arg0.as.obj);
-  ObjString* arg1s = (ObjString*)(arg1.as.obj);
+  if(self->current != NULL) {
+    Thread_mark(self, Value_fromObj((Obj*)(self->current)));
+  }
 
-  size_t length = arg0s->length + arg1s->length;
+  for(ObjUpvalue* upvalue = self->openUpvalues; upvalue != NULL; upvalue = upvalue->nextOpen) {
+    Thread_mark(self, Value_fromObj((Obj*)upvalue));
+  }
 
-  /* Add room for trailing null char */
-  char* characters = allocateChars(length + 1);
-  *characters = '\0';
+  Thread_mark(self, self->result);
 
-  strncat(characters, arg0s->characters, arg0s->length);
-  strncat(characters, arg1s->characters, arg1s->length);
+  GrayList* gray = &(self->gray);
 
-  ObjString* s = ObjString_allocateOne();
-  ObjString_init(s, length, characters);
+  while(gray->length > 0) {
+    Obj* obj = gray->items[--(gray->length)];
 
-  Value v;
-  v.is_a = TYPE_OBJ;
-  v.as.obj = (Obj*)s;
+    switch(obj->type) {
+      case OBJ_CLOSURE:
+        {
+          ObjClosure* closure = (ObjClosure*)obj;
 
-  return v;
+          for(uint8_t i = 0; i < closure->upvalueCount; i++) {
+            Thread_mark(self, Value_fromObj((Obj*)(closure->upvalues[i])));
+          }
+        } break;
+
+      case OBJ_UPVALUE:
+        {
+          // An open upvalue's variable is on the stack, marked already
+          ObjUpvalue* upvalue = (ObjUpvalue*)obj;
+          if(upvalue->location == &(upvalue->closed)) {
+            Thread_mark(self, upvalue->closed);
+          }
+        } break;
+
+      default:
+        break;
+    }
+  }
+
+  // Objects shared since the last collection move to `sharedHeap`
+  Obj** link = &(self->heap);
+  size_t survivors = 0;
+
+  while(*link != NULL) {
+    Obj* obj = *link;
+
+    if(obj->shared) {
+      *link = obj->next;
+      obj->next = self->sharedHeap;
+      self->sharedHeap = obj;
+    } else if(obj->marked) {
+      obj->marked = false;
+      survivors++;
+      link = &(obj->next);
+    } else {
+      *link = obj->next;
+      Obj_free(obj);
+    }
+  }
+
+  self->heapCount = survivors;
+  self->nextCollection = survivors * 2 > THREAD_COLLECTION_THRESHOLD
+    ? survivors * 2
+    : THREAD_COLLECTION_THRESHOLD;
 }
 
-#define ORDER_BINARY_FUNCTION(name, op) \
-  inline static Value name(Value arg0, Value arg1) { \
-    assert(isInteger(arg0)); \
-    assert(isInteger(arg1)); \
-    arg0.is_a = TYPE_BOOLEAN; \
-    arg0.as.boolean = (arg0.as.integer op arg1.as.integer); \
-    return arg0; \
+void WaitQueue_push(WaitQueue* self, Thread* thread) {
+  thread->nextWaiting = NULL;
+
+  if(self->last == NULL) {
+    self->first = thread;
+  } else {
+    self->last->nextWaiting = thread;
   }
-ORDER_BINARY_FUNCTION(lessThan, <)
-ORDER_BINARY_FUNCTION(greaterThan, >)
-ORDER_BINARY_FUNCTION(lessThanEquals, <=)
-ORDER_BINARY_FUNCTION(greaterThanEquals, >=)
-#undef ORDER_BINARY_FUNCTION
-
-inline static Value equals(Value arg0, Value arg1) {
-  switch(arg0.is_a) {
-    case TYPE_NIL:
-      return Value_fromBool(arg0.is_a == arg1.is_a);
-
-    case TYPE_BOOLEAN:
-      return Value_fromBool(
-        arg1.is_a == TYPE_BOOLEAN &&
-        arg0.as.boolean == arg1.as.boolean
-      );
-
-    case TYPE_INTEGER:
-      return Value_fromBool(
-        arg1.is_a == TYPE_INTEGER &&
-        arg0.as.integer == arg1.as.integer
-      );
-
-    case TYPE_OBJ:
-      return Value_fromBool(
-          arg1.is_a == TYPE_OBJ &&
-          Obj_equals(arg0.as.obj, arg1.as.obj)
-        );
-
-    default:
-      assert(false);
+
+  self->last = thread;
+}
+
+Thread* WaitQueue_pop(WaitQueue* self) {
+  Thread* thread = self->first;
+  if(thread == NULL) return NULL;
+
+  self->first = thread->nextWaiting;
+  if(self->first == NULL) self->last = NULL;
+
+  thread->nextWaiting = NULL;
+  return thread;
+}
+
+ObjUpvalue* Thread_captureUpvalue(Thread* self, Value* location) {
+  ObjUpvalue** link = &(self->openUpvalues);
+
+  while(*link != NULL && (*link)->location > location) {
+    link = &((*link)->nextOpen);
   }
+
+  if(*link != NULL && (*link)->location == location) {
+    return *link;
+  }
+
+  ObjUpvalue* upvalue = ObjUpvalue_allocateOne();
+  ObjUpvalue_init(upvalue, location);
+  upvalue->nextOpen = *link;
+  *link = upvalue;
+
+  Thread_addToHeap(self, (Obj*)upvalue);
+
+  return upvalue;
 }
 
-inline static Value notEquals(Value arg0, Value arg1) {
-  /* TODO Are there ways to optimzie this? */
-  return logicalNot(equals(arg0, arg1));
+void Thread_pushClosure(
+    Thread* self,
+    ObjClosure* current,
+    Value* fp,
+    ObjClosure* prototype) {
+  ObjClosure* closure = ObjClosure_allocateOne();
+  ObjClosure_initInstance(closure, prototype);
+
+  for(uint8_t i = 0; i < closure->upvalueCount; i++) {
+    UpvalueDescriptor descriptor = closure->upvalueDescriptors[i];
+
+    switch(descriptor.kind) {
+      case UPVALUE_LOCAL:
+        closure->upvalues[i] = Thread_captureUpvalue(
+            self,
+            fp + descriptor.index
+          );
+        break;
+
+      case UPVALUE_OUTER:
+        closure->upvalues[i] = Thread_captureUpvalue(
+            self,
+            self->display[descriptor.depth] + descriptor.index
+          );
+        break;
+
+      case UPVALUE_UPVALUE:
+        assert(current != NULL);
+        assert(descriptor.index < current->upvalueCount);
+        closure->upvalues[i] = current->upvalues[descriptor.index];
+        break;
+
+      default:
+        assert(false);
+    }
+  }
+
+  Stack_push(&(self->stack), Value_fromObj((Obj*)closure));
+  /* Add to heap AFTER adding to stack, to be sure it doesn't get GC'ed */
+  Thread_addToHeap(self, (Obj*)closure);
 }
 
-Value Thread_run(Thread* self, Code* code, size_t startIndex) {
+void Thread_start(Thread* self, Code* code, size_t startIndex) {
+  self->current = NULL;
+  self->code = code;
+  self->ip = code->instructions.items + startIndex;
+  self->fp = self->stack.items;
+  self->reductions = THREAD_REDUCTIONS;
+
+  /*
+   * TODO This is only used so we can assert ip is within the bounds--could be
+   * cleaned up pretty significantly.
+   */
+  self->rootCode = code;
+}
+
+/*
+ * True unless `location` is on the thread's stack above the top. A spawned
+ * thread reaches the module's variables on the stack of the thread which
+ * ran the module, so they may not be on its own stack at all.
+ */
+inline static bool Thread_isLive(Thread* self, Value* location) {
+  return location < self->stack.items
+    || location >= self->stack.items + MAX_STACK_DEPTH
+    || location < self->stack.top;
+}
+
+void Thread_declareGlobal(Thread* self) {
+  assert(self->display[0] == self->stack.items);
+
+  size_t count = self->stack.top - self->stack.items;
+  atomic_store_explicit(&(self->globalCount), count, memory_order_release);
+}
+
+/*
+ * Module variables are always at the bottom of the stack of the thread
+ * running the module (see ObjClosure.globals), so that thread holds their
+ * count.
+ */
+static Thread* Thread_ofGlobals(Value* globals) {
+  return (Thread*)((char*)globals - offsetof(Thread, stack) - offsetof(Stack, items));
+}
+
+void Thread_getLate(Thread* self, uint8_t index, ObjString* name) {
+  Thread* owner = Thread_ofGlobals(self->display[0]);
+  size_t count = atomic_load_explicit(&(owner->globalCount), memory_order_acquire);
+
+  if(index >= count) {
+    fprintf(
+        stderr,
+        "Variable \"%.*s\" was read before it was assigned.\n",
+        (int)name->length,
+        name->characters);
+    exit(1);
+  }
+
+  Stack_push(&(self->stack), self->display[0][index]);
+}
+
+ThreadStatus Thread_resume(Thread* self) {
   /*
    * TODO Wrap the outer level in a closure so we can write assertions against
    * the fact that we should always be within the bounds of the current code's
    * instructions.
    */
-  ObjClosure* current = NULL;
-  register uint8_t* ip = code->instructions.items + startIndex;
+  ObjClosure* current = self->current;
+  Code* code = self->code;
+  register uint8_t* ip = self->ip;
   register uint8_t instruction;
-  Value* fp = self->stack.items; /* TODO Profile adding this to a register. */
+  Value* fp = self->fp; /* TODO Profile adding this to a register. */
+  Code* rootCode = self->rootCode;
+
+  // Kept out of the thread, so counting one is a decrement and a branch
+  register uint32_t reductions = self->reductions;
+
+  // Saves where the thread is, for Thread_resume to carry on from
+  #define SAVE_STATE() \
+    do { \
+      self->current = current; \
+      self->code = code; \
+      self->ip = ip; \
+      self->fp = fp; \
+      self->reductions = reductions; \
+    } while(false)
 
   /*
-   * TODO This is only used so we can assert ip is within the bounds--could be
-   * cleaned up pretty significantly.
+   * Counts a reduction, after calls and backward jumps, so that a thread
+   * can't keep the others waiting by looping or recursing. Yielding is also
+   * when the thread collects, as everything it can reach is saved.
    */
-  Code* rootCode = code;
+  #define YIELD_POINT() \
+    do { \
+      if(--reductions == 0) { \
+        reductions = THREAD_REDUCTIONS; \
+        SAVE_STATE(); \
+        if(self->heapCount >= self->nextCollection) Thread_collect(self); \
+        return THREAD_YIELDED; \
+      } \
+    } while(false)
 
   for(;;) {
     /*
@@ -312,6 +581,92 @@ Value Thread_run(Thread* self, Code* code, size_t startIndex) {
           *(fp + stackIndex) = Stack_pop(&(self->stack));
         } break;
 
+      case OP_GET_OUTER:
+        {
+          uint8_t depth = Code_getUInt8(code, ip);
+          uint8_t stackIndex = Code_getUInt8(code, ip + 1);
+          ip += 2;
+
+          assert(depth < (current == NULL ? 0 : current->depth));
+          Value* outer = self->display[depth];
+          assert(Thread_isLive(self, outer + stackIndex));
+
+          Stack_push(&(self->stack), *(outer + stackIndex));
+        } break;
+
+      case OP_DECLARE_GLOBAL:
+        Thread_declareGlobal(self);
+        break;
+
+      case OP_GET_LATE:
+        {
+          uint8_t stackIndex = Code_getUInt8(code, ip);
+          ObjString* name = (ObjString*)Code_getInterned(code, Code_getUInt8(code, ip + 1));
+          ip += 2;
+
+          Thread_getLate(self, stackIndex, name);
+        } break;
+
+      case OP_SET_OUTER:
+        {
+          uint8_t depth = Code_getUInt8(code, ip);
+          uint8_t stackIndex = Code_getUInt8(code, ip + 1);
+          ip += 2;
+
+          assert(depth < (current == NULL ? 0 : current->depth));
+          Value* outer = self->display[depth];
+          assert(Thread_isLive(self, outer + stackIndex));
+
+          Value value = Stack_pop(&(self->stack));
+
+          // The variables of another thread's module or of another module
+          if(depth == 0 && outer != self->stack.items) Thread_share(self, value);
+
+          *(outer + stackIndex) = value;
+        } break;
+
+      case OP_GET_UPVALUE:
+        {
+          uint8_t upvalueIndex = Code_getUInt8(code, ip);
+          ip++;
+
+          assert(current != NULL);
+          assert(upvalueIndex < current->upvalueCount);
+
+          Stack_push(
+              &(self->stack),
+              *(current->upvalues[upvalueIndex]->location)
+            );
+        } break;
+
+      case OP_SET_UPVALUE:
+        {
+          uint8_t upvalueIndex = Code_getUInt8(code, ip);
+          ip++;
+
+          assert(current != NULL);
+          assert(upvalueIndex < current->upvalueCount);
+
+          ObjUpvalue* upvalue = current->upvalues[upvalueIndex];
+          Value value = Stack_pop(&(self->stack));
+          if(upvalue->obj.shared) Thread_share(self, value);
+
+          *(upvalue->location) = value;
+        } break;
+
+      case OP_CLOSURE:
+        {
+          ObjClosure* prototype = (ObjClosure*)Code_getInterned(
+              code,
+              Code_getUInt8(code, ip)
+            );
+          ip++;
+
+          assert(prototype->obj.type == OBJ_CLOSURE);
+
+          Thread_pushClosure(self, current, fp, prototype);
+        } break;
+
       case OP_NIL:
         {
           Value nil;
@@ -327,6 +682,37 @@ Value Thread_run(Thread* self, Code* code, size_t startIndex) {
         Stack_push(&(self->stack), Value_fromBool(false));
         break;
 
+      case OP_IMPORT:
+        {
+          ObjString* path = (ObjString*)Code_getInterned(code, Code_getUInt8(code, ip));
+          bool next = Code_getUInt8(code, ip + 1);
+          ip += 2;
+
+          // Modules belong to the list of modules, not to a heap
+          Stack_push(&(self->stack), Value_fromObj((Obj*)Module_import(path, next)));
+        } break;
+
+      case OP_PROP:
+        {
+          Value* module = self->stack.top - 1;
+          assert(module->is_a == TYPE_OBJ); /* TODO Handle this */
+          assert(module->as.obj->type == OBJ_MODULE); /* TODO Handle this */
+
+          ObjString* name = (ObjString*)Code_getInterned(code, Code_getUInt8(code, ip));
+          ip++;
+
+          Module_get((ObjModule*)(module->as.obj), self, name, module);
+
+          // Get the variable again once the module has finished
+          if(self->blocked) {
+            self->blocked = false;
+            ip -= 2;
+
+            SAVE_STATE();
+            return THREAD_BLOCKED;
+          }
+        } break;
+
       case OP_INTEGER:
         {
           Stack_push(
@@ -382,11 +768,66 @@ Value Thread_run(Thread* self, Code* code, size_t startIndex) {
 
       #undef BINARY_OP
 
+      /*
+       * The compiler only emits these when it has proven both operands are
+       * integers, so we operate on the stack in place and only check the
+       * types in debug builds.
+       */
+      #ifdef DEBUG
+      #define CHECK_INT(v) assert((v).is_a == TYPE_INTEGER)
+      #else
+      #define CHECK_INT(v)
+      #endif
+
+      #define INT_ARITHMETIC_OP(op, operator) \
+      case op: \
+        { \
+          self->stack.top--; \
+          Value* arg0 = self->stack.top - 1; \
+          CHECK_INT(*arg0); \
+          CHECK_INT(*(self->stack.top)); \
+          arg0->as.integer = arg0->as.integer operator self->stack.top->as.integer; \
+        } break
+      INT_ARITHMETIC_OP(OP_ADD_INT, +);
+      INT_ARITHMETIC_OP(OP_SUBTRACT_INT, -);
+      INT_ARITHMETIC_OP(OP_MULTIPLY_INT, *);
+      INT_ARITHMETIC_OP(OP_DIVIDE_INT, /);
+      #undef INT_ARITHMETIC_OP
+
+      #define INT_COMPARISON_OP(op, operator) \
+      case op: \
+        { \
+          self->stack.top--; \
+          Value* arg0 = self->stack.top - 1; \
+          CHECK_INT(*arg0); \
+          CHECK_INT(*(self->stack.top)); \
+          arg0->as.boolean = arg0->as.integer operator self->stack.top->as.integer; \
+          arg0->is_a = TYPE_BOOLEAN; \
+        } break
+      INT_COMPARISON_OP(OP_EQ_INT, ==);
+      INT_COMPARISON_OP(OP_NEQ_INT, !=);
+      INT_COMPARISON_OP(OP_LT_INT, <);
+      INT_COMPARISON_OP(OP_GT_INT, >);
+      INT_COMPARISON_OP(OP_LEQ_INT, <=);
+      INT_COMPARISON_OP(OP_GEQ_INT, >=);
+      #undef INT_COMPARISON_OP
+
+      case OP_NEGATE_INT:
+        {
+          Value* arg = self->stack.top - 1;
+          CHECK_INT(*arg);
+          arg->as.integer = -(arg->as.integer);
+        } break;
+
+      #undef CHECK_INT
+
       case OP_JUMP:
         {
           int16_t jump = Code_getInt16(code, ip);
           ip += jump;
           assert(ip <= code->instructions.items + code->instructions.length);
+
+          if(jump < 0) YIELD_POINT();
         } break;
 
       case OP_JUMP_IF_TRUE:
@@ -398,6 +839,9 @@ Value Thread_run(Thread* self, Code* code, size_t startIndex) {
           if(v.as.boolean) {
             int16_t jump = Code_getInt16(code, ip);
             ip += jump;
+
+            // Loops whose condition is tested at the bottom jump back here
+            if(jump < 0) YIELD_POINT();
           } else {
             // Step over the space that contains the jump target
             ip += sizeof(int16_t);
@@ -531,6 +975,66 @@ Value Thread_run(Thread* self, Code* code, size_t startIndex) {
           }
         } break;
 
+      /*
+       * Pushes a frame for the caller and starts running `callee` with the
+       * top `argc` values on the stack as its arguments.
+       */
+      #define ENTER_CLOSURE(callee, argc) \
+        do { \
+          Frame previous = { \
+            .closure = current, \
+            .ip = ip, \
+            .fp = fp, \
+            .displaced = self->display[(callee)->depth], \
+            .globals = self->display[0] \
+          }; \
+          \
+          FrameStack_push(&(self->frames), previous); \
+          \
+          assert((callee) != NULL); \
+          current = (callee); \
+          code = current->code; \
+          \
+          assert(current->code != NULL); \
+          assert(current->code->instructions.items != NULL); \
+          ip = current->code->instructions.items; \
+          \
+          fp = self->stack.top - (argc); \
+          assert(fp <= self->stack.top); \
+          assert(fp >= self->stack.items); \
+          \
+          self->display[current->depth] = fp; \
+          if(current->globals != NULL) self->display[0] = current->globals; \
+        } while(false)
+
+      case OP_CALL_DIRECT:
+        {
+          ObjClosure* closure = (ObjClosure*)Code_getCallee(
+              code,
+              Code_getUInt8(code, ip)
+            );
+          ip++;
+
+          assert(closure->obj.type == OBJ_CLOSURE);
+          assert(closure->upvalueCount == 0);
+
+          ObjClosure_ensureCompiled(closure);
+          ENTER_CLOSURE(closure, closure->arity);
+          YIELD_POINT();
+        } break;
+
+      case OP_CALL_SELF:
+        {
+          uint8_t argc = Code_getUInt8(code, ip);
+          ip++;
+
+          assert(current != NULL);
+          assert(argc == current->arity);
+
+          ENTER_CLOSURE(current, argc);
+          YIELD_POINT();
+        } break;
+
       case OP_CALL:
         {
           uint8_t argc = Code_getUInt8(code, ip);
@@ -544,36 +1048,14 @@ Value Thread_run(Thread* self, Code* code, size_t startIndex) {
               {
                 ObjClosure* closure = (ObjClosure*)(callee.as.obj);
                 assert(argc == closure->arity); /* TODO Handle this */
-
-                Frame previous = {
-                  .closure = current,
-                  .ip = ip,
-                  .fp = fp
-                };
-
-                FrameStack_push(&(self->frames), previous);
-
-                assert(closure != NULL);
-                current = closure;
-
-                /*
-                 * TODO This is only used in assertions and should probably be
-                 * cleaned up.
-                 */
-                code = closure->code;
-
-                assert(closure->code != NULL);
-                assert(closure->code->instructions.items != NULL);
-                ip = closure->code->instructions.items;
-
-                fp = self->stack.top - argc;
-                assert(fp <= self->stack.top);
-                assert(fp >= self->stack.items);
+                ObjClosure_ensureCompiled(closure);
+                ENTER_CLOSURE(closure, argc);
+                YIELD_POINT();
               } break;
 
             case OBJ_NATIVE:
               {
-                Value (*call)(uint8_t, Value*) = ((ObjNative*)(callee.as.obj))->call;
+                NativeFunction call = ((ObjNative*)(callee.as.obj))->call;
 
                 /*
                  * We leave the arguments on the stack while the function is
@@ -581,13 +1063,21 @@ Value Thread_run(Thread* self, Code* code, size_t startIndex) {
                  * collector.
                  */
                 Value* argv = self->stack.top - argc;
-                Value result = call(argc, self->stack.top - argc);
-                *argv = result;
-                self->stack.top = argv + 1;
+                Value result = call(self, argc, argv);
 
-                if(result.is_a == TYPE_OBJ) {
-                  Thread_addToHeap(self, result.as.obj);
+                // Put the call back as it was, to make it again once resumed
+                if(self->blocked) {
+                  self->blocked = false;
+                  Stack_push(&(self->stack), callee);
+                  ip -= 2;
+
+                  SAVE_STATE();
+                  return THREAD_BLOCKED;
                 }
+
+                *argv = result;
+                self->stack.top = argv + 1;
+                YIELD_POINT();
               } break;
 
             default:
@@ -595,30 +1085,39 @@ Value Thread_run(Thread* self, Code* code, size_t startIndex) {
           }
         } break;
 
+      #undef ENTER_CLOSURE
+
       case OP_RETURN:
         {
           /*
-           * TODO
-           * We're leaving global-scoped items on the stack to enable the repl.
-           * This is currently fine in modules, because we don't yet support imports
-           * so when the module returns, its stack is immediately freed because the
-           * thread ends. However, this will keep unnecessary items on the stack
-           * when we have multiple modules.
+           * Module-scoped variables are left on the stack, for the repl and
+           * because an imported module's variables are read from its
+           * thread's stack once it has finished (see ObjModule).
            *
-           * A better way to enable the REPL is to parse a single expression instead
-           * of an expression list, and then compile it to a REPL-only OP that
-           * simply pops off the top item and prints it. Then we can compile modules
-           * properly and clean up properly in their returns.
+           * TODO The REPL could instead parse a single expression rather than
+           * an expression list, and compile it to a REPL-only OP that simply
+           * pops off the top item and prints it.
            */
-          if(current == NULL) return Stack_pop(&(self->stack));
+          if(current == NULL) {
+            self->result = Stack_pop(&(self->stack));
+            return THREAD_FINISHED;
+          }
 
           assert(fp >= self->stack.items);
           assert(fp < self->stack.top);
 
+          /*
+           * This has to happen before we overwrite the frame with the return
+           * value.
+           */
+          Thread_closeUpvalues(self, fp);
+
           *fp = Stack_peek(&(self->stack));
           self->stack.top = fp + 1;
 
           Frame previous = FrameStack_pop(&(self->frames));
+          self->display[current->depth] = previous.displaced;
+          self->display[0] = previous.globals;
           current = previous.closure;
           ip = previous.ip;
           fp = previous.fp;
@@ -637,7 +1136,7 @@ Value Thread_run(Thread* self, Code* code, size_t startIndex) {
       case OP_NATIVE:
         {
           ObjNative* n = ObjNative_allocateOne();
-          ObjNative_init(n, NATIVE[Code_getUInt8(code, ip)].call);
+          ObjNative_init(n, NATIVE[Code_getUInt16(code, ip)].call);
 
           Value v;
           v.is_a = TYPE_OBJ;
@@ -647,11 +1146,14 @@ Value Thread_run(Thread* self, Code* code, size_t startIndex) {
           /* Add to heap AFTER adding to stack, to be sure it doesn't get GC'ed */
           Thread_addToHeap(self, (Obj*)n);
 
-          ip++;
+          ip += sizeof(uint16_t);
         } break;
 
       default:
         assert(false);
     }
   }
+
+  #undef YIELD_POINT
+  #undef SAVE_STATE
 }
@@ -1,6 +1,9 @@
 #ifndef FUR_THREAD_H
 #define FUR_THREAD_H
 
+#include <stdatomic.h>
+#include <stdbool.h>
+
 #include "code.h"
 #include "object.h"
 #include "value.h"
@@ -8,10 +11,53 @@
 #define MAX_FRAMESTACK_DEPTH 64
 #define MAX_STACK_DEPTH 256
 
+/*
+ * A thread yields after this many reductions, so that threads sharing an OS
+ * thread take turns. As in the Erlang VM, a call or a backward jump is a
+ * reduction: every loop or recursion makes them, so however long a thread
+ * runs, the others wait at most this many reductions of it at a time. See
+ * Thread_resume.
+ */
+#define THREAD_REDUCTIONS 2000
+
+/*
+ * A thread collects its heap once it has allocated this many objects, or
+ * twice as many as survived its last collection, whichever is more.
+ */
+#define THREAD_COLLECTION_THRESHOLD 4096
+
+typedef enum {
+  THREAD_YIELDED,
+  THREAD_BLOCKED,
+  THREAD_FINISHED
+} ThreadStatus;
+
+/*
+ * A native which can't go on yet, such as receiving from an empty channel,
+ * puts the thread where whatever it's waiting for will find it, sets it
+ * THREAD_PARKING and sets `blocked`. Thread_resume then returns
+ * THREAD_BLOCKED, to call the native again when the thread is resumed, and
+ * the scheduler sets it THREAD_PARKED, unless it has already been woken and
+ * set THREAD_RUNNABLE again, in which case it's put back to run.
+ */
+typedef enum {
+  THREAD_RUNNABLE,
+  THREAD_PARKING,
+  THREAD_PARKED
+} ThreadParking;
+
 typedef struct {
   ObjClosure* closure;
   uint8_t* ip;
   Value* fp;
+
+  /*
+   * The display entries which the call replaced, restored on return: the
+   * callee's depth, and the module's variables, in case the callee belongs
+   * to another module (see ObjClosure.globals).
+   */
+  Value* displaced;
+  Value* globals;
 } Frame;
 
 typedef struct {
@@ -33,17 +79,158 @@ void Stack_free(Stack*);
 // TODO Profile inlining these.
 void Stack_push(Stack*, Value);
 Value Stack_pop(Stack*);
+Value Stack_peek(Stack*);
+void Stack_unary(Stack*, Value (*unary)(Value));
 void Stack_binary(Stack*, Value (*binary)(Value, Value));
 
-typedef struct {
+/*
+ * Unlike ObjList, this doesn't own its items.
+ */
+LIST_DECL(GrayList, Obj*);
+
+struct Thread {
   FrameStack frames;
   Stack stack;
+
+  /*
+   * The objects the thread allocated which only it can see, which
+   * Thread_collect frees once it can't see them either, and those it has
+   * shared, which are kept until the thread is freed. Only the thread
+   * touches either list, so allocating takes no lock.
+   */
   Obj* heap;
-} Thread;
+  Obj* sharedHeap;
+  size_t heapCount;
+  size_t nextCollection;
+
+  /*
+   * Set once other threads can see the thread's variables, as when it spawns
+   * a thread, after which all its objects are shared (see Thread_shareHeap).
+   */
+  bool sharing;
+
+  // Objects marked but not yet traced, kept to reuse between collections
+  GrayList gray;
+
+  /*
+   * display[d] is the frame pointer of the innermost running function at
+   * depth d. Closures which the compiler has proven don't outlive their
+   * enclosing functions use this to read those functions' variables in
+   * place on the stack (see UpvalueKind).
+   */
+  Value* display[MAX_CLOSURE_DEPTH];
+
+  /*
+   * If the thread runs a module, how many of the variables at the bottom of
+   * its stack the module has assigned so far. Functions which read variables
+   * declared after them check this, from whichever thread they run on.
+   */
+  atomic_size_t globalCount;
+
+  /*
+   * Upvalues which still point into the stack, sorted by location from the
+   * top of the stack down, so returning frames can close them cheaply.
+   */
+  ObjUpvalue* openUpvalues;
+
+  /*
+   * Where the thread is running, saved when it yields. `rootCode` is the
+   * code it was started in, which it returns to when it returns from the
+   * outermost closure.
+   */
+  ObjClosure* current;
+  Code* code;
+  Code* rootCode;
+  uint8_t* ip;
+  Value* fp;
+
+  // Reductions left before the thread yields
+  uint32_t reductions;
+
+  // What the thread returned, once it has finished
+  Value result;
+
+  bool blocked;
+  atomic_int parking;
+
+  // How much of its output a native has written, if it waited to write more
+  size_t ioProgress;
+
+  // The next thread waiting for the same thing as this one
+  Thread* nextWaiting;
+
+  // The module this thread runs, which owns it, or NULL
+  ObjModule* module;
+};
+
+inline static ALLOCATE_ONE_IMPL(Thread);
 
 void Thread_init(Thread*);
 void Thread_free(Thread*);
 
-Value Thread_run(Thread*, Code*, size_t);
+void Thread_addToHeap(Thread*, Obj*);
+
+/*
+ * Shares `value` and whatever it reaches with other threads, as it's about
+ * to be passed to one or stored where one can read it. Sharing a closure
+ * which still reaches the thread's stack shares the whole heap.
+ */
+void Thread_share(Thread*, Value);
+
+/*
+ * Shares every object the thread has, and every one it allocates from now
+ * on, as other threads can now read its variables.
+ */
+void Thread_shareHeap(Thread*);
+
+/*
+ * Frees the objects on the thread's heap which it can no longer reach from
+ * its stack, its frames or its open upvalues. The thread must be stopped
+ * between instructions, as it is when it yields.
+ */
+void Thread_collect(Thread*);
+
+// OP_DECLARE_GLOBAL and OP_GET_LATE
+void Thread_declareGlobal(Thread*);
+void Thread_getLate(Thread*, uint8_t index, ObjString* name);
+
+void WaitQueue_push(WaitQueue*, Thread*);
+Thread* WaitQueue_pop(WaitQueue*);
+ObjUpvalue* Thread_captureUpvalue(Thread*, Value* location);
+
+/*
+ * Moves the values of all open upvalues at or above `fp` off the stack and
+ * into the upvalues, since the frame they live in is returning.
+ */
+inline static void Thread_closeUpvalues(Thread* self, Value* fp) {
+  while(self->openUpvalues != NULL && self->openUpvalues->location >= fp) {
+    ObjUpvalue* upvalue = self->openUpvalues;
+    upvalue->closed = *(upvalue->location);
+    upvalue->location = &(upvalue->closed);
+    self->openUpvalues = upvalue->nextOpen;
+  }
+}
+
+/*
+ * Instantiates `prototype` (see OP_CLOSURE), capturing its upvalues from the
+ * frame of `current` at `fp`, and pushes it.
+ */
+void Thread_pushClosure(
+    Thread*,
+    ObjClosure* current,
+    Value* fp,
+    ObjClosure* prototype);
+
+/*
+ * Prepares the thread to run `code` from `startIndex`, with the values
+ * already on its stack as the frame it runs in.
+ */
+void Thread_start(Thread*, Code*, size_t startIndex);
+
+/*
+ * Runs the thread until it yields or finishes. A thread which yielded
+ * carries on from where it was when resumed again.
+ */
+ThreadStatus Thread_resume(Thread*);
 
 #endif